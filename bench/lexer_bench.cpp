@@ -0,0 +1,85 @@
+// Lexer throughput benchmark on synthetic inputs.
+// Build and run with `make bench`, the numbers are only comparable between
+// runs on the same machine.
+
+#include "../src/lexer.h"
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <print>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr size_t TARGET_SIZE = 8 * 1024 * 1024;
+constexpr int RUNS = 5;
+
+std::string repeatUntilTarget(const std::string& chunk) {
+    std::string source;
+    source.reserve(TARGET_SIZE + chunk.size());
+    while (source.size() < TARGET_SIZE) {
+        source += chunk;
+    }
+    return source;
+}
+
+/// Long identifiers and keywords, few symbols.
+std::string identifierHeavy() {
+    return repeatUntilTarget("local some_rather_long_identifier_name = another_long_identifier "
+                             "and yet_another_identifier_here or not_this_one\n");
+}
+
+/// Deeply indented code, dominated by whitespace.
+std::string whitespaceHeavy() {
+    std::string chunk;
+    for (int depth = 0; depth < 32; ++depth) {
+        chunk += std::string(depth * 4, ' ') + "if x then\n";
+    }
+    for (int depth = 31; depth >= 0; --depth) {
+        chunk += std::string(depth * 4, ' ') + "end\n";
+    }
+    return repeatUntilTarget(chunk);
+}
+
+/// Something resembling real code.
+std::string mixed() {
+    return repeatUntilTarget(R"(function add(x: number, y: number) -> number
+    return x + y
+end
+
+local point = {x = 10, y = 20}
+local values = {1, 2, 3, 4, 5}
+if point.x >= 10 and #values == 5 then
+    print("point is far enough", add(point.x, values[1]))
+elseif point.y <= 0 then
+    print("below")
+else
+    return nil
+end
+)");
+}
+
+void run(const std::string& name, const std::string& source) {
+    double bestSeconds = 1e30;
+    size_t tokenCount = 0;
+    for (int run = 0; run < RUNS; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        Lexer lexer(source);
+        tokenCount = 0;
+        while (lexer.getNextToken().kind != TokenKind::Eof) {
+            ++tokenCount;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        bestSeconds = std::min(bestSeconds, elapsed.count());
+    }
+    double megabytes = static_cast<double>(source.size()) / (1024.0 * 1024.0);
+    std::println("lexer/{:<12} {:8.1f} MB/s {:10.1f} Mtok/s ({} tokens)", name,
+                 megabytes / bestSeconds, tokenCount / bestSeconds / 1e6, tokenCount);
+}
+} // namespace
+
+int main() {
+    run("identifiers", identifierHeavy());
+    run("whitespace", whitespaceHeavy());
+    run("mixed", mixed());
+}
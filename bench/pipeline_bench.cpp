@@ -0,0 +1,219 @@
+// Throughput of each phase of the pipeline on large generated programs.
+// Build and run with `make bench`. The workloads are the same for every commit (see
+// workload.h), the numbers are comparable between runs on the same machine.
+
+#include "../src/lexer.h"
+#include "../src/lua_codegen.h"
+#include "../src/optimizer.h"
+#include "../src/output_sink.h"
+#include "../src/parser.h"
+#include "../src/typechecker.h"
+#include "./workload.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <print>
+#include <string>
+
+namespace {
+constexpr int RUNS = 5;
+
+/// Counts the generated bytes and drops them.
+class CountingSink : public OutputSink {
+  public:
+    ~CountingSink() override { flush(); }
+
+    size_t bytes() {
+        flush();
+        return count;
+    }
+
+  protected:
+    void flushBuffer(std::string_view data) override { count += data.size(); }
+
+  private:
+    size_t count = 0;
+};
+
+/// Visits every node and does nothing else, what is left is the cost of the traversal.
+class NodeCounter final : public Visitor {
+  public:
+    size_t count = 0;
+
+    void visit(StringExpr&) override { ++count; }
+    void visit(NumberExpr&) override { ++count; }
+    void visit(NilExpr&) override { ++count; }
+    void visit(BooleanExpr&) override { ++count; }
+    void visit(VarExpr&) override { ++count; }
+    void visit(TableExpr& expr) override {
+        ++count;
+        for (auto* element : expr.arrayPart) {
+            element->accept(*this);
+        }
+        for (auto& [key, value] : expr.mapPart) {
+            value->accept(*this);
+        }
+    }
+    void visit(UnaryOpExpr& expr) override {
+        ++count;
+        expr.right->accept(*this);
+    }
+    void visit(BinOpExpr& expr) override {
+        ++count;
+        expr.left->accept(*this);
+        expr.right->accept(*this);
+    }
+    void visit(IndexExpr& expr) override {
+        ++count;
+        expr.object->accept(*this);
+        expr.index->accept(*this);
+    }
+    void visit(FunCallExpr& expr) override {
+        ++count;
+        expr.callee->accept(*this);
+        for (auto* arg : expr.args) {
+            arg->accept(*this);
+        }
+    }
+    void visit(FunDecl& stmt) override {
+        ++count;
+        stmt.body->accept(*this);
+    }
+    void visit(VarDecl& stmt) override {
+        ++count;
+        stmt.initExpr->accept(*this);
+    }
+    void visit(VarDecls& stmt) override {
+        ++count;
+        for (auto* decl : stmt.decls) {
+            decl->accept(*this);
+        }
+    }
+    void visit(IfStmt& stmt) override {
+        ++count;
+        for (auto& arm : stmt.arms) {
+            arm.condition->accept(*this);
+            arm.body->accept(*this);
+        }
+        if (stmt.else_branch) {
+            stmt.else_branch->accept(*this);
+        }
+    }
+    void visit(ReturnStmt& stmt) override {
+        ++count;
+        for (auto* value : stmt.return_values) {
+            value->accept(*this);
+        }
+    }
+    void visit(BlockStmt& stmt) override {
+        ++count;
+        for (auto* child : stmt.statements) {
+            child->accept(*this);
+        }
+    }
+    void visit(FunCallStmt& stmt) override {
+        ++count;
+        stmt.call->accept(*this);
+    }
+    void visit(AssignStmt& stmt) override {
+        ++count;
+        stmt.left->accept(*this);
+        stmt.right->accept(*this);
+    }
+};
+
+/// Best of `RUNS` timings of `measured`, `prepare` runs untimed before each of them.
+double bestSeconds(const std::function<void()>& prepare, const std::function<void()>& measured) {
+    double best = 1e30;
+    for (int run = 0; run < RUNS; ++run) {
+        prepare();
+        auto start = std::chrono::steady_clock::now();
+        measured();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+Program parseAndCheck(std::string_view source) {
+    Parser parser{Lexer{source}};
+    auto program = parser.parse();
+    TypeChecker typechecker;
+    typechecker.typeCheck(program);
+    return program;
+}
+
+void run(const std::string& name, const WorkloadShape& shape) {
+    auto source = WorkloadGenerator().generate(shape);
+    double megabytes = static_cast<double>(source.size()) / (1024.0 * 1024.0);
+
+    size_t tokens = 0;
+    double lexSeconds = bestSeconds([] {}, [&] {
+        Lexer lexer(source);
+        tokens = 0;
+        while (lexer.getNextToken().kind != TokenKind::Eof) {
+            ++tokens;
+        }
+    });
+
+    Program program;
+    double parseSeconds = bestSeconds([&] { program = Program{}; }, [&] {
+        Parser parser{Lexer{source}};
+        program = parser.parse();
+    });
+    double nodes = static_cast<double>(program.arena.size());
+
+    double checkSeconds = bestSeconds(
+        [&] {
+            Parser parser{Lexer{source}};
+            program = parser.parse();
+        },
+        [&] {
+            TypeChecker typechecker;
+            typechecker.typeCheck(program);
+        });
+
+    program = parseAndCheck(source);
+    size_t visited = 0;
+    double visitSeconds = bestSeconds([] {}, [&] {
+        NodeCounter counter;
+        for (auto* stmt : program.statements) {
+            stmt->accept(counter);
+        }
+        visited = counter.count;
+    });
+
+    double optimizeSeconds = bestSeconds([&] { program = parseAndCheck(source); }, [&] {
+        Optimizer optimizer;
+        optimizer.optimize(program);
+    });
+
+    program = parseAndCheck(source);
+    size_t bytes = 0;
+    double codegenSeconds = bestSeconds([] {}, [&] {
+        CountingSink sink;
+        LuaCodegen codegen;
+        codegen.generate(program, sink);
+        bytes = sink.bytes();
+    });
+
+    std::println("pipeline/{:<8} {:6.1f} MB source, {} tokens, {:.0f} nodes", name, megabytes,
+                 tokens, nodes);
+    std::println("pipeline/{:<8} lex       {:8.1f} MB/s", name, megabytes / lexSeconds);
+    std::println("pipeline/{:<8} parse     {:8.2f} Mnodes/s", name, nodes / parseSeconds / 1e6);
+    std::println("pipeline/{:<8} typecheck {:8.2f} Mnodes/s", name, nodes / checkSeconds / 1e6);
+    std::println("pipeline/{:<8} visit     {:8.2f} Mnodes/s", name,
+                 static_cast<double>(visited) / visitSeconds / 1e6);
+    std::println("pipeline/{:<8} optimize  {:8.2f} Mnodes/s", name, nodes / optimizeSeconds / 1e6);
+    std::println("pipeline/{:<8} codegen   {:8.1f} MB/s", name,
+                 static_cast<double>(bytes) / (1024.0 * 1024.0) / codegenSeconds);
+}
+} // namespace
+
+int main() {
+    run("mixed", {});
+    run("nested", {.functions = 200, .nestingDepth = 64, .elseifArms = 2, .tableWidth = 4});
+    run("wide", {.functions = 200, .nestingDepth = 1, .elseifArms = 1, .tableWidth = 512});
+    run("elseif", {.functions = 200, .nestingDepth = 1, .elseifArms = 200, .tableWidth = 4});
+    run("typed", {.functions = 20000, .nestingDepth = 0, .elseifArms = 0, .tableWidth = 1});
+}
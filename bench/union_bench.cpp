@@ -0,0 +1,62 @@
+// Cost of building unions of many distinct composite types.
+// Build and run with `make bench`. Each size is also timed per member, which must stay roughly
+// flat as the unions grow: the bench fails if it grows more than 8x from the smallest size,
+// quadratic unions grow 16x.
+
+#include "../src/type.h"
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <map>
+#include <print>
+#include <vector>
+
+namespace {
+constexpr int RUNS = 5;
+constexpr size_t SIZES[] = {10000, 40000, 160000};
+constexpr double MAX_GROWTH = 8.0;
+
+/// `count` distinct table types, each twice so that half of the members are duplicates.
+std::vector<Type*> distinctTables(size_t count) {
+    auto& factory = TypeFactory::instance();
+    std::vector<Type*> types;
+    types.reserve(2 * count);
+    for (size_t i = 0; i < count; ++i) {
+        std::map<Symbol, Type*> fields{{intern(std::format("f{}", i)), factory.numberType()}};
+        types.push_back(factory.createTableType(std::move(fields)));
+    }
+    // Every type comes back after all the others, like a union of two large ones
+    for (size_t i = 0; i < count; ++i) {
+        types.push_back(types[i]);
+    }
+    return types;
+}
+
+/// Nanoseconds per member to build the union of `count` distinct tables, best of `RUNS`.
+double nanosecondsPerMember(size_t count) {
+    auto types = distinctTables(count);
+    double best = 1e30;
+    for (int run = 0; run < RUNS; ++run) {
+        auto members = types;
+        auto start = std::chrono::steady_clock::now();
+        TypeFactory::instance().createUnionType(std::move(members));
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best * 1e9 / static_cast<double>(types.size());
+}
+} // namespace
+
+int main() {
+    double smallest = 0;
+    for (auto count : SIZES) {
+        double perMember = nanosecondsPerMember(count);
+        smallest = smallest == 0 ? perMember : smallest;
+        std::println("union/{:<8} {:8.1f} ns/member", count, perMember);
+        if (perMember > MAX_GROWTH * smallest) {
+            std::println("union/{:<8} grows {:.1f}x per member, unions are superlinear", count,
+                         perMember / smallest);
+            return 1;
+        }
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+// Generator of large synthetic programs for the benchmarks.
+// The output only depends on the shape and the seed: std::mt19937_64 is fully specified
+// by the standard and only its raw output is used (the distributions are not), so the
+// same workload is generated on every platform and by every commit. Function arguments
+// are evaluated in no specified order, so each draw is a statement of its own.
+
+#include <cstdint>
+#include <format>
+#include <random>
+#include <string>
+
+/// How much of each construct a generated program has.
+struct WorkloadShape {
+    // Typed top-level functions, each calls some of the functions before it
+    int functions = 2000;
+    // Nested ifs in each function body
+    int nestingDepth = 6;
+    // Arms of the elseif chain in each function body
+    int elseifArms = 8;
+    // Fields of the record and elements of the array built by each function
+    int tableWidth = 16;
+};
+
+/// Writes programs that pass the type checker, using the subset of the language the
+/// compiler supports.
+class WorkloadGenerator {
+  public:
+    explicit WorkloadGenerator(uint64_t seed = 1) : random(seed) {}
+
+    std::string generate(const WorkloadShape& shape) {
+        source.clear();
+        for (int i = 0; i < shape.functions; ++i) {
+            function(i, shape);
+        }
+        line(0, "local total = 0");
+        for (int i = 0; i < shape.functions; i += 1 + static_cast<int>(next(8))) {
+            auto first = next(100);
+            auto second = next(100);
+            line(0, std::format("total = total + f{}({}, {})", i, first, second));
+        }
+        line(0, "print(\"total: \" .. total)");
+        return std::move(source);
+    }
+
+  private:
+    uint64_t next(uint64_t bound) { return random() % bound; }
+
+    void line(int depth, const std::string& text) {
+        source.append(static_cast<size_t>(depth) * 4, ' ');
+        source += text;
+        source += '\n';
+    }
+
+    void function(int index, const WorkloadShape& shape) {
+        line(0, std::format("function f{}(a: number, b: number) -> number", index));
+
+        // A wide record and a wide array
+        std::string record = "local r = {";
+        std::string array = "local v = {";
+        for (int field = 0; field < shape.tableWidth; ++field) {
+            record += std::format("{}k{} = {}", field == 0 ? "" : ", ", field, next(1000));
+            array += std::format("{}{}", field == 0 ? "" : ", ", next(1000));
+        }
+        line(1, record + "}");
+        line(1, array + "}");
+        auto factor = next(10) + 1;
+        auto field = next(static_cast<uint64_t>(shape.tableWidth));
+        line(1, std::format("local x = a * {} + b - r.k{}", factor, field));
+
+        // Deep nesting
+        std::string previous = "x";
+        for (int depth = 0; depth < shape.nestingDepth; ++depth) {
+            line(depth + 1, std::format("if {} {} {} then", depth % 2 == 0 ? "a" : "b",
+                                        depth % 3 == 0 ? "<" : ">=", next(100)));
+            auto name = std::format("y{}", depth);
+            line(depth + 2, std::format("local {} = {} + v[{}]", name, previous,
+                                        next(static_cast<uint64_t>(shape.tableWidth)) + 1));
+            previous = name;
+        }
+        line(shape.nestingDepth + 1, std::format("x = {}", previous));
+        for (int depth = shape.nestingDepth - 1; depth >= 0; --depth) {
+            line(depth + 1, "end");
+        }
+
+        // A long elseif chain, some arms call earlier functions
+        for (int arm = 0; arm < shape.elseifArms; ++arm) {
+            line(1, std::format("{} a == {} then", arm == 0 ? "if" : "elseif", arm));
+            if (index > 0 && next(2) == 0) {
+                line(2, std::format("x = f{}(x, b)", next(static_cast<uint64_t>(index))));
+            } else {
+                line(2, std::format("x = x * {} - {}", next(5) + 1, arm));
+            }
+        }
+        if (shape.elseifArms > 0) {
+            line(1, "else");
+            line(2, "x = x + 1");
+            line(1, "end");
+        }
+        line(1, "return x");
+        line(0, "end");
+    }
+
+    std::mt19937_64 random;
+    std::string source;
+};
@@ -1,14 +1,20 @@
 #pragma once
+#include <concepts>
+#include <cstdint>
 #include <format>
 #include <map>
 #include <memory>
 #include <numeric>
 #include <optional>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
+#include "ast_arena.h"
 #include "lexer.h"
+#include "symbol.h"
 #include "type.h"
 #include "visitor.h"
 
@@ -18,12 +24,13 @@ template <class... Ts> struct overloaded : Ts... {
 };
 template <class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
 
-// Forward declaration
+// Forward declarations
 class TypeAnnotation;
+struct Decl;
 
 // Basic type annotation (number, string, boolean, nil)
 struct BasicTypeAnnotation {
-    enum class Kind { Number, String, Boolean, Nil };
+    enum class Kind { Number, Integer, String, Boolean, Nil };
     Kind kind;
 };
 
@@ -63,6 +70,8 @@ class TypeAnnotation {
                                          switch (arg.kind) {
                                          case BasicTypeAnnotation::Kind::Number:
                                              return "number";
+                                         case BasicTypeAnnotation::Kind::Integer:
+                                             return "integer";
                                          case BasicTypeAnnotation::Kind::String:
                                              return "string";
                                          case BasicTypeAnnotation::Kind::Boolean:
@@ -112,67 +121,124 @@ class TypeAnnotation {
     }
 };
 
+/// Where a node starts in the source, line 0 for nodes the compiler made up.
+struct SourceLoc {
+    uint32_t line = 0;
+    uint32_t column = 0;
+};
+
+/// Kind tag of each concrete node, what `dispatch` and `nodeCast` switch on instead of virtual
+/// calls and RTTI. Also the node tag of the binary format (binary_ast.h).
+enum class NodeKind : uint8_t {
+    String,
+    Number,
+    Nil,
+    Boolean,
+    Var,
+    Table,
+    UnaryOp,
+    BinOp,
+    Index,
+    FunCall,
+    FunDecl,
+    VarDecl,
+    VarDecls,
+    If,
+    Return,
+    Block,
+    FunCallStmt,
+    Assign,
+};
+
+/// AST nodes are allocated from the Program's AstArena,
+/// pointers between nodes are non-owning.
 struct Ast {
+    explicit Ast(NodeKind kind) : kind(kind) {}
+
+    const NodeKind kind;
+    SourceLoc loc;
+
     virtual ~Ast() = default;
     virtual std::string toSExpr() const = 0;
-    virtual void accept(Visitor& visitor) = 0;
+    /// Calls `visitor.visit` with the node as its concrete type. Dispatched on `kind`, so
+    /// passes of a `final` type don't go through a virtual call at all.
+    template <typename V> void accept(V& visitor);
 };
 
-struct Stmt : Ast {};
+struct Stmt : Ast {
+    using Ast::Ast;
+};
 
 struct Program {
-    std::vector<std::unique_ptr<Stmt>> statements;
+    // Owns every node reachable from `statements`
+    AstArena arena;
+    std::vector<Stmt*> statements;
 };
 
 struct Expr : Ast {
+    using Ast::Ast;
+
     Type* type = nullptr;
 };
 
 struct StringExpr : Expr {
-    StringExpr(std::string v) : val(std::move(v)) {}
-    std::string val;
+    static constexpr NodeKind KIND = NodeKind::String;
+    StringExpr(Symbol v) : Expr(KIND), val(v) {}
+    Symbol val;
 
-    std::string toSExpr() const override { return std::format("(string \"{}\")", val); }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
+    std::string toSExpr() const override { return std::format("(string \"{}\")", val.str()); }
 };
 
+/// A float literal, or an integer literal when `integer` is set. Lua 5.3+ keeps the two
+/// subtypes apart and integers are 64 bits, which a double can't hold exactly.
 struct NumberExpr : Expr {
-    NumberExpr(double v) : val(v) {}
+    static constexpr NodeKind KIND = NodeKind::Number;
+    NumberExpr(double v) : Expr(KIND), val(v) {}
+    template <std::integral T>
+    NumberExpr(T v) : Expr(KIND), val(static_cast<double>(v)), integer(static_cast<int64_t>(v)) {}
     double val;
+    std::optional<int64_t> integer;
 
-    std::string toSExpr() const override { return std::format("(number {})", val); }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
+    std::string toSExpr() const override {
+        return integer ? std::format("(number {})", *integer) : std::format("(number {})", val);
+    }
 };
 
 struct NilExpr : Expr {
+    static constexpr NodeKind KIND = NodeKind::Nil;
+    NilExpr() : Expr(KIND) {}
+
     std::string toSExpr() const override { return "(nil)"; }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
 struct BooleanExpr : Expr {
-    BooleanExpr(bool v) : val(v) {}
+    static constexpr NodeKind KIND = NodeKind::Boolean;
+    BooleanExpr(bool v) : Expr(KIND), val(v) {}
     bool val;
 
     std::string toSExpr() const override {
         return std::format("(boolean {})", val ? "true" : "false");
     }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
 struct VarExpr : Expr {
-    VarExpr(std::string n) : name(std::move(n)) {}
-    std::string name;
-
-    std::string toSExpr() const override { return std::format("(var {})", name); }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
+    static constexpr NodeKind KIND = NodeKind::Var;
+    VarExpr(Symbol n) : Expr(KIND), name(n) {}
+    Symbol name;
+    // The local declaration the name refers to, set by the type checker. Null for globals,
+    // parameters and field names.
+    Decl* binding = nullptr;
+
+    std::string toSExpr() const override { return std::format("(var {})", name.str()); }
 };
 
 struct TableExpr : Expr {
-    TableExpr(std::vector<std::unique_ptr<Expr>> arr,
-              std::map<std::string, std::unique_ptr<Expr>> map)
-        : arrayPart(std::move(arr)), mapPart(std::move(map)) {}
-    std::vector<std::unique_ptr<Expr>> arrayPart;
-    std::map<std::string, std::unique_ptr<Expr>> mapPart;
+    static constexpr NodeKind KIND = NodeKind::Table;
+    TableExpr(std::vector<Expr*> arr, std::vector<std::pair<Symbol, Expr*>> map)
+        : Expr(KIND), arrayPart(std::move(arr)), mapPart(std::move(map)) {}
+    std::vector<Expr*> arrayPart;
+    // Sorted by key name, keys are unique
+    std::vector<std::pair<Symbol, Expr*>> mapPart;
 
     std::string toSExpr() const override {
         auto arrayStr = std::accumulate(
@@ -180,55 +246,52 @@ struct TableExpr : Expr {
             [](std::string acc, auto&& expr) { return acc + " " + expr->toSExpr(); });
         auto mapStr = std::accumulate(
             mapPart.begin(), mapPart.end(), std::string{}, [](std::string acc, auto&& kv) {
-                return acc + " (" + kv.first + " " + kv.second->toSExpr() + ")";
+                return acc + " (" + kv.first.str() + " " + kv.second->toSExpr() + ")";
             });
         return std::format("(table (array{} ) (map{} ))", arrayStr, mapStr);
     }
-
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
 struct UnaryOpExpr : Expr {
-    UnaryOpExpr(TokenKind o, std::unique_ptr<Expr> r) : op(o), right(std::move(r)) {}
+    static constexpr NodeKind KIND = NodeKind::UnaryOp;
+    UnaryOpExpr(TokenKind o, Expr* r) : Expr(KIND), op(o), right(r) {}
     TokenKind op;
-    std::unique_ptr<Expr> right;
+    Expr* right;
 
     std::string toSExpr() const override {
         return std::format("({} {})", tokenKindToStr(op), right->toSExpr());
     }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
 struct BinOpExpr : Expr {
-    BinOpExpr(std::unique_ptr<Expr> l, TokenKind o, std::unique_ptr<Expr> r)
-        : left(std::move(l)), op(o), right(std::move(r)) {}
-    std::unique_ptr<Expr> left;
+    static constexpr NodeKind KIND = NodeKind::BinOp;
+    BinOpExpr(Expr* l, TokenKind o, Expr* r) : Expr(KIND), left(l), op(o), right(r) {}
+    Expr* left;
     TokenKind op;
-    std::unique_ptr<Expr> right;
+    Expr* right;
 
     std::string toSExpr() const override {
         return std::format("({} {} {})", tokenKindToStr(op), left->toSExpr(), right->toSExpr());
     }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
 struct IndexExpr : Expr {
-    IndexExpr(std::unique_ptr<Expr> obj, std::unique_ptr<Expr> idx)
-        : object(std::move(obj)), index(std::move(idx)) {}
-    std::unique_ptr<Expr> object;
-    std::unique_ptr<Expr> index;
+    static constexpr NodeKind KIND = NodeKind::Index;
+    IndexExpr(Expr* obj, Expr* idx) : Expr(KIND), object(obj), index(idx) {}
+    Expr* object;
+    Expr* index;
 
     std::string toSExpr() const override {
         return std::format("([] {} {})", object->toSExpr(), index->toSExpr());
     }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
 struct FunCallExpr : Expr {
-    FunCallExpr(std::unique_ptr<Expr> callee, std::vector<std::unique_ptr<Expr>> arguments)
-        : callee(std::move(callee)), args(std::move(arguments)) {}
-    std::unique_ptr<Expr> callee;
-    std::vector<std::unique_ptr<Expr>> args;
+    static constexpr NodeKind KIND = NodeKind::FunCall;
+    FunCallExpr(Expr* callee, std::vector<Expr*> arguments)
+        : Expr(KIND), callee(callee), args(std::move(arguments)) {}
+    Expr* callee;
+    std::vector<Expr*> args;
 
     std::string toSExpr() const override {
         auto argsStr = std::accumulate(
@@ -237,38 +300,42 @@ struct FunCallExpr : Expr {
         // {}{} to avoid initial space
         return std::format("(call {}{})", callee->toSExpr(), argsStr);
     }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
 struct Decl : Stmt {
-    Decl(std::string name, bool local) : name(std::move(name)), local(local) {}
-    std::string name;
+    Decl(NodeKind kind, Symbol name, bool local) : Stmt(kind), name(name), local(local) {}
+    Symbol name;
     bool local;
     Type* type = nullptr;
+    // References to the declared name whose `binding` is this declaration, counted by the
+    // type checker. Passes copying a reference count the copy; passes dropping one may
+    // leave the count high, so it is never below the actual number.
+    uint32_t uses = 0;
 };
 
 struct Parameter {
-    std::string name;
+    Symbol name;
     std::optional<TypeAnnotation> typeAnnotation;
 
-    Parameter(std::string n, std::optional<TypeAnnotation> ta = std::nullopt)
-        : name(std::move(n)), typeAnnotation(std::move(ta)) {}
+    Parameter(Symbol n, std::optional<TypeAnnotation> ta = std::nullopt)
+        : name(n), typeAnnotation(std::move(ta)) {}
 
     std::string toString() const {
         if (typeAnnotation.has_value()) {
-            return std::format("{}:{}", name, typeAnnotation->toString());
+            return std::format("{}:{}", name.str(), typeAnnotation->toString());
         } else {
-            return name;
+            return name.str();
         }
     }
 };
 
 struct FunDecl : Decl {
-    FunDecl(std::string name, bool local, std::optional<std::string> thisName, bool method,
-            std::vector<Parameter> params, std::unique_ptr<Stmt> body,
+    static constexpr NodeKind KIND = NodeKind::FunDecl;
+    FunDecl(Symbol name, bool local, std::optional<std::string> thisName, bool method,
+            std::vector<Parameter> params, Stmt* body,
             std::optional<TypeAnnotation> retType = std::nullopt)
-        : Decl{std::move(name), local}, thisName(std::move(thisName)), method(method),
-          params(std::move(params)), body(std::move(body)),
+        : Decl{KIND, name, local}, thisName(std::move(thisName)), method(method),
+          params(std::move(params)), body(body),
           returnTypeAnnotation(std::move(retType)) {}
     // Fundecls may be methods:
     // function obj:method(params)
@@ -280,13 +347,13 @@ struct FunDecl : Decl {
     bool method;
 
     std::vector<Parameter> params;
-    std::unique_ptr<Stmt> body;
+    Stmt* body;
     std::optional<TypeAnnotation> returnTypeAnnotation;
 
     std::string toSExpr() const override {
         auto paramsStr = std::accumulate(params.begin(), params.end(), std::string{},
                                          [](std::string acc, const Parameter& param) {
-                                             std::string paramStr = param.name;
+                                             std::string paramStr = param.name.str();
                                              if (param.typeAnnotation.has_value()) {
                                                  paramStr += ":" + param.typeAnnotation->toString();
                                              }
@@ -294,33 +361,34 @@ struct FunDecl : Decl {
                                          });
         std::string retTypeStr =
             returnTypeAnnotation.has_value() ? " -> " + returnTypeAnnotation->toString() : "";
-        return std::format("(fun {} {}{} ({}) {})", local ? "local" : "global", name, retTypeStr,
-                           paramsStr, body->toSExpr());
+        return std::format("(fun {} {}{} ({}) {})", local ? "local" : "global", name.str(),
+                           retTypeStr, paramsStr, body->toSExpr());
     }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
 /// Variable declaration
 struct VarDecl : Decl {
-    VarDecl(std::string name, std::unique_ptr<Expr> init,
-            std::optional<TypeAnnotation> typeAnnotation = std::nullopt)
-        : Decl{std::move(name), true}, // VarDecls are always local
-          initExpr(std::move(init)), typeAnnotation(std::move(typeAnnotation)) {}
-    std::unique_ptr<Expr> initExpr;
+    static constexpr NodeKind KIND = NodeKind::VarDecl;
+    VarDecl(Symbol name, Expr* init, std::optional<TypeAnnotation> typeAnnotation = std::nullopt)
+        : Decl{KIND, name, true}, // VarDecls are always local
+          initExpr(init), typeAnnotation(std::move(typeAnnotation)) {}
+    Expr* initExpr;
     std::optional<TypeAnnotation> typeAnnotation;
 
     std::string toSExpr() const override {
-        std::string nameWithType = name;
+        std::string nameWithType = name.str();
         if (typeAnnotation.has_value()) {
             nameWithType += ":" + typeAnnotation->toString();
         }
         return std::format("(var-decl {} {})", nameWithType, initExpr->toSExpr());
     }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
 struct VarDecls : Stmt {
-    std::vector<std::unique_ptr<VarDecl>> decls;
+    static constexpr NodeKind KIND = NodeKind::VarDecls;
+    VarDecls() : Stmt(KIND) {}
+
+    std::vector<VarDecl*> decls;
 
     std::string toSExpr() const override {
         std::string result = "(var-decls";
@@ -330,34 +398,46 @@ struct VarDecls : Stmt {
         result += ")";
         return result;
     }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
+/// `if c1 then b1 elseif c2 then b2 ... else e end`. The elseif arms are one flat list, so
+/// long chains don't nest and passes walk them without recursion.
 struct IfStmt : Stmt {
-    IfStmt(std::unique_ptr<Expr> cond, std::unique_ptr<Stmt> then_b,
-           std::unique_ptr<Stmt> else_b = nullptr)
-        : condition(std::move(cond)), then_branch(std::move(then_b)),
-          else_branch(std::move(else_b)) {}
-
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Stmt> then_branch;
-    std::unique_ptr<Stmt> else_branch;
-
+    static constexpr NodeKind KIND = NodeKind::If;
+    struct Arm {
+        Expr* condition;
+        Stmt* body;
+    };
+
+    IfStmt(Expr* cond, Stmt* then_b, Stmt* else_b = nullptr)
+        : Stmt(KIND), arms{{cond, then_b}}, else_branch(else_b) {}
+    IfStmt(std::vector<Arm> arms, Stmt* else_b = nullptr)
+        : Stmt(KIND), arms(std::move(arms)), else_branch(else_b) {}
+
+    // At least one, the first is the `if`
+    std::vector<Arm> arms;
+    Stmt* else_branch;
+
+    /// Prints elseif arms as if nested in the else branch of the arm before them.
     std::string toSExpr() const override {
-        std::string result =
-            std::format("(if {} (then {}))", condition->toSExpr(), then_branch->toSExpr());
+        std::string result;
+        for (size_t i = 0; i < arms.size(); ++i) {
+            result += std::format("{}(if {} (then {})", i > 0 ? " (else " : "",
+                                  arms[i].condition->toSExpr(), arms[i].body->toSExpr());
+        }
         if (else_branch) {
-            result = std::format("(if {} (then {}) (else {}))", condition->toSExpr(),
-                                 then_branch->toSExpr(), else_branch->toSExpr());
+            result += std::format(" (else {})", else_branch->toSExpr());
         }
+        // Closes each arm and the else of each elseif
+        result.append(arms.size() * 2 - 1, ')');
         return result;
     }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
 struct ReturnStmt : Stmt {
-    ReturnStmt(std::vector<std::unique_ptr<Expr>> vals) : return_values(std::move(vals)) {}
-    std::vector<std::unique_ptr<Expr>> return_values;
+    static constexpr NodeKind KIND = NodeKind::Return;
+    ReturnStmt(std::vector<Expr*> vals) : Stmt(KIND), return_values(std::move(vals)) {}
+    std::vector<Expr*> return_values;
 
     std::string toSExpr() const override {
         std::string result = "(return";
@@ -367,11 +447,13 @@ struct ReturnStmt : Stmt {
         result += ")";
         return result;
     }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
 struct BlockStmt : Stmt {
-    std::vector<std::unique_ptr<Stmt>> statements;
+    static constexpr NodeKind KIND = NodeKind::Block;
+    BlockStmt() : Stmt(KIND) {}
+
+    std::vector<Stmt*> statements;
 
     std::string toSExpr() const override {
         auto stmts = std::accumulate(
@@ -379,25 +461,86 @@ struct BlockStmt : Stmt {
             [](std::string acc, auto&& stmt) { return acc + " " + stmt->toSExpr(); });
         return std::format("(block{})", stmts);
     }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
 struct FunCallStmt : Stmt {
-    explicit FunCallStmt(std::unique_ptr<FunCallExpr> c) : call(std::move(c)) {}
-    std::unique_ptr<FunCallExpr> call;
+    static constexpr NodeKind KIND = NodeKind::FunCallStmt;
+    explicit FunCallStmt(FunCallExpr* c) : Stmt(KIND), call(c) {}
+    FunCallExpr* call;
 
     std::string toSExpr() const override { return call->toSExpr(); }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
 
 struct AssignStmt : Stmt {
-    AssignStmt(std::unique_ptr<Expr> l, std::unique_ptr<Expr> r)
-        : left(std::move(l)), right(std::move(r)) {}
-    std::unique_ptr<Expr> left;
-    std::unique_ptr<Expr> right;
+    static constexpr NodeKind KIND = NodeKind::Assign;
+    AssignStmt(Expr* l, Expr* r) : Stmt(KIND), left(l), right(r) {}
+    Expr* left;
+    Expr* right;
 
     std::string toSExpr() const override {
         return std::format("(assign {} {})", left->toSExpr(), right->toSExpr());
     }
-    void accept(Visitor& visitor) override { visitor.visit(*this); }
 };
+
+/// Whether a node of kind `kind` is a `T`.
+template <typename T> constexpr bool hasKind(NodeKind kind) {
+    if constexpr (std::is_same_v<T, Decl>) {
+        return kind == NodeKind::FunDecl || kind == NodeKind::VarDecl;
+    } else {
+        return kind == T::KIND;
+    }
+}
+
+/// `node` as a `T` if it is one, null otherwise (also for a null `node`). Like dynamic_cast,
+/// from the kind tag.
+template <typename T, typename Node> auto nodeCast(Node* node) {
+    using Result = std::conditional_t<std::is_const_v<Node>, const T*, T*>;
+    return node && hasKind<T>(node->kind) ? static_cast<Result>(node) : nullptr;
+}
+
+/// Calls `fn` with `node` as its concrete type, the static counterpart of a virtual call.
+template <typename Fn> decltype(auto) dispatch(Ast& node, Fn&& fn) {
+    switch (node.kind) {
+    case NodeKind::String:
+        return fn(static_cast<StringExpr&>(node));
+    case NodeKind::Number:
+        return fn(static_cast<NumberExpr&>(node));
+    case NodeKind::Nil:
+        return fn(static_cast<NilExpr&>(node));
+    case NodeKind::Boolean:
+        return fn(static_cast<BooleanExpr&>(node));
+    case NodeKind::Var:
+        return fn(static_cast<VarExpr&>(node));
+    case NodeKind::Table:
+        return fn(static_cast<TableExpr&>(node));
+    case NodeKind::UnaryOp:
+        return fn(static_cast<UnaryOpExpr&>(node));
+    case NodeKind::BinOp:
+        return fn(static_cast<BinOpExpr&>(node));
+    case NodeKind::Index:
+        return fn(static_cast<IndexExpr&>(node));
+    case NodeKind::FunCall:
+        return fn(static_cast<FunCallExpr&>(node));
+    case NodeKind::FunDecl:
+        return fn(static_cast<FunDecl&>(node));
+    case NodeKind::VarDecl:
+        return fn(static_cast<VarDecl&>(node));
+    case NodeKind::VarDecls:
+        return fn(static_cast<VarDecls&>(node));
+    case NodeKind::If:
+        return fn(static_cast<IfStmt&>(node));
+    case NodeKind::Return:
+        return fn(static_cast<ReturnStmt&>(node));
+    case NodeKind::Block:
+        return fn(static_cast<BlockStmt&>(node));
+    case NodeKind::FunCallStmt:
+        return fn(static_cast<FunCallStmt&>(node));
+    case NodeKind::Assign:
+        return fn(static_cast<AssignStmt&>(node));
+    }
+    std::unreachable();
+}
+
+template <typename V> void Ast::accept(V& visitor) {
+    dispatch(*this, [&](auto& node) { visitor.visit(node); });
+}
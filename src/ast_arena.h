@@ -0,0 +1,91 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <ranges>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// Bump allocator owning every AST node of one compilation unit.
+/// Nodes are carved out of large chunks and are never freed one by one,
+/// pointers between nodes are therefore plain non-owning pointers.
+/// On teardown the destructors of non-trivially destructible nodes are run
+/// in one flat pass (no recursion through the tree), then the chunks are released.
+class AstArena {
+  public:
+    AstArena() = default;
+    ~AstArena() { destroyNodes(); }
+
+    AstArena(const AstArena&) = delete;
+    AstArena& operator=(const AstArena&) = delete;
+
+    AstArena(AstArena&& other) noexcept
+        : chunks(std::move(other.chunks)), destructors(std::move(other.destructors)),
+          cursor(std::exchange(other.cursor, nullptr)), limit(std::exchange(other.limit, nullptr)),
+          nodeCount(std::exchange(other.nodeCount, 0)) {}
+
+    AstArena& operator=(AstArena&& other) noexcept {
+        if (this != &other) {
+            destroyNodes();
+            chunks = std::move(other.chunks);
+            destructors = std::move(other.destructors);
+            cursor = std::exchange(other.cursor, nullptr);
+            limit = std::exchange(other.limit, nullptr);
+            nodeCount = std::exchange(other.nodeCount, 0);
+        }
+        return *this;
+    }
+
+    template <typename T, typename... Args> T* make(Args&&... args) {
+        void* memory = allocate(sizeof(T), alignof(T));
+        T* node = new (memory) T(std::forward<Args>(args)...);
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            destructors.push_back({node, [](void* p) { static_cast<T*>(p)->~T(); }});
+        }
+        ++nodeCount;
+        return node;
+    }
+
+    /// Number of nodes allocated so far.
+    size_t size() const { return nodeCount; }
+
+  private:
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    struct Destructor {
+        void* node;
+        void (*destroy)(void*);
+    };
+
+    void* allocate(size_t size, size_t alignment) {
+        auto address = reinterpret_cast<std::uintptr_t>(cursor);
+        auto aligned = (address + alignment - 1) & ~(alignment - 1);
+        if (cursor == nullptr || aligned + size > reinterpret_cast<std::uintptr_t>(limit)) {
+            // Oversized nodes get a chunk of their own
+            size_t chunkSize = std::max(CHUNK_SIZE, size + alignment);
+            chunks.push_back(std::make_unique_for_overwrite<std::byte[]>(chunkSize));
+            cursor = chunks.back().get();
+            limit = cursor + chunkSize;
+            address = reinterpret_cast<std::uintptr_t>(cursor);
+            aligned = (address + alignment - 1) & ~(alignment - 1);
+        }
+        cursor += (aligned - address) + size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    void destroyNodes() {
+        for (auto& destructor : destructors | std::views::reverse) {
+            destructor.destroy(destructor.node);
+        }
+        destructors.clear();
+    }
+
+    std::vector<std::unique_ptr<std::byte[]>> chunks;
+    std::vector<Destructor> destructors;
+    std::byte* cursor = nullptr;
+    std::byte* limit = nullptr;
+    size_t nodeCount = 0;
+};
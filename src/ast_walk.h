@@ -0,0 +1,128 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "ast.h"
+
+/// Calls `fn` with a reference to each child pointer of `expr`, so passes can replace children.
+/// The field name of a member access is not an expression Lua evaluates and is skipped.
+template <typename Fn> void forEachChild(Expr* expr, Fn&& fn) {
+    if (auto* table = nodeCast<TableExpr>(expr)) {
+        for (auto& element : table->arrayPart) {
+            fn(element);
+        }
+        for (auto& [key, value] : table->mapPart) {
+            fn(value);
+        }
+    } else if (auto* unary = nodeCast<UnaryOpExpr>(expr)) {
+        fn(unary->right);
+    } else if (auto* binOp = nodeCast<BinOpExpr>(expr)) {
+        fn(binOp->left);
+        if (binOp->op != TokenKind::MemberAccess) {
+            fn(binOp->right);
+        }
+    } else if (auto* index = nodeCast<IndexExpr>(expr)) {
+        fn(index->object);
+        fn(index->index);
+    } else if (auto* call = nodeCast<FunCallExpr>(expr)) {
+        fn(call->callee);
+        for (auto& arg : call->args) {
+            fn(arg);
+        }
+    }
+}
+
+/// Calls `fn` on `expr` and every expression below it, parents first and children in order.
+/// Pending children are kept on an explicit stack, so chains can have any length.
+template <typename Fn> void forEachNode(Expr* expr, Fn&& fn) {
+    std::vector<Expr*> stack{expr};
+    while (!stack.empty()) {
+        auto* node = stack.back();
+        stack.pop_back();
+        fn(node);
+        // Pushed in reverse, the first child is taken first
+        auto children = stack.size();
+        forEachChild(node, [&](Expr* child) { stack.push_back(child); });
+        std::reverse(stack.begin() + static_cast<std::ptrdiff_t>(children), stack.end());
+    }
+}
+
+/// Calls `fn` on every expression of `stmt` and of the statements below it (function bodies
+/// included), parents first.
+template <typename Fn> void forEachNode(Stmt* stmt, Fn&& fn) {
+    auto each = [&](auto&& nodes) {
+        for (auto* node : nodes) {
+            forEachNode(node, fn);
+        }
+    };
+    if (auto* fun = nodeCast<FunDecl>(stmt)) {
+        forEachNode(fun->body, fn);
+    } else if (auto* decl = nodeCast<VarDecl>(stmt)) {
+        forEachNode(decl->initExpr, fn);
+    } else if (auto* decls = nodeCast<VarDecls>(stmt)) {
+        each(decls->decls);
+    } else if (auto* ifStmt = nodeCast<IfStmt>(stmt)) {
+        for (auto& arm : ifStmt->arms) {
+            forEachNode(arm.condition, fn);
+            forEachNode(arm.body, fn);
+        }
+        if (ifStmt->else_branch) {
+            forEachNode(ifStmt->else_branch, fn);
+        }
+    } else if (auto* ret = nodeCast<ReturnStmt>(stmt)) {
+        each(ret->return_values);
+    } else if (auto* block = nodeCast<BlockStmt>(stmt)) {
+        each(block->statements);
+    } else if (auto* call = nodeCast<FunCallStmt>(stmt)) {
+        forEachNode(call->call, fn);
+    } else if (auto* assign = nodeCast<AssignStmt>(stmt)) {
+        forEachNode(assign->left, fn);
+        forEachNode(assign->right, fn);
+    }
+}
+
+/// Takes the references below `node`, which a pass removes from the program, off the use
+/// counts of the declarations they refer to.
+template <typename Node> void releaseReferences(Node* node) {
+    forEachNode(node, [](Expr* expr) {
+        if (auto* var = nodeCast<VarExpr>(expr); var && var->binding) {
+            --var->binding->uses;
+        }
+    });
+}
+
+/// Whether `expr` is a unary or binary operator, the nodes long chains are made of.
+inline bool isOperator(const Expr* expr) {
+    return nodeCast<BinOpExpr>(expr) || nodeCast<UnaryOpExpr>(expr);
+}
+
+/// Walks the operator chain held by `root` operands first, calling `leaf` with each operand
+/// slot that doesn't hold an operator and `fn` with each operator slot once its operands are
+/// done (left before right). Both may replace the expression in the slot. An explicit stack
+/// takes the place of recursion, so chains like `a .. b .. c ...` can have any length.
+template <typename Leaf, typename Fn> void forEachOperator(Expr*& root, Leaf&& leaf, Fn&& fn) {
+    struct Pending {
+        Expr** slot;
+        bool operandsDone;
+    };
+    std::vector<Pending> stack{{&root, false}};
+    while (!stack.empty()) {
+        auto [slot, operandsDone] = stack.back();
+        stack.pop_back();
+        if (!isOperator(*slot)) {
+            leaf(*slot);
+        } else if (operandsDone) {
+            fn(*slot);
+        } else {
+            stack.push_back({slot, true});
+            // Pushed in reverse, the left operand is taken first
+            if (auto* binOp = nodeCast<BinOpExpr>(*slot)) {
+                stack.push_back({&binOp->right, false});
+                stack.push_back({&binOp->left, false});
+            } else {
+                stack.push_back({&static_cast<UnaryOpExpr*>(*slot)->right, false});
+            }
+        }
+    }
+}
@@ -0,0 +1,704 @@
+#include "binary_ast.h"
+#include "ast_walk.h"
+
+#include <bit>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace binary_ast;
+
+namespace {
+constexpr size_t ALIGNMENT = 8;
+
+constexpr size_t aligned(size_t size) { return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+
+constexpr uint64_t pack(uint32_t offset, uint32_t count) {
+    return (uint64_t{offset} << 32) | count;
+}
+
+bool isExpression(NodeKind kind) { return kind <= NodeKind::FunCall; }
+
+uint16_t annotationOf(const std::optional<TypeAnnotation>& annotation) {
+    if (!annotation) {
+        return 0;
+    }
+    // Other annotations don't type check, so they never reach a typed program
+    const auto* basic = std::get_if<BasicTypeAnnotation>(&annotation->getVariant());
+    if (basic == nullptr) {
+        throw std::runtime_error(
+            std::format("Can't serialize the type annotation '{}'", annotation->toString()));
+    }
+    return static_cast<uint16_t>(basic->kind) + 1;
+}
+
+std::optional<TypeAnnotation> annotationFrom(uint32_t value) {
+    if (value == 0) {
+        return std::nullopt;
+    }
+    if (value > static_cast<uint32_t>(BasicTypeAnnotation::Kind::Nil) + 1) {
+        throw std::runtime_error(std::format("Invalid type annotation {} in binary AST", value));
+    }
+    return BasicTypeAnnotation{static_cast<BasicTypeAnnotation::Kind>(value - 1)};
+}
+
+template <typename T> void append(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T> void appendSection(std::string& out, const std::vector<T>& items) {
+    out.append(reinterpret_cast<const char*>(items.data()), items.size() * sizeof(T));
+    out.resize(aligned(out.size()), '\0');
+}
+
+/// Writes the nodes children first, each node once even if it is reachable twice.
+class Writer final : public Visitor {
+  public:
+    std::string write(const Program& program) {
+        std::vector<uint32_t> roots;
+        for (auto* stmt : program.statements) {
+            roots.push_back(node(stmt));
+        }
+        auto rootOffset = list(roots);
+
+        std::vector<uint32_t> symbolOffsets;
+        std::string strings;
+        for (auto symbol : symbols) {
+            symbolOffsets.push_back(static_cast<uint32_t>(strings.size()));
+            strings += symbol.str();
+        }
+        symbolOffsets.push_back(static_cast<uint32_t>(strings.size()));
+
+        Header header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.symbolCount = static_cast<uint32_t>(symbols.size());
+        header.stringBytes = static_cast<uint32_t>(strings.size());
+        header.typeCount = static_cast<uint32_t>(types.size());
+        header.nodeCount = static_cast<uint32_t>(nodes.size());
+        header.listLength = static_cast<uint32_t>(lists.size());
+        header.rootOffset = rootOffset;
+        header.rootCount = static_cast<uint32_t>(roots.size());
+
+        std::string out;
+        append(out, header);
+        out.resize(aligned(out.size()), '\0');
+        appendSection(out, symbolOffsets);
+        appendSection(out, std::vector<char>(strings.begin(), strings.end()));
+        appendSection(out, types);
+        appendSection(out, nodes);
+        appendSection(out, lists);
+        return out;
+    }
+
+    void visit(StringExpr& expr) override {
+        auto record = make(NodeKind::String, expr, expr.type);
+        record.first = symbol(expr.val);
+        emit(record);
+    }
+
+    void visit(NumberExpr& expr) override {
+        auto record = make(NodeKind::Number, expr, expr.type);
+        record.flags = expr.integer.has_value();
+        record.extra = expr.integer ? std::bit_cast<uint64_t>(*expr.integer)
+                                    : std::bit_cast<uint64_t>(expr.val);
+        emit(record);
+    }
+
+    void visit(NilExpr& expr) override { emit(make(NodeKind::Nil, expr, expr.type)); }
+
+    void visit(BooleanExpr& expr) override {
+        auto record = make(NodeKind::Boolean, expr, expr.type);
+        record.flags = expr.val;
+        emit(record);
+    }
+
+    void visit(TableExpr& expr) override {
+        std::vector<uint32_t> arrayPart;
+        for (auto* item : expr.arrayPart) {
+            arrayPart.push_back(node(item));
+        }
+        std::vector<uint32_t> mapPart;
+        for (auto&& [key, value] : expr.mapPart) {
+            mapPart.push_back(symbol(key));
+            mapPart.push_back(node(value));
+        }
+        auto record = make(NodeKind::Table, expr, expr.type);
+        record.first = list(arrayPart);
+        record.second = static_cast<uint32_t>(arrayPart.size());
+        record.extra = pack(list(mapPart), static_cast<uint32_t>(mapPart.size()));
+        emit(record);
+    }
+
+    void visit(VarExpr& expr) override {
+        auto record = make(NodeKind::Var, expr, expr.type);
+        record.first = symbol(expr.name);
+        emit(record);
+    }
+
+    void visit(UnaryOpExpr& expr) override { writeOperators(expr); }
+
+    void visit(BinOpExpr& expr) override { writeOperators(expr); }
+
+    void visit(IndexExpr& expr) override {
+        auto object = node(expr.object);
+        auto index = node(expr.index);
+        auto record = make(NodeKind::Index, expr, expr.type);
+        record.first = object;
+        record.second = index;
+        emit(record);
+    }
+
+    void visit(FunCallExpr& expr) override {
+        auto callee = node(expr.callee);
+        std::vector<uint32_t> args;
+        for (auto* arg : expr.args) {
+            args.push_back(node(arg));
+        }
+        auto record = make(NodeKind::FunCall, expr, expr.type);
+        record.first = callee;
+        record.extra = pack(list(args), static_cast<uint32_t>(args.size()));
+        emit(record);
+    }
+
+    void visit(FunDecl& stmt) override {
+        auto body = node(stmt.body);
+        std::vector<uint32_t> parts{stmt.thisName ? symbol(intern(*stmt.thisName)) + 1 : 0};
+        for (const auto& param : stmt.params) {
+            parts.push_back(symbol(param.name));
+            parts.push_back(annotationOf(param.typeAnnotation));
+        }
+        auto record = make(NodeKind::FunDecl, stmt, stmt.type);
+        record.flags = static_cast<uint16_t>(stmt.local | stmt.method << 1 |
+                                             annotationOf(stmt.returnTypeAnnotation) << 2);
+        record.first = symbol(stmt.name);
+        record.second = body;
+        record.extra = pack(list(parts), static_cast<uint32_t>(parts.size()));
+        emit(record);
+    }
+
+    void visit(VarDecl& stmt) override {
+        auto init = node(stmt.initExpr);
+        auto record = make(NodeKind::VarDecl, stmt, stmt.type);
+        record.flags = annotationOf(stmt.typeAnnotation);
+        record.first = symbol(stmt.name);
+        record.second = init;
+        emit(record);
+    }
+
+    void visit(VarDecls& stmt) override {
+        std::vector<uint32_t> decls;
+        for (auto* decl : stmt.decls) {
+            decls.push_back(node(decl));
+        }
+        auto record = make(NodeKind::VarDecls, stmt, nullptr);
+        record.extra = pack(list(decls), static_cast<uint32_t>(decls.size()));
+        emit(record);
+    }
+
+    void visit(IfStmt& stmt) override {
+        std::vector<uint32_t> arms;
+        for (auto& arm : stmt.arms) {
+            arms.push_back(node(arm.condition));
+            arms.push_back(node(arm.body));
+        }
+        uint32_t elseBranch = stmt.else_branch ? node(stmt.else_branch) + 1 : 0;
+        auto record = make(NodeKind::If, stmt, nullptr);
+        record.first = elseBranch;
+        record.extra = pack(list(arms), static_cast<uint32_t>(arms.size()));
+        emit(record);
+    }
+
+    void visit(ReturnStmt& stmt) override {
+        std::vector<uint32_t> values;
+        for (auto* value : stmt.return_values) {
+            values.push_back(node(value));
+        }
+        auto record = make(NodeKind::Return, stmt, nullptr);
+        record.extra = pack(list(values), static_cast<uint32_t>(values.size()));
+        emit(record);
+    }
+
+    void visit(BlockStmt& stmt) override {
+        std::vector<uint32_t> statements;
+        for (auto* child : stmt.statements) {
+            statements.push_back(node(child));
+        }
+        auto record = make(NodeKind::Block, stmt, nullptr);
+        record.extra = pack(list(statements), static_cast<uint32_t>(statements.size()));
+        emit(record);
+    }
+
+    void visit(FunCallStmt& stmt) override {
+        auto call = node(stmt.call);
+        auto record = make(NodeKind::FunCallStmt, stmt, nullptr);
+        record.first = call;
+        emit(record);
+    }
+
+    void visit(AssignStmt& stmt) override {
+        auto left = node(stmt.left);
+        auto right = node(stmt.right);
+        auto record = make(NodeKind::Assign, stmt, nullptr);
+        record.first = left;
+        record.second = right;
+        emit(record);
+    }
+
+  private:
+    /// Writes the operator chain `root` starts, operands first, without recursing along it (see
+    /// forEachOperator). `last` is the index of `root` afterwards.
+    void writeOperators(Expr& root) {
+        Expr* slot = &root;
+        forEachOperator(
+            slot, [this](Expr* operand) { node(operand); },
+            [this](Expr* op) {
+                // Shared operators are written once, like every other node
+                if (nodeIndices.contains(op)) {
+                    return;
+                }
+                NodeRecord record;
+                if (auto* binOp = nodeCast<BinOpExpr>(op)) {
+                    record = make(NodeKind::BinOp, *op, op->type);
+                    record.op = static_cast<uint8_t>(binOp->op);
+                    record.first = nodeIndices.at(binOp->left);
+                    record.second = nodeIndices.at(binOp->right);
+                } else {
+                    auto* unary = static_cast<UnaryOpExpr*>(op);
+                    record = make(NodeKind::UnaryOp, *op, op->type);
+                    record.op = static_cast<uint8_t>(unary->op);
+                    record.first = nodeIndices.at(unary->right);
+                }
+                emit(record);
+                nodeIndices.emplace(op, last);
+            });
+    }
+
+    uint32_t node(Ast* ast) {
+        if (auto found = nodeIndices.find(ast); found != nodeIndices.end()) {
+            return found->second;
+        }
+        ast->accept(*this);
+        nodeIndices.emplace(ast, last);
+        return last;
+    }
+
+    NodeRecord make(NodeKind kind, const Ast& ast, Type* type) {
+        NodeRecord record{};
+        record.kind = static_cast<uint8_t>(kind);
+        record.type = typeReference(type);
+        record.line = ast.loc.line;
+        record.column = ast.loc.column;
+        return record;
+    }
+
+    void emit(const NodeRecord& record) {
+        last = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(record);
+    }
+
+    uint32_t symbol(Symbol symbol) {
+        auto [found, inserted] =
+            symbolIndices.try_emplace(symbol, static_cast<uint32_t>(symbols.size()));
+        if (inserted) {
+            symbols.push_back(symbol);
+        }
+        return found->second;
+    }
+
+    uint32_t list(const std::vector<uint32_t>& items) {
+        auto offset = static_cast<uint32_t>(lists.size());
+        lists.insert(lists.end(), items.begin(), items.end());
+        return offset;
+    }
+
+    /// Writes `type` after its members, returns its index + 1.
+    uint32_t typeReference(Type* type) {
+        if (type == nullptr) {
+            return 0;
+        }
+        if (auto found = typeIndices.find(type); found != typeIndices.end()) {
+            return found->second;
+        }
+        TypeRecord record{};
+        record.kind = static_cast<uint8_t>(type->getKind());
+        std::vector<uint32_t> members;
+        switch (type->getKind()) {
+        case TypeKind::Array:
+            record.first = typeReference(static_cast<ArrayType*>(type)->getElementType());
+            break;
+        case TypeKind::Record: {
+            auto* recordType = static_cast<RecordType*>(type);
+            record.first = typeReference(recordType->getKeyType());
+            record.second = typeReference(recordType->getValueType());
+            break;
+        }
+        case TypeKind::Table:
+            for (auto&& [name, fieldType] : static_cast<TableType*>(type)->getFields()) {
+                members.push_back(symbol(name));
+                members.push_back(typeReference(fieldType));
+            }
+            break;
+        case TypeKind::Function: {
+            auto* function = static_cast<FunctionType*>(type);
+            for (auto* param : function->getParamTypes()) {
+                members.push_back(typeReference(param));
+            }
+            record.first = typeReference(function->getReturnType());
+            break;
+        }
+        case TypeKind::Union:
+            for (auto* member : static_cast<UnionType*>(type)->getTypes()) {
+                members.push_back(typeReference(member));
+            }
+            break;
+        default:
+            break;
+        }
+        record.listOffset = list(members);
+        record.listCount = static_cast<uint32_t>(members.size());
+        types.push_back(record);
+        auto reference = static_cast<uint32_t>(types.size());
+        typeIndices.emplace(type, reference);
+        return reference;
+    }
+
+    std::vector<Symbol> symbols;
+    std::unordered_map<Symbol, uint32_t> symbolIndices;
+    std::vector<TypeRecord> types;
+    std::unordered_map<Type*, uint32_t> typeIndices;
+    std::vector<NodeRecord> nodes;
+    std::unordered_map<Ast*, uint32_t> nodeIndices;
+    std::vector<uint32_t> lists;
+    // Index of the node written by the last visit
+    uint32_t last = 0;
+};
+
+/// Rebuilds the nodes in file order, the children of a node are built before it.
+class Builder {
+  public:
+    explicit Builder(const BinaryAst& ast) : ast(ast) {}
+
+    Program build() {
+        Program program;
+        for (uint32_t i = 0; i < ast.nodeCount(); ++i) {
+            auto record = ast.node(i);
+            kinds.push_back(static_cast<NodeKind>(record.kind));
+            Ast* node = make(program.arena, record);
+            node->loc = {record.line, record.column};
+            built.push_back(node);
+        }
+        auto roots = ast.roots();
+        for (uint32_t i = 0; i < roots.count; ++i) {
+            program.statements.push_back(stmt(ast.item(roots, i)));
+        }
+        return program;
+    }
+
+  private:
+    Ast* make(AstArena& arena, const NodeRecord& record) {
+        auto kind = static_cast<NodeKind>(record.kind);
+        if (isExpression(kind)) {
+            Expr* expr = makeExpr(arena, record);
+            expr->type = ast.type(record.type);
+            return expr;
+        }
+        return makeStmt(arena, record);
+    }
+
+    Expr* makeExpr(AstArena& arena, const NodeRecord& record) {
+        switch (static_cast<NodeKind>(record.kind)) {
+        case NodeKind::String:
+            return arena.make<StringExpr>(ast.symbol(record.first));
+        case NodeKind::Number:
+            if (record.flags & 1) {
+                return arena.make<NumberExpr>(std::bit_cast<int64_t>(record.extra));
+            }
+            return arena.make<NumberExpr>(std::bit_cast<double>(record.extra));
+        case NodeKind::Nil:
+            return arena.make<NilExpr>();
+        case NodeKind::Boolean:
+            return arena.make<BooleanExpr>(record.flags != 0);
+        case NodeKind::Var:
+            return arena.make<VarExpr>(ast.symbol(record.first));
+        case NodeKind::Table: {
+            std::vector<Expr*> arrayPart;
+            BinaryAst::List array{record.first, record.second};
+            for (uint32_t i = 0; i < array.count; ++i) {
+                arrayPart.push_back(expr(ast.item(array, i)));
+            }
+            std::vector<std::pair<Symbol, Expr*>> mapPart;
+            auto map = BinaryAst::unpack(record.extra);
+            for (uint32_t i = 0; i + 1 < map.count; i += 2) {
+                mapPart.emplace_back(ast.symbol(ast.item(map, i)), expr(ast.item(map, i + 1)));
+            }
+            return arena.make<TableExpr>(std::move(arrayPart), std::move(mapPart));
+        }
+        case NodeKind::UnaryOp:
+            return arena.make<UnaryOpExpr>(static_cast<TokenKind>(record.op), expr(record.first));
+        case NodeKind::BinOp:
+            return arena.make<BinOpExpr>(expr(record.first), static_cast<TokenKind>(record.op),
+                                         expr(record.second));
+        case NodeKind::Index:
+            return arena.make<IndexExpr>(expr(record.first), expr(record.second));
+        default: {
+            std::vector<Expr*> args;
+            auto list = BinaryAst::unpack(record.extra);
+            for (uint32_t i = 0; i < list.count; ++i) {
+                args.push_back(expr(ast.item(list, i)));
+            }
+            return arena.make<FunCallExpr>(expr(record.first), std::move(args));
+        }
+        }
+    }
+
+    Stmt* makeStmt(AstArena& arena, const NodeRecord& record) {
+        auto list = BinaryAst::unpack(record.extra);
+        switch (static_cast<NodeKind>(record.kind)) {
+        case NodeKind::FunDecl: {
+            auto thisSymbol = ast.item(list, 0);
+            std::optional<std::string> thisName;
+            if (thisSymbol != 0) {
+                thisName = std::string(ast.symbolText(thisSymbol - 1));
+            }
+            std::vector<Parameter> params;
+            for (uint32_t i = 1; i + 1 < list.count; i += 2) {
+                params.emplace_back(ast.symbol(ast.item(list, i)),
+                                    annotationFrom(ast.item(list, i + 1)));
+            }
+            auto* decl = arena.make<FunDecl>(ast.symbol(record.first), (record.flags & 1) != 0,
+                                             std::move(thisName), (record.flags & 2) != 0,
+                                             std::move(params), stmt(record.second),
+                                             annotationFrom(record.flags >> 2));
+            decl->type = ast.type(record.type);
+            return decl;
+        }
+        case NodeKind::VarDecl: {
+            auto* decl = arena.make<VarDecl>(ast.symbol(record.first), expr(record.second),
+                                             annotationFrom(record.flags));
+            decl->type = ast.type(record.type);
+            return decl;
+        }
+        case NodeKind::VarDecls: {
+            auto* decls = arena.make<VarDecls>();
+            for (uint32_t i = 0; i < list.count; ++i) {
+                decls->decls.push_back(
+                    static_cast<VarDecl*>(child(ast.item(list, i), NodeKind::VarDecl)));
+            }
+            return decls;
+        }
+        case NodeKind::If: {
+            if (list.count == 0 || list.count % 2 != 0) {
+                throw std::runtime_error("Invalid if statement in binary AST");
+            }
+            std::vector<IfStmt::Arm> arms;
+            for (uint32_t i = 0; i < list.count; i += 2) {
+                arms.push_back({expr(ast.item(list, i)), stmt(ast.item(list, i + 1))});
+            }
+            return arena.make<IfStmt>(std::move(arms),
+                                      record.first != 0 ? stmt(record.first - 1) : nullptr);
+        }
+        case NodeKind::Return: {
+            std::vector<Expr*> values;
+            for (uint32_t i = 0; i < list.count; ++i) {
+                values.push_back(expr(ast.item(list, i)));
+            }
+            return arena.make<ReturnStmt>(std::move(values));
+        }
+        case NodeKind::Block: {
+            auto* block = arena.make<BlockStmt>();
+            for (uint32_t i = 0; i < list.count; ++i) {
+                block->statements.push_back(stmt(ast.item(list, i)));
+            }
+            return block;
+        }
+        case NodeKind::FunCallStmt:
+            return arena.make<FunCallStmt>(
+                static_cast<FunCallExpr*>(child(record.first, NodeKind::FunCall)));
+        case NodeKind::Assign:
+            return arena.make<AssignStmt>(expr(record.first), expr(record.second));
+        default:
+            throw std::runtime_error(
+                std::format("Invalid node kind {} in binary AST", record.kind));
+        }
+    }
+
+    /// An already built node, nodes referring to later ones (or themselves) are rejected.
+    Ast* at(uint32_t index) const {
+        if (index >= built.size()) {
+            throw std::runtime_error(
+                std::format("Invalid reference to node {} in binary AST", index));
+        }
+        return built[index];
+    }
+
+    Expr* expr(uint32_t index) const {
+        Ast* node = at(index);
+        if (!isExpression(kinds[index])) {
+            throw std::runtime_error(
+                std::format("Node {} in binary AST isn't an expression", index));
+        }
+        return static_cast<Expr*>(node);
+    }
+
+    Stmt* stmt(uint32_t index) const {
+        Ast* node = at(index);
+        if (isExpression(kinds[index])) {
+            throw std::runtime_error(
+                std::format("Node {} in binary AST isn't a statement", index));
+        }
+        return static_cast<Stmt*>(node);
+    }
+
+    Ast* child(uint32_t index, NodeKind kind) const {
+        Ast* node = at(index);
+        if (kinds[index] != kind) {
+            throw std::runtime_error(
+                std::format("Node {} in binary AST has the wrong kind", index));
+        }
+        return node;
+    }
+
+    const BinaryAst& ast;
+    std::vector<Ast*> built;
+    std::vector<NodeKind> kinds;
+};
+} // namespace
+
+std::string writeBinaryAst(const Program& program) { return Writer().write(program); }
+
+BinaryAst::BinaryAst(std::string_view bytes) : bytes(bytes) {
+    if (bytes.size() < sizeof(Header)) {
+        throw std::runtime_error("Binary AST is truncated");
+    }
+    std::memcpy(&header, bytes.data(), sizeof(Header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw std::runtime_error("Not a binary AST");
+    }
+    if (header.version != VERSION) {
+        throw std::runtime_error(std::format("Unsupported binary AST version {}, expected {}",
+                                             header.version, VERSION));
+    }
+    // The sizes are at most 2^32 items, these sums can't overflow
+    symbolsOffset = aligned(sizeof(Header));
+    stringsOffset = symbolsOffset + aligned((size_t{header.symbolCount} + 1) * sizeof(uint32_t));
+    typesOffset = stringsOffset + aligned(header.stringBytes);
+    nodesOffset = typesOffset + aligned(size_t{header.typeCount} * sizeof(TypeRecord));
+    listsOffset = nodesOffset + aligned(size_t{header.nodeCount} * sizeof(NodeRecord));
+    if (listsOffset + size_t{header.listLength} * sizeof(uint32_t) > bytes.size()) {
+        throw std::runtime_error("Binary AST is truncated");
+    }
+    if (size_t{header.rootOffset} + header.rootCount > header.listLength) {
+        throw std::runtime_error("Invalid list of statements in binary AST");
+    }
+    types.resize(header.typeCount);
+}
+
+uint32_t BinaryAst::item(List list, size_t i) const {
+    if (i >= list.count || size_t{list.offset} + list.count > header.listLength) {
+        throw std::runtime_error(std::format("Invalid list at {} in binary AST", list.offset));
+    }
+    uint32_t value;
+    std::memcpy(&value, bytes.data() + listsOffset + (list.offset + i) * sizeof(uint32_t),
+                sizeof(value));
+    return value;
+}
+
+NodeRecord BinaryAst::node(uint32_t index) const {
+    if (index >= header.nodeCount) {
+        throw std::runtime_error(std::format("Invalid node {} in binary AST", index));
+    }
+    NodeRecord record;
+    std::memcpy(&record, bytes.data() + nodesOffset + size_t{index} * sizeof(NodeRecord),
+                sizeof(record));
+    return record;
+}
+
+std::string_view BinaryAst::symbolText(uint32_t index) const {
+    if (index >= header.symbolCount) {
+        throw std::runtime_error(std::format("Invalid symbol {} in binary AST", index));
+    }
+    uint32_t range[2];
+    std::memcpy(range, bytes.data() + symbolsOffset + size_t{index} * sizeof(uint32_t),
+                sizeof(range));
+    if (range[0] > range[1] || range[1] > header.stringBytes) {
+        throw std::runtime_error(std::format("Invalid symbol {} in binary AST", index));
+    }
+    return bytes.substr(stringsOffset + range[0], range[1] - range[0]);
+}
+
+TypeRecord BinaryAst::typeRecord(uint32_t index) const {
+    TypeRecord record;
+    std::memcpy(&record, bytes.data() + typesOffset + size_t{index} * sizeof(TypeRecord),
+                sizeof(record));
+    return record;
+}
+
+Type* BinaryAst::type(uint32_t reference) const {
+    if (reference == 0) {
+        return nullptr;
+    }
+    uint32_t index = reference - 1;
+    if (index >= header.typeCount) {
+        throw std::runtime_error(std::format("Invalid type {} in binary AST", reference));
+    }
+    if (types[index] != nullptr) {
+        return types[index];
+    }
+
+    auto record = typeRecord(index);
+    // Members are written first, which also rules out cycles
+    auto member = [&](uint32_t memberReference) {
+        if (memberReference == 0 || memberReference > index) {
+            throw std::runtime_error(
+                std::format("Invalid member of type {} in binary AST", reference));
+        }
+        return type(memberReference);
+    };
+    List members{record.listOffset, record.listCount};
+    auto& factory = TypeFactory::instance();
+    Type* result;
+    switch (static_cast<TypeKind>(record.kind)) {
+    case TypeKind::Array:
+        result = factory.createArrayType(member(record.first));
+        break;
+    case TypeKind::Record:
+        result = factory.createRecordType(member(record.first), member(record.second));
+        break;
+    case TypeKind::Table: {
+        std::map<Symbol, Type*> fields;
+        for (uint32_t i = 0; i + 1 < members.count; i += 2) {
+            fields.emplace(symbol(item(members, i)), member(item(members, i + 1)));
+        }
+        result = factory.createTableType(std::move(fields));
+        break;
+    }
+    case TypeKind::Function: {
+        std::vector<Type*> params;
+        for (uint32_t i = 0; i < members.count; ++i) {
+            params.push_back(member(item(members, i)));
+        }
+        result = factory.createFunctionType(std::move(params), member(record.first));
+        break;
+    }
+    case TypeKind::Union: {
+        std::vector<Type*> unionMembers;
+        for (uint32_t i = 0; i < members.count; ++i) {
+            unionMembers.push_back(member(item(members, i)));
+        }
+        result = factory.createUnionType(std::move(unionMembers));
+        break;
+    }
+    default:
+        if (record.kind > static_cast<uint8_t>(TypeKind::Any)) {
+            throw std::runtime_error(
+                std::format("Invalid type kind {} in binary AST", record.kind));
+        }
+        result = BasicType::ofKind(static_cast<TypeKind>(record.kind));
+    }
+    types[index] = result;
+    return result;
+}
+
+Program BinaryAst::toProgram() const { return Builder(*this).build(); }
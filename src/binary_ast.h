@@ -0,0 +1,134 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ast.h"
+
+/// Compact, versioned binary form of a typed Program, for tools that consume the checked
+/// tree without compiling it again.
+///
+/// Integers are in the byte order of the machine that wrote the file, sections are 8 byte
+/// aligned and follow each other:
+///   header     magic "TAST", version and the size of each section (9 x u32)
+///   symbols    u32 offset of each symbol's text, plus the end of the last one
+///   strings    the texts of the symbols
+///   types      one TypeRecord per type, members before the types using them
+///   nodes      one NodeRecord per node, children before their parents
+///   lists      u32 items of the variable length parts of nodes and types
+/// Records refer to each other by index. Type references are index + 1, 0 is no type.
+///
+/// The file can be used in place: BinaryAst reads records straight out of the bytes (e.g.
+/// a MappedFile) and only interns the symbols and types that are asked for.
+namespace binary_ast {
+inline constexpr char MAGIC[4] = {'T', 'A', 'S', 'T'};
+inline constexpr uint32_t VERSION = 2;
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t symbolCount;
+    uint32_t stringBytes;
+    uint32_t typeCount;
+    uint32_t nodeCount;
+    uint32_t listLength;
+    // The top-level statements are a list
+    uint32_t rootOffset;
+    uint32_t rootCount;
+};
+
+/// Arrays, records and functions use `first` and `second` for their member types, unions,
+/// tables and function parameters a list: the member types, the (symbol, type) pairs of the
+/// fields, or the parameter types.
+struct TypeRecord {
+    uint8_t kind; // TypeKind
+    uint8_t padding[3];
+    uint32_t first;
+    uint32_t second;
+    uint32_t listOffset;
+    uint32_t listCount;
+};
+
+/// `first`, `second` and `extra` depend on the kind:
+///   String, Var    first = symbol
+///   Number         flags = 1 for integers, extra = the bits of the int64_t or double
+///   Boolean        flags = the value
+///   Table          first, second = list of the array part; extra = list of (symbol, node)
+///   UnaryOp        op, first = operand
+///   BinOp          op, first = left, second = right
+///   Index          first = object, second = index
+///   FunCall        first = callee, extra = list of the arguments
+///   FunDecl        flags = local | method << 1 | return annotation << 2, first = name,
+///                  second = body, extra = list: this name (symbol + 1 or 0), then a
+///                  (symbol, annotation) pair for each parameter
+///   VarDecl        flags = annotation, first = name, second = initializer
+///   VarDecls       extra = list of the declarations
+///   If             first = else branch + 1 or 0, extra = list: a (condition, body) pair
+///                  for each arm
+///   Return, Block  extra = list of the values or statements
+///   FunCallStmt    first = call
+///   Assign         first = target, second = value
+/// Lists are packed into `extra` as offset << 32 | count. Annotations are
+/// BasicTypeAnnotation::Kind + 1, or 0 when there is none.
+struct NodeRecord {
+    uint8_t kind; // NodeKind
+    uint8_t op;   // TokenKind
+    uint16_t flags;
+    uint32_t type;
+    uint32_t line;
+    uint32_t column;
+    uint32_t first;
+    uint32_t second;
+    uint64_t extra;
+};
+} // namespace binary_ast
+
+/// Serializes `program` and the types of its nodes.
+std::string writeBinaryAst(const Program& program);
+
+/// Reader of the binary format over bytes that must outlive it. The header and the section
+/// sizes are checked up front, indices on each access; both throw std::runtime_error.
+class BinaryAst {
+  public:
+    /// A list of u32 items in the lists section.
+    struct List {
+        uint32_t offset = 0;
+        uint32_t count = 0;
+    };
+
+    explicit BinaryAst(std::string_view bytes);
+
+    size_t symbolCount() const { return header.symbolCount; }
+    size_t typeCount() const { return header.typeCount; }
+    size_t nodeCount() const { return header.nodeCount; }
+
+    /// Indices of the top-level statements.
+    List roots() const { return {header.rootOffset, header.rootCount}; }
+    uint32_t item(List list, size_t i) const;
+    static List unpack(uint64_t extra) {
+        return {static_cast<uint32_t>(extra >> 32), static_cast<uint32_t>(extra)};
+    }
+
+    binary_ast::NodeRecord node(uint32_t index) const;
+    std::string_view symbolText(uint32_t index) const;
+    Symbol symbol(uint32_t index) const { return intern(symbolText(index)); }
+    /// The interned type of a type reference (index + 1), nullptr for 0.
+    Type* type(uint32_t reference) const;
+
+    /// Builds the nodes in a Program of their own, for passes that need the pointer tree.
+    Program toProgram() const;
+
+  private:
+    binary_ast::TypeRecord typeRecord(uint32_t index) const;
+
+    std::string_view bytes;
+    binary_ast::Header header{};
+    size_t symbolsOffset = 0;
+    size_t stringsOffset = 0;
+    size_t typesOffset = 0;
+    size_t nodesOffset = 0;
+    size_t listsOffset = 0;
+    // Types interned so far, by index
+    mutable std::vector<Type*> types;
+};
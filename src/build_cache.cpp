@@ -0,0 +1,153 @@
+#include "build_cache.h"
+
+#include <charconv>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <unistd.h>
+
+#include "version.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+uint64_t fnv1a(std::string_view bytes, uint64_t hash = FNV_OFFSET) {
+    for (unsigned char c : bytes) {
+        hash = (hash ^ c) * FNV_PRIME;
+    }
+    return hash;
+}
+
+std::optional<std::string> readFile(const fs::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return std::nullopt;
+    }
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+/// Writes to a temporary file first, readers never see a partially written file. The temporary
+/// is named after the process and thread, writers sharing the cache never write the same one.
+void writeAtomically(const fs::path& path, std::string_view content) {
+    auto tmp = path;
+    tmp += std::format(".tmp{}.{}", ::getpid(),
+                       std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        file << content;
+        if (!file) {
+            throw std::runtime_error(std::format("Could not write file: {}", tmp.string()));
+        }
+    }
+    fs::rename(tmp, path);
+}
+
+std::optional<uint64_t> parseKey(std::string_view text) {
+    uint64_t key = 0;
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), key, 16);
+    if (ec != std::errc{} || end != text.data() + text.size()) {
+        return std::nullopt;
+    }
+    return key;
+}
+} // namespace
+
+BuildCache::BuildCache(fs::path dir) : dir(std::move(dir)) {
+    fs::create_directories(this->dir / "paths");
+}
+
+uint64_t BuildCache::key(std::string_view source, std::string_view flags) {
+    // The NUL separators keep version "1" + source "2..." apart from version "12" + source "..."
+    constexpr std::string_view separator("\0", 1);
+    uint64_t hash = fnv1a(TLUA_VERSION);
+    hash = fnv1a(separator, hash);
+    hash = fnv1a(flags, hash);
+    hash = fnv1a(separator, hash);
+    return fnv1a(source, hash);
+}
+
+fs::path BuildCache::entryPath(uint64_t key) const {
+    return dir / std::format("{:016x}.entry", key);
+}
+
+fs::path BuildCache::indexPath(const fs::path& source) const {
+    auto canonical = fs::weakly_canonical(source).string();
+    return dir / "paths" / std::format("{:016x}", fnv1a(canonical));
+}
+
+// Entry layout:
+//   tlua-cache <version>
+//   exports <count>
+//   <name> <signature>        (one line per export)
+//   lua <size>
+//   <size bytes of Lua>
+std::optional<CacheEntry> BuildCache::lookup(uint64_t key) const {
+    auto content = readFile(entryPath(key));
+    if (!content) {
+        return std::nullopt;
+    }
+    std::istringstream in(*content);
+    std::string magic, version, tag;
+    size_t count = 0;
+    if (!(in >> magic >> version) || magic != "tlua-cache" || version != TLUA_VERSION ||
+        !(in >> tag >> count) || tag != "exports") {
+        return std::nullopt;
+    }
+
+    CacheEntry entry;
+    in.ignore(1); // end of the exports line
+    for (size_t i = 0; i < count; ++i) {
+        std::string line;
+        if (!std::getline(in, line)) {
+            return std::nullopt;
+        }
+        auto space = line.find(' ');
+        if (space == std::string::npos) {
+            return std::nullopt;
+        }
+        entry.exports.push_back({line.substr(0, space), line.substr(space + 1)});
+    }
+
+    size_t size = 0;
+    if (!(in >> tag >> size) || tag != "lua") {
+        return std::nullopt;
+    }
+    in.ignore(1);
+    entry.lua.resize(size);
+    if (!in.read(entry.lua.data(), static_cast<std::streamsize>(size))) {
+        return std::nullopt;
+    }
+    return entry;
+}
+
+void BuildCache::store(uint64_t key, const CacheEntry& entry) const {
+    std::string content = std::format("tlua-cache {}\nexports {}\n", TLUA_VERSION,
+                                      entry.exports.size());
+    for (auto&& symbol : entry.exports) {
+        content += std::format("{} {}\n", symbol.name, symbol.signature);
+    }
+    content += std::format("lua {}\n", entry.lua.size());
+    content += entry.lua;
+    writeAtomically(entryPath(key), content);
+}
+
+std::optional<uint64_t> BuildCache::lastKey(const fs::path& path) const {
+    auto content = readFile(indexPath(path));
+    if (!content) {
+        return std::nullopt;
+    }
+    return parseKey(*content);
+}
+
+void BuildCache::setLastKey(const fs::path& path, uint64_t key) const {
+    writeAtomically(indexPath(path), std::format("{:016x}", key));
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// A top-level global function and its type, the part of a file other files can depend on.
+struct ExportedSymbol {
+    std::string name;
+    std::string signature;
+
+    bool operator==(const ExportedSymbol&) const = default;
+};
+
+struct CacheEntry {
+    std::string lua;
+    std::vector<ExportedSymbol> exports;
+};
+
+/// On-disk cache of compilation results, one entry per distinct (source, compiler version).
+/// Entries are written atomically, so concurrent compilations may share one cache directory.
+/// Unreadable or corrupted entries are treated as misses.
+class BuildCache {
+  public:
+    static constexpr std::string_view DEFAULT_DIR = ".tlua-cache";
+
+    explicit BuildCache(std::filesystem::path dir);
+
+    /// Cache key of a source text: FNV-1a of the compiler version, the `flags` changing the
+    /// generated code and the source bytes.
+    static uint64_t key(std::string_view source, std::string_view flags = {});
+
+    std::optional<CacheEntry> lookup(uint64_t key) const;
+    void store(uint64_t key, const CacheEntry& entry) const;
+
+    /// Key last stored for the source file at `path`, used to find the previous
+    /// exports of a file that changed.
+    std::optional<uint64_t> lastKey(const std::filesystem::path& path) const;
+    void setLastKey(const std::filesystem::path& path, uint64_t key) const;
+
+  private:
+    std::filesystem::path entryPath(uint64_t key) const;
+    std::filesystem::path indexPath(const std::filesystem::path& source) const;
+
+    std::filesystem::path dir;
+};
@@ -0,0 +1,254 @@
+#include "compile_server.h"
+
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <list>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "mapped_file.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+/// Closes the descriptor when leaving the scope, also when serving throws.
+struct Socket {
+    int fd;
+
+    explicit Socket(int fd) : fd(fd) {}
+    ~Socket() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+};
+
+/// A client connection, with what it sent of requests not answered yet.
+struct Connection {
+    Socket socket;
+    std::string buffer;
+
+    explicit Connection(int fd) : socket(fd) {}
+};
+
+std::string response(bool ok, std::string_view payload) {
+    return std::format("{} {}\n{}", ok ? "ok" : "error", payload.size(), payload);
+}
+
+/// Writes all of `data`, a client that went away only ends its connection.
+bool writeAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t written = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(written));
+    }
+    return true;
+}
+
+std::runtime_error socketError(std::string_view what, const fs::path& path) {
+    return std::runtime_error(
+        std::format("Could not {} socket {}: {}", what, path.string(), std::strerror(errno)));
+}
+/// Reads what `client` sent and answers the request lines it completed. False once the
+/// connection ended.
+bool serveClient(CompileServer& server, Connection& client) {
+    char chunk[4096];
+    ssize_t count = ::read(client.socket.fd, chunk, sizeof(chunk));
+    if (count < 0 && errno == EINTR) {
+        return true;
+    }
+    if (count <= 0) {
+        return false;
+    }
+    auto& buffer = client.buffer;
+    buffer.append(chunk, static_cast<size_t>(count));
+
+    size_t start = 0;
+    for (size_t end; !server.stopped() && (end = buffer.find('\n', start)) != std::string::npos;
+         start = end + 1) {
+        auto line = std::string_view(buffer).substr(start, end - start);
+        if (!writeAll(client.socket.fd, server.handleRequest(line))) {
+            return false;
+        }
+    }
+    buffer.erase(0, start);
+    return true;
+}
+} // namespace
+
+CompileServer::CompileServer(CompileOptions options) : options(std::move(options)) {
+    if (!this->options.modulePath.empty()) {
+        modules = std::make_unique<ModuleResolver>(this->options.modulePath);
+    }
+}
+
+std::string CompileServer::handleRequest(std::string_view request) {
+    ++requests;
+    if (request.ends_with('\r')) {
+        request.remove_suffix(1);
+    }
+    auto space = request.find(' ');
+    auto command = request.substr(0, space);
+    auto argument = space == std::string_view::npos ? std::string_view{}
+                                                    : request.substr(space + 1);
+
+    if (command == "compile" || command == "check") {
+        if (argument.empty()) {
+            return response(false, std::format("{} needs a file path", command));
+        }
+        const auto& file = compile(argument);
+        if (!file.error.empty()) {
+            return response(false, file.error);
+        }
+        return response(true, command == "compile" ? std::string_view(file.lua) : "");
+    }
+    if (command == "stats") {
+        return response(true, std::format("files {} requests {} hits {} compiles {}",
+                                          files.size(), requests, hits, compiles));
+    }
+    if (command == "shutdown") {
+        stopping = true;
+        return response(true, "");
+    }
+    return response(false, std::format("Unknown request: {}", command));
+}
+
+const CompileServer::CachedFile& CompileServer::compile(const fs::path& path) {
+    auto& file = files[fs::absolute(path).lexically_normal().string()];
+    std::error_code ec;
+    auto modified = fs::last_write_time(path, ec);
+    auto size = ec ? 0 : fs::file_size(path, ec);
+    if (ec) {
+        file = CachedFile{};
+        file.error = std::format("Could not read file: {}", path.string());
+        return file;
+    }
+    refreshModules(file.requiredModules);
+    if (file.key != 0 && file.modified == modified && file.size == size &&
+        dependencyFlags(file.requiredModules, modules.get()) == file.dependencies) {
+        ++hits;
+        return file;
+    }
+
+    file.modified = modified;
+    file.size = size;
+    try {
+        // Lexemes point into the mapping, so it is kept open until the pipeline is done
+        MappedFile source(path.string());
+        // What Lua calls the chunk in messages and tracebacks, as in a build
+        auto chunkName = "@" + path.string();
+        file.requiredModules = scanRequires(source.view());
+        refreshModules(file.requiredModules);
+        file.dependencies = dependencyFlags(file.requiredModules, modules.get());
+        // The same key as a build's, though only this server's memory holds the results
+        auto flags = cacheFlags(options) + file.dependencies;
+        if (options.bytecode) {
+            flags += " chunk " + chunkName;
+        }
+        auto key = BuildCache::key(source.view(), flags);
+        if (key == file.key) {
+            // Touched, but the contents and the modules are the same
+            ++hits;
+            return file;
+        }
+        file.key = key;
+        ++compiles;
+        file.lua = compileUnit(source.view(), options, modules.get(), chunkName).lua;
+        file.error.clear();
+    } catch (const std::exception& e) {
+        file.lua.clear();
+        file.error = e.what();
+    }
+    return file;
+}
+
+void CompileServer::refreshModules(const std::vector<std::string>& names) {
+    if (!modules) {
+        return;
+    }
+    for (const auto& name : names) {
+        ModuleFile current;
+        if (auto location = modules->locate(name)) {
+            std::error_code ec;
+            current.modified = fs::last_write_time(*location, ec);
+            current.size = ec ? 0 : fs::file_size(*location, ec);
+            current.exists = !ec;
+        }
+        auto [known, added] = moduleFiles.try_emplace(name, current);
+        if (!added && (known->second.exists != current.exists ||
+                       known->second.modified != current.modified ||
+                       known->second.size != current.size)) {
+            modules->invalidate(name);
+            known->second = current;
+        }
+    }
+}
+
+void CompileServer::serve(const fs::path& socketPath) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    const auto& name = socketPath.native();
+    if (name.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error(std::format("Socket path too long: {}", socketPath.string()));
+    }
+    std::memcpy(address.sun_path, name.c_str(), name.size() + 1);
+
+    Socket listener(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (listener.fd < 0) {
+        throw socketError("create", socketPath);
+    }
+    // A socket left behind by a server that didn't shut down cleanly
+    ::unlink(name.c_str());
+    if (::bind(listener.fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        throw socketError("bind", socketPath);
+    }
+    if (::listen(listener.fd, SOMAXCONN) < 0) {
+        throw socketError("listen on", socketPath);
+    }
+
+    // One thread serves every connection, with the caches it owns: a client keeping its
+    // connection open only holds up the others while a request of its own is answered.
+    std::list<Connection> clients;
+    std::vector<pollfd> ready;
+    while (!stopping) {
+        ready.assign(1, pollfd{listener.fd, POLLIN, 0});
+        for (auto& client : clients) {
+            ready.push_back(pollfd{client.socket.fd, POLLIN, 0});
+        }
+        if (::poll(ready.data(), ready.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw socketError("poll on", socketPath);
+        }
+        auto polled = ready.begin() + 1;
+        for (auto client = clients.begin(); client != clients.end(); ++polled) {
+            if (polled->revents && !serveClient(*this, *client)) {
+                client = clients.erase(client);
+            } else {
+                ++client;
+            }
+        }
+        if (ready[0].revents & POLLIN) {
+            int fd = ::accept4(listener.fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                clients.emplace_back(fd);
+            } else if (errno != EINTR && errno != ECONNABORTED) {
+                throw socketError("accept on", socketPath);
+            }
+        }
+    }
+    ::unlink(name.c_str());
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "driver.h"
+#include "module_resolver.h"
+
+/// Long-running compiler answering requests over a Unix socket, for editors and watchers
+/// that would otherwise start a process per file. Interned symbols and types stay alive
+/// between requests, and the result of every file is kept in memory: a file is only read
+/// again when its size or modification time changed, and only compiled again when its
+/// contents, or the summaries of the modules it requires, did. Module summaries are kept as
+/// well and read again when their file changes.
+///
+/// The protocol is line based. Each request is one line:
+///   compile PATH   the Lua for PATH
+///   check PATH     only whether PATH compiles
+///   stats          counters of the server
+///   shutdown       stop after answering
+/// Each response is a header line `ok N` or `error N`, followed by N bytes of payload: the
+/// Lua, the error message or the counters.
+class CompileServer {
+  public:
+    static constexpr std::string_view DEFAULT_SOCKET = ".tlua.sock";
+
+    explicit CompileServer(CompileOptions options = {});
+
+    /// Answers one request line (without its newline).
+    std::string handleRequest(std::string_view request);
+
+    /// Listens on `socketPath` and answers the requests of all its connections as they
+    /// arrive, until a shutdown request. Throws std::runtime_error if the socket can't be set up.
+    void serve(const std::filesystem::path& socketPath);
+
+    bool stopped() const { return stopping; }
+
+  private:
+    struct CachedFile {
+        std::filesystem::file_time_type modified;
+        uintmax_t size = 0;
+        uint64_t key = 0;
+        // The modules the contents require, and their summaries as part of the key
+        std::vector<std::string> requiredModules;
+        std::string dependencies;
+        std::string lua;
+        // Empty when the file compiled
+        std::string error;
+    };
+
+    // Of a module file when its summary was last read, `exists` is false if it wasn't found
+    struct ModuleFile {
+        bool exists = false;
+        std::filesystem::file_time_type modified;
+        uintmax_t size = 0;
+    };
+
+    /// The up to date result for the file at `path`, compiling it if needed.
+    const CachedFile& compile(const std::filesystem::path& path);
+    /// Drops the summaries of the `names` modules whose file changed since they were read.
+    void refreshModules(const std::vector<std::string>& names);
+
+    CompileOptions options;
+    // Null without a module path
+    std::unique_ptr<ModuleResolver> modules;
+    // Keyed on the absolute path of each file
+    std::unordered_map<std::string, CachedFile> files;
+    // By module name
+    std::map<std::string, ModuleFile, std::less<>> moduleFiles;
+    bool stopping = false;
+
+    size_t requests = 0;
+    size_t hits = 0;
+    size_t compiles = 0;
+};
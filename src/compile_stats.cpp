@@ -0,0 +1,105 @@
+#include "compile_stats.h"
+
+#include <algorithm>
+#include <format>
+
+#include <sys/resource.h>
+
+AllocationCounts& threadAllocations() {
+    // Constant initialized, operator new may use it before anything else ran on the thread
+    static thread_local AllocationCounts counts;
+    return counts;
+}
+
+uint64_t peakRssKiB() {
+    rusage usage{};
+    if (::getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    // Linux reports kilobytes
+    return static_cast<uint64_t>(usage.ru_maxrss);
+}
+
+PhaseTimer::PhaseTimer(CompileStats* stats, std::string_view name)
+    : stats(stats), name(name), start(std::chrono::steady_clock::now()),
+      allocationsBefore(threadAllocations()) {}
+
+PhaseTimer::~PhaseTimer() {
+    if (stats == nullptr) {
+        return;
+    }
+    auto allocations = threadAllocations();
+    CompileStats phase;
+    phase.phases.push_back({std::string(name), std::chrono::steady_clock::now() - start,
+                            allocations.count - allocationsBefore.count,
+                            allocations.bytes - allocationsBefore.bytes});
+    *stats += phase;
+}
+
+CompileStats& CompileStats::operator+=(const CompileStats& other) {
+    for (const auto& phase : other.phases) {
+        auto found = std::ranges::find(phases, phase.name, &PhaseStats::name);
+        if (found == phases.end()) {
+            phases.push_back(phase);
+            continue;
+        }
+        found->time += phase.time;
+        found->allocations += phase.allocations;
+        found->allocatedBytes += phase.allocatedBytes;
+    }
+    tokens += other.tokens;
+    nodes += other.nodes;
+    files += other.files;
+    subtypeCacheHits += other.subtypeCacheHits;
+    subtypeCacheMisses += other.subtypeCacheMisses;
+    // Process wide counters, the latest value is the total
+    types = std::max(types, other.types);
+    symbols = std::max(symbols, other.symbols);
+    peakRssKiB = std::max(peakRssKiB, other.peakRssKiB);
+    return *this;
+}
+
+namespace {
+double milliseconds(std::chrono::nanoseconds time) {
+    return std::chrono::duration<double, std::milli>(time).count();
+}
+} // namespace
+
+std::string CompileStats::toText() const {
+    std::string text = std::format("{:<12}{:>12}{:>14}{:>14}\n", "phase", "time (ms)",
+                                   "allocations", "bytes");
+    PhaseStats total{"total"};
+    for (const auto& phase : phases) {
+        text += std::format("{:<12}{:>12.3f}{:>14}{:>14}\n", phase.name, milliseconds(phase.time),
+                            phase.allocations, phase.allocatedBytes);
+        total.time += phase.time;
+        total.allocations += phase.allocations;
+        total.allocatedBytes += phase.allocatedBytes;
+    }
+    text += std::format("{:<12}{:>12.3f}{:>14}{:>14}\n", total.name, milliseconds(total.time),
+                        total.allocations, total.allocatedBytes);
+    text += std::format("files {}, tokens {}, nodes {}, types {}, symbols {}\n", files, tokens,
+                        nodes, types, symbols);
+    text += std::format("subtype cache {} hits, {} misses\n", subtypeCacheHits,
+                        subtypeCacheMisses);
+    text += std::format("peak rss {} KiB\n", peakRssKiB);
+    return text;
+}
+
+std::string CompileStats::toJson() const {
+    // Phase names are identifiers, nothing needs escaping
+    std::string json = "{\"phases\": [";
+    for (size_t i = 0; i < phases.size(); ++i) {
+        const auto& phase = phases[i];
+        json += std::format("{}{{\"name\": \"{}\", \"ms\": {:.3f}, \"allocations\": {}, "
+                            "\"bytes\": {}}}",
+                            i == 0 ? "" : ", ", phase.name, milliseconds(phase.time),
+                            phase.allocations, phase.allocatedBytes);
+    }
+    json += std::format("], \"files\": {}, \"tokens\": {}, \"nodes\": {}, \"types\": {}, "
+                        "\"symbols\": {}, \"subtypeCacheHits\": {}, \"subtypeCacheMisses\": {}, "
+                        "\"peakRssKiB\": {}}}",
+                        files, tokens, nodes, types, symbols, subtypeCacheHits,
+                        subtypeCacheMisses, peakRssKiB);
+    return json;
+}
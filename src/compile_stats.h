@@ -0,0 +1,77 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Heap allocations made by one thread. Only counted when the replacement of the global
+/// operator new in allocation_counter.cpp is linked in (the compiler binary), otherwise
+/// the counts stay zero.
+struct AllocationCounts {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+};
+
+/// Allocations of the calling thread so far.
+AllocationCounts& threadAllocations();
+
+struct PhaseStats {
+    std::string name;
+    std::chrono::nanoseconds time{};
+    uint64_t allocations = 0;
+    uint64_t allocatedBytes = 0;
+};
+
+/// What the compilation of one or more files cost, for `--stats`.
+struct CompileStats {
+    // In pipeline order
+    std::vector<PhaseStats> phases;
+    size_t tokens = 0;
+    // AST nodes in the arena at the end of the pipeline, made up nodes included
+    size_t nodes = 0;
+    // Composite types interned by the TypeFactory, shared by all files of the process
+    size_t types = 0;
+    size_t symbols = 0;
+    size_t files = 0;
+    // isSubtype calls answered from the subtype cache, and those that weren't
+    uint64_t subtypeCacheHits = 0;
+    uint64_t subtypeCacheMisses = 0;
+    // Of the whole process
+    uint64_t peakRssKiB = 0;
+
+    /// Adds the phases and counts of another compilation, phases of the same name are summed.
+    CompileStats& operator+=(const CompileStats& other);
+
+    /// A table for people.
+    std::string toText() const;
+    /// One JSON object, for tracking regressions between releases.
+    std::string toJson() const;
+};
+
+/// Peak resident set size of the process.
+uint64_t peakRssKiB();
+
+/// Adds the wall time and the allocations of its scope as a phase of `stats`.
+/// Does nothing when `stats` is null.
+class PhaseTimer {
+  public:
+    PhaseTimer(CompileStats* stats, std::string_view name);
+    ~PhaseTimer();
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+  private:
+    CompileStats* stats;
+    std::string_view name;
+    std::chrono::steady_clock::time_point start;
+    AllocationCounts allocationsBefore;
+};
+
+/// Runs `run` as the phase `name` of `stats`, returning its result.
+template <typename Fn>
+decltype(auto) timePhase(CompileStats* stats, std::string_view name, Fn&& run) {
+    PhaseTimer timer(stats, name);
+    return run();
+}
@@ -0,0 +1,424 @@
+#include "driver.h"
+
+#include <algorithm>
+#include <atomic>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "binary_ast.h"
+#include "eliminator.h"
+#include "inliner.h"
+#include "lexer.h"
+#include "localizer.h"
+#include "lua_bytecode.h"
+#include "lua_codegen.h"
+#include "mapped_file.h"
+#include "module_resolver.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "typechecker.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+// Chunk name of sources compiled without a file, Lua shows it as "?"
+constexpr std::string_view ANONYMOUS_CHUNK = "=?";
+
+/// Front end and middle end: everything up to code generation. Phases are added to `stats`
+/// if it isn't null.
+Program checkedProgram(std::string_view source, const CompileOptions& options,
+                       CompileStats* stats, ModuleResolver* modules) {
+    if (stats) {
+        // The parser pulls its tokens from the lexer as it goes, so "parse" includes lexing
+        // again. Only tokenizing on its own tells how long lexing takes.
+        stats->tokens = timePhase(stats, "lex", [&] { return Lexer::tokenize(source).size(); });
+    }
+    Parser parser{Lexer{source}};
+    auto program = timePhase(stats, "parse", [&] { return parser.parse(); });
+    TypeChecker typechecker(modules);
+    auto cacheBefore = subtypeCacheCounters();
+    timePhase(stats, "typecheck", [&] { typechecker.typeCheck(program); });
+    if (stats) {
+        auto cacheAfter = subtypeCacheCounters();
+        stats->subtypeCacheHits = cacheAfter.hits - cacheBefore.hits;
+        stats->subtypeCacheMisses = cacheAfter.misses - cacheBefore.misses;
+    }
+    if (options.inlineFunctions) {
+        Inliner inliner;
+        timePhase(stats, "inline", [&] { inliner.inlineCalls(program); });
+    }
+    if (options.optimize) {
+        Optimizer optimizer;
+        timePhase(stats, "optimize", [&] { optimizer.optimize(program); });
+    }
+    if (options.eliminate) {
+        Eliminator eliminator;
+        timePhase(stats, "eliminate", [&] { eliminator.eliminate(program); });
+    }
+    if (options.localize) {
+        Localizer localizer;
+        timePhase(stats, "localize", [&] { localizer.localize(program); });
+    }
+    return program;
+}
+
+/// Lua source, or a precompiled chunk named `chunkName` with `bytecode`.
+void generateLua(Program& program, OutputSink& sink, const CompileOptions& options,
+                 CompileStats* stats, std::string_view chunkName) {
+    LuaCodegen codegen(options.checked);
+    if (options.bytecode) {
+        LuaBytecode bytecode;
+        timePhase(stats, "codegen", [&] { bytecode.generate(program, sink, chunkName); });
+    } else {
+        timePhase(stats, "codegen", [&] { codegen.generate(program, sink); });
+    }
+    if (stats) {
+        stats->nodes = program.arena.size();
+        stats->types = TypeFactory::instance().size();
+        stats->symbols = SymbolTable::instance().size();
+        stats->files = 1;
+        stats->peakRssKiB = peakRssKiB();
+    }
+    // Chunks keep the source lines of their instructions, they need no map
+    if (options.sourceMap && !options.bytecode && !codegen.getSourceMap().empty()) {
+        sink.write('\n');
+        sink.write(SourceMap::COMMENT_PREFIX);
+        sink.write(codegen.getSourceMap().encode());
+    }
+}
+
+/// A resolver for `options.modulePath`, null without one.
+std::unique_ptr<ModuleResolver> makeResolver(const CompileOptions& options) {
+    if (options.modulePath.empty()) {
+        return nullptr;
+    }
+    return std::make_unique<ModuleResolver>(options.modulePath);
+}
+
+CompiledUnit compileUnitWith(std::string_view source, const CompileOptions& options,
+                             ModuleResolver* modules, std::string_view chunkName) {
+    CompiledUnit unit;
+    CompileStats* stats = options.collectStats ? &unit.stats : nullptr;
+    auto program = checkedProgram(source, options, stats, modules);
+
+    for (auto* stmt : program.statements) {
+        if (auto* funDecl = nodeCast<FunDecl>(stmt); funDecl && !funDecl->local) {
+            unit.exports.push_back({funDecl->name.str(), funDecl->type->toString()});
+        }
+    }
+    StringSink sink;
+    generateLua(program, sink, options, stats, chunkName);
+    unit.lua = sink.str();
+    return unit;
+}
+
+/// compileSource, also serializing the program into `ast` if it isn't null.
+CompileStats compileToSink(std::string_view source, OutputSink& sink,
+                           const CompileOptions& options, ModuleResolver* modules,
+                           std::string* ast, std::string_view chunkName) {
+    CompileStats stats;
+    CompileStats* collected = options.collectStats ? &stats : nullptr;
+    auto program = checkedProgram(source, options, collected, modules);
+    if (ast) {
+        *ast = writeBinaryAst(program);
+    }
+    generateLua(program, sink, options, collected, chunkName);
+    return stats;
+}
+} // namespace
+
+CompiledUnit compileUnit(std::string_view source, const CompileOptions& options) {
+    return compileUnitWith(source, options, makeResolver(options).get(), ANONYMOUS_CHUNK);
+}
+
+CompiledUnit compileUnit(std::string_view source, const CompileOptions& options,
+                         ModuleResolver* modules, std::string_view chunkName) {
+    return compileUnitWith(source, options, modules, chunkName);
+}
+
+CompileStats compileSource(std::string_view source, OutputSink& sink,
+                           const CompileOptions& options) {
+    return compileToSink(source, sink, options, makeResolver(options).get(), nullptr,
+                         ANONYMOUS_CHUNK);
+}
+
+std::string compileSource(std::string_view source, const CompileOptions& options) {
+    StringSink sink;
+    compileSource(source, sink, options);
+    return sink.str();
+}
+
+std::string cacheFlags(const CompileOptions& options) {
+    std::string flags;
+    if (options.optimize) {
+        flags += " optimize";
+    }
+    if (options.inlineFunctions) {
+        flags += " inline";
+    }
+    if (options.eliminate) {
+        flags += " eliminate";
+    }
+    if (options.localize) {
+        flags += " localize";
+    }
+    if (options.sourceMap) {
+        flags += " source-map";
+    }
+    if (options.checked) {
+        flags += " checked";
+    }
+    if (options.bytecode) {
+        flags += " bytecode";
+    }
+    return flags;
+}
+
+std::string dependencyFlags(const std::vector<std::string>& required, ModuleResolver* modules) {
+    std::string flags;
+    if (modules == nullptr) {
+        return flags;
+    }
+    for (const auto& name : required) {
+        try {
+            if (const auto* summary = modules->summary(name)) {
+                flags += std::format(" require {} {{{}}}", name, summary->toString());
+            }
+        } catch (const std::exception&) {
+            // Reported by the type checker, the file doesn't compile
+        }
+    }
+    return flags;
+}
+
+namespace {
+void collectInput(const std::string& arg, std::vector<CompileInput>& inputs);
+
+void collectManifest(const fs::path& manifest, std::vector<CompileInput>& inputs) {
+    std::ifstream file(manifest);
+    if (!file) {
+        throw std::runtime_error(std::format("Could not open manifest: {}", manifest.string()));
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        auto first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        auto last = line.find_last_not_of(" \t\r");
+        // Entries are relative to the manifest itself
+        fs::path entry = line.substr(first, last - first + 1);
+        collectInput((manifest.parent_path() / entry).string(), inputs);
+    }
+}
+
+void collectInput(const std::string& arg, std::vector<CompileInput>& inputs) {
+    if (arg.starts_with("@")) {
+        collectManifest(arg.substr(1), inputs);
+        return;
+    }
+
+    fs::path path = arg;
+    if (fs::is_directory(path)) {
+        std::vector<fs::path> found;
+        for (auto&& entry : fs::recursive_directory_iterator(path)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".tlua") {
+                found.push_back(entry.path());
+            }
+        }
+        std::ranges::sort(found);
+        for (auto&& source : found) {
+            inputs.push_back({source, source.lexically_relative(path)});
+        }
+    } else if (fs::exists(path)) {
+        inputs.push_back({path, path.filename()});
+    } else {
+        throw std::runtime_error(std::format("No such file or directory: {}", arg));
+    }
+}
+} // namespace
+
+std::vector<CompileInput> collectInputs(const std::vector<std::string>& args) {
+    std::vector<CompileInput> inputs;
+    for (auto&& arg : args) {
+        collectInput(arg, inputs);
+    }
+    return inputs;
+}
+
+fs::path outputPath(const CompileInput& input, const CompileOptions& options) {
+    fs::path output = options.outDir ? *options.outDir / input.relative : input.source;
+    output.replace_extension(options.bytecode ? ".luac" : ".lua");
+    if (fs::weakly_canonical(output) == fs::weakly_canonical(input.source)) {
+        throw std::runtime_error(
+            std::format("Output would overwrite input: {}", input.source.string()));
+    }
+    return output;
+}
+
+fs::path astPath(const fs::path& output) {
+    fs::path path = output;
+    path.replace_extension(".tast");
+    return path;
+}
+
+namespace {
+std::optional<std::string> readFile(const fs::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return std::nullopt;
+    }
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+/// A file next to `path` to write before renaming it into place, one per thread of each
+/// process, so concurrent builds writing the same output don't share it.
+fs::path temporaryPath(const fs::path& path) {
+    auto tmp = path;
+    tmp += std::format(".tmp{}.{}", ::getpid(),
+                       std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    return tmp;
+}
+
+/// Leaves an up to date output untouched, so its timestamp only changes with its content.
+/// Otherwise it is replaced at once, readers never see a partly written file.
+void writeOutput(const fs::path& path, const std::string& content) {
+    if (readFile(path) == content) {
+        return;
+    }
+    if (path.has_parent_path()) {
+        fs::create_directories(path.parent_path());
+    }
+    auto tmp = temporaryPath(path);
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out << content;
+        if (!out) {
+            fs::remove(tmp);
+            throw std::runtime_error(std::format("Could not write file: {}", path.string()));
+        }
+    }
+    fs::rename(tmp, path);
+}
+
+/// Streams the Lua for `source` into a temporary file next to `path`, then renames it into
+/// place. The output never has to fit in memory, and a failed compilation leaves no file.
+/// With `emitAst` the binary AST is written the same way, after the Lua.
+CompileStats streamOutput(const fs::path& path, std::string_view source,
+                          const CompileOptions& options, ModuleResolver* modules,
+                          std::string_view chunkName) {
+    if (path.has_parent_path()) {
+        fs::create_directories(path.parent_path());
+    }
+    auto tmp = temporaryPath(path);
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error(std::format("Could not write file: {}", tmp.string()));
+    }
+    CompileStats stats;
+    std::string ast;
+    try {
+        FdSink sink(fd);
+        stats = compileToSink(source, sink, options, modules, options.emitAst ? &ast : nullptr,
+                              chunkName);
+        if (!options.bytecode) {
+            sink.write('\n');
+        }
+        sink.flush();
+    } catch (...) {
+        ::close(fd);
+        fs::remove(tmp);
+        throw;
+    }
+    ::close(fd);
+    fs::rename(tmp, path);
+    if (options.emitAst) {
+        writeOutput(astPath(path), ast);
+    }
+    return stats;
+}
+
+CompileResult compileFile(const CompileInput& input, const CompileOptions& options,
+                          const std::optional<BuildCache>& cache, ModuleResolver* modules) {
+    CompileResult result;
+    result.input = input.source;
+    try {
+        result.output = outputPath(input, options);
+        // Lexemes point into the mapping, so it is kept open until the pipeline is done
+        MappedFile source(input.source.string());
+        // What Lua calls the chunk in messages and tracebacks
+        auto chunkName = "@" + input.source.string();
+
+        if (!cache || options.emitAst) {
+            result.stats =
+                streamOutput(result.output, source.view(), options, modules, chunkName);
+            result.exportsChanged = true;
+            return result;
+        }
+
+        auto key = BuildCache::key(source.view(),
+                                   cacheFlags(options) +
+                                       dependencyFlags(scanRequires(source.view()), modules) +
+                                       (options.bytecode ? " chunk " + chunkName : ""));
+        auto lastKey = cache->lastKey(input.source);
+        std::optional<CacheEntry> entry = cache->lookup(key);
+        result.cached = entry.has_value();
+        if (!entry) {
+            auto unit = compileUnitWith(source.view(), options, modules, chunkName);
+            result.stats = std::move(unit.stats);
+            entry = CacheEntry{std::move(unit.lua), std::move(unit.exports)};
+            cache->store(key, *entry);
+        }
+        if (lastKey != key) {
+            auto previous = lastKey ? cache->lookup(*lastKey) : std::nullopt;
+            result.exportsChanged = !previous || previous->exports != entry->exports;
+            cache->setLastKey(input.source, key);
+        }
+        writeOutput(result.output, options.bytecode ? entry->lua : entry->lua + "\n");
+    } catch (const std::exception& e) {
+        result.error = e.what();
+    }
+    return result;
+}
+} // namespace
+
+std::vector<CompileResult> compileFiles(const std::vector<CompileInput>& inputs,
+                                        const CompileOptions& options) {
+    return compileFiles(inputs, options, makeResolver(options).get());
+}
+
+std::vector<CompileResult> compileFiles(const std::vector<CompileInput>& inputs,
+                                        const CompileOptions& options, ModuleResolver* modules) {
+    std::vector<CompileResult> results(inputs.size());
+    std::optional<BuildCache> cache;
+    if (options.cacheDir) {
+        cache.emplace(*options.cacheDir);
+    }
+    unsigned jobs = options.jobs != 0 ? options.jobs : std::thread::hardware_concurrency();
+    jobs = std::clamp<unsigned>(jobs, 1, std::max<size_t>(inputs.size(), 1));
+
+    // Workers pull the next file from a shared counter, so long files don't hold up a queue
+    std::atomic<size_t> next = 0;
+    auto worker = [&] {
+        for (size_t i = next++; i < inputs.size(); i = next++) {
+            results[i] = compileFile(inputs[i], options, cache, modules);
+        }
+    };
+
+    {
+        std::vector<std::jthread> pool;
+        for (unsigned i = 1; i < jobs; ++i) {
+            pool.emplace_back(worker);
+        }
+        worker();
+    } // joins the pool
+    return results;
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "build_cache.h"
+#include "compile_stats.h"
+#include "output_sink.h"
+
+class ModuleResolver;
+
+struct CompileOptions {
+    // Number of worker threads, 0 uses one per hardware thread
+    unsigned jobs = 0;
+    // Outputs are written next to their inputs when not set
+    std::optional<std::filesystem::path> outDir;
+    // Reuse the results of unchanged files from this build cache directory
+    std::optional<std::filesystem::path> cacheDir;
+    // Run the Optimizer between type checking and code generation
+    bool optimize = true;
+    // Inline calls to small local functions (before optimizing)
+    bool inlineFunctions = false;
+    // Remove unused locals and unreachable statements (after optimizing), see Eliminator
+    bool eliminate = false;
+    // Cache library globals and repeated member access chains in locals (after optimizing)
+    bool localize = false;
+    // End the Lua with a comment mapping its lines back to the source, see SourceMap
+    bool sourceMap = false;
+    // Time the phases and count what they produce and allocate, see CompileStats
+    bool collectStats = false;
+    // Also write the program the Lua is generated from next to each output file, as a `.tast`
+    // in the format of BinaryAst. Files are always compiled, the build cache only holds Lua.
+    bool emitAst = false;
+    // Check at runtime what the types can't promise where untyped values are used, see
+    // LuaCodegen. Lua source only.
+    bool checked = false;
+    // Emit Lua 5.4 precompiled chunks (`.luac`) instead of Lua source, see LuaBytecode
+    bool bytecode = false;
+    // Directories `require("a.b")` looks for `a/b.tlua` in, the global functions of the modules
+    // found are known with their types. Required modules are untyped when empty.
+    std::vector<std::filesystem::path> modulePath;
+};
+
+struct CompiledUnit {
+    std::string lua;
+    // Top-level global functions, in declaration order
+    std::vector<ExportedSymbol> exports;
+    // Empty unless `collectStats`
+    CompileStats stats;
+};
+
+/// Runs the whole pipeline (lex, parse, type check, optimize, Lua codegen) on one source text.
+/// Throws ParseError or TypeCheckError on invalid input.
+CompiledUnit compileUnit(std::string_view source, const CompileOptions& options = {});
+
+/// Same as `compileUnit` with the summaries of `modules` (none if null) for the modules the
+/// source requires. `chunkName` is what Lua calls the chunk in messages and tracebacks.
+CompiledUnit compileUnit(std::string_view source, const CompileOptions& options,
+                         ModuleResolver* modules, std::string_view chunkName);
+
+/// The options that change the generated code, part of the cache key.
+std::string cacheFlags(const CompileOptions& options);
+
+/// The summaries of the `required` modules, part of the cache key: a file has to be checked
+/// again when the signatures it uses change. Empty without `modules`.
+std::string dependencyFlags(const std::vector<std::string>& required, ModuleResolver* modules);
+
+/// Same as `compileUnit`, streaming the generated Lua into `sink` (without a final newline).
+/// Returns the stats of the compilation, empty unless `collectStats`.
+CompileStats compileSource(std::string_view source, OutputSink& sink,
+                           const CompileOptions& options = {});
+
+/// Same as `compileUnit`, only returning the generated Lua.
+std::string compileSource(std::string_view source, const CompileOptions& options = {});
+
+/// One file to compile. `relative` is the path the output gets below the output directory,
+/// inputs found by walking a directory keep their place in the tree.
+struct CompileInput {
+    std::filesystem::path source;
+    std::filesystem::path relative;
+};
+
+struct CompileResult {
+    std::filesystem::path input;
+    std::filesystem::path output;
+    // Empty on success
+    std::string error;
+    // Taken from the build cache without compiling
+    bool cached = false;
+    // The exported signatures differ from the previous build of this file (or there was none),
+    // files depending on it have to be checked again
+    bool exportsChanged = false;
+    // Empty unless `collectStats` and the file was compiled
+    CompileStats stats;
+
+    bool ok() const { return error.empty(); }
+};
+
+/// Expands command line inputs: plain files are taken as is, directories are searched
+/// recursively for `.tlua` files (in sorted order), and `@file` reads one input per line
+/// from a manifest. Throws std::runtime_error for inputs that don't exist.
+std::vector<CompileInput> collectInputs(const std::vector<std::string>& args);
+
+/// Where the Lua output of `input` goes: its extension is replaced by `.lua`, or `.luac` with
+/// `bytecode`.
+/// Throws std::runtime_error if that would overwrite the input.
+std::filesystem::path outputPath(const CompileInput& input, const CompileOptions& options);
+
+/// Where the binary AST of `output` goes with `emitAst`: `.lua` is replaced by `.tast`.
+std::filesystem::path astPath(const std::filesystem::path& output);
+
+/// Compiles every input on a pool of `options.jobs` threads, one pipeline per file, and
+/// writes each output file, renamed into place once complete. Results are in the order of
+/// `inputs`.
+/// Module summaries only depend on the headers of the modules, so files never wait for the
+/// files they require: all of them are checked in parallel, sharing one ModuleResolver. The
+/// cache key of a file includes the summaries of the modules it requires.
+std::vector<CompileResult> compileFiles(const std::vector<CompileInput>& inputs,
+                                        const CompileOptions& options);
+
+/// Same as `compileFiles` with a resolver for `options.modulePath` (null without one) that
+/// outlives the build, so builds of the same tree share the module summaries.
+std::vector<CompileResult> compileFiles(const std::vector<CompileInput>& inputs,
+                                        const CompileOptions& options, ModuleResolver* modules);
@@ -0,0 +1,151 @@
+#include "eliminator.h"
+#include "ast_walk.h"
+
+#include <algorithm>
+#include <ranges>
+
+namespace {
+bool isNumber(const Expr* expr) {
+    auto kind = expr->type ? expr->type->getKind() : TypeKind::Any;
+    return kind == TypeKind::Number || kind == TypeKind::Integer;
+}
+
+bool isString(const Expr* expr) {
+    return expr->type && expr->type->getKind() == TypeKind::String;
+}
+
+bool isPrimitive(const Expr* expr) {
+    return expr->type && expr->type->getKind() <= TypeKind::Nil;
+}
+
+/// Whether evaluating `expr` can't do anything but produce its value: no calls, no
+/// metamethods and no errors. Operators only qualify on operands whose static type has no
+/// metamethods, and `//` not at all (an integer division by zero raises an error).
+bool hasNoEffects(const Expr* expr) {
+    if (nodeCast<NumberExpr>(expr) || nodeCast<StringExpr>(expr) || nodeCast<BooleanExpr>(expr) ||
+        nodeCast<NilExpr>(expr) || nodeCast<VarExpr>(expr)) {
+        return true;
+    }
+    if (auto* table = nodeCast<TableExpr>(expr)) {
+        return std::ranges::all_of(table->arrayPart, hasNoEffects) &&
+               std::ranges::all_of(table->mapPart,
+                                   [](auto&& field) { return hasNoEffects(field.second); });
+    }
+    if (auto* unary = nodeCast<UnaryOpExpr>(expr)) {
+        bool operand = unary->op == TokenKind::Not ||
+                       (unary->op == TokenKind::Minus && isNumber(unary->right));
+        return operand && hasNoEffects(unary->right);
+    }
+    auto* binOp = nodeCast<BinOpExpr>(expr);
+    if (!binOp) {
+        return false;
+    }
+    const Expr* left = binOp->left;
+    const Expr* right = binOp->right;
+    bool operands;
+    switch (binOp->op) {
+    case TokenKind::And:
+    case TokenKind::Or:
+        operands = true;
+        break;
+    case TokenKind::Plus:
+    case TokenKind::Minus:
+    case TokenKind::Star:
+    case TokenKind::Slash:
+        operands = isNumber(left) && isNumber(right);
+        break;
+    case TokenKind::Equal:
+    case TokenKind::NotEqual:
+        operands = isPrimitive(left) && isPrimitive(right);
+        break;
+    case TokenKind::Less:
+    case TokenKind::Greater:
+    case TokenKind::LessEqual:
+    case TokenKind::GreaterEqual:
+        operands = (isNumber(left) && isNumber(right)) || (isString(left) && isString(right));
+        break;
+    case TokenKind::Concat:
+        operands = (isNumber(left) || isString(left)) && (isNumber(right) || isString(right));
+        break;
+    default:
+        operands = false;
+    }
+    return operands && hasNoEffects(left) && hasNoEffects(right);
+}
+
+/// References to `decl` from the body of the function it declares. A recursive function that
+/// only calls itself is still unused.
+uint32_t selfReferences(Decl* decl) {
+    auto* fun = nodeCast<FunDecl>(decl);
+    uint32_t references = 0;
+    if (fun) {
+        forEachNode(fun->body, [&](Expr* expr) {
+            auto* var = nodeCast<VarExpr>(expr);
+            references += var && var->binding == decl ? 1 : 0;
+        });
+    }
+    return references;
+}
+} // namespace
+
+void Eliminator::eliminate(Program& program) {
+    arena = &program.arena;
+    eliminateBlock(program.statements);
+    arena = nullptr;
+}
+
+void Eliminator::eliminateBlock(std::vector<Stmt*>& statements) {
+    auto ret = std::ranges::find_if(statements,
+                                    [](Stmt* stmt) { return nodeCast<ReturnStmt>(stmt); });
+    if (ret != statements.end() && ++ret != statements.end()) {
+        std::for_each(ret, statements.end(), releaseReferences<Stmt>);
+        removed += statements.end() - ret;
+        statements.erase(ret, statements.end());
+    }
+    // Nested blocks first, what they remove may leave declarations of this block unused
+    for (auto* stmt : statements) {
+        eliminateNested(stmt);
+    }
+
+    // Backwards, so a declaration only used by later ones that are removed is removed too
+    std::vector<Stmt*> kept;
+    kept.reserve(statements.size());
+    for (auto* stmt : statements | std::views::reverse) {
+        auto* decl = nodeCast<Decl>(stmt);
+        if (!decl || !decl->local || decl->uses > selfReferences(decl)) {
+            kept.push_back(stmt);
+            continue;
+        }
+        auto* var = nodeCast<VarDecl>(stmt);
+        auto* call = var ? nodeCast<FunCallExpr>(var->initExpr) : nullptr;
+        if (call) {
+            // The call still has to run, only the local goes
+            auto* callStmt = arena->make<FunCallStmt>(call);
+            callStmt->loc = stmt->loc;
+            kept.push_back(callStmt);
+        } else if (var && !hasNoEffects(var->initExpr)) {
+            kept.push_back(stmt);
+            continue;
+        } else {
+            releaseReferences(stmt);
+        }
+        ++removed;
+    }
+    std::ranges::reverse(kept);
+    statements = std::move(kept);
+}
+
+void Eliminator::eliminateNested(Stmt* stmt) {
+    if (auto* fun = nodeCast<FunDecl>(stmt)) {
+        eliminateNested(fun->body);
+    } else if (auto* ifStmt = nodeCast<IfStmt>(stmt)) {
+        for (auto& arm : ifStmt->arms) {
+            eliminateNested(arm.body);
+        }
+        if (ifStmt->else_branch) {
+            eliminateNested(ifStmt->else_branch);
+        }
+    } else if (auto* block = nodeCast<BlockStmt>(stmt)) {
+        eliminateBlock(block->statements);
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "ast.h"
+
+#include <cstddef>
+#include <vector>
+
+/// Removes code that doesn't change what a type checked program does, using the use counts
+/// the type checker recorded on each declaration:
+/// - local functions that are never referenced,
+/// - locals that are never referenced whose value has no effects; an unused local initialized
+///   by a call is left as the call,
+/// - statements after a `return`, which can never run.
+/// Removing a declaration drops the references it made, so a local only used by removed code
+/// goes as well. Globals are kept, other chunks may use them.
+class Eliminator {
+  public:
+    void eliminate(Program& program);
+
+    /// Declarations and statements removed so far.
+    size_t removedCount() const { return removed; }
+
+  private:
+    AstArena* arena = nullptr;
+    size_t removed = 0;
+
+    void eliminateBlock(std::vector<Stmt*>& statements);
+    /// Eliminates in the blocks below `stmt`.
+    void eliminateNested(Stmt* stmt);
+};
@@ -1,28 +1,51 @@
 #include "environment.h"
 
-void Environment::pushScope() { scopes.emplace_back(); }
+void Environment::pushScope() { scopeMarks.push_back(bindings.size()); }
 
 void Environment::popScope() {
-    if (!scopes.empty()) {
-        scopes.pop_back();
+    if (scopeMarks.empty()) {
+        return;
+    }
+    size_t mark = scopeMarks.back();
+    scopeMarks.pop_back();
+    while (bindings.size() > mark) {
+        auto& binding = bindings.back();
+        current[binding.name.id] = binding.shadowed;
+        bindings.pop_back();
     }
 }
 
-void Environment::define(const std::string& name, Type* type) {
-    if (scopes.empty()) {
+void Environment::define(Symbol name, Type* type, Decl* decl) {
+    if (scopeMarks.empty()) {
         // Implicitly create global scope if needed
         pushScope();
     }
-    scopes.back()[name] = type;
+    if (name.id >= current.size()) {
+        current.resize(name.id + 1, NO_BINDING);
+    }
+
+    auto depth = static_cast<uint32_t>(scopeMarks.size());
+    uint32_t& innermost = current[name.id];
+    if (innermost != NO_BINDING && bindings[innermost].depth == depth) {
+        // Redefinition in the same scope replaces the binding
+        bindings[innermost].type = type;
+        bindings[innermost].decl = decl;
+        return;
+    }
+    bindings.push_back(Binding{name, type, decl, innermost, depth});
+    innermost = static_cast<uint32_t>(bindings.size() - 1);
+}
+
+Type* Environment::lookup(Symbol name) const {
+    if (name.id >= current.size() || current[name.id] == NO_BINDING) {
+        return nullptr;
+    }
+    return bindings[current[name.id]].type;
 }
 
-Type* Environment::lookup(const std::string& name) const {
-    // Search from innermost to outermost scope
-    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-        auto found = it->find(name);
-        if (found != it->end()) {
-            return found->second;
-        }
+Decl* Environment::declaration(Symbol name) const {
+    if (name.id >= current.size() || current[name.id] == NO_BINDING) {
+        return nullptr;
     }
-    return nullptr;
+    return bindings[current[name.id]].decl;
 }
@@ -1,9 +1,14 @@
 #pragma once
+#include "symbol.h"
 #include "type.h"
-#include <map>
-#include <string>
+#include <cstdint>
 #include <vector>
 
+struct Decl;
+
+/// Shadow-stack environment: all bindings live in one flat stack, and every symbol
+/// knows the index of its innermost binding. Defining is an append, lookup is one
+/// indexed load, and popping a scope truncates the stack back to the mark of that scope.
 class Environment {
   public:
     Environment() = default;
@@ -14,15 +19,33 @@ class Environment {
     // Exit the current scope
     void popScope();
 
-    // Bind a variable name to a type
-    void define(const std::string& name, Type* type);
+    // Bind a variable name to a type, declared by `decl` (null for parameters)
+    void define(Symbol name, Type* type, Decl* decl = nullptr);
 
-    // Look up a variable's type (searches from innermost to outermost scope)
+    // Look up a variable's type (the innermost binding wins)
     // Returns nullptr if not found
-    Type* lookup(const std::string& name) const;
+    Type* lookup(Symbol name) const;
+
+    // The declaration of the innermost binding of a variable, nullptr if it has none
+    Decl* declaration(Symbol name) const;
 
   private:
-    // Stack of scopes, each scope is a map from name -> type
-    // scopes[0] is global, scopes[scopes.size()-1] is current
-    std::vector<std::map<std::string, Type*>> scopes;
+    static constexpr uint32_t NO_BINDING = UINT32_MAX;
+
+    struct Binding {
+        Symbol name;
+        Type* type;
+        Decl* decl;
+        // Binding of the same name this one shadows, restored when it goes out of scope
+        uint32_t shadowed;
+        // Depth of the scope the binding belongs to
+        uint32_t depth;
+    };
+
+    std::vector<Binding> bindings;
+    // Indexed by symbol id: innermost binding of that symbol, or NO_BINDING
+    std::vector<uint32_t> current;
+    // Size of `bindings` when each open scope was entered
+    // scopeMarks[0] is global, scopeMarks.back() is current
+    std::vector<size_t> scopeMarks;
 };
@@ -0,0 +1,136 @@
+#include "file_watcher.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+// Editors write in place, write a new file and move it over the old one, or delete and recreate
+constexpr uint32_t FILE_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+constexpr uint32_t DIRECTORY_EVENTS = IN_CREATE;
+
+bool isSource(const fs::path& path) { return path.extension() == ".tlua"; }
+
+std::runtime_error inotifyError(std::string_view what) {
+    return std::runtime_error(std::format("Could not {}: {}", what, std::strerror(errno)));
+}
+} // namespace
+
+FileWatcher::FileWatcher(const std::vector<fs::path>& roots) {
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        throw inotifyError("set up inotify");
+    }
+    try {
+        for (const auto& root : roots) {
+            watchTree(fs::absolute(root).lexically_normal(), nullptr);
+        }
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+FileWatcher::~FileWatcher() { ::close(fd); }
+
+void FileWatcher::watchTree(const fs::path& directory, std::vector<fs::path>* changed) {
+    int wd = inotify_add_watch(fd, directory.c_str(), FILE_EVENTS | DIRECTORY_EVENTS | IN_ONLYDIR);
+    if (wd < 0) {
+        // A directory created while watching may already be gone again
+        if (changed) {
+            return;
+        }
+        throw inotifyError(std::format("watch {}", directory.string()));
+    }
+    directories[wd] = directory;
+    std::error_code error;
+    for (auto&& entry : fs::directory_iterator(directory, error)) {
+        if (entry.is_directory()) {
+            watchTree(entry.path(), changed);
+        } else if (changed && isSource(entry.path())) {
+            changed->push_back(entry.path());
+        }
+    }
+}
+
+bool FileWatcher::readEvents(std::chrono::milliseconds timeout, std::vector<fs::path>& changed) {
+    pollfd events{fd, POLLIN, 0};
+    int ready = ::poll(&events, 1, static_cast<int>(timeout.count()));
+    if (ready < 0 && errno != EINTR) {
+        throw inotifyError("wait for file changes");
+    }
+    if (ready <= 0) {
+        return false;
+    }
+
+    alignas(inotify_event) std::array<char, 64 * 1024> buffer;
+    for (;;) {
+        ssize_t size = ::read(fd, buffer.data(), buffer.size());
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size <= 0) {
+            // EAGAIN: all read
+            return true;
+        }
+        for (ssize_t offset = 0; offset < size;) {
+            auto* event = reinterpret_cast<const inotify_event*>(buffer.data() + offset);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Changes were lost, any file may have changed
+                for (const auto& [wd, directory] : directories) {
+                    std::error_code error;
+                    for (auto&& entry : fs::directory_iterator(directory, error)) {
+                        if (entry.is_regular_file() && isSource(entry.path())) {
+                            changed.push_back(entry.path());
+                        }
+                    }
+                }
+                continue;
+            }
+            auto directory = directories.find(event->wd);
+            if (directory == directories.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // The directory was removed
+                directories.erase(directory);
+                continue;
+            }
+            if (event->len == 0) {
+                continue;
+            }
+            auto path = directory->second / event->name;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    watchTree(path, &changed);
+                }
+            } else if (isSource(path)) {
+                changed.push_back(path);
+            }
+        }
+    }
+}
+
+std::vector<fs::path> FileWatcher::waitForChanges(std::chrono::milliseconds timeout,
+                                                  std::chrono::milliseconds quiet) {
+    std::vector<fs::path> changed;
+    if (readEvents(timeout, changed)) {
+        while (readEvents(quiet, changed)) {
+        }
+    }
+    std::ranges::sort(changed);
+    auto [first, last] = std::ranges::unique(changed);
+    changed.erase(first, last);
+    return changed;
+}
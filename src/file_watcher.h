@@ -0,0 +1,36 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+/// Reports the `.tlua` files written, created, moved or removed below a set of directories,
+/// with inotify. Directories created later are watched as well.
+class FileWatcher {
+  public:
+    /// Throws std::runtime_error if inotify can't be set up.
+    explicit FileWatcher(const std::vector<std::filesystem::path>& directories);
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    /// Waits up to `timeout` for a change, then for more until none came for `quiet`, so a
+    /// burst of saves is reported at once. Returns the absolute paths of the files changed,
+    /// sorted and without duplicates, empty on timeout. When the kernel dropped events every
+    /// file watched is reported.
+    std::vector<std::filesystem::path> waitForChanges(std::chrono::milliseconds timeout,
+                                                      std::chrono::milliseconds quiet);
+
+  private:
+    /// Watches `directory` and the directories below it, reporting the files found in
+    /// `changed`, they may have been written before the watch was in place.
+    void watchTree(const std::filesystem::path& directory,
+                   std::vector<std::filesystem::path>* changed);
+    /// Reads the events that arrived, false if there were none within `timeout`.
+    bool readEvents(std::chrono::milliseconds timeout, std::vector<std::filesystem::path>& changed);
+
+    int fd = -1;
+    // Watched directory of each watch descriptor
+    std::unordered_map<int, std::filesystem::path> directories;
+};
@@ -0,0 +1,219 @@
+#include "incremental_build.h"
+
+#include <algorithm>
+#include <format>
+#include <set>
+
+#include "build_cache.h"
+#include "file_watcher.h"
+#include "mapped_file.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+// Time FileWatcher waits for a change at once, the watch loop goes on after it
+constexpr std::chrono::milliseconds WAIT_TIMEOUT{60'000};
+
+fs::path normalize(const fs::path& path) { return fs::absolute(path).lexically_normal(); }
+
+bool isBelow(const fs::path& path, const fs::path& directory) {
+    auto relative = path.lexically_relative(directory);
+    return !relative.empty() && *relative.begin() != "..";
+}
+
+/// A module summary as compared between builds, empty for modules that don't exist.
+std::string describe(const ModuleSummary* summary) {
+    return summary ? std::format("{} {{{}}}", summary->path.string(), summary->toString()) : "";
+}
+
+void report(std::ostream& log, const std::vector<CompileResult>& results,
+            std::chrono::steady_clock::duration elapsed) {
+    size_t failures = 0;
+    for (const auto& result : results) {
+        if (!result.ok()) {
+            log << result.input.string() << ": " << result.error << "\n";
+            ++failures;
+        }
+    }
+    auto ms = std::chrono::duration<double, std::milli>(elapsed).count();
+    log << std::format("Compiled {} file{} in {:.1f} ms", results.size(),
+                       results.size() == 1 ? "" : "s", ms);
+    if (failures > 0) {
+        log << std::format(", {} failed", failures);
+    }
+    log << std::endl;
+}
+} // namespace
+
+IncrementalBuild::IncrementalBuild(const std::vector<std::string>& args, CompileOptions options)
+    : options(std::move(options)) {
+    if (!this->options.modulePath.empty()) {
+        modules = std::make_unique<ModuleResolver>(this->options.modulePath);
+    }
+    for (const auto& arg : args) {
+        if (!arg.starts_with("@") && fs::is_directory(arg)) {
+            roots.push_back(normalize(arg));
+        }
+    }
+    for (auto&& input : collectInputs(args)) {
+        auto path = normalize(input.source);
+        files.emplace(std::move(path), SourceFile{std::move(input), std::nullopt, {}});
+    }
+}
+
+std::vector<CompileResult> IncrementalBuild::buildAll() {
+    std::vector<fs::path> paths;
+    for (auto& [path, file] : files) {
+        refresh(file);
+        paths.push_back(path);
+    }
+    return compile(paths);
+}
+
+bool IncrementalBuild::refresh(SourceFile& file) {
+    MappedFile source(file.input.source.string());
+    auto key = BuildCache::key(source.view());
+    if (file.contentKey == key) {
+        return false;
+    }
+    file.contentKey = key;
+    try {
+        file.requiredModules = scanRequires(source.view());
+    } catch (const std::exception&) {
+        // Reported when the file is compiled
+        file.requiredModules.clear();
+    }
+    return true;
+}
+
+std::vector<CompileResult> IncrementalBuild::rebuild(const std::vector<fs::path>& changed) {
+    // Sources that read differently than before, appeared or are gone
+    std::vector<fs::path> modified;
+    std::set<fs::path> toCompile;
+    for (const auto& each : changed) {
+        auto path = normalize(each);
+        auto found = files.find(path);
+        if (!fs::is_regular_file(path)) {
+            if (found != files.end()) {
+                files.erase(found);
+            }
+            modified.push_back(path);
+            continue;
+        }
+        if (found == files.end()) {
+            auto root =
+                std::ranges::find_if(roots, [&](auto&& root) { return isBelow(path, root); });
+            if (root == roots.end()) {
+                // A module outside of the inputs, only the files requiring it are built
+                modified.push_back(path);
+                continue;
+            }
+            CompileInput input{path, path.lexically_relative(*root)};
+            found = files.emplace(path, SourceFile{std::move(input), std::nullopt, {}}).first;
+        }
+        try {
+            if (!refresh(found->second)) {
+                continue;
+            }
+        } catch (const std::exception&) {
+            // Removed again since the change was seen
+            files.erase(found);
+            modified.push_back(path);
+            continue;
+        }
+        modified.push_back(path);
+        toCompile.insert(path);
+    }
+
+    for (auto&& path : dependents(modified)) {
+        toCompile.insert(path);
+    }
+    return compile({toCompile.begin(), toCompile.end()});
+}
+
+std::vector<fs::path> IncrementalBuild::dependents(const std::vector<fs::path>& modified) {
+    std::vector<fs::path> result;
+    if (!modules || modified.empty()) {
+        return result;
+    }
+    std::set<std::string> required;
+    for (const auto& [path, file] : files) {
+        required.insert(file.requiredModules.begin(), file.requiredModules.end());
+    }
+
+    for (const auto& name : required) {
+        const auto* previous = modules->loaded(name);
+        auto location = modules->locate(name);
+        bool affected = std::ranges::any_of(modified, [&](auto&& path) {
+            return (previous && normalize(previous->path) == path) ||
+                   (location && normalize(*location) == path);
+        });
+        if (!affected) {
+            continue;
+        }
+        auto before = describe(previous);
+        modules->invalidate(name);
+        std::string after;
+        try {
+            after = describe(modules->summary(name));
+        } catch (const std::exception& e) {
+            after = std::format("error {}", e.what());
+        }
+        if (before == after) {
+            continue;
+        }
+        for (const auto& [path, file] : files) {
+            if (std::ranges::find(file.requiredModules, name) != file.requiredModules.end()) {
+                result.push_back(path);
+            }
+        }
+    }
+    return result;
+}
+
+std::vector<CompileResult> IncrementalBuild::compile(const std::vector<fs::path>& paths) {
+    std::vector<CompileInput> inputs;
+    inputs.reserve(paths.size());
+    for (const auto& path : paths) {
+        inputs.push_back(files.at(path).input);
+    }
+    return compileFiles(inputs, options, modules.get());
+}
+
+std::vector<fs::path> IncrementalBuild::watchedDirectories() const {
+    std::vector<fs::path> directories = roots;
+    for (const auto& [path, file] : files) {
+        if (std::ranges::none_of(roots, [&](auto&& root) { return isBelow(path, root); })) {
+            directories.push_back(path.parent_path());
+        }
+    }
+    for (const auto& directory : options.modulePath) {
+        if (fs::is_directory(directory)) {
+            directories.push_back(normalize(directory));
+        }
+    }
+    std::ranges::sort(directories);
+    auto [first, last] = std::ranges::unique(directories);
+    directories.erase(first, last);
+    return directories;
+}
+
+void IncrementalBuild::watch(std::ostream& log) {
+    // Watching before the first build, saves made during it aren't missed
+    FileWatcher watcher(watchedDirectories());
+    auto start = std::chrono::steady_clock::now();
+    auto results = buildAll();
+    report(log, results, std::chrono::steady_clock::now() - start);
+    for (;;) {
+        auto changed = watcher.waitForChanges(WAIT_TIMEOUT, QUIET_PERIOD);
+        if (changed.empty()) {
+            continue;
+        }
+        start = std::chrono::steady_clock::now();
+        results = rebuild(changed);
+        // Saves that didn't change anything aren't builds
+        if (!results.empty()) {
+            report(log, results, std::chrono::steady_clock::now() - start);
+        }
+    }
+}
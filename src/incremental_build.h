@@ -0,0 +1,68 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "driver.h"
+#include "module_resolver.h"
+
+/// A tree of sources kept built across edits, for `--watch`. Every input is compiled once,
+/// then `rebuild` only compiles the files whose content changed and the files requiring a
+/// module whose summary changed. Files only see the summaries of the modules they require
+/// (the headers of their global functions), so an edit reaches no further down the module
+/// graph than the files requiring the file edited, and only when it changes a header.
+/// The module summaries, the interned symbols and types and the subtype cache of the thread
+/// building stay warm from one build to the next.
+class IncrementalBuild {
+  public:
+    // How long a burst of saves is waited for before building
+    static constexpr std::chrono::milliseconds QUIET_PERIOD{10};
+
+    /// `args` are command line inputs as for `collectInputs`. New sources below the
+    /// directories among them are built as well. Throws std::runtime_error for inputs that
+    /// don't exist.
+    IncrementalBuild(const std::vector<std::string>& args, CompileOptions options);
+
+    /// Compiles every input.
+    std::vector<CompileResult> buildAll();
+
+    /// Compiles what changes to the sources `changed` affect: each of them that is an input
+    /// and reads differently than at its last build, and the files requiring a module whose
+    /// summary changed. Sources that are gone are forgotten, their outputs are left alone.
+    std::vector<CompileResult> rebuild(const std::vector<std::filesystem::path>& changed);
+
+    /// The directories to watch for changes: the input directories, those of the input
+    /// files, and the module path.
+    std::vector<std::filesystem::path> watchedDirectories() const;
+
+    /// Builds everything, then rebuilds after each burst of changes forever, reporting each
+    /// build to `log`. Throws std::runtime_error if the directories can't be watched.
+    [[noreturn]] void watch(std::ostream& log);
+
+  private:
+    struct SourceFile {
+        CompileInput input;
+        // Of the content at the last build
+        std::optional<uint64_t> contentKey;
+        std::vector<std::string> requiredModules;
+    };
+
+    /// Reads `file` again, false if its content didn't change since the last build.
+    bool refresh(SourceFile& file);
+    /// The files requiring a module whose summary differs after the changes of `modified`.
+    std::vector<std::filesystem::path>
+    dependents(const std::vector<std::filesystem::path>& modified);
+    std::vector<CompileResult> compile(const std::vector<std::filesystem::path>& paths);
+
+    CompileOptions options;
+    std::unique_ptr<ModuleResolver> modules;
+    std::vector<std::filesystem::path> roots;
+    // By absolute path
+    std::map<std::filesystem::path, SourceFile> files;
+};
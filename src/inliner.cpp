@@ -0,0 +1,504 @@
+#include "inliner.h"
+#include "ast_walk.h"
+
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+
+namespace {
+bool isLiteral(const Expr* expr) {
+    return nodeCast<NumberExpr>(expr) || nodeCast<StringExpr>(expr) ||
+           nodeCast<BooleanExpr>(expr) || nodeCast<NilExpr>(expr);
+}
+
+/// Whether evaluating `expr` can do more than read: calls run arbitrary code, and every
+/// evaluation of a table constructor creates a new table.
+bool hasEffects(Expr* expr) {
+    bool effects = false;
+    forEachNode(expr, [&](Expr* node) {
+        effects = effects || nodeCast<FunCallExpr>(node) || nodeCast<TableExpr>(node);
+    });
+    return effects;
+}
+
+Expr* clone(AstArena& arena, const Expr* expr, const std::unordered_map<Symbol, Expr*>& args);
+
+/// Copy of an operand, which isn't an operator.
+Expr* cloneOperand(AstArena& arena, const Expr* expr,
+                   const std::unordered_map<Symbol, Expr*>& args) {
+    auto cloneChild = [&](const Expr* child) { return clone(arena, child, args); };
+    Expr* copy;
+    if (auto* var = nodeCast<VarExpr>(expr)) {
+        if (auto found = args.find(var->name); found != args.end()) {
+            return clone(arena, found->second, {});
+        }
+        auto* copyVar = arena.make<VarExpr>(var->name);
+        copyVar->binding = var->binding;
+        if (copyVar->binding) {
+            ++copyVar->binding->uses;
+        }
+        copy = copyVar;
+    } else if (auto* number = nodeCast<NumberExpr>(expr)) {
+        copy = arena.make<NumberExpr>(*number);
+    } else if (auto* string = nodeCast<StringExpr>(expr)) {
+        copy = arena.make<StringExpr>(string->val);
+    } else if (auto* boolean = nodeCast<BooleanExpr>(expr)) {
+        copy = arena.make<BooleanExpr>(boolean->val);
+    } else if (nodeCast<NilExpr>(expr)) {
+        copy = arena.make<NilExpr>();
+    } else if (auto* table = nodeCast<TableExpr>(expr)) {
+        std::vector<Expr*> arrayPart;
+        for (auto* element : table->arrayPart) {
+            arrayPart.push_back(cloneChild(element));
+        }
+        std::vector<std::pair<Symbol, Expr*>> mapPart;
+        for (auto&& [key, value] : table->mapPart) {
+            mapPart.emplace_back(key, cloneChild(value));
+        }
+        copy = arena.make<TableExpr>(std::move(arrayPart), std::move(mapPart));
+    } else if (auto* index = nodeCast<IndexExpr>(expr)) {
+        copy = arena.make<IndexExpr>(cloneChild(index->object), cloneChild(index->index));
+    } else if (auto* call = nodeCast<FunCallExpr>(expr)) {
+        std::vector<Expr*> callArgs;
+        for (auto* arg : call->args) {
+            callArgs.push_back(cloneChild(arg));
+        }
+        copy = arena.make<FunCallExpr>(cloneChild(call->callee), std::move(callArgs));
+    } else {
+        throw std::logic_error("Unknown expression in inliner");
+    }
+    copy->type = expr->type;
+    return copy;
+}
+
+/// Deep copy of `expr` in `arena`, with the names in `args` replaced by copies of their value.
+/// Operator chains are copied operands first from an explicit stack, without recursing.
+Expr* clone(AstArena& arena, const Expr* expr, const std::unordered_map<Symbol, Expr*>& args) {
+    struct Pending {
+        const Expr* expr;
+        bool operandsDone;
+        // The field name of a member access is no variable and keeps its name
+        bool field;
+    };
+    static const std::unordered_map<Symbol, Expr*> NO_ARGS;
+    std::vector<Pending> stack{{expr, false, false}};
+    // Copies of the operands taken so far, the last ones belong to the operator on top
+    std::vector<Expr*> copies;
+    while (!stack.empty()) {
+        auto [node, operandsDone, field] = stack.back();
+        stack.pop_back();
+        if (!isOperator(node)) {
+            copies.push_back(cloneOperand(arena, node, field ? NO_ARGS : args));
+        } else if (!operandsDone) {
+            stack.push_back({node, true, false});
+            // Pushed in reverse, the left operand is copied first
+            if (auto* binOp = nodeCast<BinOpExpr>(node)) {
+                stack.push_back({binOp->right, false, binOp->op == TokenKind::MemberAccess});
+                stack.push_back({binOp->left, false, false});
+            } else {
+                stack.push_back({static_cast<const UnaryOpExpr*>(node)->right, false, false});
+            }
+        } else {
+            Expr* copy;
+            if (auto* binOp = nodeCast<BinOpExpr>(node)) {
+                auto* right = copies.back();
+                copies.pop_back();
+                copy = arena.make<BinOpExpr>(copies.back(), binOp->op, right);
+            } else {
+                copy = arena.make<UnaryOpExpr>(static_cast<const UnaryOpExpr*>(node)->op,
+                                               copies.back());
+            }
+            copy->type = node->type;
+            copies.back() = copy;
+        }
+    }
+    return copies.back();
+}
+
+/// Number of locals `stmt` declares, in nested blocks too but not in nested functions. This
+/// bounds the number of its locals active at once.
+size_t countLocals(const Stmt* stmt) {
+    if (auto* decls = nodeCast<VarDecls>(stmt)) {
+        return decls->decls.size();
+    }
+    if (auto* decl = nodeCast<Decl>(stmt)) {
+        return decl->local ? 1 : 0;
+    }
+    size_t locals = 0;
+    if (auto* ifStmt = nodeCast<IfStmt>(stmt)) {
+        for (const auto& arm : ifStmt->arms) {
+            locals += countLocals(arm.body);
+        }
+        if (ifStmt->else_branch) {
+            locals += countLocals(ifStmt->else_branch);
+        }
+    } else if (auto* block = nodeCast<BlockStmt>(stmt)) {
+        for (auto* child : block->statements) {
+            locals += countLocals(child);
+        }
+    }
+    return locals;
+}
+
+/// Room left for temporaries in a function whose own locals number `locals`.
+size_t localsLeft(size_t locals) {
+    return locals < Inliner::MAX_LOCALS ? Inliner::MAX_LOCALS - locals : 0;
+}
+
+void collectAssignedNames(const Stmt* stmt, std::unordered_set<Symbol>& names) {
+    if (auto* assign = nodeCast<AssignStmt>(stmt)) {
+        if (auto* var = nodeCast<VarExpr>(assign->left)) {
+            names.insert(var->name);
+        }
+    } else if (auto* fun = nodeCast<FunDecl>(stmt)) {
+        // `function f()` assigns to whatever `f` is in scope
+        if (!fun->local && !fun->thisName) {
+            names.insert(fun->name);
+        }
+        collectAssignedNames(fun->body, names);
+    } else if (auto* ifStmt = nodeCast<IfStmt>(stmt)) {
+        for (const auto& arm : ifStmt->arms) {
+            collectAssignedNames(arm.body, names);
+        }
+        if (ifStmt->else_branch) {
+            collectAssignedNames(ifStmt->else_branch, names);
+        }
+    } else if (auto* block = nodeCast<BlockStmt>(stmt)) {
+        for (auto* child : block->statements) {
+            collectAssignedNames(child, names);
+        }
+    }
+}
+} // namespace
+
+void Inliner::inlineCalls(Program& program) {
+    arena = &program.arena;
+    size_t locals = 0;
+    for (auto* stmt : program.statements) {
+        collectAssignedNames(stmt, assignedNames);
+        locals += countLocals(stmt);
+    }
+    localsLeft = ::localsLeft(locals);
+    rewriteBlock(program.statements);
+    arena = nullptr;
+}
+
+Expr* Inliner::rewrite(Expr* expr) {
+    rewritten = expr;
+    expr->accept(*this);
+    return rewritten;
+}
+
+void Inliner::rewriteBlock(std::vector<Stmt*>& statements) {
+    auto* outerHoisted = hoisted;
+    auto outerCalls = callsInPlace;
+    auto outerReads = readsInPlace;
+
+    scopes.pushScope();
+    std::vector<Stmt*> result;
+    result.reserve(statements.size());
+    for (auto* stmt : statements) {
+        std::vector<Stmt*> statementTemporaries;
+        hoisted = &statementTemporaries;
+        callsInPlace = 0;
+        readsInPlace = 0;
+        stmt->accept(*this);
+        result.insert(result.end(), statementTemporaries.begin(), statementTemporaries.end());
+        result.push_back(stmt);
+    }
+    popScope();
+    std::erase_if(result, [&](Stmt* stmt) { return unused.contains(stmt); });
+    statements = std::move(result);
+
+    hoisted = outerHoisted;
+    callsInPlace = outerCalls;
+    readsInPlace = outerReads;
+}
+
+void Inliner::popScope() {
+    scopes.popScope([&](const LocalScopes::Binding& binding) {
+        if (auto found = candidates.find(binding.id); found != candidates.end()) {
+            if (found->second.uses == 0) {
+                unused.insert(found->second.decl);
+            }
+            candidates.erase(found);
+        }
+    });
+}
+
+void Inliner::consider(FunDecl& decl, uint32_t binding) {
+    auto* block = nodeCast<BlockStmt>(decl.body);
+    if (decl.thisName || assignedNames.contains(decl.name) || !block ||
+        block->statements.size() != 1) {
+        return;
+    }
+    auto* ret = nodeCast<ReturnStmt>(block->statements[0]);
+    if (!ret || ret->return_values.size() != 1) {
+        return;
+    }
+
+    Candidate candidate{&decl, ret->return_values[0]};
+    candidate.paramUses.resize(decl.params.size());
+    size_t nodes = 0;
+    bool recursive = false;
+    forEachNode(candidate.body, [&](Expr* node) {
+        ++nodes;
+        if (nodeCast<FunCallExpr>(node)) {
+            ++candidate.calls;
+        }
+        auto* var = nodeCast<VarExpr>(node);
+        if (!var) {
+            return;
+        }
+        auto param = std::ranges::find(decl.params, var->name, &Parameter::name);
+        if (param != decl.params.end()) {
+            ++candidate.paramUses[param - decl.params.begin()];
+        } else if (var->name == decl.name) {
+            recursive = true;
+        } else if (std::ranges::none_of(candidate.freeNames,
+                                        [&](auto&& free) { return free.first == var->name; })) {
+            candidate.freeNames.emplace_back(var->name, scopes.lookup(var->name));
+        }
+    });
+    if (nodes <= MAX_INLINE_NODES && !recursive) {
+        candidates.emplace(binding, std::move(candidate));
+    }
+}
+
+Expr* Inliner::inlineCall(FunCallExpr& call, Candidate& candidate, bool firstCall,
+                          bool firstRead) {
+    for (auto&& [name, binding] : candidate.freeNames) {
+        if (scopes.lookup(name) != binding) {
+            return nullptr;
+        }
+    }
+
+    // Lua evaluates all arguments before the body runs, a substituted argument runs where the
+    // body uses it instead. That is fine for literals, and for other arguments without effects
+    // as long as the body makes no call that could change what they read. Otherwise every
+    // argument but the literals is evaluated into a temporary, in the original order.
+    bool inOrder = candidate.calls > 0 || std::ranges::any_of(call.args, hasEffects);
+    std::vector<bool> temporary(call.args.size());
+    size_t count = 0;
+    bool hoistsEffects = false;
+    for (size_t i = 0; i < call.args.size(); ++i) {
+        auto* arg = call.args[i];
+        bool simple = isLiteral(arg) || nodeCast<VarExpr>(arg);
+        // Pure arguments used more than once are still only computed once
+        temporary[i] = !isLiteral(arg) && (inOrder || (!simple && candidate.paramUses[i] > 1));
+        count += temporary[i] ? 1 : 0;
+        hoistsEffects = hoistsEffects || (temporary[i] && hasEffects(arg));
+    }
+    bool hoisting = count > 0;
+    // Temporaries run before the whole statement, which must not move them past another call,
+    // nor move effects past a read they could change
+    if (hoisting && (!hoisted || !firstCall || (hoistsEffects && !firstRead) ||
+                     count > localsLeft)) {
+        return nullptr;
+    }
+    localsLeft -= count;
+
+    std::unordered_map<Symbol, Expr*> substitutions;
+    const auto& params = candidate.decl->params;
+    for (size_t i = 0; i < params.size(); ++i) {
+        Expr* arg = call.args[i];
+        if (temporary[i]) {
+            auto name = intern(std::format("__inl_{}", ++temporaries));
+            auto* temporary = arena->make<VarDecl>(name, arg);
+            temporary->type = arg->type;
+            hoisted->push_back(temporary);
+            auto* var = arena->make<VarExpr>(name);
+            var->type = temporary->type;
+            // Only the copies of `var` in the inlined body count as uses
+            var->binding = temporary;
+            arg = var;
+        }
+        substitutions.emplace(params[i].name, arg);
+    }
+    if (hoisting) {
+        callsInPlace = 0;
+    }
+    callsInPlace += candidate.calls;
+    return clone(*arena, candidate.body, substitutions);
+}
+
+void Inliner::visit(StringExpr& expr) { rewritten = &expr; }
+
+void Inliner::visit(NumberExpr& expr) { rewritten = &expr; }
+
+void Inliner::visit(NilExpr& expr) { rewritten = &expr; }
+
+void Inliner::visit(BooleanExpr& expr) { rewritten = &expr; }
+
+void Inliner::visit(TableExpr& expr) {
+    for (auto& element : expr.arrayPart) {
+        element = rewrite(element);
+    }
+    for (auto& [key, value] : expr.mapPart) {
+        value = rewrite(value);
+    }
+    rewritten = &expr;
+}
+
+void Inliner::visit(VarExpr& expr) {
+    auto binding = scopes.lookup(expr.name);
+    if (auto found = candidates.find(binding); found != candidates.end()) {
+        ++found->second.uses;
+    }
+    if (binding == LocalScopes::GLOBAL || assignedNames.contains(expr.name)) {
+        ++readsInPlace;
+    }
+    rewritten = &expr;
+}
+
+void Inliner::visit(UnaryOpExpr& expr) { rewriteOperators(expr); }
+
+void Inliner::visit(BinOpExpr& expr) { rewriteOperators(expr); }
+
+void Inliner::rewriteOperators(Expr& root) {
+    struct Operand {
+        // Null for the point where a member access reads its field
+        Expr** slot;
+        // Where the temporaries of the calls in the operand go
+        std::vector<Stmt*>* hoisted;
+    };
+    auto* outerHoisted = hoisted;
+    Expr* result = &root;
+    std::vector<Operand> stack{{&result, hoisted}};
+    while (!stack.empty()) {
+        auto [slot, target] = stack.back();
+        stack.pop_back();
+        if (!slot) {
+            ++readsInPlace;
+        } else if (auto* binOp = nodeCast<BinOpExpr>(*slot)) {
+            // Pushed in reverse, the left operand is taken first. The right operand of and/or
+            // may not run, its temporaries can't go before the statement.
+            bool conditional = binOp->op == TokenKind::And || binOp->op == TokenKind::Or;
+            if (binOp->op != TokenKind::MemberAccess) {
+                stack.push_back({&binOp->right, conditional ? nullptr : target});
+            } else {
+                stack.push_back({nullptr, target});
+            }
+            stack.push_back({&binOp->left, target});
+        } else if (auto* unary = nodeCast<UnaryOpExpr>(*slot)) {
+            stack.push_back({&unary->right, target});
+        } else {
+            hoisted = target;
+            *slot = rewrite(*slot);
+        }
+    }
+    hoisted = outerHoisted;
+    rewritten = result;
+}
+
+void Inliner::visit(IndexExpr& expr) {
+    expr.object = rewrite(expr.object);
+    expr.index = rewrite(expr.index);
+    ++readsInPlace;
+    rewritten = &expr;
+}
+
+void Inliner::visit(FunCallExpr& expr) {
+    Candidate* candidate = nullptr;
+    if (auto* callee = nodeCast<VarExpr>(expr.callee)) {
+        auto found = candidates.find(scopes.lookup(callee->name));
+        if (found != candidates.end() && found->second.decl->params.size() == expr.args.size()) {
+            candidate = &found->second;
+        }
+    }
+    if (!candidate) {
+        expr.callee = rewrite(expr.callee);
+    }
+    bool firstCall = callsInPlace == 0;
+    bool firstRead = readsInPlace == 0;
+    for (auto& arg : expr.args) {
+        arg = rewrite(arg);
+    }
+    rewritten = &expr;
+
+    if (candidate) {
+        if (auto* inlined = inlineCall(expr, *candidate, firstCall, firstRead)) {
+            rewritten = inlined;
+            return;
+        }
+        ++candidate->uses;
+    }
+    ++callsInPlace;
+}
+
+void Inliner::visit(FunDecl& stmt) {
+    uint32_t binding = stmt.local ? scopes.define(stmt.name) : LocalScopes::GLOBAL;
+    scopes.pushScope();
+    for (auto&& param : stmt.params) {
+        scopes.define(param.name);
+    }
+    // The body is a function of its own, with its own locals
+    auto outerLocals = localsLeft;
+    localsLeft = ::localsLeft(stmt.params.size() + (stmt.method ? 1 : 0) + countLocals(stmt.body));
+    stmt.body->accept(*this);
+    localsLeft = outerLocals;
+    popScope();
+    if (stmt.local) {
+        consider(stmt, binding);
+    }
+}
+
+void Inliner::visit(VarDecl& stmt) {
+    stmt.initExpr = rewrite(stmt.initExpr);
+    scopes.define(stmt.name);
+}
+
+void Inliner::visit(VarDecls& stmt) {
+    // All initializers run before any of the names is in scope
+    for (auto* decl : stmt.decls) {
+        decl->initExpr = rewrite(decl->initExpr);
+    }
+    for (auto* decl : stmt.decls) {
+        scopes.define(decl->name);
+    }
+}
+
+void Inliner::visit(IfStmt& stmt) {
+    for (size_t i = 0; i < stmt.arms.size(); ++i) {
+        // An elseif condition only runs when the ones before it failed
+        if (i > 0) {
+            hoisted = nullptr;
+        }
+        stmt.arms[i].condition = rewrite(stmt.arms[i].condition);
+        stmt.arms[i].body->accept(*this);
+    }
+    if (stmt.else_branch) {
+        hoisted = nullptr;
+        stmt.else_branch->accept(*this);
+    }
+}
+
+void Inliner::visit(ReturnStmt& stmt) {
+    for (auto& value : stmt.return_values) {
+        value = rewrite(value);
+    }
+}
+
+void Inliner::visit(BlockStmt& stmt) { rewriteBlock(stmt.statements); }
+
+void Inliner::visit(FunCallStmt& stmt) {
+    // A call statement has no value to replace it with, only its arguments can be inlined
+    stmt.call->callee = rewrite(stmt.call->callee);
+    for (auto& arg : stmt.call->args) {
+        arg = rewrite(arg);
+    }
+}
+
+void Inliner::visit(AssignStmt& stmt) {
+    // The target is stored to after the value is computed, only its operands are read before
+    auto* access = nodeCast<BinOpExpr>(stmt.left);
+    if (auto* index = nodeCast<IndexExpr>(stmt.left)) {
+        index->object = rewrite(index->object);
+        index->index = rewrite(index->index);
+    } else if (access && access->op == TokenKind::MemberAccess) {
+        access->left = rewrite(access->left);
+    } else if (!nodeCast<VarExpr>(stmt.left)) {
+        stmt.left = rewrite(stmt.left);
+    }
+    stmt.right = rewrite(stmt.right);
+}
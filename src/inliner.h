@@ -0,0 +1,95 @@
+#pragma once
+#include "ast.h"
+#include "local_scopes.h"
+#include "visitor.h"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/// Replaces calls to small local functions by their body. A function is inlined when its body
+/// is a single `return <expr>` of at most MAX_INLINE_NODES nodes, it does not call itself, and
+/// its name is never assigned. Arguments that the body could observe out of order are first
+/// stored in `__inl_N` temporaries, declared before the statement containing the call, as
+/// long as the function has room for more locals. A function whose calls were all inlined
+/// and that is not used otherwise is removed.
+class Inliner final : public Visitor {
+  public:
+    static constexpr size_t MAX_INLINE_NODES = 16;
+    /// Lua's limit on the locals active at once in a function.
+    static constexpr size_t MAX_LOCALS = 200;
+
+    void inlineCalls(Program& program);
+
+    // Expression visitors
+    void visit(StringExpr& expr) override;
+    void visit(NumberExpr& expr) override;
+    void visit(NilExpr& expr) override;
+    void visit(BooleanExpr& expr) override;
+    void visit(TableExpr& expr) override;
+    void visit(VarExpr& expr) override;
+    void visit(UnaryOpExpr& expr) override;
+    void visit(BinOpExpr& expr) override;
+    void visit(IndexExpr& expr) override;
+    void visit(FunCallExpr& expr) override;
+
+    // Statement visitors
+    void visit(FunDecl& stmt) override;
+    void visit(VarDecl& stmt) override;
+    void visit(VarDecls& stmt) override;
+    void visit(IfStmt& stmt) override;
+    void visit(ReturnStmt& stmt) override;
+    void visit(BlockStmt& stmt) override;
+    void visit(FunCallStmt& stmt) override;
+    void visit(AssignStmt& stmt) override;
+
+  private:
+    struct Candidate {
+        Candidate(FunDecl* decl, Expr* body) : decl(decl), body(body) {}
+
+        FunDecl* decl;
+        // The single returned expression
+        Expr* body;
+        // Names the body reads besides its parameters, with the binding each one has at the
+        // definition. A call site shadowing one of them can't be inlined.
+        std::vector<std::pair<Symbol, uint32_t>> freeNames;
+        // Number of times the body reads each parameter
+        std::vector<size_t> paramUses;
+        size_t calls = 0;
+        // References that were not inlined
+        size_t uses = 0;
+    };
+
+    AstArena* arena = nullptr;
+    // Set by the expression visitors: the node replacing the visited expression
+    Expr* rewritten = nullptr;
+
+    LocalScopes scopes;
+    std::unordered_map<uint32_t, Candidate> candidates;
+    // Names some statement assigns to (`f = ...` or `function f()`)
+    std::unordered_set<Symbol> assignedNames;
+    // Candidates removed from the block they were declared in
+    std::unordered_set<Stmt*> unused;
+
+    // Temporaries to declare before the current statement, null where that is not possible
+    std::vector<Stmt*>* hoisted = nullptr;
+    // Calls evaluated so far in the current statement, hoisting past them would reorder effects
+    size_t callsInPlace = 0;
+    // Reads so far in the current statement that a call could change the value of: fields,
+    // globals and locals assigned somewhere. Hoisted effects must not run before them.
+    size_t readsInPlace = 0;
+    size_t temporaries = 0;
+    // Temporaries the current function can still declare without passing MAX_LOCALS
+    size_t localsLeft = 0;
+
+    Expr* rewrite(Expr* expr);
+    /// Rewrites the operands of the operator chain `root` starts, left to right, keeping the
+    /// operators still to take apart on an explicit stack instead of recursing along the chain.
+    void rewriteOperators(Expr& root);
+    void rewriteBlock(std::vector<Stmt*>& statements);
+    void popScope();
+    /// Registers `decl` as a candidate if it is small and simple enough.
+    void consider(FunDecl& decl, uint32_t binding);
+    /// The inlined body for `call`, or nullptr if this call site has to stay a call.
+    Expr* inlineCall(FunCallExpr& call, Candidate& candidate, bool firstCall, bool firstRead);
+};
@@ -1,133 +1,337 @@
-#include <map>
+#include <array>
+#include <bit>
+#include <cstdint>
 
 #include "lexer.h"
 
-std::map<std::string, TokenKind> keywordMap = {
-    {"local", TokenKind::Local},
-    {"function", TokenKind::Function},
-    {"end", TokenKind::End},
-    {"return", TokenKind::Return},
-    {"if", TokenKind::If},
-    {"then", TokenKind::Then},
-    {"else", TokenKind::Else},
-    {"elseif", TokenKind::ElseIf},
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
-    {"true", TokenKind::True},
-    {"false", TokenKind::False},
-    {"nil", TokenKind::Nil},
-    // logical ops
-    {"not", TokenKind::Not},
-    {"and", TokenKind::And},
-    {"or", TokenKind::Or},
+namespace {
+// Character classes, replacing the locale-dependent <cctype> predicates
+enum CharClass : uint8_t {
+    BLANK = 1 << 0,   // ' ' and '\t', skipped in bulk
+    SPACE = 1 << 1,   // any whitespace, including newlines
+    IDENT_START = 1 << 2,
+    IDENT = 1 << 3,
+    DIGIT = 1 << 4,
 };
 
-Token Lexer::getNextToken() {
-    char c = peek();
-    std::string lexeme;
+constexpr std::array<uint8_t, 256> CHAR_CLASSES = [] {
+    std::array<uint8_t, 256> table{};
+    for (int c = 'a'; c <= 'z'; ++c) {
+        table[c] = IDENT_START | IDENT;
+        table[c - 'a' + 'A'] = IDENT_START | IDENT;
+    }
+    for (int c = '0'; c <= '9'; ++c) {
+        table[c] = IDENT | DIGIT;
+    }
+    table['_'] = IDENT_START | IDENT;
+    table[' '] = table['\t'] = BLANK | SPACE;
+    table['\n'] = table['\r'] = table['\v'] = table['\f'] = SPACE;
+    return table;
+}();
 
-    if (c == '\0') {
-        return tok(TokenKind::Eof, "");
-    } else if (isspace(c)) {
-        advance();
-        return getNextToken();
-    } else if (isalpha(c) || c == '_') {
-        while (isalnum(peek()) || peek() == '_') {
-            lexeme += advance();
+bool hasClass(char c, uint8_t cls) { return CHAR_CLASSES[static_cast<unsigned char>(c)] & cls; }
+
+/// Length of the run of spaces and tabs at the start of `text`.
+size_t blankRunLength(std::string_view text) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    for (; i + 16 <= text.size(); i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+        __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab));
+        auto other = ~static_cast<uint32_t>(_mm_movemask_epi8(blank)) & 0xFFFF;
+        if (other != 0) {
+            return i + std::countr_zero(other);
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 16 <= text.size(); i += 16) {
+        uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(text.data() + i));
+        uint8x16_t blank =
+            vorrq_u8(vceqq_u8(chunk, vdupq_n_u8(' ')), vceqq_u8(chunk, vdupq_n_u8('\t')));
+        // Narrow every byte lane to a nibble, giving a 64-bit mask with 4 bits per byte
+        uint64_t nibbles =
+            vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(blank), 4)), 0);
+        if (~nibbles != 0) {
+            return i + std::countr_zero(~nibbles) / 4;
         }
+    }
+#endif
+    while (i < text.size() && hasClass(text[i], BLANK)) {
+        ++i;
+    }
+    return i;
+}
 
-        auto keywordIt = keywordMap.find(lexeme);
-        if (keywordIt != keywordMap.end()) {
-            return tok(keywordIt->second, std::move(lexeme));
+/// Length of the run of identifier characters ([A-Za-z0-9_]) at the start of `text`.
+size_t identRunLength(std::string_view text) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= text.size(); i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+        // Setting bit 5 folds upper case letters onto lower case ones. The signed
+        // compares reject bytes >= 0x80, which are negative.
+        __m128i folded = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+        __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(folded, _mm_set1_epi8('a' - 1)),
+                                      _mm_cmplt_epi8(folded, _mm_set1_epi8('z' + 1)));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('0' - 1)),
+                                      _mm_cmplt_epi8(chunk, _mm_set1_epi8('9' + 1)));
+        __m128i underscore = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_'));
+        __m128i ident = _mm_or_si128(_mm_or_si128(alpha, digit), underscore);
+        auto other = ~static_cast<uint32_t>(_mm_movemask_epi8(ident)) & 0xFFFF;
+        if (other != 0) {
+            return i + std::countr_zero(other);
         }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 16 <= text.size(); i += 16) {
+        uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(text.data() + i));
+        // Unsigned range checks via wrap-around: (c - lo) < (hi - lo + 1)
+        uint8x16_t folded = vorrq_u8(chunk, vdupq_n_u8(0x20));
+        uint8x16_t alpha = vcltq_u8(vsubq_u8(folded, vdupq_n_u8('a')), vdupq_n_u8(26));
+        uint8x16_t digit = vcltq_u8(vsubq_u8(chunk, vdupq_n_u8('0')), vdupq_n_u8(10));
+        uint8x16_t underscore = vceqq_u8(chunk, vdupq_n_u8('_'));
+        uint8x16_t ident = vorrq_u8(vorrq_u8(alpha, digit), underscore);
+        uint64_t nibbles =
+            vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(ident), 4)), 0);
+        if (~nibbles != 0) {
+            return i + std::countr_zero(~nibbles) / 4;
+        }
+    }
+#endif
+    while (i < text.size() && hasClass(text[i], IDENT)) {
+        ++i;
+    }
+    return i;
+}
+
+/// Keywords are resolved by switching on length and first character,
+/// leaving at most two string compares per identifier.
+TokenKind identifierKind(std::string_view word) {
+    auto is = [&](std::string_view keyword, TokenKind kind) {
+        return word == keyword ? kind : TokenKind::Identifier;
+    };
 
-        return tok(TokenKind::Identifier, std::move(lexeme));
-    } else if (isdigit(c)) {
-        while (isdigit(peek())) {
-            lexeme += advance();
+    switch (word.size()) {
+    case 2:
+        switch (word[0]) {
+        case 'i':
+            return is("if", TokenKind::If);
+        case 'o':
+            return is("or", TokenKind::Or);
+        }
+        break;
+    case 3:
+        switch (word[0]) {
+        case 'a':
+            return is("and", TokenKind::And);
+        case 'e':
+            return is("end", TokenKind::End);
+        case 'n':
+            return word[1] == 'i' ? is("nil", TokenKind::Nil) : is("not", TokenKind::Not);
+        }
+        break;
+    case 4:
+        switch (word[0]) {
+        case 'e':
+            return is("else", TokenKind::Else);
+        case 't':
+            return word[1] == 'h' ? is("then", TokenKind::Then) : is("true", TokenKind::True);
         }
-        return tok(TokenKind::Number, std::move(lexeme));
+        break;
+    case 5:
+        switch (word[0]) {
+        case 'f':
+            return is("false", TokenKind::False);
+        case 'l':
+            return is("local", TokenKind::Local);
+        }
+        break;
+    case 6:
+        switch (word[0]) {
+        case 'e':
+            return is("elseif", TokenKind::ElseIf);
+        case 'r':
+            return is("return", TokenKind::Return);
+        }
+        break;
+    case 8:
+        return is("function", TokenKind::Function);
+    }
+    return TokenKind::Identifier;
+}
+} // namespace
+
+void Lexer::skipWhitespace() {
+    while (true) {
+        char c = peek();
+        if (hasClass(c, BLANK)) {
+            // Indentation and runs of spaces never contain newlines, skip them in bulk
+            size_t length = blankRunLength(source.substr(position));
+            position += length;
+            column += static_cast<int>(length);
+        } else if (hasClass(c, SPACE)) {
+            advance();
+        } else {
+            return;
+        }
+    }
+}
+
+Token Lexer::lexNumber() {
+    while (hasClass(peek(), DIGIT)) {
+        advance();
+    }
+    if (peek() == '.' && peek(1) != '.') {
+        advance();
+        while (hasClass(peek(), DIGIT)) {
+            advance();
+        }
+    }
+    if (peek() == 'e' || peek() == 'E') {
+        size_t sign = peek(1) == '+' || peek(1) == '-' ? 1 : 0;
+        if (hasClass(peek(1 + sign), DIGIT)) {
+            advance();
+            if (sign) {
+                advance();
+            }
+            while (hasClass(peek(), DIGIT)) {
+                advance();
+            }
+        }
+    }
+    return tok(TokenKind::Number);
+}
+
+Token Lexer::getNextToken() {
+    skipWhitespace();
+    startToken();
+    char c = peek();
+
+    if (c == '\0') {
+        return tok(TokenKind::Eof);
+    } else if (hasClass(c, IDENT_START)) {
+        size_t length = identRunLength(source.substr(position));
+        position += length;
+        column += static_cast<int>(length);
+
+        Token token = tok(TokenKind::Identifier);
+        token.kind = identifierKind(token.lexeme);
+        if (token.kind == TokenKind::Identifier) {
+            token.symbol = intern(token.lexeme);
+        }
+        return token;
+    } else if (hasClass(c, DIGIT) || (c == '.' && hasClass(peek(1), DIGIT))) {
+        return lexNumber();
     } else if (c == '"') {
         advance(); // consume opening quote
+        size_t contentStart = position;
         while (peek() != '"' && peek() != '\0') {
-            lexeme += advance();
+            advance();
         }
+        auto content = source.substr(contentStart, position - contentStart);
         advance(); // consume closing quote
-        return tok(TokenKind::String, std::move(lexeme));
+        Token token = tok(TokenKind::String, content);
+        token.symbol = intern(content);
+        return token;
     } else {
         // Handle single-character tokens
         switch (c) {
         case '(':
             advance();
-            return tok(TokenKind::LParen, "(");
+            return tok(TokenKind::LParen);
         case ')':
             advance();
-            return tok(TokenKind::RParen, ")");
+            return tok(TokenKind::RParen);
         case '{':
             advance();
-            return tok(TokenKind::LBrace, "{");
+            return tok(TokenKind::LBrace);
         case '}':
             advance();
-            return tok(TokenKind::RBrace, "}");
+            return tok(TokenKind::RBrace);
         case '[':
             advance();
-            return tok(TokenKind::LBracket, "[");
+            return tok(TokenKind::LBracket);
         case ']':
             advance();
-            return tok(TokenKind::RBracket, "]");
+            return tok(TokenKind::RBracket);
         case ':':
             advance();
-            return tok(TokenKind::Colon, ":");
+            return tok(TokenKind::Colon);
         case ',':
             advance();
-            return tok(TokenKind::Comma, ",");
+            return tok(TokenKind::Comma);
         case '+':
             advance();
-            return tok(TokenKind::Plus, "+");
+            return tok(TokenKind::Plus);
         case '-':
             advance();
             if (peek() == '>') {
                 advance();
-                return tok(TokenKind::Arrow, "->");
+                return tok(TokenKind::Arrow);
             }
-            return tok(TokenKind::Minus, "-");
+            return tok(TokenKind::Minus);
         case '*':
             advance();
-            return tok(TokenKind::Star, "*");
+            return tok(TokenKind::Star);
         case '/':
             advance();
-            return tok(TokenKind::Slash, "/");
+            if (peek() == '/') {
+                advance();
+                return tok(TokenKind::FloorDiv);
+            }
+            return tok(TokenKind::Slash);
         case '.':
             advance();
-            return tok(TokenKind::MemberAccess, ".");
+            if (peek() == '.') {
+                advance();
+                return tok(TokenKind::Concat);
+            }
+            return tok(TokenKind::MemberAccess);
         case '#':
             advance();
-            return tok(TokenKind::Length, "#");
+            return tok(TokenKind::Length);
         case '<': {
             advance();
             if (peek() == '=') {
                 advance();
-                return tok(TokenKind::LessEqual, "<=");
+                return tok(TokenKind::LessEqual);
             }
-            return tok(TokenKind::Less, "<");
+            return tok(TokenKind::Less);
         }
         case '>': {
             advance();
             if (peek() == '=') {
                 advance();
-                return tok(TokenKind::GreaterEqual, ">=");
+                return tok(TokenKind::GreaterEqual);
             }
-            return tok(TokenKind::Greater, ">");
+            return tok(TokenKind::Greater);
         }
         case '=': {
             advance();
             if (peek() == '=') {
                 advance();
-                return tok(TokenKind::Equal, "==");
+                return tok(TokenKind::Equal);
+            }
+            return tok(TokenKind::Assign);
+        }
+        case '~': {
+            advance();
+            if (peek() == '=') {
+                advance();
+                return tok(TokenKind::NotEqual);
             }
-            return tok(TokenKind::Assign, "=");
+            break;
         }
         }
     }
 
-    return Token{TokenKind::Eof, "", line, column};
+    return Token{TokenKind::Eof, {}, line, column};
 }
@@ -1,8 +1,13 @@
 #pragma once
+#include <array>
+#include <format>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "symbol.h"
+
 enum class TokenKind {
     // literals
     Identifier,
@@ -39,6 +44,7 @@ enum class TokenKind {
     Minus,
     Star,
     Slash,
+    FloorDiv,
     Equal,
     NotEqual,
     Less,
@@ -58,12 +64,14 @@ enum class TokenKind {
 
 inline const char* tokenKindToStr(TokenKind kind) {
     static const char* tokenKindToString[] = {
-        "Identifier", "Number",   "String", "Nil",     "True",         "False",        "Local",
-        "Function",   "End",      "Return", "If",      "Then",         "Else",         "ElseIf",
-        "LParen",     "RParen",   "LBrace", "RBrace",  "LBracket",     "RBracket",     "Colon",
-        "Comma",      "Assign",   "Arrow",  "Plus",    "Minus",        "Star",         "Slash",
-        "Equal",      "NotEqual", "Less",   "Greater", "LessEqual",    "GreaterEqual", "And",
-        "Or",         "Not",      "Length", "Concat",  "MemberAccess", "MethodAccess", "Eof",
+        "Identifier", "Number",   "String",   "Nil",     "True",         "False",
+        "Local",      "Function", "End",      "Return",  "If",           "Then",
+        "Else",       "ElseIf",   "LParen",   "RParen",  "LBrace",       "RBrace",
+        "LBracket",   "RBracket", "Colon",    "Comma",   "Assign",       "Arrow",
+        "Plus",       "Minus",    "Star",     "Slash",   "FloorDiv",     "Equal",
+        "NotEqual",   "Less",     "Greater",  "LessEqual", "GreaterEqual", "And",
+        "Or",         "Not",      "Length",   "Concat",  "MemberAccess", "MethodAccess",
+        "Eof",
     };
 
     size_t size = sizeof(tokenKindToString) / sizeof(tokenKindToString[0]);
@@ -90,19 +98,23 @@ enum class BinOpType {
     Concat,
 };
 
+/// A token's lexeme is a view into the source buffer handed to the Lexer,
+/// so the buffer must outlive every token (and everything built from them).
+/// Identifiers and string literals are also interned into `symbol`.
 struct Token {
     TokenKind kind;
-    std::string lexeme;
+    std::string_view lexeme;
     int line;
     int column;
+    Symbol symbol{};
 };
 
 class Lexer {
   public:
-    Lexer(const std::string& source) : source(source), position(0), line(1), column(1) {}
+    Lexer(std::string_view source) : source(source), position(0), line(1), column(1) {}
     Token getNextToken();
 
-    static std::vector<Token> tokenize(const std::string& source) {
+    static std::vector<Token> tokenize(std::string_view source) {
         Lexer lexer(source);
         std::vector<Token> tokens;
         Token token;
@@ -114,10 +126,16 @@ class Lexer {
     }
 
   private:
-    char peek() const {
-        if (position >= source.size())
+    /// Skips whitespace iteratively, runs of blanks are skipped in bulk.
+    void skipWhitespace();
+    /// Lexes a decimal numeral: digits with an optional fraction and exponent (`12`, `1.5`,
+    /// `.5`, `3e-2`). A `.` followed by another `.` is a concat, not a fraction.
+    Token lexNumber();
+
+    char peek(size_t ahead = 0) const {
+        if (position + ahead >= source.size())
             return '\0';
-        return source[position];
+        return source[position + ahead];
     }
 
     char advance() {
@@ -133,12 +151,79 @@ class Lexer {
         return current;
     }
 
-    Token tok(TokenKind kind, std::string lexeme) {
-        return Token{kind, lexeme, line, column - static_cast<int>(lexeme.size())};
+    /// Marks the current position as the start of the next token.
+    void startToken() {
+        tokenStart = position;
+        tokenLine = line;
+        tokenColumn = column;
     }
 
-    std::string source;
+    /// Creates a token spanning from the last `startToken()` to the current position.
+    Token tok(TokenKind kind) { return tok(kind, source.substr(tokenStart, position - tokenStart)); }
+
+    Token tok(TokenKind kind, std::string_view lexeme) {
+        return Token{kind, lexeme, tokenLine, tokenColumn};
+    }
+
+    std::string_view source;
     size_t position;
     int line;
     int column;
+
+    size_t tokenStart = 0;
+    int tokenLine = 1;
+    int tokenColumn = 1;
+};
+
+/// Pulls tokens lazily from a Lexer, keeping only the last `WINDOW_SIZE` of them alive.
+/// Positions are absolute token indices, the window bounds how far back `restore` can go.
+class TokenStream {
+  public:
+    static constexpr size_t WINDOW_SIZE = 16;
+
+    explicit TokenStream(Lexer lexer) : lexer(std::move(lexer)) { fill(); }
+
+    /// The current (not yet consumed) token.
+    const Token& peek() const { return window[position % WINDOW_SIZE]; }
+
+    /// The most recently consumed token.
+    const Token& previous() const {
+        if (position == 0) {
+            throw std::out_of_range("No token has been consumed yet");
+        }
+        return window[(position - 1) % WINDOW_SIZE];
+    }
+
+    void advance() {
+        ++position;
+        fill();
+    }
+
+    /// Returns a checkpoint that can be passed to `restore`.
+    size_t mark() const { return position; }
+
+    /// Rewinds to a checkpoint, which must still be inside the window.
+    void restore(size_t stashed) {
+        if (stashed > position || produced - stashed > WINDOW_SIZE) {
+            throw std::out_of_range(std::format(
+                "Cannot restore token position {}, the window starts at {}", stashed,
+                produced > WINDOW_SIZE ? produced - WINDOW_SIZE : 0));
+        }
+        position = stashed;
+    }
+
+  private:
+    /// Makes sure the current token has been pulled from the lexer.
+    void fill() {
+        while (produced <= position) {
+            window[produced % WINDOW_SIZE] = lexer.getNextToken();
+            ++produced;
+        }
+    }
+
+    Lexer lexer;
+    std::array<Token, WINDOW_SIZE> window;
+    size_t position = 0;
+    // Number of tokens pulled from the lexer so far
+    size_t produced = 0;
 };
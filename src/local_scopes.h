@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "symbol.h"
+
+/// Resolves names to the local declaration they refer to, for passes walking the AST after
+/// type checking. Every declaration gets its own binding id (a redeclaration in the same
+/// scope shadows the previous one, as in Lua), names with no local declaration are GLOBAL.
+/// Same shadow stack as the Environment.
+class LocalScopes {
+  public:
+    static constexpr uint32_t GLOBAL = 0;
+
+    struct Binding {
+        Symbol name;
+        uint32_t id;
+        uint32_t shadowed;
+    };
+
+    void pushScope() { marks.push_back(bindings.size()); }
+
+    /// Leaves the innermost scope, calling `onExit` with each of its bindings.
+    template <typename Fn> void popScope(Fn&& onExit) {
+        size_t mark = marks.back();
+        marks.pop_back();
+        while (bindings.size() > mark) {
+            auto& binding = bindings.back();
+            innermost[binding.name.id] = binding.shadowed;
+            onExit(binding);
+            bindings.pop_back();
+        }
+    }
+    void popScope() {
+        popScope([](const Binding&) {});
+    }
+
+    uint32_t define(Symbol name) {
+        if (name.id >= innermost.size()) {
+            innermost.resize(name.id + 1, NO_BINDING);
+        }
+        uint32_t id = nextId++;
+        bindings.push_back(Binding{name, id, innermost[name.id]});
+        innermost[name.id] = static_cast<uint32_t>(bindings.size() - 1);
+        return id;
+    }
+
+    uint32_t lookup(Symbol name) const {
+        if (name.id >= innermost.size() || innermost[name.id] == NO_BINDING) {
+            return GLOBAL;
+        }
+        return bindings[innermost[name.id]].id;
+    }
+
+  private:
+    static constexpr uint32_t NO_BINDING = UINT32_MAX;
+
+    std::vector<Binding> bindings;
+    // Index into `bindings` of the innermost binding of each symbol id
+    std::vector<uint32_t> innermost;
+    std::vector<size_t> marks;
+    uint32_t nextId = GLOBAL + 1;
+};
@@ -0,0 +1,433 @@
+#include "localizer.h"
+#include "ast_walk.h"
+
+#include <algorithm>
+#include <array>
+#include <format>
+#include <ranges>
+#include <string_view>
+
+namespace {
+// Standard library tables, whose fields are cached as well
+constexpr std::array<std::string_view, 7> LUA_LIBRARIES = {
+    "coroutine", "io", "math", "os", "string", "table", "utf8",
+};
+
+constexpr std::array<std::string_view, 20> LUA_GLOBAL_FUNCTIONS = {
+    "assert",  "error",  "getmetatable", "ipairs",   "next",     "pairs", "pcall",
+    "print",   "rawequal", "rawget",     "rawlen",   "rawset",   "require",
+    "select",  "setmetatable", "tonumber", "tostring", "type",   "unpack", "xpcall",
+};
+
+template <size_t N> bool contains(const std::array<std::string_view, N>& names, Symbol name) {
+    return std::ranges::find(names, name.str()) != names.end();
+}
+
+bool isLibrary(Symbol name) { return contains(LUA_LIBRARIES, name); }
+
+bool isLibraryGlobal(Symbol name) {
+    return isLibrary(name) || contains(LUA_GLOBAL_FUNCTIONS, name);
+}
+
+bool hasCall(Expr* expr) {
+    bool call = false;
+    forEachNode(expr, [&](Expr* node) { call = call || nodeCast<FunCallExpr>(node); });
+    return call;
+}
+
+/// Whether running `stmt` may call a function or assign a variable or field.
+/// Function bodies only run when they are called.
+bool hasEffects(Stmt* stmt) {
+    if (auto* decl = nodeCast<VarDecl>(stmt)) {
+        return hasCall(decl->initExpr);
+    }
+    if (auto* decls = nodeCast<VarDecls>(stmt)) {
+        return std::ranges::any_of(decls->decls, [](auto* decl) { return hasEffects(decl); });
+    }
+    if (auto* ret = nodeCast<ReturnStmt>(stmt)) {
+        return std::ranges::any_of(ret->return_values, hasCall);
+    }
+    if (auto* ifStmt = nodeCast<IfStmt>(stmt)) {
+        return std::ranges::any_of(ifStmt->arms,
+                                   [](auto&& arm) {
+                                       return hasCall(arm.condition) || hasEffects(arm.body);
+                                   }) ||
+               (ifStmt->else_branch && hasEffects(ifStmt->else_branch));
+    }
+    if (auto* block = nodeCast<BlockStmt>(stmt)) {
+        return std::ranges::any_of(block->statements,
+                                   [](auto* child) { return hasEffects(child); });
+    }
+    return nodeCast<FunDecl>(stmt) == nullptr;
+}
+
+/// The expressions `stmt` evaluates itself, without those in nested blocks.
+std::vector<Expr**> directExpressions(Stmt* stmt) {
+    std::vector<Expr**> slots;
+    if (auto* decl = nodeCast<VarDecl>(stmt)) {
+        slots.push_back(&decl->initExpr);
+    } else if (auto* decls = nodeCast<VarDecls>(stmt)) {
+        for (auto* decl : decls->decls) {
+            slots.push_back(&decl->initExpr);
+        }
+    } else if (auto* ret = nodeCast<ReturnStmt>(stmt)) {
+        for (auto& value : ret->return_values) {
+            slots.push_back(&value);
+        }
+    } else if (auto* ifStmt = nodeCast<IfStmt>(stmt)) {
+        // Later conditions only run when the ones before them fail
+        slots.push_back(&ifStmt->arms[0].condition);
+    }
+    return slots;
+}
+
+std::vector<Symbol> declaredNames(Stmt* stmt) {
+    if (auto* decls = nodeCast<VarDecls>(stmt)) {
+        std::vector<Symbol> names;
+        for (auto* decl : decls->decls) {
+            names.push_back(decl->name);
+        }
+        return names;
+    }
+    if (auto* decl = nodeCast<Decl>(stmt); decl && decl->local) {
+        return {decl->name};
+    }
+    return {};
+}
+
+bool isTable(const Expr* expr) { return expr->type && expr->type->getKind() == TypeKind::Table; }
+
+/// Whether `expr` is a member access chain `v.a.b` where every step reads a field of a
+/// value the type checker knows to be a table.
+bool isStaticChain(Expr* expr) {
+    while (true) {
+        auto* access = nodeCast<BinOpExpr>(expr);
+        if (!access || access->op != TokenKind::MemberAccess || !isTable(access->left)) {
+            return false;
+        }
+        if (nodeCast<VarExpr>(access->left)) {
+            return true;
+        }
+        expr = access->left;
+    }
+}
+
+/// Root variable and field names of a static chain.
+std::vector<Symbol> chainPath(Expr* expr) {
+    std::vector<Symbol> path;
+    while (auto* access = nodeCast<BinOpExpr>(expr)) {
+        path.push_back(static_cast<VarExpr*>(access->right)->name);
+        expr = access->left;
+    }
+    path.push_back(static_cast<VarExpr*>(expr)->name);
+    std::ranges::reverse(path);
+    return path;
+}
+
+/// Collects the outermost static chains in `root`, in order.
+void collectChains(Expr*& root, std::vector<Expr**>& chains) {
+    std::vector<Expr**> stack{&root};
+    while (!stack.empty()) {
+        auto* slot = stack.back();
+        stack.pop_back();
+        if (isStaticChain(*slot)) {
+            chains.push_back(slot);
+            continue;
+        }
+        // Pushed in reverse, the first child is taken first
+        auto children = stack.size();
+        forEachChild(*slot, [&](Expr*& child) { stack.push_back(&child); });
+        std::reverse(stack.begin() + static_cast<std::ptrdiff_t>(children), stack.end());
+    }
+}
+} // namespace
+
+void Localizer::localize(Program& program) {
+    arena = &program.arena;
+    counting = true;
+    rewriteBlock(program.statements);
+
+    std::vector<Stmt*> cached;
+    auto* any = TypeFactory::anyType();
+    auto makeVar = [&](std::string_view name) {
+        auto* var = arena->make<VarExpr>(intern(name));
+        var->type = any;
+        return var;
+    };
+    for (auto&& [name, reads] : globalReads) {
+        if (reads < MIN_USES || assignedGlobals.contains(name)) {
+            continue;
+        }
+        VarDecl* decl;
+        if (auto dot = name.find('.'); dot == std::string::npos) {
+            decl = arena->make<VarDecl>(intern(name), makeVar(name));
+        } else {
+            auto library = name.substr(0, dot);
+            auto field = name.substr(dot + 1);
+            if (assignedGlobals.contains(library)) {
+                continue;
+            }
+            auto local = intern(std::format("__{}_{}", library, field));
+            auto* access =
+                arena->make<BinOpExpr>(makeVar(library), TokenKind::MemberAccess, makeVar(field));
+            access->type = any;
+            decl = arena->make<VarDecl>(local, access);
+            cachedFields.emplace(name, local);
+        }
+        decl->type = any;
+        cached.push_back(decl);
+    }
+
+    counting = false;
+    rewriteBlock(program.statements);
+    program.statements.insert(program.statements.begin(), cached.begin(), cached.end());
+    arena = nullptr;
+}
+
+Expr* Localizer::rewrite(Expr* expr) {
+    rewritten = expr;
+    expr->accept(*this);
+    return rewritten;
+}
+
+void Localizer::rewriteBlock(std::vector<Stmt*>& statements) {
+    scopes.pushScope();
+    for (auto* stmt : statements) {
+        stmt->accept(*this);
+    }
+    scopes.popScope();
+    if (!counting) {
+        hoistChains(statements);
+    }
+}
+
+void Localizer::hoistChains(std::vector<Stmt*>& statements) {
+    struct Use {
+        size_t statement;
+        Expr** slot;
+    };
+    // Uses since the last statement with effects, by chain ("p.a.b")
+    std::map<std::string, std::vector<Use>> window;
+    std::unordered_set<Symbol> roots;
+    std::vector<std::pair<size_t, Stmt*>> locals;
+
+    auto flush = [&] {
+        std::unordered_set<std::string> names;
+        for (auto&& [key, uses] : window) {
+            if (uses.size() < MIN_USES) {
+                continue;
+            }
+            auto name = "__" + key;
+            std::ranges::replace(name, '.', '_');
+            if (!names.insert(name).second) {
+                name += std::format("_{}", names.size()); // "a_b.c" and "a.b_c"
+                names.insert(name);
+            }
+            Expr* chain = *uses.front().slot;
+            auto* decl = arena->make<VarDecl>(intern(name), chain);
+            decl->type = chain->type;
+            for (auto&& use : uses) {
+                auto* var = arena->make<VarExpr>(decl->name);
+                var->type = chain->type;
+                *use.slot = var;
+            }
+            locals.emplace_back(uses.front().statement, decl);
+        }
+        window.clear();
+        roots.clear();
+    };
+
+    for (size_t i = 0; i < statements.size(); ++i) {
+        if (hasEffects(statements[i])) {
+            flush();
+            continue;
+        }
+        std::vector<Expr**> chains;
+        for (auto* slot : directExpressions(statements[i])) {
+            collectChains(*slot, chains);
+        }
+        for (auto* slot : chains) {
+            auto path = chainPath(*slot);
+            std::string key = path.front().str();
+            for (auto&& field : path | std::views::drop(1)) {
+                key += "." + field.str();
+            }
+            window[key].push_back({i, slot});
+            roots.insert(path.front());
+        }
+        // Later uses of a redeclared root read another variable
+        if (std::ranges::any_of(declaredNames(statements[i]),
+                                [&](Symbol name) { return roots.contains(name); })) {
+            flush();
+        }
+    }
+    flush();
+
+    if (locals.empty()) {
+        return;
+    }
+    std::ranges::stable_sort(locals, {}, &std::pair<size_t, Stmt*>::first);
+    std::vector<Stmt*> result;
+    result.reserve(statements.size() + locals.size());
+    auto next = locals.begin();
+    for (size_t i = 0; i < statements.size(); ++i) {
+        for (; next != locals.end() && next->first == i; ++next) {
+            result.push_back(next->second);
+        }
+        result.push_back(statements[i]);
+    }
+    statements = std::move(result);
+}
+
+std::string Localizer::libraryField(const BinOpExpr& expr) const {
+    auto* library = nodeCast<VarExpr>(expr.left);
+    auto* field = nodeCast<VarExpr>(expr.right);
+    if (expr.op != TokenKind::MemberAccess || !library || !field || !isLibrary(library->name) ||
+        scopes.lookup(library->name) != LocalScopes::GLOBAL) {
+        return {};
+    }
+    return library->name.str() + "." + field->name.str();
+}
+
+void Localizer::noteAssignment(Expr* target) {
+    if (auto* var = nodeCast<VarExpr>(target)) {
+        if (scopes.lookup(var->name) == LocalScopes::GLOBAL) {
+            assignedGlobals.insert(var->name.str());
+        }
+    } else if (auto* access = nodeCast<BinOpExpr>(target)) {
+        if (auto field = libraryField(*access); !field.empty()) {
+            assignedGlobals.insert(field);
+        }
+    }
+}
+
+void Localizer::visit(StringExpr& expr) { rewritten = &expr; }
+
+void Localizer::visit(NumberExpr& expr) { rewritten = &expr; }
+
+void Localizer::visit(NilExpr& expr) { rewritten = &expr; }
+
+void Localizer::visit(BooleanExpr& expr) { rewritten = &expr; }
+
+void Localizer::visit(TableExpr& expr) {
+    forEachChild(&expr, [&](Expr*& child) { child = rewrite(child); });
+    rewritten = &expr;
+}
+
+void Localizer::visit(VarExpr& expr) {
+    if (counting && isLibraryGlobal(expr.name) &&
+        scopes.lookup(expr.name) == LocalScopes::GLOBAL) {
+        ++globalReads[expr.name.str()];
+    }
+    rewritten = &expr;
+}
+
+void Localizer::visit(UnaryOpExpr& expr) { rewriteOperators(expr); }
+
+void Localizer::visit(BinOpExpr& expr) { rewriteOperators(expr); }
+
+void Localizer::rewriteOperators(Expr& root) {
+    Expr* result = &root;
+    std::vector<Expr**> stack{&result};
+    while (!stack.empty()) {
+        auto* slot = stack.back();
+        stack.pop_back();
+        auto* binOp = nodeCast<BinOpExpr>(*slot);
+        auto field = binOp ? libraryField(*binOp) : std::string{};
+        if (!field.empty()) {
+            *slot = readField(*binOp, field);
+        } else if (binOp) {
+            // Pushed in reverse, the left operand is taken first
+            if (binOp->op != TokenKind::MemberAccess) {
+                stack.push_back(&binOp->right);
+            }
+            stack.push_back(&binOp->left);
+        } else if (auto* unary = nodeCast<UnaryOpExpr>(*slot)) {
+            stack.push_back(&unary->right);
+        } else {
+            *slot = rewrite(*slot);
+        }
+    }
+    rewritten = result;
+}
+
+Expr* Localizer::readField(BinOpExpr& expr, const std::string& field) {
+    if (counting) {
+        ++globalReads[field];
+    } else if (auto cached = cachedFields.find(field); cached != cachedFields.end()) {
+        auto* var = arena->make<VarExpr>(cached->second);
+        var->type = expr.type;
+        return var;
+    }
+    return &expr;
+}
+
+void Localizer::visit(IndexExpr& expr) {
+    forEachChild(&expr, [&](Expr*& child) { child = rewrite(child); });
+    rewritten = &expr;
+}
+
+void Localizer::visit(FunCallExpr& expr) {
+    forEachChild(&expr, [&](Expr*& child) { child = rewrite(child); });
+    rewritten = &expr;
+}
+
+void Localizer::visit(FunDecl& stmt) {
+    if (stmt.local) {
+        scopes.define(stmt.name);
+    } else if (counting && scopes.lookup(stmt.name) == LocalScopes::GLOBAL) {
+        assignedGlobals.insert(stmt.name.str());
+    }
+    scopes.pushScope();
+    for (auto&& param : stmt.params) {
+        scopes.define(param.name);
+    }
+    stmt.body->accept(*this);
+    scopes.popScope();
+}
+
+void Localizer::visit(VarDecl& stmt) {
+    stmt.initExpr = rewrite(stmt.initExpr);
+    scopes.define(stmt.name);
+}
+
+void Localizer::visit(VarDecls& stmt) {
+    // All initializers run before any of the names is in scope
+    for (auto* decl : stmt.decls) {
+        decl->initExpr = rewrite(decl->initExpr);
+    }
+    for (auto* decl : stmt.decls) {
+        scopes.define(decl->name);
+    }
+}
+
+void Localizer::visit(IfStmt& stmt) {
+    for (auto& arm : stmt.arms) {
+        arm.condition = rewrite(arm.condition);
+        arm.body->accept(*this);
+    }
+    if (stmt.else_branch) {
+        stmt.else_branch->accept(*this);
+    }
+}
+
+void Localizer::visit(ReturnStmt& stmt) {
+    for (auto& value : stmt.return_values) {
+        value = rewrite(value);
+    }
+}
+
+void Localizer::visit(BlockStmt& stmt) { rewriteBlock(stmt.statements); }
+
+void Localizer::visit(FunCallStmt& stmt) {
+    forEachChild(stmt.call, [&](Expr*& child) { child = rewrite(child); });
+}
+
+void Localizer::visit(AssignStmt& stmt) {
+    if (counting) {
+        noteAssignment(stmt.left);
+    }
+    // The target is written, not read: only the parts of it that are evaluated are rewritten
+    forEachChild(stmt.left, [&](Expr*& child) { child = rewrite(child); });
+    stmt.right = rewrite(stmt.right);
+}
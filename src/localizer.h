@@ -0,0 +1,72 @@
+#pragma once
+#include "ast.h"
+#include "local_scopes.h"
+#include "visitor.h"
+
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/// Caches values the generated Lua would otherwise look up every time they are read:
+/// - Lua standard library globals (`print`, `math`, ...) and library fields (`string.format`)
+///   read at least MIN_USES times are copied into locals at the top of the chunk, which makes
+///   them upvalues of every function. Names the chunk assigns are left alone.
+/// - Member access chains on statically typed tables (`a.b.c`) read at least MIN_USES times
+///   in a run of statements without calls or assignments are read once into a local, in the
+///   block they are used in.
+class Localizer final : public Visitor {
+  public:
+    static constexpr size_t MIN_USES = 2;
+
+    void localize(Program& program);
+
+    // Expression visitors
+    void visit(StringExpr& expr) override;
+    void visit(NumberExpr& expr) override;
+    void visit(NilExpr& expr) override;
+    void visit(BooleanExpr& expr) override;
+    void visit(TableExpr& expr) override;
+    void visit(VarExpr& expr) override;
+    void visit(UnaryOpExpr& expr) override;
+    void visit(BinOpExpr& expr) override;
+    void visit(IndexExpr& expr) override;
+    void visit(FunCallExpr& expr) override;
+
+    // Statement visitors
+    void visit(FunDecl& stmt) override;
+    void visit(VarDecl& stmt) override;
+    void visit(VarDecls& stmt) override;
+    void visit(IfStmt& stmt) override;
+    void visit(ReturnStmt& stmt) override;
+    void visit(BlockStmt& stmt) override;
+    void visit(FunCallStmt& stmt) override;
+    void visit(AssignStmt& stmt) override;
+
+  private:
+    // The program is walked twice: once counting global reads, once rewriting
+    bool counting = true;
+    AstArena* arena = nullptr;
+    // Set by the expression visitors: the node replacing the visited expression
+    Expr* rewritten = nullptr;
+    LocalScopes scopes;
+
+    // Reads of library globals ("math") and library fields ("math.floor")
+    std::map<std::string, size_t> globalReads;
+    std::unordered_set<std::string> assignedGlobals;
+    // Library fields chosen for caching, with the local holding each one
+    std::map<std::string, Symbol> cachedFields;
+
+    Expr* rewrite(Expr* expr);
+    void rewriteBlock(std::vector<Stmt*>& statements);
+    /// Reads each static member access chain used often enough in `statements` only once.
+    void hoistChains(std::vector<Stmt*>& statements);
+    /// Rewrites the operands of the operator chain `root` starts, left to right, keeping the
+    /// operators still to take apart on an explicit stack instead of recursing along the chain.
+    void rewriteOperators(Expr& root);
+    /// "lib.field" if `expr` reads a field of a library global, empty otherwise.
+    std::string libraryField(const BinOpExpr& expr) const;
+    /// Counts the read of `field` by `expr`, or returns the local caching it (`expr` if none).
+    Expr* readField(BinOpExpr& expr, const std::string& field);
+    void noteAssignment(Expr* target);
+};
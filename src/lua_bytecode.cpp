@@ -0,0 +1,1234 @@
+#include "lua_bytecode.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+using namespace lua_bytecode;
+
+namespace {
+// Registers 0 to 254, as in the Lua compiler
+constexpr uint32_t MAX_REGISTERS = 255;
+constexpr uint32_t MAX_UPVALUES = 255;
+// Lua only looks up short strings with GETFIELD, GETTABUP, SETFIELD and SETTABUP
+constexpr size_t MAX_SHORT_STRING = 40;
+// Array elements stored per SETLIST
+constexpr uint32_t FIELDS_PER_FLUSH = 50;
+
+// Metamethod events OP_MMBIN and friends name
+constexpr uint32_t TM_ADD = 6;
+constexpr uint32_t TM_SUB = 7;
+constexpr uint32_t TM_MUL = 8;
+constexpr uint32_t TM_DIV = 11;
+constexpr uint32_t TM_IDIV = 12;
+
+// Constant type tags of the chunk format
+constexpr uint8_t TAG_NIL = 0x00;
+constexpr uint8_t TAG_FALSE = 0x01;
+constexpr uint8_t TAG_TRUE = 0x11;
+constexpr uint8_t TAG_INTEGER = 0x03;
+constexpr uint8_t TAG_FLOAT = 0x13;
+constexpr uint8_t TAG_SHORT_STRING = 0x04;
+constexpr uint8_t TAG_LONG_STRING = 0x14;
+
+// Line info: a relative line per instruction, an absolute one at least every 128
+constexpr int LINE_DIFF_LIMIT = 0x80;
+constexpr int8_t ABSOLUTE_LINE = -0x80;
+constexpr int MAX_WITHOUT_ABSOLUTE = 128;
+
+const char* OPCODE_NAMES[] = {
+    "MOVE",     "LOADI",      "LOADF",    "LOADK",    "LOADKX",   "LOADFALSE", "LFALSESKIP",
+    "LOADTRUE", "LOADNIL",    "GETUPVAL", "SETUPVAL", "GETTABUP", "GETTABLE",  "GETI",
+    "GETFIELD", "SETTABUP",   "SETTABLE", "SETI",     "SETFIELD", "NEWTABLE",  "SELF",
+    "ADDI",     "ADDK",       "SUBK",     "MULK",     "MODK",     "POWK",      "DIVK",
+    "IDIVK",    "BANDK",      "BORK",     "BXORK",    "SHRI",     "SHLI",      "ADD",
+    "SUB",      "MUL",        "MOD",      "POW",      "DIV",      "IDIV",      "BAND",
+    "BOR",      "BXOR",       "SHL",      "SHR",      "MMBIN",    "MMBINI",    "MMBINK",
+    "UNM",      "BNOT",       "NOT",      "LEN",      "CONCAT",   "CLOSE",     "TBC",
+    "JMP",      "EQ",         "LT",       "LE",       "EQK",      "EQI",       "LTI",
+    "LEI",      "GTI",        "GEI",      "TEST",     "TESTSET",  "CALL",      "TAILCALL",
+    "RETURN",   "RETURN0",    "RETURN1",  "FORLOOP",  "FORPREP",  "TFORPREP",  "TFORCALL",
+    "TFORLOOP", "SETLIST",    "CLOSURE",  "VARARG",   "VARARGPREP", "EXTRAARG",
+};
+
+bool fitsC(int64_t value) { return value >= -OFFSET_SC && value <= OFFSET_SC + 1; }
+
+bool fitsBx(int64_t value) { return value >= -OFFSET_SBX && value <= OFFSET_SBX + 1; }
+
+/// The smallest n with 2^n >= x.
+uint32_t ceilLog2(uint32_t x) { return x <= 1 ? 0 : std::bit_width(x - 1); }
+
+bool isComparison(TokenKind op) {
+    switch (op) {
+    case TokenKind::Equal:
+    case TokenKind::NotEqual:
+    case TokenKind::Less:
+    case TokenKind::Greater:
+    case TokenKind::LessEqual:
+    case TokenKind::GreaterEqual:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// The register form of an arithmetic operator and its metamethod event.
+std::pair<OpCode, uint32_t> arithmetic(TokenKind op) {
+    switch (op) {
+    case TokenKind::Plus:
+        return {OpCode::Add, TM_ADD};
+    case TokenKind::Minus:
+        return {OpCode::Sub, TM_SUB};
+    case TokenKind::Star:
+        return {OpCode::Mul, TM_MUL};
+    case TokenKind::Slash:
+        return {OpCode::Div, TM_DIV};
+    case TokenKind::FloorDiv:
+        return {OpCode::IDiv, TM_IDIV};
+    default:
+        throw std::runtime_error(std::format("No Lua operator for {}", tokenKindToStr(op)));
+    }
+}
+
+/// The constant form of an arithmetic register form: ADD -> ADDK.
+OpCode withConstant(OpCode op) {
+    return static_cast<OpCode>(static_cast<int>(op) - static_cast<int>(OpCode::Add) +
+                               static_cast<int>(OpCode::AddK));
+}
+
+/// Operators evaluated operands first, which emitOperators walks without recursion.
+bool isChainOperator(const Expr* expr) {
+    if (nodeCast<UnaryOpExpr>(expr)) {
+        return true;
+    }
+    auto* binOp = nodeCast<BinOpExpr>(expr);
+    return binOp && binOp->op != TokenKind::And && binOp->op != TokenKind::Or &&
+           binOp->op != TokenKind::MemberAccess && binOp->op != TokenKind::Colon;
+}
+
+/// The value of a literal, if `expr` is one.
+std::optional<Constant> literal(const Expr* expr) {
+    if (auto* string = nodeCast<StringExpr>(expr)) {
+        return string->val.str();
+    }
+    if (auto* number = nodeCast<NumberExpr>(expr)) {
+        return number->integer ? Constant{*number->integer} : Constant{number->val};
+    }
+    if (auto* boolean = nodeCast<BooleanExpr>(expr)) {
+        return boolean->val;
+    }
+    if (nodeCast<NilExpr>(expr)) {
+        return std::monostate{};
+    }
+    return std::nullopt;
+}
+
+std::optional<int64_t> integerLiteral(const Expr* expr) {
+    auto* number = nodeCast<NumberExpr>(expr);
+    return number ? number->integer : std::nullopt;
+}
+
+/// Writes the chunk format: sizes as 7-bit groups, most significant first, the last one
+/// marked with 0x80; numbers and instructions in native byte order.
+class Dumper {
+  public:
+    std::string out;
+
+    void byte(uint8_t value) { out += static_cast<char>(value); }
+
+    void size(uint64_t value) {
+        uint8_t buffer[10];
+        int n = 0;
+        do {
+            buffer[n++] = value & 0x7f;
+            value >>= 7;
+        } while (value != 0);
+        buffer[0] |= 0x80;
+        while (n > 0) {
+            byte(buffer[--n]);
+        }
+    }
+
+    template <typename T> void raw(T value) {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        out.append(bytes, sizeof(T));
+    }
+
+    void string(std::optional<std::string_view> text) {
+        if (!text) {
+            size(0);
+            return;
+        }
+        size(text->size() + 1);
+        out += *text;
+    }
+
+    void function(const Function& f, std::optional<std::string_view> source) {
+        string(source);
+        size(f.lineDefined);
+        size(f.lastLineDefined);
+        byte(f.numParams);
+        byte(f.vararg);
+        byte(f.maxStackSize);
+
+        size(f.code.size());
+        for (auto instruction : f.code) {
+            raw(instruction);
+        }
+
+        size(f.constants.size());
+        for (const auto& value : f.constants) {
+            constant(value);
+        }
+
+        size(f.upvalues.size());
+        for (const auto& upvalue : f.upvalues) {
+            byte(upvalue.inStack);
+            byte(upvalue.index);
+            byte(0); // a regular variable
+        }
+
+        size(f.functions.size());
+        for (const auto& nested : f.functions) {
+            // Nested functions share the source of the chunk
+            function(*nested, std::nullopt);
+        }
+        debug(f);
+    }
+
+  private:
+    void constant(const Constant& value) {
+        std::visit(overloaded{[&](std::monostate) { byte(TAG_NIL); },
+                              [&](bool b) { byte(b ? TAG_TRUE : TAG_FALSE); },
+                              [&](int64_t i) {
+                                  byte(TAG_INTEGER);
+                                  raw(i);
+                              },
+                              [&](double d) {
+                                  byte(TAG_FLOAT);
+                                  raw(d);
+                              },
+                              [&](const std::string& s) {
+                                  byte(s.size() <= MAX_SHORT_STRING ? TAG_SHORT_STRING
+                                                                    : TAG_LONG_STRING);
+                                  string(s);
+                              }},
+                   value);
+    }
+
+    void debug(const Function& f) {
+        // The same encoding as savelineinfo in lcode.c
+        std::vector<int8_t> relative;
+        std::vector<std::pair<size_t, uint32_t>> absolute;
+        int previous = static_cast<int>(f.lineDefined);
+        int withoutAbsolute = 0;
+        for (size_t pc = 0; pc < f.lines.size(); ++pc) {
+            int line = static_cast<int>(f.lines[pc]);
+            int diff = line - previous;
+            if (std::abs(diff) >= LINE_DIFF_LIMIT || withoutAbsolute++ >= MAX_WITHOUT_ABSOLUTE) {
+                absolute.emplace_back(pc, f.lines[pc]);
+                diff = ABSOLUTE_LINE;
+                withoutAbsolute = 1;
+            }
+            relative.push_back(static_cast<int8_t>(diff));
+            previous = line;
+        }
+        size(relative.size());
+        for (auto diff : relative) {
+            byte(static_cast<uint8_t>(diff));
+        }
+        size(absolute.size());
+        for (auto [pc, line] : absolute) {
+            size(pc);
+            size(line);
+        }
+        size(0); // local names
+        size(f.upvalues.size());
+        for (const auto& upvalue : f.upvalues) {
+            string(upvalue.name.str());
+        }
+    }
+};
+} // namespace
+
+std::string Function::listing() const {
+    std::string result;
+    for (auto i : code) {
+        auto op = opcode(i);
+        result += OPCODE_NAMES[static_cast<int>(op)];
+        switch (op) {
+        case OpCode::LoadK:
+        case OpCode::LoadKX:
+        case OpCode::Closure:
+            result += std::format(" {} {}", argA(i), argBx(i));
+            break;
+        case OpCode::LoadI:
+        case OpCode::LoadF:
+            result += std::format(" {} {}", argA(i), argSBx(i));
+            break;
+        case OpCode::Jmp:
+            result += std::format(" {}", argSJ(i));
+            break;
+        case OpCode::ExtraArg:
+            result += std::format(" {}", argAx(i));
+            break;
+        case OpCode::AddI:
+            result += std::format(" {} {} {}", argA(i), argB(i),
+                                  static_cast<int>(argC(i)) - OFFSET_SC);
+            break;
+        case OpCode::MMBinI:
+        case OpCode::EqI:
+        case OpCode::LtI:
+        case OpCode::LeI:
+        case OpCode::GtI:
+        case OpCode::GeI:
+            result += std::format(" {} {} {}", argA(i), static_cast<int>(argB(i)) - OFFSET_SC,
+                                  argC(i));
+            break;
+        default:
+            result += std::format(" {} {} {}", argA(i), argB(i), argC(i));
+        }
+        if (argK(i) && op != OpCode::LoadK && op != OpCode::LoadKX && op != OpCode::Closure &&
+            op != OpCode::LoadI && op != OpCode::LoadF && op != OpCode::Jmp &&
+            op != OpCode::ExtraArg) {
+            result += " k";
+        }
+        result += '\n';
+    }
+    for (size_t i = 0; i < functions.size(); ++i) {
+        result += std::format("function {}\n", i);
+        auto nested = functions[i]->listing();
+        for (size_t start = 0; start < nested.size();) {
+            auto end = nested.find('\n', start);
+            result += "    " + nested.substr(start, end + 1 - start);
+            start = end + 1;
+        }
+    }
+    return result;
+}
+
+std::string lua_bytecode::dump(const Function& main, std::string_view chunkName) {
+    Dumper dumper;
+    dumper.out = "\x1bLua";
+    dumper.byte(0x54); // version
+    dumper.byte(0);    // official format
+    dumper.out += "\x19\x93\r\n\x1a\n";
+    dumper.byte(sizeof(uint32_t)); // Instruction
+    dumper.byte(sizeof(int64_t));  // lua_Integer
+    dumper.byte(sizeof(double));   // lua_Number
+    // Tell the loader the byte order and the float format
+    dumper.raw(int64_t{0x5678});
+    dumper.raw(370.5);
+    dumper.byte(static_cast<uint8_t>(main.upvalues.size()));
+    dumper.function(main, chunkName);
+    return dumper.out;
+}
+
+std::unique_ptr<Function> LuaBytecode::compile(Program& program) {
+    auto main = std::make_unique<Function>();
+    main->vararg = true;
+    FunctionState state{main.get(), nullptr};
+    line = 1;
+    openFunction(*main, state);
+    main->upvalues.push_back({intern("_ENV"), true, 0});
+    emit(iABC(OpCode::VarArgPrep, 0, 0, 0));
+    for (auto* stmt : program.statements) {
+        stmt->accept(*this);
+    }
+    closeFunction();
+    return main;
+}
+
+void LuaBytecode::generate(Program& program, OutputSink& sink, std::string_view chunkName) {
+    sink.write(dump(*compile(program), chunkName));
+}
+
+std::string LuaBytecode::generate(Program& program, std::string_view chunkName) {
+    return dump(*compile(program), chunkName);
+}
+
+void LuaBytecode::openFunction(Function& function, FunctionState& state) {
+    state.function = &function;
+    state.parent = fs;
+    fs = &state;
+}
+
+void LuaBytecode::closeFunction() {
+    emit(iABC(OpCode::Return, localCount(), 1, 0));
+    auto& function = *fs->function;
+    // Like luaK_finish: returns close the upvalues of captured locals and undo the vararg
+    // adjustment
+    for (auto& instruction : function.code) {
+        auto op = opcode(instruction);
+        if (op != OpCode::Return && op != OpCode::TailCall) {
+            continue;
+        }
+        instruction = iABC(op, argA(instruction), argB(instruction),
+                           function.vararg ? function.numParams + 1 : 0, fs->needsClose);
+    }
+    function.lastLineDefined = function.lineDefined == 0 ? 0 : line;
+    fs = fs->parent;
+}
+
+void LuaBytecode::emitClosure(FunDecl& decl, uint8_t reg) {
+    auto& parent = *fs->function;
+    auto function = std::make_unique<Function>();
+    function->lineDefined = decl.loc.line;
+    FunctionState state{function.get(), nullptr};
+    auto enclosingLine = line;
+    openFunction(*function, state);
+
+    // Parameters are the first locals
+    if (decl.method) {
+        reserve();
+        addLocal(intern("self"));
+    }
+    for (const auto& param : decl.params) {
+        reserve();
+        addLocal(param.name);
+    }
+    function->numParams = localCount();
+    // The body shares the scope of the parameters, the return closes its upvalues
+    if (auto* body = nodeCast<BlockStmt>(decl.body)) {
+        for (auto* stmt : body->statements) {
+            stmt->accept(*this);
+        }
+    } else {
+        decl.body->accept(*this);
+    }
+    closeFunction();
+    line = enclosingLine;
+
+    parent.functions.push_back(std::move(function));
+    emit(iABx(OpCode::Closure, reg, static_cast<uint32_t>(parent.functions.size() - 1)));
+}
+
+void LuaBytecode::startStatement(const Stmt& stmt) {
+    // Statements the compiler made up belong to the source line before them
+    if (stmt.loc.line != 0) {
+        line = stmt.loc.line;
+    }
+}
+
+void LuaBytecode::enterBlock() { fs->blocks.push_back(fs->locals.size()); }
+
+void LuaBytecode::leaveBlock(bool closeUpvalues) {
+    size_t mark = fs->blocks.back();
+    fs->blocks.pop_back();
+    auto captured = std::find_if(fs->locals.begin() + static_cast<std::ptrdiff_t>(mark),
+                                 fs->locals.end(), [](auto&& local) { return local.captured; });
+    if (captured != fs->locals.end() && closeUpvalues) {
+        // Closures keep the values, the registers are taken by the next locals
+        emit(iABC(OpCode::Close, static_cast<uint32_t>(captured - fs->locals.begin()), 0, 0));
+    }
+    fs->locals.resize(mark);
+    fs->firstFree = static_cast<uint32_t>(mark);
+}
+
+void LuaBytecode::addLocal(Symbol name) { fs->locals.push_back({name}); }
+
+uint8_t LuaBytecode::reserve(uint32_t count) {
+    auto first = fs->firstFree;
+    fs->firstFree += count;
+    if (fs->firstFree >= MAX_REGISTERS) {
+        throw std::runtime_error(std::format(
+            "Line {}: function or expression needs more than {} registers", line, MAX_REGISTERS));
+    }
+    auto& maxStackSize = fs->function->maxStackSize;
+    maxStackSize = std::max(maxStackSize, static_cast<uint8_t>(fs->firstFree));
+    return static_cast<uint8_t>(first);
+}
+
+void LuaBytecode::freeRegister(uint8_t reg) {
+    if (reg >= localCount()) {
+        assert(reg + 1u == fs->firstFree && "Temporaries are released in reverse order");
+        --fs->firstFree;
+    }
+}
+
+void LuaBytecode::freeRegisters(uint8_t first, uint8_t second) {
+    freeRegister(std::max(first, second));
+    freeRegister(std::min(first, second));
+}
+
+uint8_t LuaBytecode::place(int reg) { return reg == FRESH ? reserve() : static_cast<uint8_t>(reg); }
+
+void LuaBytecode::finish(int reg, uint8_t value) {
+    if (reg == FRESH) {
+        result = value;
+        return;
+    }
+    if (reg != value) {
+        emit(iABC(OpCode::Move, reg, value, 0));
+    }
+    freeRegister(value);
+    result = static_cast<uint8_t>(reg);
+}
+
+LuaBytecode::Variable LuaBytecode::resolve(FunctionState& state, Symbol name) {
+    for (size_t i = state.locals.size(); i-- > 0;) {
+        if (state.locals[i].name == name) {
+            return {Variable::Local, static_cast<uint8_t>(i)};
+        }
+    }
+    auto& upvalues = state.function->upvalues;
+    for (size_t i = 0; i < upvalues.size(); ++i) {
+        if (upvalues[i].name == name) {
+            return {Variable::Upvalue, static_cast<uint8_t>(i)};
+        }
+    }
+    if (state.parent == nullptr) {
+        return {Variable::Global};
+    }
+    auto outer = resolve(*state.parent, name);
+    switch (outer.kind) {
+    case Variable::Local:
+        state.parent->locals[outer.index].captured = true;
+        state.parent->needsClose = true;
+        return {Variable::Upvalue, addUpvalue(state, name, true, outer.index)};
+    case Variable::Upvalue:
+        return {Variable::Upvalue, addUpvalue(state, name, false, outer.index)};
+    default:
+        return {Variable::Global};
+    }
+}
+
+uint8_t LuaBytecode::addUpvalue(FunctionState& state, Symbol name, bool inStack, uint8_t index) {
+    auto& upvalues = state.function->upvalues;
+    if (upvalues.size() >= MAX_UPVALUES) {
+        throw std::runtime_error(
+            std::format("Line {}: function needs more than {} upvalues", line, MAX_UPVALUES));
+    }
+    upvalues.push_back({name, inStack, index});
+    return static_cast<uint8_t>(upvalues.size() - 1);
+}
+
+size_t LuaBytecode::emit(uint32_t instruction) {
+    fs->function->code.push_back(instruction);
+    fs->function->lines.push_back(line);
+    return fs->function->code.size() - 1;
+}
+
+size_t LuaBytecode::emitJump() { return emit(isJ(OpCode::Jmp, 0)); }
+
+void LuaBytecode::patchToHere(const std::vector<size_t>& jumps) {
+    auto& code = fs->function->code;
+    for (auto jump : jumps) {
+        auto offset = static_cast<int64_t>(code.size()) - static_cast<int64_t>(jump + 1);
+        if (offset > OFFSET_SJ) {
+            throw std::runtime_error(std::format("Line {}: control structure too long", line));
+        }
+        code[jump] = isJ(OpCode::Jmp, static_cast<int32_t>(offset));
+    }
+}
+
+uint32_t LuaBytecode::constant(const Constant& value) {
+    // Keyed by the bits, 0.0 and -0.0 are different constants
+    std::string key(1, static_cast<char>(value.index()));
+    std::visit(overloaded{[](std::monostate) {}, [&](bool b) { key += b ? '1' : '0'; },
+                          [&](int64_t i) { key.append(reinterpret_cast<char*>(&i), sizeof i); },
+                          [&](double d) { key.append(reinterpret_cast<char*>(&d), sizeof d); },
+                          [&](const std::string& s) { key += s; }},
+               value);
+    auto& constants = fs->function->constants;
+    auto [found, inserted] =
+        fs->constants.try_emplace(std::move(key), static_cast<uint32_t>(constants.size()));
+    if (inserted) {
+        constants.push_back(value);
+    }
+    return found->second;
+}
+
+std::optional<uint8_t> LuaBytecode::keyConstant(std::string_view key) {
+    if (key.size() > MAX_SHORT_STRING) {
+        return std::nullopt;
+    }
+    auto index = constant(std::string(key));
+    if (index > MAXARG_C) {
+        return std::nullopt;
+    }
+    return static_cast<uint8_t>(index);
+}
+
+void LuaBytecode::loadConstant(uint8_t reg, const Constant& value) {
+    if (std::holds_alternative<std::monostate>(value)) {
+        emit(iABC(OpCode::LoadNil, reg, 0, 0));
+        return;
+    }
+    if (auto* b = std::get_if<bool>(&value)) {
+        emit(iABC(*b ? OpCode::LoadTrue : OpCode::LoadFalse, reg, 0, 0));
+        return;
+    }
+    if (auto* i = std::get_if<int64_t>(&value); i && fitsBx(*i)) {
+        emit(iAsBx(OpCode::LoadI, reg, static_cast<int32_t>(*i)));
+        return;
+    }
+    if (auto* d = std::get_if<double>(&value);
+        d && *d == std::trunc(*d) && fitsBx(static_cast<int64_t>(*d)) && !std::signbit(*d)) {
+        emit(iAsBx(OpCode::LoadF, reg, static_cast<int32_t>(*d)));
+        return;
+    }
+    auto index = constant(value);
+    if (index <= MAXARG_BX) {
+        emit(iABx(OpCode::LoadK, reg, index));
+    } else {
+        emit(iABx(OpCode::LoadKX, reg, 0));
+        emit(iAx(OpCode::ExtraArg, index));
+    }
+}
+
+uint8_t LuaBytecode::emitExpr(Expr* expr, int reg) {
+    // On top of the temporaries, `reg` is where a new register would go
+    if (reg != FRESH && reg + 1u == fs->firstFree && reg >= localCount()) {
+        freeRegister(static_cast<uint8_t>(reg));
+        reg = FRESH;
+    }
+    target = reg;
+    expr->accept(*this);
+    return result;
+}
+
+uint8_t LuaBytecode::emitOperand(Expr* expr) {
+    if (auto* var = nodeCast<VarExpr>(expr)) {
+        auto variable = resolve(*fs, var->name);
+        if (variable.kind == Variable::Local) {
+            return variable.index;
+        }
+    }
+    return emitExpr(expr);
+}
+
+void LuaBytecode::loadVariable(uint8_t reg, Symbol name) {
+    auto variable = resolve(*fs, name);
+    switch (variable.kind) {
+    case Variable::Local:
+        if (reg != variable.index) {
+            emit(iABC(OpCode::Move, reg, variable.index, 0));
+        }
+        return;
+    case Variable::Upvalue:
+        emit(iABC(OpCode::GetUpval, reg, variable.index, 0));
+        return;
+    case Variable::Global:
+        break;
+    }
+    // Globals are fields of _ENV
+    auto env = resolve(*fs, intern("_ENV"));
+    if (env.kind == Variable::Upvalue) {
+        if (auto key = keyConstant(name.str())) {
+            emit(iABC(OpCode::GetTabUp, reg, env.index, *key));
+            return;
+        }
+        emit(iABC(OpCode::GetUpval, reg, env.index, 0));
+        getField(reg, reg, name.str());
+        return;
+    }
+    getField(reg, env.index, name.str());
+}
+
+void LuaBytecode::storeVariable(Symbol name, uint8_t value) {
+    auto variable = resolve(*fs, name);
+    switch (variable.kind) {
+    case Variable::Local:
+        if (value != variable.index) {
+            emit(iABC(OpCode::Move, variable.index, value, 0));
+        }
+        return;
+    case Variable::Upvalue:
+        emit(iABC(OpCode::SetUpval, value, variable.index, 0));
+        return;
+    case Variable::Global:
+        break;
+    }
+    auto env = resolve(*fs, intern("_ENV"));
+    if (env.kind == Variable::Local) {
+        setField(env.index, name.str(), value);
+        return;
+    }
+    if (auto key = keyConstant(name.str())) {
+        emit(iABC(OpCode::SetTabUp, env.index, *key, value));
+        return;
+    }
+    uint8_t table = reserve();
+    emit(iABC(OpCode::GetUpval, table, env.index, 0));
+    setField(table, name.str(), value);
+    freeRegister(table);
+}
+
+void LuaBytecode::getField(uint8_t reg, uint8_t object, std::string_view key) {
+    if (auto index = keyConstant(key)) {
+        emit(iABC(OpCode::GetField, reg, object, *index));
+        return;
+    }
+    uint8_t keyReg = reserve();
+    loadConstant(keyReg, std::string(key));
+    emit(iABC(OpCode::GetTable, reg, object, keyReg));
+    freeRegister(keyReg);
+}
+
+void LuaBytecode::setField(uint8_t object, std::string_view key, uint8_t value) {
+    if (auto index = keyConstant(key)) {
+        emit(iABC(OpCode::SetField, object, *index, value));
+        return;
+    }
+    uint8_t keyReg = reserve();
+    loadConstant(keyReg, std::string(key));
+    emit(iABC(OpCode::SetTable, object, keyReg, value));
+    freeRegister(keyReg);
+}
+
+void LuaBytecode::visit(StringExpr& expr) {
+    result = place(target);
+    loadConstant(result, expr.val.str());
+}
+
+void LuaBytecode::visit(NumberExpr& expr) {
+    result = place(target);
+    loadConstant(result, expr.integer ? Constant{*expr.integer} : Constant{expr.val});
+}
+
+void LuaBytecode::visit(NilExpr& /*expr*/) {
+    result = place(target);
+    loadConstant(result, std::monostate{});
+}
+
+void LuaBytecode::visit(BooleanExpr& expr) {
+    result = place(target);
+    loadConstant(result, expr.val);
+}
+
+void LuaBytecode::visit(TableExpr& expr) {
+    int reg = target;
+    uint8_t table = reserve();
+    size_t newTable = emit(iABC(OpCode::NewTable, table, 0, 0));
+    emit(iAx(OpCode::ExtraArg, 0));
+
+    // Array elements go to the registers above the table, SETLIST moves them in batches
+    uint32_t stored = 0;
+    uint32_t pending = 0;
+    bool open = false;
+    auto flush = [&](uint32_t count) {
+        if (stored <= MAXARG_C) {
+            emit(iABC(OpCode::SetList, table, count, stored));
+        } else {
+            emit(iABC(OpCode::SetList, table, count, stored % (MAXARG_C + 1), true));
+            emit(iAx(OpCode::ExtraArg, stored / (MAXARG_C + 1)));
+        }
+        stored += pending;
+        pending = 0;
+        fs->firstFree = table + 1u;
+    };
+    for (size_t i = 0; i < expr.arrayPart.size(); ++i) {
+        auto* call = nodeCast<FunCallExpr>(expr.arrayPart[i]);
+        if (call && i + 1 == expr.arrayPart.size()) {
+            // A call last in the list adds all of its results
+            emitCall(*call, ALL_RESULTS);
+            open = true;
+            flush(0);
+            break;
+        }
+        emitExpr(expr.arrayPart[i]);
+        if (++pending == FIELDS_PER_FLUSH) {
+            flush(pending);
+        }
+    }
+    if (pending > 0) {
+        flush(pending);
+    }
+    for (auto& [key, value] : expr.mapPart) {
+        uint8_t valueReg = emitOperand(value);
+        setField(table, key.str(), valueReg);
+        freeRegister(valueReg);
+    }
+
+    // Sized up front, so filling the table doesn't rehash it
+    auto arraySize = static_cast<uint32_t>(expr.arrayPart.size()) - (open ? 1 : 0);
+    auto hashSize = static_cast<uint32_t>(expr.mapPart.size());
+    auto& code = fs->function->code;
+    code[newTable] = iABC(OpCode::NewTable, table, hashSize > 0 ? ceilLog2(hashSize) + 1 : 0,
+                          arraySize % (MAXARG_C + 1), arraySize > MAXARG_C);
+    code[newTable + 1] = iAx(OpCode::ExtraArg, arraySize / (MAXARG_C + 1));
+    finish(reg, table);
+}
+
+void LuaBytecode::visit(VarExpr& expr) {
+    result = place(target);
+    loadVariable(result, expr.name);
+}
+
+void LuaBytecode::visit(UnaryOpExpr& expr) { emitOperators(expr); }
+
+void LuaBytecode::visit(BinOpExpr& expr) {
+    switch (expr.op) {
+    case TokenKind::And:
+    case TokenKind::Or:
+        emitLogical(expr);
+        return;
+    case TokenKind::MemberAccess: {
+        int reg = target;
+        uint8_t object = emitOperand(expr.left);
+        freeRegister(object);
+        result = place(reg);
+        getField(result, object, static_cast<VarExpr*>(expr.right)->name.str());
+        return;
+    }
+    case TokenKind::Colon:
+        throw std::runtime_error(std::format("Line {}: method access outside of a call", line));
+    default:
+        emitOperators(expr);
+    }
+}
+
+std::pair<LuaBytecode::Operand, uint32_t> LuaBytecode::rightOperand(const BinOpExpr& expr) {
+    auto integer = integerLiteral(expr.right);
+    if (isComparison(expr.op)) {
+        if (integer && fitsC(*integer)) {
+            return {Operand::Immediate, static_cast<uint32_t>(*integer + OFFSET_SC)};
+        }
+        auto value = literal(expr.right);
+        if (value && (expr.op == TokenKind::Equal || expr.op == TokenKind::NotEqual)) {
+            if (auto index = constant(*value); index <= MAXARG_B) {
+                return {Operand::Constant, index};
+            }
+        }
+        return {Operand::Register, 0};
+    }
+    if (expr.op == TokenKind::Concat) {
+        return {Operand::Register, 0};
+    }
+    if (expr.op == TokenKind::Plus && integer && fitsC(*integer)) {
+        return {Operand::Immediate, static_cast<uint32_t>(*integer + OFFSET_SC)};
+    }
+    if (auto* number = nodeCast<NumberExpr>(expr.right)) {
+        auto index = constant(number->integer ? Constant{*number->integer} : Constant{number->val});
+        if (index <= MAXARG_C) {
+            return {Operand::Constant, index};
+        }
+    }
+    return {Operand::Register, 0};
+}
+
+void LuaBytecode::emitComparison(TokenKind op, uint8_t left, Operand form, uint32_t right,
+                                 bool when) {
+    // The comparison skips the jump after it unless its outcome is k. `~=` is `==` with the
+    // outcome negated.
+    bool k = when != (op == TokenKind::NotEqual);
+    if (form == Operand::Constant) {
+        emit(iABC(OpCode::EqK, left, right, 0, k));
+        return;
+    }
+    if (form == Operand::Immediate) {
+        OpCode opcode = op == TokenKind::Less           ? OpCode::LtI
+                        : op == TokenKind::LessEqual    ? OpCode::LeI
+                        : op == TokenKind::Greater      ? OpCode::GtI
+                        : op == TokenKind::GreaterEqual ? OpCode::GeI
+                                                        : OpCode::EqI;
+        emit(iABC(opcode, left, right, 0, k));
+        return;
+    }
+    switch (op) {
+    case TokenKind::Less:
+        emit(iABC(OpCode::Lt, left, right, 0, k));
+        break;
+    case TokenKind::LessEqual:
+        emit(iABC(OpCode::Le, left, right, 0, k));
+        break;
+    // a > b is b < a
+    case TokenKind::Greater:
+        emit(iABC(OpCode::Lt, right, left, 0, k));
+        break;
+    case TokenKind::GreaterEqual:
+        emit(iABC(OpCode::Le, right, left, 0, k));
+        break;
+    default:
+        emit(iABC(OpCode::Eq, left, right, 0, k));
+    }
+}
+
+void LuaBytecode::emitOperators(Expr& root) {
+    struct Pending {
+        Expr* expr;
+        // Where the value goes, only the root has a target
+        int reg;
+        // In a new register even if it is a local, concatenation takes consecutive registers
+        bool fresh;
+        bool operandsDone;
+        Operand form;
+        uint32_t right;
+    };
+    std::vector<Pending> pending{{&root, target, false, false, Operand::Register, 0}};
+    // Registers of the operands done, right above left
+    std::vector<uint8_t> values;
+
+    while (!pending.empty()) {
+        auto item = pending.back();
+        pending.pop_back();
+        if (!isChainOperator(item.expr)) {
+            values.push_back(item.fresh ? emitExpr(item.expr) : emitOperand(item.expr));
+            continue;
+        }
+        auto* binOp = nodeCast<BinOpExpr>(item.expr);
+        if (!item.operandsDone) {
+            item.operandsDone = true;
+            if (binOp) {
+                std::tie(item.form, item.right) = rightOperand(*binOp);
+            }
+            pending.push_back(item);
+            // Pushed in reverse, the left operand is emitted first
+            if (binOp) {
+                bool concat = binOp->op == TokenKind::Concat;
+                if (item.form == Operand::Register) {
+                    pending.push_back({binOp->right, FRESH, concat, false, Operand::Register, 0});
+                }
+                pending.push_back({binOp->left, FRESH, concat, false, Operand::Register, 0});
+            } else {
+                pending.push_back({static_cast<UnaryOpExpr*>(item.expr)->right, FRESH, false,
+                                   false, Operand::Register, 0});
+            }
+            continue;
+        }
+
+        if (!binOp) {
+            auto* unary = static_cast<UnaryOpExpr*>(item.expr);
+            uint8_t operand = values.back();
+            values.pop_back();
+            freeRegister(operand);
+            uint8_t dest = place(item.reg);
+            OpCode op = unary->op == TokenKind::Minus ? OpCode::Unm
+                        : unary->op == TokenKind::Not ? OpCode::Not
+                                                      : OpCode::Len;
+            emit(iABC(op, dest, operand, 0));
+            values.push_back(dest);
+            continue;
+        }
+
+        uint8_t right = 0;
+        if (item.form == Operand::Register) {
+            right = values.back();
+            values.pop_back();
+        }
+        uint8_t left = values.back();
+        values.pop_back();
+        if (item.form == Operand::Register) {
+            freeRegisters(left, right);
+        } else {
+            freeRegister(left);
+        }
+
+        if (binOp->op == TokenKind::Concat) {
+            // Both operands are new registers, concatenated into the first
+            emit(iABC(OpCode::Concat, left, 2, 0));
+            uint8_t dest = place(FRESH);
+            finish(item.reg, dest);
+            values.push_back(result);
+        } else if (isComparison(binOp->op)) {
+            uint8_t dest = place(item.reg);
+            emitComparison(binOp->op, left, item.form, item.form == Operand::Register ? right
+                                                                                      : item.right,
+                           true);
+            emit(isJ(OpCode::Jmp, 1));
+            emit(iABC(OpCode::LFalseSkip, dest, 0, 0));
+            emit(iABC(OpCode::LoadTrue, dest, 0, 0));
+            values.push_back(dest);
+        } else {
+            // The operation skips the MMBIN after it when the operands are numbers, otherwise
+            // MMBIN calls the metamethod
+            auto [op, event] = arithmetic(binOp->op);
+            uint8_t dest = place(item.reg);
+            if (item.form == Operand::Immediate) {
+                emit(iABC(OpCode::AddI, dest, left, item.right));
+                emit(iABC(OpCode::MMBinI, left, item.right, event));
+            } else if (item.form == Operand::Constant) {
+                emit(iABC(withConstant(op), dest, left, item.right));
+                emit(iABC(OpCode::MMBinK, left, item.right, event));
+            } else {
+                emit(iABC(op, dest, left, right));
+                emit(iABC(OpCode::MMBin, left, right, event));
+            }
+            values.push_back(dest);
+        }
+    }
+    result = values.back();
+}
+
+void LuaBytecode::emitLogical(BinOpExpr& expr) {
+    // The value is the left operand unless `and` finds it true or `or` finds it false, then it
+    // is the right one
+    int reg = target;
+    uint8_t value = emitExpr(expr.left);
+    emit(iABC(OpCode::Test, value, 0, 0, expr.op == TokenKind::Or));
+    auto skip = emitJump();
+    emitExpr(expr.right, value);
+    patchToHere({skip});
+    finish(reg, value);
+}
+
+uint8_t LuaBytecode::emitCall(FunCallExpr& call, int results) {
+    uint8_t base = 0;
+    auto args = static_cast<uint32_t>(call.args.size());
+    auto* method = nodeCast<BinOpExpr>(call.callee);
+    if (method && method->op == TokenKind::Colon) {
+        // SELF puts the function and the object as its first argument in two registers
+        uint8_t object = emitOperand(method->left);
+        freeRegister(object);
+        base = reserve(2);
+        const auto& name = static_cast<VarExpr*>(method->right)->name.str();
+        if (auto key = keyConstant(name)) {
+            emit(iABC(OpCode::Self, base, object, *key, true));
+        } else {
+            uint8_t keyReg = reserve();
+            loadConstant(keyReg, name);
+            emit(iABC(OpCode::Self, base, object, keyReg));
+            freeRegister(keyReg);
+        }
+        ++args;
+    } else {
+        base = emitExpr(call.callee);
+    }
+
+    bool open = false;
+    for (size_t i = 0; i < call.args.size(); ++i) {
+        auto* argCall = nodeCast<FunCallExpr>(call.args[i]);
+        if (argCall && i + 1 == call.args.size()) {
+            // All results of a call last in the arguments are passed on
+            emitCall(*argCall, ALL_RESULTS);
+            open = true;
+        } else {
+            emitExpr(call.args[i]);
+        }
+    }
+    emit(iABC(OpCode::Call, base, open ? 0 : args + 1, static_cast<uint32_t>(results + 1)));
+    fs->firstFree = base;
+    if (results > 0) {
+        reserve(static_cast<uint32_t>(results));
+    }
+    return base;
+}
+
+std::vector<size_t> LuaBytecode::emitJumpIf(Expr* expr, bool when) {
+    if (auto* binOp = nodeCast<BinOpExpr>(expr)) {
+        if (binOp->op == TokenKind::And || binOp->op == TokenKind::Or) {
+            bool isAnd = binOp->op == TokenKind::And;
+            if (isAnd != when) {
+                // `a and b` is false, `a or b` is true, as soon as one operand is
+                auto jumps = emitJumpIf(binOp->left, when);
+                auto more = emitJumpIf(binOp->right, when);
+                jumps.insert(jumps.end(), more.begin(), more.end());
+                return jumps;
+            }
+            // Otherwise the left operand can only rule the jump out
+            auto skip = emitJumpIf(binOp->left, !when);
+            auto jumps = emitJumpIf(binOp->right, when);
+            patchToHere(skip);
+            return jumps;
+        }
+        if (isComparison(binOp->op)) {
+            uint8_t left = emitOperand(binOp->left);
+            auto [form, right] = rightOperand(*binOp);
+            if (form == Operand::Register) {
+                right = emitOperand(binOp->right);
+                freeRegisters(left, static_cast<uint8_t>(right));
+            } else {
+                freeRegister(left);
+            }
+            emitComparison(binOp->op, left, form, right, when);
+            return {emitJump()};
+        }
+    }
+    if (auto* unary = nodeCast<UnaryOpExpr>(expr); unary && unary->op == TokenKind::Not) {
+        return emitJumpIf(unary->right, !when);
+    }
+    if (auto value = literal(expr)) {
+        bool truthy = !std::holds_alternative<std::monostate>(*value) && *value != Constant{false};
+        return truthy == when ? std::vector<size_t>{emitJump()} : std::vector<size_t>{};
+    }
+    uint8_t value = emitOperand(expr);
+    freeRegister(value);
+    // TEST skips the jump unless the truthiness of the value is k
+    emit(iABC(OpCode::Test, value, 0, 0, when));
+    return {emitJump()};
+}
+
+void LuaBytecode::visit(IndexExpr& expr) {
+    int reg = target;
+    uint8_t object = emitOperand(expr.object);
+    auto integer = integerLiteral(expr.index);
+    auto* string = nodeCast<StringExpr>(expr.index);
+    if (integer && *integer >= 0 && *integer <= MAXARG_C) {
+        freeRegister(object);
+        result = place(reg);
+        emit(iABC(OpCode::GetI, result, object, static_cast<uint32_t>(*integer)));
+    } else if (string) {
+        freeRegister(object);
+        result = place(reg);
+        getField(result, object, string->val.str());
+    } else {
+        uint8_t key = emitOperand(expr.index);
+        freeRegisters(object, key);
+        result = place(reg);
+        emit(iABC(OpCode::GetTable, result, object, key));
+    }
+}
+
+void LuaBytecode::visit(FunCallExpr& expr) {
+    int reg = target;
+    finish(reg, emitCall(expr, 1));
+}
+
+void LuaBytecode::visit(FunDecl& stmt) {
+    startStatement(stmt);
+    if (stmt.local) {
+        // In scope in its own body, for recursion
+        uint8_t reg = reserve();
+        addLocal(stmt.name);
+        emitClosure(stmt, reg);
+        return;
+    }
+    uint8_t closure = reserve();
+    emitClosure(stmt, closure);
+    if (stmt.thisName) {
+        // function obj.name() and function obj:name() set a field of obj
+        VarExpr object(intern(*stmt.thisName));
+        uint8_t objectReg = emitOperand(&object);
+        setField(objectReg, stmt.name.str(), closure);
+        freeRegister(objectReg);
+    } else {
+        storeVariable(stmt.name, closure);
+    }
+    freeRegister(closure);
+}
+
+void LuaBytecode::visit(VarDecl& stmt) {
+    startStatement(stmt);
+    emitExpr(stmt.initExpr);
+    addLocal(stmt.name);
+}
+
+void LuaBytecode::visit(VarDecls& stmt) {
+    startStatement(stmt);
+    // All initializers run before any of the names is in scope
+    for (auto* decl : stmt.decls) {
+        emitExpr(decl->initExpr);
+    }
+    for (auto* decl : stmt.decls) {
+        addLocal(decl->name);
+    }
+}
+
+void LuaBytecode::visit(IfStmt& stmt) {
+    startStatement(stmt);
+    std::vector<size_t> toEnd;
+    for (size_t i = 0; i < stmt.arms.size(); ++i) {
+        auto& arm = stmt.arms[i];
+        if (arm.condition->loc.line != 0) {
+            line = arm.condition->loc.line;
+        }
+        auto toNext = emitJumpIf(arm.condition, false);
+        arm.body->accept(*this);
+        if (i + 1 < stmt.arms.size() || stmt.else_branch) {
+            toEnd.push_back(emitJump());
+        }
+        patchToHere(toNext);
+    }
+    if (stmt.else_branch) {
+        stmt.else_branch->accept(*this);
+    }
+    patchToHere(toEnd);
+}
+
+void LuaBytecode::visit(ReturnStmt& stmt) {
+    startStatement(stmt);
+    auto& values = stmt.return_values;
+    auto* call = values.size() == 1 ? nodeCast<FunCallExpr>(values[0]) : nullptr;
+    if (call) {
+        // `return f()` is a tail call
+        uint8_t base = emitCall(*call, ALL_RESULTS);
+        auto& last = fs->function->code.back();
+        last = iABC(OpCode::TailCall, argA(last), argB(last), 0);
+        emit(iABC(OpCode::Return, base, 0, 0));
+        return;
+    }
+    if (values.size() == 1) {
+        uint8_t value = emitOperand(values[0]);
+        emit(iABC(OpCode::Return, value, 2, 0));
+        freeRegister(value);
+        return;
+    }
+
+    auto base = static_cast<uint8_t>(fs->firstFree);
+    bool open = false;
+    for (size_t i = 0; i < values.size(); ++i) {
+        auto* valueCall = nodeCast<FunCallExpr>(values[i]);
+        if (valueCall && i + 1 == values.size()) {
+            emitCall(*valueCall, ALL_RESULTS);
+            open = true;
+        } else {
+            emitExpr(values[i]);
+        }
+    }
+    emit(iABC(OpCode::Return, base, open ? 0 : static_cast<uint32_t>(values.size() + 1), 0));
+    fs->firstFree = base;
+}
+
+void LuaBytecode::visit(BlockStmt& stmt) {
+    enterBlock();
+    for (auto* child : stmt.statements) {
+        child->accept(*this);
+    }
+    leaveBlock();
+}
+
+void LuaBytecode::visit(FunCallStmt& stmt) {
+    startStatement(stmt);
+    emitCall(*stmt.call, 0);
+}
+
+void LuaBytecode::visit(AssignStmt& stmt) {
+    startStatement(stmt);
+    if (auto* var = nodeCast<VarExpr>(stmt.left)) {
+        auto variable = resolve(*fs, var->name);
+        if (variable.kind == Variable::Local) {
+            emitExpr(stmt.right, variable.index);
+            return;
+        }
+        uint8_t value = emitOperand(stmt.right);
+        storeVariable(var->name, value);
+        freeRegister(value);
+        return;
+    }
+    if (auto* access = nodeCast<BinOpExpr>(stmt.left);
+        access && access->op == TokenKind::MemberAccess) {
+        uint8_t object = emitOperand(access->left);
+        uint8_t value = emitOperand(stmt.right);
+        setField(object, static_cast<VarExpr*>(access->right)->name.str(), value);
+        freeRegisters(object, value);
+        return;
+    }
+    auto* index = nodeCast<IndexExpr>(stmt.left);
+    if (index == nullptr) {
+        throw std::runtime_error(std::format("Line {}: invalid assignment target", line));
+    }
+    uint8_t object = emitOperand(index->object);
+    auto integer = integerLiteral(index->index);
+    auto* string = nodeCast<StringExpr>(index->index);
+    if (integer && *integer >= 0 && *integer <= MAXARG_B) {
+        uint8_t value = emitOperand(stmt.right);
+        emit(iABC(OpCode::SetI, object, static_cast<uint32_t>(*integer), value));
+        freeRegisters(object, value);
+    } else if (string) {
+        uint8_t value = emitOperand(stmt.right);
+        setField(object, string->val.str(), value);
+        freeRegisters(object, value);
+    } else {
+        uint8_t key = emitOperand(index->index);
+        uint8_t value = emitOperand(stmt.right);
+        emit(iABC(OpCode::SetTable, object, key, value));
+        freeRegister(value);
+        freeRegisters(object, key);
+    }
+}
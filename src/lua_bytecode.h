@@ -0,0 +1,320 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "ast.h"
+#include "output_sink.h"
+#include "visitor.h"
+
+/// Lua 5.4 precompiled chunks, the format `luac` writes and `load` accepts in place of source
+/// (see lopcodes.h, ldump.c and lundump.c in the Lua sources). Instructions are 32 bits:
+///   iABC   op:7 A:8 k:1 B:8 C:8
+///   iABx   op:7 A:8 Bx:17        (sBx = Bx - 65535)
+///   iAx    op:7 Ax:25
+///   isJ    op:7 sJ:25            (jump offset + 16777215)
+/// Signed B and C operands (sB, sC) are stored + 127.
+namespace lua_bytecode {
+
+// In the order of the Lua 5.4 VM, the values are the opcodes
+enum class OpCode : uint8_t {
+    Move,
+    LoadI,
+    LoadF,
+    LoadK,
+    LoadKX,
+    LoadFalse,
+    LFalseSkip,
+    LoadTrue,
+    LoadNil,
+    GetUpval,
+    SetUpval,
+    GetTabUp,
+    GetTable,
+    GetI,
+    GetField,
+    SetTabUp,
+    SetTable,
+    SetI,
+    SetField,
+    NewTable,
+    Self,
+    AddI,
+    AddK,
+    SubK,
+    MulK,
+    ModK,
+    PowK,
+    DivK,
+    IDivK,
+    BAndK,
+    BOrK,
+    BXorK,
+    ShrI,
+    ShlI,
+    Add,
+    Sub,
+    Mul,
+    Mod,
+    Pow,
+    Div,
+    IDiv,
+    BAnd,
+    BOr,
+    BXor,
+    Shl,
+    Shr,
+    MMBin,
+    MMBinI,
+    MMBinK,
+    Unm,
+    BNot,
+    Not,
+    Len,
+    Concat,
+    Close,
+    Tbc,
+    Jmp,
+    Eq,
+    Lt,
+    Le,
+    EqK,
+    EqI,
+    LtI,
+    LeI,
+    GtI,
+    GeI,
+    Test,
+    TestSet,
+    Call,
+    TailCall,
+    Return,
+    Return0,
+    Return1,
+    ForLoop,
+    ForPrep,
+    TForPrep,
+    TForCall,
+    TForLoop,
+    SetList,
+    Closure,
+    VarArg,
+    VarArgPrep,
+    ExtraArg,
+};
+
+inline constexpr uint32_t MAXARG_A = 255;
+inline constexpr uint32_t MAXARG_B = 255;
+inline constexpr uint32_t MAXARG_C = 255;
+inline constexpr uint32_t MAXARG_BX = (1u << 17) - 1;
+inline constexpr uint32_t MAXARG_AX = (1u << 25) - 1;
+inline constexpr int32_t OFFSET_SBX = MAXARG_BX >> 1;
+inline constexpr int32_t OFFSET_SJ = MAXARG_AX >> 1;
+inline constexpr int32_t OFFSET_SC = MAXARG_C >> 1;
+
+inline constexpr uint32_t iABC(OpCode op, uint32_t a, uint32_t b, uint32_t c, bool k = false) {
+    return static_cast<uint32_t>(op) | a << 7 | uint32_t{k} << 15 | b << 16 | c << 24;
+}
+inline constexpr uint32_t iABx(OpCode op, uint32_t a, uint32_t bx) {
+    return static_cast<uint32_t>(op) | a << 7 | bx << 15;
+}
+inline constexpr uint32_t iAsBx(OpCode op, uint32_t a, int32_t sbx) {
+    return iABx(op, a, static_cast<uint32_t>(sbx + OFFSET_SBX));
+}
+inline constexpr uint32_t iAx(OpCode op, uint32_t ax) {
+    return static_cast<uint32_t>(op) | ax << 7;
+}
+inline constexpr uint32_t isJ(OpCode op, int32_t sj) {
+    return static_cast<uint32_t>(op) | static_cast<uint32_t>(sj + OFFSET_SJ) << 7;
+}
+
+inline constexpr OpCode opcode(uint32_t i) { return static_cast<OpCode>(i & 0x7f); }
+inline constexpr uint32_t argA(uint32_t i) { return (i >> 7) & 0xff; }
+inline constexpr bool argK(uint32_t i) { return (i >> 15) & 1; }
+inline constexpr uint32_t argB(uint32_t i) { return (i >> 16) & 0xff; }
+inline constexpr uint32_t argC(uint32_t i) { return i >> 24; }
+inline constexpr uint32_t argBx(uint32_t i) { return i >> 15; }
+inline constexpr int32_t argSBx(uint32_t i) {
+    return static_cast<int32_t>(argBx(i)) - OFFSET_SBX;
+}
+inline constexpr uint32_t argAx(uint32_t i) { return i >> 7; }
+inline constexpr int32_t argSJ(uint32_t i) { return static_cast<int32_t>(argAx(i)) - OFFSET_SJ; }
+
+/// nil, a boolean, an integer, a float or a string.
+using Constant = std::variant<std::monostate, bool, int64_t, double, std::string>;
+
+struct Upvalue {
+    Symbol name;
+    // A register of the enclosing function, otherwise one of its upvalues
+    bool inStack;
+    uint8_t index;
+};
+
+/// A compiled function (a Proto in the Lua sources). The main chunk is a vararg function with
+/// `_ENV` as its only upvalue.
+struct Function {
+    std::vector<uint32_t> code;
+    // Source line of each instruction
+    std::vector<uint32_t> lines;
+    std::vector<Constant> constants;
+    std::vector<Upvalue> upvalues;
+    std::vector<std::unique_ptr<Function>> functions;
+    uint32_t lineDefined = 0;
+    uint32_t lastLineDefined = 0;
+    uint8_t numParams = 0;
+    bool vararg = false;
+    uint8_t maxStackSize = 2;
+
+    /// One instruction per line ("ADDK 1 0 2"), then each nested function, for tests and
+    /// debugging. Signed operands are printed as their value.
+    std::string listing() const;
+};
+
+/// The precompiled chunk of `main`, header included. `chunkName` is the source name Lua
+/// reports in messages, "@file" or "=name" by convention. Local names are left out, like
+/// `luac -s` would, line numbers are kept.
+std::string dump(const Function& main, std::string_view chunkName);
+} // namespace lua_bytecode
+
+/// Visitor that compiles a typed Lua AST to Lua 5.4 bytecode, the second backend next to
+/// LuaCodegen. Locals live in registers, allocated in declaration order per scope as the Lua
+/// compiler does. Lua 5.4 has no opcodes specialized on static types: arithmetic checks its
+/// operands at runtime and falls back to a metamethod, so number operands that are constants
+/// use the immediate and constant forms (ADDI, ADDK, EQI, LTI, ...) instead of a register.
+/// Throws std::runtime_error when a function needs more registers or upvalues than Lua allows.
+class LuaBytecode final : public Visitor {
+  public:
+    std::unique_ptr<lua_bytecode::Function> compile(Program& program);
+    void generate(Program& program, OutputSink& sink, std::string_view chunkName = "=?");
+    std::string generate(Program& program, std::string_view chunkName = "=?");
+
+    // Expression visitors
+    void visit(StringExpr& expr) override;
+    void visit(NumberExpr& expr) override;
+    void visit(NilExpr& expr) override;
+    void visit(BooleanExpr& expr) override;
+    void visit(TableExpr& expr) override;
+    void visit(VarExpr& expr) override;
+    void visit(UnaryOpExpr& expr) override;
+    void visit(BinOpExpr& expr) override;
+    void visit(IndexExpr& expr) override;
+    void visit(FunCallExpr& expr) override;
+
+    // Statement visitors
+    void visit(FunDecl& stmt) override;
+    void visit(VarDecl& stmt) override;
+    void visit(VarDecls& stmt) override;
+    void visit(IfStmt& stmt) override;
+    void visit(ReturnStmt& stmt) override;
+    void visit(BlockStmt& stmt) override;
+    void visit(FunCallStmt& stmt) override;
+    void visit(AssignStmt& stmt) override;
+
+  private:
+    // Register argument meaning "a new register on top of the temporaries"
+    static constexpr int FRESH = -1;
+    // Result count of a call passing all of its results on
+    static constexpr int ALL_RESULTS = -1;
+
+    struct ActiveLocal {
+        Symbol name;
+        bool captured = false;
+    };
+    // Where a name lives: registers are locals, upvalues are captured from enclosing functions
+    struct Variable {
+        enum Kind { Local, Upvalue, Global } kind;
+        uint8_t index = 0;
+    };
+    struct FunctionState {
+        FunctionState(lua_bytecode::Function* function, FunctionState* parent)
+            : function(function), parent(parent) {}
+
+        lua_bytecode::Function* function;
+        FunctionState* parent;
+        // Active locals, the register of each is its position
+        std::vector<ActiveLocal> locals;
+        // Number of locals when each enclosing block was entered
+        std::vector<size_t> blocks;
+        // The first register that isn't a local or a temporary in use
+        uint32_t firstFree = 0;
+        // A local was captured, returns have to close upvalues
+        bool needsClose = false;
+        // Index of each constant, by its type and bits
+        std::unordered_map<std::string, uint32_t> constants;
+    };
+    // How the right operand of an arithmetic or comparison operator is encoded
+    enum class Operand { Register, Immediate, Constant };
+
+    FunctionState* fs = nullptr;
+    // Source line of the instructions being emitted
+    uint32_t line = 0;
+    // Set by emitExpr for the expression visitors: where the value should go (a register or
+    // FRESH), then the register it went to
+    int target = FRESH;
+    uint8_t result = 0;
+
+    // Functions
+    void openFunction(lua_bytecode::Function& function, FunctionState& state);
+    void closeFunction();
+    void emitClosure(FunDecl& decl, uint8_t reg);
+
+    // Scopes and registers
+    void startStatement(const Stmt& stmt);
+    void enterBlock();
+    /// Ends the scope of the block's locals, closing the upvalues taken from them unless the
+    /// function ends there anyway.
+    void leaveBlock(bool closeUpvalues = true);
+    void addLocal(Symbol name);
+    uint8_t localCount() const { return static_cast<uint8_t>(fs->locals.size()); }
+    uint8_t reserve(uint32_t count = 1);
+    /// Releases a temporary register, the last one reserved. Locals are left alone.
+    void freeRegister(uint8_t reg);
+    void freeRegisters(uint8_t first, uint8_t second);
+    /// `reg`, or a new register when it is FRESH.
+    uint8_t place(int reg);
+    /// Puts the value computed into the new register `value` where `reg` asks for it.
+    void finish(int reg, uint8_t value);
+    Variable resolve(FunctionState& state, Symbol name);
+    uint8_t addUpvalue(FunctionState& state, Symbol name, bool inStack, uint8_t index);
+
+    // Instructions and constants
+    size_t emit(uint32_t instruction);
+    size_t emitJump();
+    void patchToHere(const std::vector<size_t>& jumps);
+    uint32_t constant(const lua_bytecode::Constant& value);
+    /// The index of `key` as a constant, if instructions taking a short string key can use it.
+    std::optional<uint8_t> keyConstant(std::string_view key);
+    void loadConstant(uint8_t reg, const lua_bytecode::Constant& value);
+
+    // Expressions
+    /// Emits `expr` into register `reg` (or a new one), returns the register holding it.
+    uint8_t emitExpr(Expr* expr, int reg = FRESH);
+    /// Emits `expr` where it can be read: a local is used in place, other values get a new
+    /// register.
+    uint8_t emitOperand(Expr* expr);
+    /// Emits a chain of arithmetic, comparison, concatenation and unary operators with an
+    /// explicit stack, so long chains don't recurse.
+    void emitOperators(Expr& root);
+    void emitLogical(BinOpExpr& expr);
+    /// Emits the call at a new register, leaving `results` values there (ALL_RESULTS for
+    /// however many it returns). Returns that register.
+    uint8_t emitCall(FunCallExpr& call, int results);
+    /// Emits jumps taken when the truthiness of `expr` is `when`, returns them to be patched.
+    std::vector<size_t> emitJumpIf(Expr* expr, bool when);
+    /// How the right operand of `expr` can be encoded, and the encoded value if it isn't a
+    /// register.
+    std::pair<Operand, uint32_t> rightOperand(const BinOpExpr& expr);
+    /// Emits the comparison `op` of `left` and `right`, the jump after it is taken when the
+    /// comparison is `when`.
+    void emitComparison(TokenKind op, uint8_t left, Operand form, uint32_t right, bool when);
+    void loadVariable(uint8_t reg, Symbol name);
+    void storeVariable(Symbol name, uint8_t value);
+    /// `reg` := `object`[`key`], `object` in a register.
+    void getField(uint8_t reg, uint8_t object, std::string_view key);
+    void setField(uint8_t object, std::string_view key, uint8_t value);
+};
@@ -1,7 +1,9 @@
 #include "lua_codegen.h"
-#include "utils.h"
+#include "ast_walk.h"
 #include <algorithm>
+#include <cmath>
 #include <format>
+#include <limits>
 #include <vector>
 
 namespace {
@@ -15,6 +17,8 @@ const char* tokenKindToLuaOperator(TokenKind kind) {
         return "*";
     case TokenKind::Slash:
         return "/";
+    case TokenKind::FloorDiv:
+        return "//";
     case TokenKind::Equal:
         return "==";
     case TokenKind::NotEqual:
@@ -41,250 +45,629 @@ const char* tokenKindToLuaOperator(TokenKind kind) {
         return tokenKindToStr(kind);
     }
 }
+
+// Binding power of Lua's operators, higher binds tighter
+constexpr int UNARY_PRECEDENCE = 7;
+constexpr int PRIMARY_PRECEDENCE = 8; // literals, names, calls, indexing and member access
+
+int binaryPrecedence(TokenKind kind) {
+    switch (kind) {
+    case TokenKind::Or:
+        return 1;
+    case TokenKind::And:
+        return 2;
+    case TokenKind::Equal:
+    case TokenKind::NotEqual:
+    case TokenKind::Less:
+    case TokenKind::Greater:
+    case TokenKind::LessEqual:
+    case TokenKind::GreaterEqual:
+        return 3;
+    case TokenKind::Concat:
+        return 4;
+    case TokenKind::Plus:
+    case TokenKind::Minus:
+        return 5;
+    case TokenKind::Star:
+    case TokenKind::Slash:
+    case TokenKind::FloorDiv:
+        return 6;
+    default:
+        return PRIMARY_PRECEDENCE;
+    }
+}
+
+/// Whether `expr` is printed starting with a '-', which must not follow a unary minus.
+bool leadingMinus(const Expr& expr) {
+    if (auto* unary = nodeCast<UnaryOpExpr>(&expr)) {
+        return unary->op == TokenKind::Minus;
+    }
+    auto* number = nodeCast<NumberExpr>(&expr);
+    return number && std::signbit(number->val);
+}
+
+int precedence(const Expr& expr) {
+    if (auto* binOp = nodeCast<BinOpExpr>(&expr)) {
+        return binaryPrecedence(binOp->op);
+    }
+    if (nodeCast<UnaryOpExpr>(&expr) || leadingMinus(expr)) {
+        return UNARY_PRECEDENCE;
+    }
+    return PRIMARY_PRECEDENCE;
+}
+
+/// Whether Lua accepts `expr` before `.name`, `[index]` or `(args)` without parentheses.
+bool isPrefixExpr(const Expr& expr) {
+    if (auto* binOp = nodeCast<BinOpExpr>(&expr)) {
+        return binOp->op == TokenKind::MemberAccess || binOp->op == TokenKind::Colon;
+    }
+    return nodeCast<VarExpr>(&expr) || nodeCast<IndexExpr>(&expr) ||
+           nodeCast<FunCallExpr>(&expr);
+}
+
+bool isAny(const Expr* expr) { return expr->type && expr->type->getKind() == TypeKind::Any; }
+
+bool isArithmetic(TokenKind op) {
+    return op == TokenKind::Plus || op == TokenKind::Minus || op == TokenKind::Star ||
+           op == TokenKind::Slash || op == TokenKind::FloorDiv;
+}
+
+/// Calls `fn` with each operand of `expr` checked mode guards and the Lua type it must have:
+/// the untyped operands Lua would accept with the wrong type.
+template <typename Fn> void forEachGuardedOperand(Expr* expr, Fn&& fn) {
+    if (auto* unary = nodeCast<UnaryOpExpr>(expr)) {
+        if (isAny(unary->right) && unary->op == TokenKind::Minus) {
+            fn(unary->right, "number");
+        } else if (isAny(unary->right) && unary->op == TokenKind::Length) {
+            fn(unary->right, "table");
+        }
+    } else if (auto* binOp = nodeCast<BinOpExpr>(expr)) {
+        if (isArithmetic(binOp->op)) {
+            if (isAny(binOp->left)) {
+                fn(binOp->left, "number");
+            }
+            if (isAny(binOp->right)) {
+                fn(binOp->right, "number");
+            }
+        } else if (binOp->op == TokenKind::MemberAccess && isAny(binOp->left)) {
+            fn(binOp->left, "table");
+        }
+    } else if (auto* index = nodeCast<IndexExpr>(expr)) {
+        if (isAny(index->object)) {
+            fn(index->object, "table");
+        } else if (index->object->type && index->object->type->getKind() == TypeKind::Array &&
+                   isAny(index->index)) {
+            fn(index->index, "number");
+        }
+    }
+}
+
+/// Calls `fn` with each expression `stmt` and the statements in it evaluate, the bodies of
+/// functions included.
+template <typename Fn> void forEachExpression(Stmt* stmt, Fn& fn) {
+    if (auto* funDecl = nodeCast<FunDecl>(stmt)) {
+        forEachExpression(funDecl->body, fn);
+    } else if (auto* decl = nodeCast<VarDecl>(stmt)) {
+        fn(decl->initExpr);
+    } else if (auto* decls = nodeCast<VarDecls>(stmt)) {
+        for (auto* decl : decls->decls) {
+            fn(decl->initExpr);
+        }
+    } else if (auto* ifStmt = nodeCast<IfStmt>(stmt)) {
+        for (auto& arm : ifStmt->arms) {
+            fn(arm.condition);
+            forEachExpression(arm.body, fn);
+        }
+        if (ifStmt->else_branch) {
+            forEachExpression(ifStmt->else_branch, fn);
+        }
+    } else if (auto* ret = nodeCast<ReturnStmt>(stmt)) {
+        for (auto* value : ret->return_values) {
+            fn(value);
+        }
+    } else if (auto* block = nodeCast<BlockStmt>(stmt)) {
+        for (auto* child : block->statements) {
+            forEachExpression(child, fn);
+        }
+    } else if (auto* call = nodeCast<FunCallStmt>(stmt)) {
+        fn(call->call);
+    } else if (auto* assign = nodeCast<AssignStmt>(stmt)) {
+        fn(assign->left);
+        fn(assign->right);
+    }
+}
+
+/// The condition under which the value of `name` doesn't have `type`, empty when `type()` can't
+/// tell (`any`, and unions with an unknown member).
+std::string guardFailure(std::string_view name, Type* type) {
+    std::vector<std::string_view> luaTypes;
+    bool integer = false;
+    auto add = [&](std::string_view luaType) {
+        if (std::ranges::find(luaTypes, luaType) == luaTypes.end()) {
+            luaTypes.push_back(luaType);
+        }
+    };
+    auto addMember = [&](TypeKind kind) {
+        switch (kind) {
+        case TypeKind::Number:
+            add("number");
+            return true;
+        case TypeKind::Integer:
+            integer = true;
+            return true;
+        case TypeKind::String:
+            add("string");
+            return true;
+        case TypeKind::Boolean:
+            add("boolean");
+            return true;
+        case TypeKind::Nil:
+            add("nil");
+            return true;
+        case TypeKind::Array:
+        case TypeKind::Table:
+        case TypeKind::Record:
+            add("table");
+            return true;
+        case TypeKind::Function:
+            add("function");
+            return true;
+        default:
+            return false;
+        }
+    };
+    if (type->getKind() == TypeKind::Union) {
+        auto* unionType = static_cast<UnionType*>(type);
+        for (auto kind : {TypeKind::Number, TypeKind::Integer, TypeKind::String,
+                          TypeKind::Boolean, TypeKind::Nil, TypeKind::Unknown}) {
+            if ((unionType->getPrimitives() & primitiveBit(kind)) && !addMember(kind)) {
+                return {};
+            }
+        }
+        for (auto* member : unionType->getComposites()) {
+            if (!addMember(member->getKind())) {
+                return {};
+            }
+        }
+    } else if (!addMember(type->getKind())) {
+        return {};
+    }
+
+    std::string failure;
+    // Integers are numbers, only a number without integer needs math.type
+    if (integer && std::ranges::find(luaTypes, "number") == luaTypes.end()) {
+        failure = std::format("math.type({}) ~= \"integer\"", name);
+    }
+    for (auto luaType : luaTypes) {
+        if (!failure.empty()) {
+            failure += " and ";
+        }
+        failure += std::format("type({}) ~= \"{}\"", name, luaType);
+    }
+    return failure;
+}
 } // namespace
 
-std::string LuaCodegen::indent() const { return std::string(indent_level * 4, ' '); }
+void LuaCodegen::begin(OutputSink& sink) {
+    out = &sink;
+    indent_level = 0;
+    line = 1;
+    sourceMap = {};
+    guards.clear();
+    escapingFunctions.clear();
+}
+
+void LuaCodegen::indent() { out->fill(' ', indent_level * 4); }
+
+void LuaCodegen::startLine(const Stmt& stmt) {
+    // Statements the compiler made up belong to the source line before them
+    if (stmt.loc.line != 0) {
+        sourceMap.add(line, stmt.loc.line);
+    }
+    indent();
+}
 
-void LuaCodegen::newline() { result += "\n"; }
+void LuaCodegen::newline() {
+    out->write('\n');
+    ++line;
+}
 
-std::string LuaCodegen::generateExprString(Expr& expr) {
-    std::string saved_result = std::move(result);
-    int saved_indent = indent_level;
-    result.clear();
+void LuaCodegen::planGuards(Program& program) {
+    // Parents come before their children, so callees are known when they are reached
+    std::unordered_set<const Expr*> callees;
+    auto plan = [&](Expr* root) {
+        std::vector<Expr*> pending{root};
+        while (!pending.empty()) {
+            auto* expr = pending.back();
+            pending.pop_back();
+            forEachGuardedOperand(
+                expr, [&](Expr* operand, std::string_view type) { guards.emplace(operand, type); });
+            if (auto* call = nodeCast<FunCallExpr>(expr)) {
+                callees.insert(call->callee);
+            } else if (auto* var = nodeCast<VarExpr>(expr);
+                       var && var->type && var->type->getKind() == TypeKind::Function &&
+                       !callees.contains(var)) {
+                // Passed on, then called by code that may not be typed
+                escapingFunctions.insert(var->name);
+            }
+            forEachChild(expr, [&](Expr* child) { pending.push_back(child); });
+        }
+    };
+    for (auto* stmt : program.statements) {
+        forEachExpression(stmt, plan);
+    }
+}
+
+void LuaCodegen::emitGuardFunction() {
+    out->format("local function {}(value, expected)", GUARD_FUNCTION);
+    newline();
+    out->write("    if type(value) ~= expected then");
+    newline();
+    out->write("        error(expected .. \" expected, got \" .. type(value), 2)");
+    newline();
+    out->write("    end");
+    newline();
+    out->write("    return value");
+    newline();
+    out->write("end");
+}
+
+void LuaCodegen::emitParameterGuards(const FunDecl& stmt) {
+    // Calls of other local functions were checked statically
+    if (!stmt.type || stmt.type->getKind() != TypeKind::Function ||
+        (stmt.local && !escapingFunctions.contains(stmt.name))) {
+        return;
+    }
+    const auto& paramTypes = static_cast<FunctionType*>(stmt.type)->getParamTypes();
+    for (size_t i = 0; i < stmt.params.size() && i < paramTypes.size(); ++i) {
+        const auto& name = stmt.params[i].name.str();
+        auto failure = guardFailure(name, paramTypes[i]);
+        if (failure.empty()) {
+            continue;
+        }
+        startLine(stmt);
+        out->format("if {} then error(\"bad argument #{} to '{}' ({} expected, got \" .. "
+                    "type({}) .. \")\", 2) end",
+                    failure, i + 1, stmt.name.str(), paramTypes[i]->toString(), name);
+        newline();
+    }
+}
+
+void LuaCodegen::guarded(Expr& expr) {
+    auto found = guards.find(&expr);
+    if (found == guards.end()) {
+        expr.accept(*this);
+        return;
+    }
+    out->write(GUARD_FUNCTION);
+    out->write('(');
     expr.accept(*this);
-    std::string expr_result = std::move(result);
-    result = std::move(saved_result);
-    indent_level = saved_indent;
-    return expr_result;
+    out->format(", \"{}\")", found->second);
 }
 
-std::string LuaCodegen::generate(Program& program) {
-    result.clear();
-    indent_level = 0;
+void LuaCodegen::operand(Expr& expr, bool parenthesize) {
+    // A guard is a call, which needs no parentheses
+    if (guards.contains(&expr)) {
+        guarded(expr);
+        return;
+    }
+    if (parenthesize) {
+        out->write('(');
+    }
+    expr.accept(*this);
+    if (parenthesize) {
+        out->write(')');
+    }
+}
+
+template <typename Range, typename Fn>
+void LuaCodegen::commaSeparated(const Range& items, Fn emitItem) {
+    bool first = true;
+    for (auto&& item : items) {
+        if (!first) {
+            out->write(", ");
+        }
+        emitItem(item);
+        first = false;
+    }
+}
+
+void LuaCodegen::generate(Program& program, OutputSink& sink) {
+    begin(sink);
+    if (checked) {
+        planGuards(program);
+        if (!guards.empty()) {
+            emitGuardFunction();
+            if (!program.statements.empty()) {
+                newline();
+            }
+        }
+    }
     for (size_t i = 0; i < program.statements.size(); ++i) {
         program.statements[i]->accept(*this);
         if (i < program.statements.size() - 1) {
             newline();
         }
     }
-    return result;
+    out = nullptr;
+}
+
+std::string LuaCodegen::generate(Program& program) {
+    StringSink sink;
+    generate(program, sink);
+    return sink.str();
 }
 
 std::string LuaCodegen::generate(Expr& expr) {
-    result.clear();
-    indent_level = 0;
+    StringSink sink;
+    begin(sink);
     expr.accept(*this);
-    return result;
+    out = nullptr;
+    return sink.str();
 }
 
 std::string LuaCodegen::generate(Stmt& stmt) {
-    result.clear();
-    indent_level = 0;
+    StringSink sink;
+    begin(sink);
     stmt.accept(*this);
-    return result;
+    out = nullptr;
+    return sink.str();
 }
 
 void LuaCodegen::visit(StringExpr& expr) {
     // Escape special characters in the string
-    std::string escaped;
-    for (char c : expr.val) {
+    out->write('"');
+    for (char c : expr.val.str()) {
         switch (c) {
         case '\n':
-            escaped += "\\n";
+            out->write("\\n");
             break;
         case '\t':
-            escaped += "\\t";
+            out->write("\\t");
             break;
         case '\r':
-            escaped += "\\r";
+            out->write("\\r");
             break;
         case '\\':
-            escaped += "\\\\";
+            out->write("\\\\");
             break;
         case '"':
-            escaped += "\\\"";
+            out->write("\\\"");
             break;
         default:
-            escaped += c;
+            out->write(c);
         }
     }
-    result += std::format("\"{}\"", escaped);
+    out->write('"');
 }
 
 void LuaCodegen::visit(NumberExpr& expr) {
-    // Format number without trailing zeros for integers
-    if (expr.val == static_cast<int>(expr.val)) {
-        result += std::format("{}", static_cast<int>(expr.val));
-    } else {
-        result += std::format("{}", expr.val);
+    if (expr.integer == std::numeric_limits<int64_t>::min()) {
+        // 9223372036854775808 reads as a float, so there is no literal for the minimum integer
+        out->write("(-9223372036854775807 - 1)");
+        return;
+    }
+    if (expr.integer) {
+        out->format("{}", *expr.integer);
+        return;
+    }
+    // Floats must read back as floats: `2.0`, not `2`, and Lua has no inf or nan literal
+    if (std::isnan(expr.val)) {
+        out->write("(0 / 0)");
+        return;
+    }
+    if (std::isinf(expr.val)) {
+        out->write(expr.val < 0 ? "-1e999" : "1e999");
+        return;
+    }
+    // Shortest text that reads back as the same double
+    auto text = std::format("{}", expr.val);
+    out->write(text);
+    if (text.find_first_of(".e") == std::string::npos) {
+        out->write(".0");
     }
 }
 
-void LuaCodegen::visit(NilExpr& /*expr*/) { result += "nil"; }
+void LuaCodegen::visit(NilExpr& /*expr*/) { out->write("nil"); }
 
-void LuaCodegen::visit(BooleanExpr& expr) { result += expr.val ? "true" : "false"; }
+void LuaCodegen::visit(BooleanExpr& expr) { out->write(expr.val ? "true" : "false"); }
 
 void LuaCodegen::visit(TableExpr& expr) {
-    result += "{";
-    std::vector<std::string> elements;
-
+    out->write('{');
     // Array elements
-    for (const auto& element : expr.arrayPart) {
-        elements.push_back(generateExprString(*element));
-    }
+    commaSeparated(expr.arrayPart, [this](auto&& element) { element->accept(*this); });
 
     // Key-value pairs
-    for (const auto& [key, value] : expr.mapPart) {
-        std::string keyValStr = std::format("[{}] = {}", key, generateExprString(*value));
-        elements.push_back(keyValStr);
+    if (!expr.arrayPart.empty() && !expr.mapPart.empty()) {
+        out->write(", ");
     }
-
-    result += join(elements, ", ");
-    result += "}";
+    commaSeparated(expr.mapPart, [this](auto&& keyValue) {
+        out->format("{} = ", keyValue.first.str());
+        keyValue.second->accept(*this);
+    });
+    out->write('}');
 }
 
-void LuaCodegen::visit(VarExpr& expr) { result += expr.name; }
-
-void LuaCodegen::visit(UnaryOpExpr& expr) {
-    auto op = tokenKindToLuaOperator(expr.op);
-    result += op;
-    // Add space after 'not' keyword
-    if (expr.op == TokenKind::Not) {
-        result += " ";
+void LuaCodegen::visit(VarExpr& expr) { out->write(expr.name.str()); }
+
+void LuaCodegen::visit(UnaryOpExpr& expr) { emitOperators(expr); }
+
+void LuaCodegen::visit(BinOpExpr& expr) { emitOperators(expr); }
+
+void LuaCodegen::emitOperators(Expr& root) {
+    // Output still to be written, last first: text, or an expression to emit
+    struct Pending {
+        Expr* expr = nullptr;
+        std::string_view text;
+    };
+    std::vector<Pending> pending{{&root, {}}};
+    auto pushOperand = [&](Expr* expr, bool parenthesize) {
+        // Guarded in a call, the operand needs no parentheses
+        if (auto guard = guards.find(expr); guard != guards.end()) {
+            pending.push_back({nullptr, "\")"});
+            pending.push_back({nullptr, guard->second});
+            pending.push_back({nullptr, ", \""});
+            pending.push_back({expr, {}});
+            pending.push_back({nullptr, "("});
+            pending.push_back({nullptr, GUARD_FUNCTION});
+            return;
+        }
+        if (parenthesize) {
+            pending.push_back({nullptr, ")"});
+        }
+        pending.push_back({expr, {}});
+        if (parenthesize) {
+            pending.push_back({nullptr, "("});
+        }
+    };
+
+    while (!pending.empty()) {
+        auto [expr, text] = pending.back();
+        pending.pop_back();
+        if (!expr) {
+            out->write(text);
+        } else if (auto* unary = nodeCast<UnaryOpExpr>(expr)) {
+            // "--" would start a comment
+            bool doubleMinus = unary->op == TokenKind::Minus && leadingMinus(*unary->right);
+            pushOperand(unary->right,
+                        precedence(*unary->right) < UNARY_PRECEDENCE || doubleMinus);
+            // Add space after 'not' keyword
+            if (unary->op == TokenKind::Not) {
+                pending.push_back({nullptr, " "});
+            }
+            pending.push_back({nullptr, tokenKindToLuaOperator(unary->op)});
+        } else if (auto* binOp = nodeCast<BinOpExpr>(expr)) {
+            if (binOp->op == TokenKind::MemberAccess || binOp->op == TokenKind::Colon) {
+                pending.push_back({binOp->right, {}});
+                pending.push_back({nullptr, binOp->op == TokenKind::MemberAccess ? "." : ":"});
+                pushOperand(binOp->left, !isPrefixExpr(*binOp->left));
+                continue;
+            }
+            // Parentheses the parser dropped are put back where precedence requires them.
+            // `..` is right associative, the other binary operators are left associative.
+            int prec = binaryPrecedence(binOp->op);
+            bool rightAssociative = binOp->op == TokenKind::Concat;
+            int leftPrec = precedence(*binOp->left);
+            int rightPrec = precedence(*binOp->right);
+            pushOperand(binOp->right, rightPrec < prec || (rightPrec == prec && !rightAssociative));
+            pending.push_back({nullptr, " "});
+            pending.push_back({nullptr, tokenKindToLuaOperator(binOp->op)});
+            pending.push_back({nullptr, " "});
+            pushOperand(binOp->left, leftPrec < prec || (leftPrec == prec && rightAssociative));
+        } else {
+            expr->accept(*this);
+        }
     }
-    expr.right->accept(*this);
-}
-
-void LuaCodegen::visit(BinOpExpr& expr) {
-    expr.left->accept(*this);
-    result += std::format(" {} ", tokenKindToLuaOperator(expr.op));
-    expr.right->accept(*this);
 }
 
 void LuaCodegen::visit(IndexExpr& expr) {
-    expr.object->accept(*this);
-    result += "[";
-    expr.index->accept(*this);
-    result += "]";
+    operand(*expr.object, !isPrefixExpr(*expr.object));
+    out->write('[');
+    guarded(*expr.index);
+    out->write(']');
 }
 
 void LuaCodegen::visit(FunCallExpr& expr) {
-    expr.callee->accept(*this);
-    result += "(";
-    std::vector<std::string> argStrings;
-    std::transform(expr.args.begin(), expr.args.end(), std::back_inserter(argStrings),
-                   [this](auto&& arg) { return generateExprString(*arg); });
-    result += join(argStrings, ", ");
-    result += ")";
+    operand(*expr.callee, !isPrefixExpr(*expr.callee));
+    out->write('(');
+    commaSeparated(expr.args, [this](auto&& arg) { arg->accept(*this); });
+    out->write(')');
 }
 
 void LuaCodegen::visit(FunDecl& stmt) {
-    result += indent();
+    startLine(stmt);
     if (stmt.local) {
-        result += "local ";
+        out->write("local ");
     }
-    result += "function ";
+    out->write("function ");
 
     if (stmt.thisName) {
-        result += *stmt.thisName;
+        out->write(*stmt.thisName);
         if (stmt.method) {
-            result += ":";
+            out->write(':');
         } else {
-            result += ".";
+            out->write('.');
         }
     }
-    result += stmt.name;
+    out->write(stmt.name.str());
 
-    result += "(";
-    std::vector<std::string> params;
-    std::transform(stmt.params.begin(), stmt.params.end(), std::back_inserter(params),
-                   [](auto&& param) { return param.name; });
-    result += join(params, ", ");
-    result += ")";
+    out->write('(');
+    commaSeparated(stmt.params, [this](auto&& param) { out->write(param.name.str()); });
+    out->write(')');
     newline();
 
     ++indent_level;
+    if (checked) {
+        emitParameterGuards(stmt);
+    }
     stmt.body->accept(*this);
     --indent_level;
 
     newline();
-    result += indent();
-    result += "end";
+    indent();
+    out->write("end");
 }
 
 void LuaCodegen::visit(VarDecl& stmt) {
-    result += indent();
-    result += "local ";
-    result += stmt.name;
-    result += " = ";
+    startLine(stmt);
+    out->write("local ");
+    out->write(stmt.name.str());
+    out->write(" = ");
     stmt.initExpr->accept(*this);
 }
 
 void LuaCodegen::visit(VarDecls& stmt) {
-    result += indent();
-    result += "local ";
-    std::vector<std::string> names;
-    std::transform(stmt.decls.begin(), stmt.decls.end(), std::back_inserter(names),
-                   [](auto&& decl) { return decl->name; });
-    result += join(names, ", ");
-    result += " = ";
-    std::vector<std::string> initExprs;
-    std::transform(stmt.decls.begin(), stmt.decls.end(), std::back_inserter(initExprs),
-                   [this](auto&& decl) { return generateExprString(*decl->initExpr); });
-    result += join(initExprs, ", ");
+    startLine(stmt);
+    out->write("local ");
+    commaSeparated(stmt.decls, [this](auto&& decl) { out->write(decl->name.str()); });
+    out->write(" = ");
+    commaSeparated(stmt.decls, [this](auto&& decl) { decl->initExpr->accept(*this); });
 }
 
 void LuaCodegen::visit(IfStmt& stmt) {
-    result += indent();
-    result += "if ";
-    stmt.condition->accept(*this);
-    result += " then";
-    newline();
+    startLine(stmt);
+    for (size_t i = 0; i < stmt.arms.size(); ++i) {
+        auto& arm = stmt.arms[i];
+        if (i > 0) {
+            newline();
+            indent();
+            // Unlike the statements, the elseif line is mapped by its condition
+            if (arm.condition->loc.line != 0) {
+                sourceMap.add(line, arm.condition->loc.line);
+            }
+            out->write("elseif ");
+        } else {
+            out->write("if ");
+        }
+        arm.condition->accept(*this);
+        out->write(" then");
+        newline();
 
-    ++indent_level;
-    stmt.then_branch->accept(*this);
-    --indent_level;
+        ++indent_level;
+        arm.body->accept(*this);
+        --indent_level;
+    }
 
     if (stmt.else_branch) {
         newline();
-        result += indent();
-        // Check if else branch is another IfStmt (elseif pattern)
-        if (dynamic_cast<IfStmt*>(stmt.else_branch.get())) {
-            result += "else";
-            newline();
-            ++indent_level;
-            stmt.else_branch->accept(*this);
-            --indent_level;
-            newline();
-            result += indent();
-            result += "end";
-        } else {
-            result += "else";
-            newline();
-            ++indent_level;
-            stmt.else_branch->accept(*this);
-            --indent_level;
-            newline();
-            result += indent();
-            result += "end";
-        }
-    } else {
+        indent();
+        out->write("else");
         newline();
-        result += indent();
-        result += "end";
+        ++indent_level;
+        stmt.else_branch->accept(*this);
+        --indent_level;
     }
+    newline();
+    indent();
+    out->write("end");
 }
 
 void LuaCodegen::visit(ReturnStmt& stmt) {
-    result += indent();
-    result += "return";
+    startLine(stmt);
+    out->write("return");
     if (!stmt.return_values.empty()) {
-        result += " ";
-        std::vector<std::string> returnStrings;
-        std::transform(stmt.return_values.begin(), stmt.return_values.end(),
-                       std::back_inserter(returnStrings),
-                       [this](auto&& val) { return generateExprString(*val); });
-        result += join(returnStrings, ", ");
+        out->write(' ');
+        commaSeparated(stmt.return_values, [this](auto&& val) { val->accept(*this); });
     }
 }
 
@@ -298,13 +681,13 @@ void LuaCodegen::visit(BlockStmt& stmt) {
 }
 
 void LuaCodegen::visit(FunCallStmt& stmt) {
-    result += indent();
+    startLine(stmt);
     stmt.call->accept(*this);
 }
 
 void LuaCodegen::visit(AssignStmt& stmt) {
-    result += indent();
+    startLine(stmt);
     stmt.left->accept(*this);
-    result += " = ";
+    out->write(" = ");
     stmt.right->accept(*this);
 }
@@ -1,13 +1,41 @@
 #pragma once
 
 #include "ast.h"
+#include "output_sink.h"
+#include "source_map.h"
 #include "visitor.h"
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 
 /// Visitor that converts a typed Lua AST back to normal Lua source code.
 /// Type annotations are stripped, producing valid Lua output.
-class LuaCodegen : public Visitor {
+/// The code is streamed into an OutputSink as it is generated.
+///
+/// In checked mode the output verifies at runtime what the type checker had to take on trust,
+/// where static types are lost:
+/// - Operands typed `any` (globals, untyped parameters, `IndexExpr` on tables, ...) of
+///   operations Lua would also run on a value of the wrong type go through `__guard`:
+///   arithmetic (strings are coerced), `#`, member access and indexing (strings have fields).
+///   Everything else Lua checks itself, and operands with a known type need no guard.
+/// - Typed parameters of functions untyped code can call, the global ones and local ones used
+///   as values, are checked when the function is entered.
+/// The checks are `type(x) == "..."` tests, their number grows with the uses of untyped values,
+/// not with the size of the program.
+class LuaCodegen final : public Visitor {
   public:
+    // Name of the function checked mode defines to guard an expression
+    static constexpr std::string_view GUARD_FUNCTION = "__guard";
+
+    explicit LuaCodegen(bool checked = false) : checked(checked) {}
+
+    void generate(Program& program, OutputSink& sink);
+
+    /// Where the lines of the last generated code come from.
+    const SourceMap& getSourceMap() const { return sourceMap; }
+
+    // Convenience overloads collecting the output into a string
     std::string generate(Program& program);
     std::string generate(Expr& expr);
     std::string generate(Stmt& stmt);
@@ -35,10 +63,35 @@ class LuaCodegen : public Visitor {
     void visit(AssignStmt& stmt) override;
 
   private:
-    std::string result;
+    OutputSink* out = nullptr;
     int indent_level = 0;
+    // Line of the output being written, starting at 1
+    uint32_t line = 1;
+    SourceMap sourceMap;
+    bool checked;
+    // Planned by planGuards: the Lua type name each guarded expression must have, and the
+    // local functions used as values
+    std::unordered_map<const Expr*, std::string_view> guards;
+    std::unordered_set<Symbol> escapingFunctions;
 
-    std::string indent() const;
+    /// Resets the output position and the source map for a new output.
+    void begin(OutputSink& sink);
+    void indent();
+    /// Indents the line of the statement `stmt` starts, mapping it to the source of `stmt`.
+    void startLine(const Stmt& stmt);
     void newline();
-    std::string generateExprString(Expr& expr);
+    /// Finds the expressions and functions of `program` checked mode guards.
+    void planGuards(Program& program);
+    /// Writes GUARD_FUNCTION, if any expression needs it.
+    void emitGuardFunction();
+    /// Writes a check of each typed parameter of `stmt` if untyped code can call it.
+    void emitParameterGuards(const FunDecl& stmt);
+    /// Emits `expr` as an operand, guarded if planned.
+    void guarded(Expr& expr);
+    /// Emits an operand of an enclosing expression, in parentheses if `parenthesize`.
+    void operand(Expr& expr, bool parenthesize);
+    /// Emits the operator chain `root` starts from an explicit stack, long chains don't recurse.
+    void emitOperators(Expr& root);
+    /// Emits `items` separated by ", ", generating each one with `emitItem`.
+    template <typename Range, typename Fn> void commaSeparated(const Range& items, Fn emitItem);
 };
@@ -1,27 +1,32 @@
-#include <fstream>
+#include <charconv>
 #include <iostream>
+#include <optional>
 #include <print>
 #include <string>
 #include <vector>
 
+#include <unistd.h>
+
+#include "compile_server.h"
+#include "driver.h"
+#include "incremental_build.h"
 #include "lexer.h"
-#include "lua_codegen.h"
+#include "mapped_file.h"
+#include "output_sink.h"
 #include "parser.h"
 #include "typechecker.h"
 
-std::string readFileContents(const std::string& filename) {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        throw std::runtime_error("Could not open file: " + filename);
-    }
-
-    std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    return contents;
-}
-
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <source-file>\n";
+        std::cerr << "Usage: " << argv[0]
+                  << " [--jobs=N] [--out-dir=DIR] [--cache | --cache-dir=DIR] [--no-optimize]"
+                     " [--inline] [--eliminate] [--localize] [--source-map] [--emit-ast]"
+                     " [--bytecode] [--checked]"
+                     " [--module-path=DIR]..."
+                     " [--stats[=json]]"
+                     " [--watch]"
+                     " <source-file | directory | @manifest>...\n"
+                  << "       " << argv[0] << " [options] --server[=SOCKET]\n";
         return 1;
     }
 
@@ -33,15 +38,124 @@ int main(int argc, char* argv[]) {
     bool tokenize = std::ranges::find(args, "--tokenize") != args.end();
     bool sexpr = std::ranges::find(args, "--sexpr") != args.end();
 
-    auto sourceFileIt =
-        std::ranges::find_if(args, [](const std::string& arg) { return !arg.starts_with("--"); });
-    if (sourceFileIt == args.end()) {
+    CompileOptions options;
+    bool statsJson = false;
+    bool watch = false;
+    std::optional<std::string> serverSocket;
+    std::vector<std::string> inputArgs;
+    for (const auto& arg : args) {
+        if (arg.starts_with("--jobs=")) {
+            auto value = std::string_view(arg).substr(7);
+            auto [end, ec] =
+                std::from_chars(value.data(), value.data() + value.size(), options.jobs);
+            if (ec != std::errc{} || end != value.data() + value.size()) {
+                std::cerr << "Error: Invalid job count: " << value << "\n";
+                return 1;
+            }
+        } else if (arg.starts_with("--out-dir=")) {
+            options.outDir = arg.substr(10);
+        } else if (arg == "--cache") {
+            options.cacheDir = BuildCache::DEFAULT_DIR;
+        } else if (arg.starts_with("--cache-dir=")) {
+            options.cacheDir = arg.substr(12);
+        } else if (arg == "--no-optimize") {
+            options.optimize = false;
+        } else if (arg == "--inline") {
+            options.inlineFunctions = true;
+        } else if (arg == "--eliminate") {
+            options.eliminate = true;
+        } else if (arg == "--localize") {
+            options.localize = true;
+        } else if (arg == "--source-map") {
+            options.sourceMap = true;
+        } else if (arg.starts_with("--module-path=")) {
+            options.modulePath.push_back(arg.substr(14));
+        } else if (arg == "--emit-ast") {
+            options.emitAst = true;
+        } else if (arg == "--bytecode") {
+            options.bytecode = true;
+        } else if (arg == "--checked") {
+            options.checked = true;
+        } else if (arg == "--stats" || arg == "--stats=json") {
+            options.collectStats = true;
+            statsJson = arg == "--stats=json";
+        } else if (arg == "--watch") {
+            watch = true;
+        } else if (arg == "--server") {
+            serverSocket = std::string(CompileServer::DEFAULT_SOCKET);
+        } else if (arg.starts_with("--server=")) {
+            serverSocket = arg.substr(9);
+        } else if (!arg.starts_with("--")) {
+            inputArgs.push_back(arg);
+        }
+    }
+    if (options.checked && options.bytecode) {
+        std::cerr << "Error: --checked only applies to Lua source, not --bytecode.\n";
+        return 1;
+    }
+    if (serverSocket) {
+        try {
+            CompileServer server(options);
+            server.serve(*serverSocket);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    // Printed to stderr, the Lua may go to stdout
+    auto printStats = [&](const CompileStats& stats) {
+        if (options.collectStats) {
+            std::cerr << (statsJson ? stats.toJson() + "\n" : stats.toText());
+        }
+    };
+    if (inputArgs.empty()) {
         std::cerr << "Error: No source file provided.\n";
         return 1;
     }
+    if (watch) {
+        try {
+            IncrementalBuild(inputArgs, options).watch(std::cerr);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    // Several inputs, an output directory, a build cache, an AST to write or bytecode, which
+    // doesn't belong on a terminal: compile in parallel into files
+    bool singleFile = inputArgs.size() == 1 && !inputArgs[0].starts_with("@") &&
+                      !std::filesystem::is_directory(inputArgs[0]);
+    if (!singleFile || options.outDir || options.cacheDir || options.emitAst ||
+        options.bytecode) {
+        if (tokenize || sexpr) {
+            std::cerr << "Error: --tokenize and --sexpr take a single source file.\n";
+            return 1;
+        }
+        std::vector<CompileResult> results;
+        try {
+            results = compileFiles(collectInputs(inputArgs), options);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        int failures = 0;
+        CompileStats stats;
+        for (const auto& result : results) {
+            if (!result.ok()) {
+                std::cerr << result.input.string() << ": " << result.error << "\n";
+                ++failures;
+            }
+            stats += result.stats;
+        }
+        printStats(stats);
+        return failures == 0 ? 0 : 1;
+    }
 
-    std::string sourceFile = *sourceFileIt;
-    std::string sourceCode = readFileContents(sourceFile);
+    std::string sourceFile = inputArgs[0];
+    // Lexemes point into the mapping, so it is kept open until the pipeline is done.
+    MappedFile source(sourceFile);
+    std::string_view sourceCode = source.view();
 
     if (tokenize) {
         auto tokens = Lexer::tokenize(sourceCode);
@@ -52,22 +166,32 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
-    if (sexpr) {
-        auto tokens = Lexer::tokenize(sourceCode);
-        Parser parser(tokens);
-        auto program = parser.parse();
-        for (const auto& stmt : program.statements) {
-            std::println("{}", stmt->toSExpr());
+    // Every error of the file, one per line like the multi-file path
+    auto printDiagnostics = [&](const std::vector<std::string>& diagnostics) {
+        for (const auto& diagnostic : diagnostics) {
+            std::cerr << sourceFile << ": " << diagnostic << "\n";
+        }
+        return 1;
+    };
+    try {
+        if (sexpr) {
+            Parser parser{Lexer{sourceCode}};
+            auto program = parser.parse();
+            for (const auto& stmt : program.statements) {
+                std::println("{}", stmt->toSExpr());
+            }
+            return 0;
         }
-        return 0;
-    }
 
-    // Default: compile
-    auto tokens = Lexer::tokenize(sourceCode);
-    Parser parser(tokens);
-    auto program = parser.parse();
-    TypeChecker typechecker;
-    typechecker.typeCheck(program);
-    LuaCodegen codegen;
-    std::println("{}", codegen.generate(program));
+        // Default: compile to stdout
+        FdSink out(STDOUT_FILENO);
+        auto stats = compileSource(sourceCode, out, options);
+        out.write('\n');
+        out.flush();
+        printStats(stats);
+    } catch (const ParseError& e) {
+        return printDiagnostics(e.getDiagnostics());
+    } catch (const TypeCheckError& e) {
+        return printDiagnostics(e.getDiagnostics());
+    }
 }
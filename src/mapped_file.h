@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/// Read-only memory mapping of a source file.
+/// Tokens and everything built from them keep views into the mapping,
+/// so it has to stay alive for the whole compilation.
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    std::string_view view() const { return {data, size}; }
+
+  private:
+    void unmap();
+
+    const char* data = nullptr;
+    size_t size = 0;
+};
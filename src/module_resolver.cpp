@@ -0,0 +1,141 @@
+#include "module_resolver.h"
+
+#include <algorithm>
+#include <format>
+#include <ranges>
+
+#include "lexer.h"
+#include "mapped_file.h"
+#include "parser.h"
+#include "typechecker.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+/// "a.b" -> a/b.tlua
+fs::path modulePath(std::string_view name) {
+    std::string relative(name);
+    std::ranges::replace(relative, '.', '/');
+    return fs::path(relative + ".tlua");
+}
+
+/// The name of the module a `require("name")` call loads.
+std::optional<std::string> requireName(Expr* expr) {
+    auto* call = nodeCast<FunCallExpr>(expr);
+    if (call == nullptr || call->args.size() != 1) {
+        return std::nullopt;
+    }
+    auto* callee = nodeCast<VarExpr>(call->callee);
+    auto* name = nodeCast<StringExpr>(call->args[0]);
+    if (callee == nullptr || callee->name.str() != "require" || name == nullptr) {
+        return std::nullopt;
+    }
+    return name->val.str();
+}
+
+void addUnique(std::vector<std::string>& names, std::string name) {
+    if (std::ranges::find(names, name) == names.end()) {
+        names.push_back(std::move(name));
+    }
+}
+} // namespace
+
+std::string ModuleSummary::toString() const {
+    auto exportStrings = std::ranges::views::transform(exports, [](auto&& symbol) {
+        return std::format("{}: {}", symbol.first.str(), symbol.second->toString());
+    });
+    return join(exportStrings, ", ");
+}
+
+std::optional<fs::path> ModuleResolver::locate(std::string_view name) const {
+    auto relative = modulePath(name);
+    for (const auto& directory : searchPath) {
+        auto path = directory / relative;
+        if (fs::is_regular_file(path)) {
+            return path;
+        }
+    }
+    return std::nullopt;
+}
+
+const ModuleSummary* ModuleResolver::summary(std::string_view name) {
+    {
+        std::lock_guard lock(mutex);
+        if (auto found = summaries.find(name); found != summaries.end()) {
+            return found->second.get();
+        }
+    }
+
+    // Loaded without the lock, two threads may both load a module, the first one is kept
+    std::unique_ptr<ModuleSummary> loaded;
+    if (auto path = locate(name)) {
+        MappedFile source(path->string());
+        Parser parser{Lexer{source.view()}};
+        auto program = parser.parseDeclarations();
+        TypeChecker typechecker;
+        typechecker.typeCheck(program);
+
+        loaded = std::make_unique<ModuleSummary>();
+        loaded->path = *path;
+        for (auto* stmt : program.statements) {
+            auto* decl = static_cast<FunDecl*>(stmt);
+            loaded->exports.emplace_back(decl->name, decl->type);
+        }
+    }
+    std::lock_guard lock(mutex);
+    auto [found, inserted] = summaries.try_emplace(std::string(name), std::move(loaded));
+    return found->second.get();
+}
+
+const ModuleSummary* ModuleResolver::loaded(std::string_view name) {
+    std::lock_guard lock(mutex);
+    auto found = summaries.find(name);
+    return found != summaries.end() ? found->second.get() : nullptr;
+}
+
+void ModuleResolver::invalidate(std::string_view name) {
+    std::lock_guard lock(mutex);
+    if (auto found = summaries.find(name); found != summaries.end()) {
+        summaries.erase(found);
+    }
+}
+
+std::vector<std::string> requiredModules(const Program& program) {
+    std::vector<std::string> names;
+    for (auto* stmt : program.statements) {
+        std::optional<std::string> name;
+        if (auto* call = nodeCast<FunCallStmt>(stmt)) {
+            name = requireName(call->call);
+        } else if (auto* decl = nodeCast<VarDecl>(stmt)) {
+            name = requireName(decl->initExpr);
+        } else if (auto* decls = nodeCast<VarDecls>(stmt)) {
+            for (auto* each : decls->decls) {
+                if (auto declName = requireName(each->initExpr)) {
+                    addUnique(names, std::move(*declName));
+                }
+            }
+        }
+        if (name) {
+            addUnique(names, std::move(*name));
+        }
+    }
+    return names;
+}
+
+std::vector<std::string> scanRequires(std::string_view source) {
+    std::vector<std::string> names;
+    Lexer lexer(source);
+    // The last four tokens: require ( "name" )
+    std::array<Token, 4> recent{};
+    for (Token token = lexer.getNextToken(); token.kind != TokenKind::Eof;
+         token = lexer.getNextToken()) {
+        std::shift_left(recent.begin(), recent.end(), 1);
+        recent.back() = token;
+        if (recent[0].kind == TokenKind::Identifier && recent[0].lexeme == "require" &&
+            recent[1].kind == TokenKind::LParen && recent[2].kind == TokenKind::String &&
+            recent[3].kind == TokenKind::RParen) {
+            addUnique(names, recent[2].symbol.str());
+        }
+    }
+    return names;
+}
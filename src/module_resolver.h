@@ -0,0 +1,60 @@
+#pragma once
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ast.h"
+
+/// What a module declares for the files requiring it: the types of its top-level global
+/// functions, taken from their annotations.
+struct ModuleSummary {
+    std::filesystem::path path;
+    // In declaration order
+    std::vector<std::pair<Symbol, Type*>> exports;
+
+    /// "name: type" of each export, for cache keys and messages.
+    std::string toString() const;
+};
+
+/// Finds the modules `require("a.b")` loads, `a/b.tlua` below one of the directories of the
+/// search path, and summarizes them. Only the function headers of a module are parsed, its
+/// bodies are skipped. Summaries are loaded on first use and kept for the lifetime of the
+/// resolver. Thread-safe: files compiled in parallel share one resolver.
+class ModuleResolver {
+  public:
+    explicit ModuleResolver(std::vector<std::filesystem::path> searchPath)
+        : searchPath(std::move(searchPath)) {}
+
+    /// The file of a module, the first match in the search path.
+    std::optional<std::filesystem::path> locate(std::string_view name) const;
+
+    /// The summary of a module, nullptr if there is no such file (e.g. a plain Lua library).
+    /// Throws ParseError or TypeCheckError if its declarations are invalid.
+    const ModuleSummary* summary(std::string_view name);
+
+    /// The summary of a module if it was loaded, without loading it.
+    const ModuleSummary* loaded(std::string_view name);
+
+    /// Drops the summary of a module, the next `summary` reads its file again. Pointers to
+    /// the summary dropped become invalid, no summary may be in use.
+    void invalidate(std::string_view name);
+
+  private:
+    std::vector<std::filesystem::path> searchPath;
+    // By module name, null for modules that weren't found
+    std::map<std::string, std::unique_ptr<ModuleSummary>, std::less<>> summaries;
+    std::mutex mutex;
+};
+
+/// Names of the modules a program requires at the top level, `require("name")` as a statement
+/// or as the initializer of a local, in order and without duplicates.
+std::vector<std::string> requiredModules(const Program& program);
+
+/// Same as `requiredModules` from the tokens of a source, without parsing it. Finds every
+/// `require("name")`, also nested ones.
+std::vector<std::string> scanRequires(std::string_view source);
@@ -0,0 +1,464 @@
+#include "optimizer.h"
+#include "ast_walk.h"
+
+#include <algorithm>
+#include <cmath>
+#include <compare>
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <ranges>
+
+namespace {
+/// Truthiness of a literal in Lua (only nil and false are falsy), nullopt for other nodes.
+std::optional<bool> truthiness(const Expr* expr) {
+    if (auto* boolean = nodeCast<BooleanExpr>(expr)) {
+        return boolean->val;
+    }
+    if (nodeCast<NilExpr>(expr)) {
+        return false;
+    }
+    if (nodeCast<NumberExpr>(expr) || nodeCast<StringExpr>(expr)) {
+        return true;
+    }
+    return std::nullopt;
+}
+
+// Doubles hold every integer up to 2^53 exactly
+constexpr int64_t MAX_EXACT_INTEGER = int64_t{1} << 53;
+
+/// The value of a number literal as a double, nullopt for integers a double can't hold.
+std::optional<double> exactFloat(const NumberExpr& number) {
+    if (number.integer && (*number.integer > MAX_EXACT_INTEGER ||
+                           *number.integer < -MAX_EXACT_INTEGER)) {
+        return std::nullopt;
+    }
+    return number.val;
+}
+
+/// Lua compares integers and floats by their mathematical values.
+std::optional<std::partial_ordering> compareNumbers(const NumberExpr& left,
+                                                    const NumberExpr& right) {
+    if (left.integer && right.integer) {
+        return *left.integer <=> *right.integer;
+    }
+    auto l = exactFloat(left);
+    auto r = exactFloat(right);
+    if (!l || !r) {
+        return std::nullopt;
+    }
+    return *l <=> *r;
+}
+
+/// `==` of two literals, nullopt if either side is not a literal.
+std::optional<bool> literalEquals(const Expr* left, const Expr* right) {
+    if (!truthiness(left) || !truthiness(right)) {
+        return std::nullopt;
+    }
+    if (auto* l = nodeCast<NumberExpr>(left)) {
+        auto* r = nodeCast<NumberExpr>(right);
+        if (!r) {
+            return false;
+        }
+        auto order = compareNumbers(*l, *r);
+        return order ? std::optional(*order == 0) : std::nullopt;
+    }
+    if (auto* l = nodeCast<StringExpr>(left)) {
+        auto* r = nodeCast<StringExpr>(right);
+        return r && l->val == r->val;
+    }
+    if (auto* l = nodeCast<BooleanExpr>(left)) {
+        auto* r = nodeCast<BooleanExpr>(right);
+        return r && l->val == r->val;
+    }
+    return nodeCast<NilExpr>(right) != nullptr;
+}
+
+/// Integer arithmetic of Lua 5.3+: 64 bits, wrapping around on overflow.
+/// Integer division by zero is a runtime error, so it is left to run.
+std::optional<int64_t> foldIntegers(TokenKind op, int64_t left, int64_t right) {
+    auto l = static_cast<uint64_t>(left);
+    auto r = static_cast<uint64_t>(right);
+    switch (op) {
+    case TokenKind::Plus:
+        return static_cast<int64_t>(l + r);
+    case TokenKind::Minus:
+        return static_cast<int64_t>(l - r);
+    case TokenKind::Star:
+        return static_cast<int64_t>(l * r);
+    case TokenKind::FloorDiv: {
+        if (right == 0) {
+            return std::nullopt;
+        }
+        if (right == -1) {
+            return static_cast<int64_t>(0 - l); // the minimum integer wraps to itself
+        }
+        int64_t quotient = left / right;
+        bool inexact = quotient * right != left;
+        return inexact && (left < 0) != (right < 0) ? quotient - 1 : quotient;
+    }
+    default:
+        return std::nullopt;
+    }
+}
+
+/// Float arithmetic, where integer operands are converted to floats first.
+/// Results that aren't finite have no literal and are left to run.
+std::optional<double> foldFloats(TokenKind op, double left, double right) {
+    double result;
+    switch (op) {
+    case TokenKind::Plus:
+        result = left + right;
+        break;
+    case TokenKind::Minus:
+        result = left - right;
+        break;
+    case TokenKind::Star:
+        result = left * right;
+        break;
+    case TokenKind::Slash:
+        result = left / right;
+        break;
+    case TokenKind::FloorDiv:
+        result = std::floor(left / right);
+        break;
+    default:
+        return std::nullopt;
+    }
+    return std::isfinite(result) ? std::optional(result) : std::nullopt;
+}
+
+std::optional<bool> foldComparison(TokenKind op, std::partial_ordering order) {
+    switch (op) {
+    case TokenKind::Less:
+        return order < 0;
+    case TokenKind::Greater:
+        return order > 0;
+    case TokenKind::LessEqual:
+        return order <= 0;
+    case TokenKind::GreaterEqual:
+        return order >= 0;
+    default:
+        return std::nullopt;
+    }
+}
+
+/// Text `expr` contributes to a `..`, nullopt unless it is a string or an integer literal.
+/// Lua formats floats with "%.14g", which does not round trip, so those are left alone.
+std::optional<std::string> concatText(const Expr* expr) {
+    if (auto* string = nodeCast<StringExpr>(expr)) {
+        return string->val.str();
+    }
+    if (auto* number = nodeCast<NumberExpr>(expr); number && number->integer) {
+        return std::format("{}", *number->integer);
+    }
+    return std::nullopt;
+}
+
+/// Whether `value` can be evaluated where the constructor of `table` is: it doesn't read the
+/// table, which isn't assigned there yet, and doesn't call anything that could.
+bool movableIntoConstructor(Expr* value, Symbol table) {
+    bool movable = true;
+    forEachNode(value, [&](Expr* node) {
+        auto* var = nodeCast<VarExpr>(node);
+        movable = movable && !nodeCast<FunCallExpr>(node) && !(var && var->name == table);
+    });
+    return movable;
+}
+
+/// Whether splicing `block` into its enclosing block would change what its locals shadow.
+bool declaresLocals(const BlockStmt& block) {
+    for (auto* stmt : block.statements) {
+        auto* decl = nodeCast<Decl>(stmt);
+        if ((decl && decl->local) || nodeCast<VarDecls>(stmt)) {
+            return true;
+        }
+    }
+    return false;
+}
+} // namespace
+
+void Optimizer::optimize(Program& program) {
+    arena = &program.arena;
+    optimizeBlock(program.statements);
+    arena = nullptr;
+}
+
+Expr* Optimizer::fold(Expr* expr) {
+    folded = expr;
+    expr->accept(*this);
+    return folded;
+}
+
+void Optimizer::optimizeBlock(std::vector<Stmt*>& statements) {
+    std::vector<Stmt*> result;
+    result.reserve(statements.size());
+    for (size_t i = 0; i < statements.size(); ++i) {
+        auto* stmt = statements[i];
+        stmt->accept(*this);
+        auto* ifStmt = nodeCast<IfStmt>(stmt);
+        Stmt* kept = ifStmt ? pruneIf(ifStmt) : stmt;
+        if (kept == nullptr) {
+            continue;
+        }
+        auto* block = nodeCast<BlockStmt>(kept);
+        if (block && !declaresLocals(*block)) {
+            result.insert(result.end(), block->statements.begin(), block->statements.end());
+        } else if (block) {
+            // The branch keeps a scope of its own
+            auto* always = make<BooleanExpr>(TypeFactory::booleanType(), true);
+            auto* scope = arena->make<IfStmt>(always, block);
+            scope->loc = stmt->loc;
+            result.push_back(scope);
+        } else {
+            result.push_back(kept);
+        }
+        // A spliced branch may end in a return, which Lua only accepts last in a block
+        if (!result.empty() && nodeCast<ReturnStmt>(result.back())) {
+            std::for_each(statements.begin() + i + 1, statements.end(), releaseReferences<Stmt>);
+            break;
+        }
+    }
+    foldConstructors(result);
+    statements = std::move(result);
+}
+
+void Optimizer::foldConstructors(std::vector<Stmt*>& statements) {
+    std::vector<Stmt*> result;
+    result.reserve(statements.size());
+    // The table declared by the last kept statement, while assignments can still move into it
+    VarDecl* decl = nullptr;
+    TableExpr* table = nullptr;
+    for (auto* stmt : statements) {
+        auto* assign = nodeCast<AssignStmt>(stmt);
+        if (table && assign && foldIntoConstructor(*decl, *table, *assign)) {
+            continue;
+        }
+        result.push_back(stmt);
+        decl = nodeCast<VarDecl>(stmt);
+        table = decl ? nodeCast<TableExpr>(decl->initExpr) : nullptr;
+    }
+    statements = std::move(result);
+}
+
+bool Optimizer::foldIntoConstructor(const VarDecl& decl, TableExpr& table, const AssignStmt& assign) {
+    if (!movableIntoConstructor(assign.right, decl.name)) {
+        return false;
+    }
+    if (auto* access = nodeCast<BinOpExpr>(assign.left)) {
+        auto* object = nodeCast<VarExpr>(access->left);
+        if (access->op != TokenKind::MemberAccess || !object || object->name != decl.name ||
+            !table.arrayPart.empty()) {
+            return false;
+        }
+        // Keys stay sorted like the parser keeps them
+        auto key = static_cast<VarExpr*>(access->right)->name;
+        auto it = std::ranges::lower_bound(table.mapPart, key.str(), {},
+                                           [](auto&& kv) -> auto& { return kv.first.str(); });
+        if (it != table.mapPart.end() && it->first == key) {
+            // The value being replaced is never read, but it must not have had effects
+            if (!movableIntoConstructor(it->second, decl.name)) {
+                return false;
+            }
+            it->second = assign.right;
+        } else {
+            table.mapPart.emplace(it, key, assign.right);
+        }
+    } else if (auto* index = nodeCast<IndexExpr>(assign.left)) {
+        // Only appends: `t[n + 1] = value` for a constructor of n elements
+        auto* object = nodeCast<VarExpr>(index->object);
+        auto* position = nodeCast<NumberExpr>(index->index);
+        if (!object || object->name != decl.name || !position || !table.mapPart.empty() ||
+            position->integer != static_cast<int64_t>(table.arrayPart.size()) + 1) {
+            return false;
+        }
+        table.arrayPart.push_back(assign.right);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Stmt* Optimizer::pruneIf(IfStmt* stmt) {
+    std::vector<IfStmt::Arm> arms;
+    Stmt* elseBranch = stmt->else_branch;
+    // The references of the branches that are dropped go away with them
+    for (size_t i = 0; i < stmt->arms.size(); ++i) {
+        auto& arm = stmt->arms[i];
+        auto condition = truthiness(arm.condition);
+        if (!condition) {
+            arms.push_back(arm);
+        } else if (!*condition) {
+            releaseReferences(arm.body);
+        } else {
+            // No later arm can run
+            for (auto& later : stmt->arms | std::views::drop(i + 1)) {
+                releaseReferences(later.body);
+            }
+            if (elseBranch) {
+                releaseReferences(elseBranch);
+            }
+            elseBranch = arm.body;
+            break;
+        }
+    }
+    if (arms.empty()) {
+        return elseBranch;
+    }
+    stmt->arms = std::move(arms);
+    stmt->else_branch = elseBranch;
+    return stmt;
+}
+
+void Optimizer::visit(StringExpr& expr) { folded = &expr; }
+
+void Optimizer::visit(NumberExpr& expr) { folded = &expr; }
+
+void Optimizer::visit(NilExpr& expr) { folded = &expr; }
+
+void Optimizer::visit(BooleanExpr& expr) { folded = &expr; }
+
+void Optimizer::visit(TableExpr& expr) {
+    for (auto& element : expr.arrayPart) {
+        element = fold(element);
+    }
+    for (auto& [key, value] : expr.mapPart) {
+        value = fold(value);
+    }
+    folded = &expr;
+}
+
+void Optimizer::visit(VarExpr& expr) { folded = &expr; }
+
+void Optimizer::visit(UnaryOpExpr& expr) { foldOperators(expr); }
+
+void Optimizer::visit(BinOpExpr& expr) { foldOperators(expr); }
+
+void Optimizer::foldOperators(Expr& root) {
+    Expr* result = &root;
+    forEachOperator(
+        result, [this](Expr*& operand) { operand = fold(operand); },
+        [this](Expr*& op) {
+            folded = op;
+            if (auto* binOp = nodeCast<BinOpExpr>(op)) {
+                foldBinOp(*binOp);
+            } else {
+                foldUnaryOp(static_cast<UnaryOpExpr&>(*op));
+            }
+            op = folded;
+        });
+    folded = result;
+}
+
+void Optimizer::foldUnaryOp(UnaryOpExpr& expr) {
+    if (expr.op == TokenKind::Not) {
+        if (auto truthy = truthiness(expr.right)) {
+            folded = make<BooleanExpr>(TypeFactory::booleanType(), !*truthy);
+        }
+    } else if (expr.op == TokenKind::Minus) {
+        if (auto* number = nodeCast<NumberExpr>(expr.right); number && number->integer) {
+            auto negated = static_cast<int64_t>(0 - static_cast<uint64_t>(*number->integer));
+            folded = make<NumberExpr>(TypeFactory::integerType(), negated);
+        } else if (number) {
+            folded = make<NumberExpr>(TypeFactory::numberType(), -number->val);
+        }
+    }
+}
+
+void Optimizer::foldBinOp(BinOpExpr& expr) {
+    switch (expr.op) {
+    case TokenKind::And:
+    case TokenKind::Or:
+        // Only the left operand decides, the right one is whatever it is
+        if (auto truthy = truthiness(expr.left)) {
+            bool takeLeft = expr.op == TokenKind::And ? !*truthy : *truthy;
+            folded = takeLeft ? expr.left : expr.right;
+        }
+        return;
+    case TokenKind::Equal:
+    case TokenKind::NotEqual:
+        if (auto equal = literalEquals(expr.left, expr.right)) {
+            bool value = expr.op == TokenKind::Equal ? *equal : !*equal;
+            folded = make<BooleanExpr>(TypeFactory::booleanType(), value);
+        }
+        return;
+    case TokenKind::Concat:
+        if (auto left = concatText(expr.left)) {
+            if (auto right = concatText(expr.right)) {
+                folded = make<StringExpr>(TypeFactory::stringType(), intern(*left + *right));
+            }
+        }
+        return;
+    default:
+        break;
+    }
+
+    auto* left = nodeCast<NumberExpr>(expr.left);
+    auto* right = nodeCast<NumberExpr>(expr.right);
+    if (!left || !right) {
+        return;
+    }
+    if (left->integer && right->integer && expr.op != TokenKind::Slash) {
+        if (auto value = foldIntegers(expr.op, *left->integer, *right->integer)) {
+            folded = make<NumberExpr>(TypeFactory::integerType(), *value);
+            return;
+        }
+    } else if (auto value = foldFloats(expr.op, left->val, right->val)) {
+        folded = make<NumberExpr>(TypeFactory::numberType(), *value);
+        return;
+    }
+    if (auto order = compareNumbers(*left, *right)) {
+        if (auto value = foldComparison(expr.op, *order)) {
+            folded = make<BooleanExpr>(TypeFactory::booleanType(), *value);
+        }
+    }
+}
+
+void Optimizer::visit(IndexExpr& expr) {
+    expr.object = fold(expr.object);
+    expr.index = fold(expr.index);
+    folded = &expr;
+}
+
+void Optimizer::visit(FunCallExpr& expr) {
+    expr.callee = fold(expr.callee);
+    for (auto& arg : expr.args) {
+        arg = fold(arg);
+    }
+    folded = &expr;
+}
+
+void Optimizer::visit(FunDecl& stmt) { stmt.body->accept(*this); }
+
+void Optimizer::visit(VarDecl& stmt) { stmt.initExpr = fold(stmt.initExpr); }
+
+void Optimizer::visit(VarDecls& stmt) {
+    for (auto* decl : stmt.decls) {
+        decl->accept(*this);
+    }
+}
+
+void Optimizer::visit(IfStmt& stmt) {
+    for (auto& arm : stmt.arms) {
+        arm.condition = fold(arm.condition);
+        arm.body->accept(*this);
+    }
+    if (stmt.else_branch) {
+        stmt.else_branch->accept(*this);
+    }
+}
+
+void Optimizer::visit(ReturnStmt& stmt) {
+    for (auto& value : stmt.return_values) {
+        value = fold(value);
+    }
+}
+
+void Optimizer::visit(BlockStmt& stmt) { optimizeBlock(stmt.statements); }
+
+void Optimizer::visit(FunCallStmt& stmt) { stmt.call->accept(*this); }
+
+void Optimizer::visit(AssignStmt& stmt) {
+    stmt.left = fold(stmt.left);
+    stmt.right = fold(stmt.right);
+}
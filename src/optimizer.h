@@ -0,0 +1,67 @@
+#pragma once
+#include "ast.h"
+#include "visitor.h"
+
+#include <vector>
+
+/// Rewrites a type checked AST before code generation: expressions whose operands are
+/// literals are folded, `if` branches whose condition is a constant are removed, and
+/// assignments filling in a table right after its constructor are moved into the
+/// constructor, so Lua allocates the table at its final size instead of rehashing it.
+/// Folding follows Lua semantics, an expression is only folded when the result prints back
+/// as the value Lua would compute at runtime. Replacement nodes are allocated in the
+/// program's arena and get the type the checker would have given them.
+class Optimizer final : public Visitor {
+  public:
+    void optimize(Program& program);
+
+    // Expression visitors
+    void visit(StringExpr& expr) override;
+    void visit(NumberExpr& expr) override;
+    void visit(NilExpr& expr) override;
+    void visit(BooleanExpr& expr) override;
+    void visit(TableExpr& expr) override;
+    void visit(VarExpr& expr) override;
+    void visit(UnaryOpExpr& expr) override;
+    void visit(BinOpExpr& expr) override;
+    void visit(IndexExpr& expr) override;
+    void visit(FunCallExpr& expr) override;
+
+    // Statement visitors
+    void visit(FunDecl& stmt) override;
+    void visit(VarDecl& stmt) override;
+    void visit(VarDecls& stmt) override;
+    void visit(IfStmt& stmt) override;
+    void visit(ReturnStmt& stmt) override;
+    void visit(BlockStmt& stmt) override;
+    void visit(FunCallStmt& stmt) override;
+    void visit(AssignStmt& stmt) override;
+
+  private:
+    AstArena* arena = nullptr;
+    // Set by the expression visitors: the node replacing the visited expression
+    Expr* folded = nullptr;
+
+    /// Returns the folded form of `expr`, which may be `expr` itself.
+    Expr* fold(Expr* expr);
+    /// Folds the operator chain `root` starts operands first, without recursing into them.
+    void foldOperators(Expr& root);
+    // Fold an operator whose operands are folded already
+    void foldUnaryOp(UnaryOpExpr& expr);
+    void foldBinOp(BinOpExpr& expr);
+    void optimizeBlock(std::vector<Stmt*>& statements);
+    /// Drops the arms of an if/elseif chain whose condition is a constant. Returns the
+    /// statement that is left to run: `stmt` itself, a branch, or nullptr when none runs.
+    Stmt* pruneIf(IfStmt* stmt);
+    /// Moves `t.name = value` and `t[n] = value` statements that directly follow
+    /// `local t = {...}` into the constructor, as long as that doesn't change what they do.
+    /// Only the expressions move: `t` and its uses keep the types they were checked with.
+    void foldConstructors(std::vector<Stmt*>& statements);
+    bool foldIntoConstructor(const VarDecl& decl, TableExpr& table, const AssignStmt& assign);
+
+    template <typename T, typename... Args> T* make(Type* type, Args&&... args) {
+        auto* node = arena->make<T>(std::forward<Args>(args)...);
+        node->type = type;
+        return node;
+    }
+};
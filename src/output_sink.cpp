@@ -0,0 +1,29 @@
+#include "output_sink.h"
+
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <unistd.h>
+
+FdSink::~FdSink() {
+    // Destructors must not throw, call flush() explicitly to see write errors
+    try {
+        flush();
+    } catch (const std::runtime_error&) {
+    }
+}
+
+void FdSink::flushBuffer(std::string_view data) {
+    while (!data.empty()) {
+        ssize_t written = ::write(fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(
+                std::format("Could not write output: {}", std::strerror(errno)));
+        }
+        data.remove_prefix(static_cast<size_t>(written));
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <format>
+#include <iterator>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+/// Buffered destination for generated code. Text is collected in a fixed size buffer and
+/// handed to `flushBuffer` in large blocks, so producers can emit many small pieces
+/// without building intermediate strings.
+class OutputSink {
+  public:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    OutputSink() { buffer.reserve(BUFFER_SIZE); }
+    virtual ~OutputSink() = default;
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    void write(std::string_view text) {
+        if (buffer.size() + text.size() > BUFFER_SIZE) {
+            flush();
+            if (text.size() > BUFFER_SIZE) {
+                flushBuffer(text);
+                return;
+            }
+        }
+        buffer += text;
+    }
+
+    void write(char c) {
+        if (buffer.size() == BUFFER_SIZE) {
+            flush();
+        }
+        buffer += c;
+    }
+
+    /// Writes `count` copies of `c`.
+    void fill(char c, size_t count) {
+        if (buffer.size() + count > BUFFER_SIZE) {
+            flush();
+        }
+        buffer.append(count, c);
+    }
+
+    template <typename... Args> void format(std::format_string<Args...> fmt, Args&&... args) {
+        std::format_to(std::back_inserter(buffer), fmt, std::forward<Args>(args)...);
+        if (buffer.size() >= BUFFER_SIZE) {
+            flush();
+        }
+    }
+
+    /// Passes everything buffered so far on to the destination.
+    void flush() {
+        if (!buffer.empty()) {
+            flushBuffer(buffer);
+            buffer.clear();
+        }
+    }
+
+  protected:
+    /// Subclasses have to call `flush()` in their destructor.
+    virtual void flushBuffer(std::string_view data) = 0;
+
+  private:
+    std::string buffer;
+};
+
+/// Collects the output in memory, mostly for tests and small snippets.
+class StringSink : public OutputSink {
+  public:
+    ~StringSink() override { flush(); }
+
+    /// Everything written so far.
+    const std::string& str() {
+        flush();
+        return result;
+    }
+
+  protected:
+    void flushBuffer(std::string_view data) override { result += data; }
+
+  private:
+    std::string result;
+};
+
+/// Writes to a file descriptor, which stays owned by the caller.
+/// Throws std::runtime_error when a write fails.
+class FdSink : public OutputSink {
+  public:
+    explicit FdSink(int fd) : fd(fd) {}
+    ~FdSink() override;
+
+  protected:
+    void flushBuffer(std::string_view data) override;
+
+  private:
+    int fd;
+};
+
+class OstreamSink : public OutputSink {
+  public:
+    explicit OstreamSink(std::ostream& stream) : stream(stream) {}
+    ~OstreamSink() override { flush(); }
+
+  protected:
+    void flushBuffer(std::string_view data) override {
+        stream.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+
+  private:
+    std::ostream& stream;
+};
@@ -6,39 +6,80 @@
 #include "ast.h"
 #include "lexer.h"
 #include <cassert>
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
 #include <format>
 #include <vector>
 
-Program Parser::parse() { return parseTopLevel(); }
+Program Parser::parse() {
+    auto program = parseTopLevel();
+    if (!diagnostics.empty()) {
+        throw ParseError(std::move(diagnostics));
+    }
+    return program;
+}
 
 bool Parser::match(TokenKind kind) {
-    if (position < tokens.size() && tokens[position].kind == kind) {
-        position++;
+    if (peek().kind == kind) {
+        tokens.advance();
         return true;
     }
     return false;
 }
 
-Token Parser::peek() const {
-    if (position < tokens.size()) {
-        return tokens[position];
+Program Parser::parseDeclarations() {
+    declarationsOnly = true;
+    std::vector<Stmt*> statements;
+    // Blocks that are open around the current token
+    int depth = 0;
+    while (peek().kind != TokenKind::Eof) {
+        if (depth == 0 && match(TokenKind::Function)) {
+            auto loc = locationOf(previous());
+            statements.push_back(at(loc, parseFunDecl(false)));
+            continue;
+        }
+        switch (peek().kind) {
+        case TokenKind::Local:
+            // Local functions are skipped like any other block
+            tokens.advance();
+            if (peek().kind != TokenKind::Function) {
+                continue;
+            }
+            ++depth;
+            break;
+        case TokenKind::Function:
+        case TokenKind::If:
+            ++depth;
+            break;
+        case TokenKind::End:
+            --depth;
+            break;
+        default:
+            break;
+        }
+        tokens.advance();
     }
-    return Token{TokenKind::Eof, "", -1, -1};
+    return Program{std::move(arena), std::move(statements)};
 }
 
 Program Parser::parseTopLevel() {
-    Program program;
-    while (position < tokens.size() && tokens[position].kind != TokenKind::Eof) {
-        program.statements.emplace_back(parseStmt());
+    std::vector<Stmt*> statements;
+    while (peek().kind != TokenKind::Eof) {
+        if (auto* stmt = parseStmtOrRecover()) {
+            statements.emplace_back(stmt);
+        }
     }
-    return program;
+    return Program{std::move(arena), std::move(statements)};
 }
 
 std::pair<int, int> Parser::opPrecedence(TokenKind kind) const {
+    // Follows Lua: `and` binds tighter than `or`, `..` sits between comparisons and `+`
     switch (kind) {
-    case TokenKind::And:
     case TokenKind::Or:
         return {10, 11};
+    case TokenKind::And:
+        return {12, 13};
     case TokenKind::Equal:
     case TokenKind::NotEqual:
     case TokenKind::Less:
@@ -46,17 +87,18 @@ std::pair<int, int> Parser::opPrecedence(TokenKind kind) const {
     case TokenKind::LessEqual:
     case TokenKind::GreaterEqual:
         return {20, 21};
+    case TokenKind::Concat:
+        return {25, 25}; // right associative
     case TokenKind::Plus:
     case TokenKind::Minus:
         return {30, 31};
     case TokenKind::Star:
     case TokenKind::Slash:
+    case TokenKind::FloorDiv:
         return {40, 41};
-    case TokenKind::Concat:
-        return {50, 51};
     case TokenKind::MemberAccess:
     case TokenKind::Colon: // Method access (obj:method)
-        return {60, 61};
+        return {90, 91}; // binds tighter than calls, `a.b(x)` calls the field
     default:
         return {-1, -1}; // causes the parser to stop parsing further
     }
@@ -83,20 +125,27 @@ std::optional<int> Parser::postfixPrecedence(TokenKind kind) const {
     }
 }
 
-std::unique_ptr<TableExpr> Parser::parseTableExpr() {
-    std::vector<std::unique_ptr<Expr>> arrayElements;
-    std::map<std::string, std::unique_ptr<Expr>> keyValueElements;
+TableExpr* Parser::parseTableExpr() {
+    std::vector<Expr*> arrayElements;
+    std::vector<std::pair<Symbol, Expr*>> keyValueElements;
     while (!match(TokenKind::RBrace)) {
         auto expr = parseExpr();
         if (match(TokenKind::Assign)) {
-            auto id = dynamic_cast<VarExpr*>(expr.get());
+            auto id = nodeCast<VarExpr>(expr);
             if (!id) {
                 throw ParseError("Expected identifier in table key=value assignment");
             }
             auto valueExpr = parseExpr();
-            keyValueElements[id->name] = std::move(valueExpr);
+            // Keep the keys sorted and unique, a repeated key overrides the previous value
+            auto it = std::ranges::lower_bound(keyValueElements, id->name.str(), {},
+                                               [](auto&& kv) -> auto& { return kv.first.str(); });
+            if (it != keyValueElements.end() && it->first == id->name) {
+                it->second = valueExpr;
+            } else {
+                keyValueElements.emplace(it, id->name, valueExpr);
+            }
         } else {
-            arrayElements.emplace_back(std::move(expr));
+            arrayElements.emplace_back(expr);
         }
 
         if (!match(TokenKind::Comma)) {
@@ -105,22 +154,33 @@ std::unique_ptr<TableExpr> Parser::parseTableExpr() {
             }
         }
     }
-    return std::make_unique<TableExpr>(std::move(arrayElements), std::move(keyValueElements));
+    return make<TableExpr>(std::move(arrayElements), std::move(keyValueElements));
 }
 
-std::unique_ptr<Expr> Parser::parseAtomExpr() {
+Expr* Parser::parseAtomExpr() {
     if (match(TokenKind::Number)) {
-        return std::make_unique<NumberExpr>(std::stod(tokens[position - 1].lexeme));
+        // Like Lua, a decimal integer numeral that doesn't fit in 64 bits is a float
+        auto lexeme = previous().lexeme;
+        if (lexeme.find_first_of(".eE") == std::string_view::npos) {
+            int64_t integer = 0;
+            auto [end, ec] =
+                std::from_chars(lexeme.data(), lexeme.data() + lexeme.size(), integer);
+            if (ec == std::errc{}) {
+                return make<NumberExpr>(integer);
+            }
+        }
+        // strtod rounds out of range values to infinity and zero, as Lua does
+        return make<NumberExpr>(std::strtod(std::string(lexeme).c_str(), nullptr));
     } else if (match(TokenKind::Identifier)) {
-        return std::make_unique<VarExpr>(tokens[position - 1].lexeme);
+        return make<VarExpr>(previous().symbol);
     } else if (match(TokenKind::String)) {
-        return std::make_unique<StringExpr>(tokens[position - 1].lexeme);
+        return make<StringExpr>(previous().symbol);
     } else if (match(TokenKind::Nil)) {
-        return std::make_unique<NilExpr>();
+        return make<NilExpr>();
     } else if (match(TokenKind::True)) {
-        return std::make_unique<BooleanExpr>(true);
+        return make<BooleanExpr>(true);
     } else if (match(TokenKind::False)) {
-        return std::make_unique<BooleanExpr>(false);
+        return make<BooleanExpr>(false);
     } else if (match(TokenKind::LBrace)) {
         return parseTableExpr();
     } else if (match(TokenKind::LParen)) {
@@ -132,22 +192,13 @@ std::unique_ptr<Expr> Parser::parseAtomExpr() {
     }
 
     throw ParseError(std::format("Expected atomic expression, but found '{}'",
-                                 tokenKindToStr(tokens[position].kind)));
-}
-
-std::unique_ptr<Expr> binaryExpr(std::unique_ptr<Expr> lhs, TokenKind op,
-                                 std::unique_ptr<Expr> rhs) {
-    return std::make_unique<BinOpExpr>(std::move(lhs), op, std::move(rhs));
+                                 tokenKindToStr(peek().kind)));
 }
 
-std::unique_ptr<Expr> unaryExpr(TokenKind op, std::unique_ptr<Expr> rhs) {
-    return std::make_unique<UnaryOpExpr>(op, std::move(rhs));
-}
-
-std::unique_ptr<Expr> Parser::parsePostfixExpr(std::unique_ptr<Expr> lhs, TokenKind op) {
+Expr* Parser::parsePostfixExpr(Expr* lhs) {
     // funcall
     if (match(TokenKind::LParen)) {
-        std::vector<std::unique_ptr<Expr>> args;
+        std::vector<Expr*> args;
         while (true) {
             if (peek().kind == TokenKind::RParen) {
                 break;
@@ -162,7 +213,7 @@ std::unique_ptr<Expr> Parser::parsePostfixExpr(std::unique_ptr<Expr> lhs, TokenK
         if (!match(TokenKind::RParen)) {
             throw errorExpectedTok("')' after function call arguments");
         }
-        return std::make_unique<FunCallExpr>(std::move(lhs), std::move(args));
+        return make<FunCallExpr>(lhs, std::move(args));
     }
     // bracket indexing
     else if (match(TokenKind::LBracket)) {
@@ -170,49 +221,73 @@ std::unique_ptr<Expr> Parser::parsePostfixExpr(std::unique_ptr<Expr> lhs, TokenK
         if (!match(TokenKind::RBracket)) {
             throw errorExpectedTok("']' after index expression");
         }
-        return std::make_unique<IndexExpr>(std::move(lhs), std::move(index));
+        return make<IndexExpr>(lhs, index);
     } else {
         throw errorExpectedTok("postfix operator");
     }
 }
 
 // Pratt parser
-std::unique_ptr<Expr> Parser::parseExpr(int prevPrec) {
-    auto prefixTok = peek();
-    auto prefixPrecOpt = prefixPrecedence(prefixTok.kind);
-
-    std::unique_ptr<Expr> lhs;
-    if (prefixPrecOpt) { // We have a prefix operator
-        match(prefixTok.kind);
-        auto rhs = parseExpr(*prefixPrecOpt);
-        lhs = unaryExpr(prefixTok.kind, std::move(rhs));
-    } else {
-        lhs = parseAtomExpr();
-    }
+Expr* Parser::parseExpr(int prevPrec) {
+    // Where the recursive formulation would call itself for the operand of an operator, the
+    // state of the caller is pushed instead, so prefix and right associative chains of any
+    // length take no stack. An operand ends where the recursive call would have returned.
+    struct Pending {
+        SourceLoc start;
+        Expr* lhs; // nullptr for prefix operators
+        TokenKind op;
+        int prevPrec;
+    };
+    std::vector<Pending> pending;
 
     while (true) {
-        auto currentToken = peek();
-
-        auto postfixPrecOpt = postfixPrecedence(currentToken.kind);
-        if (postfixPrecOpt) {
-            lhs = parsePostfixExpr(std::move(lhs), currentToken.kind);
-            continue;
+        // Operators and postfix expressions start where their first operand does
+        auto start = here();
+        while (auto prefixPrec = prefixPrecedence(peek().kind)) {
+            auto prefixKind = peek().kind;
+            match(prefixKind);
+            pending.push_back({start, nullptr, prefixKind, prevPrec});
+            prevPrec = *prefixPrec;
+            start = here();
         }
+        Expr* lhs = at(start, parseAtomExpr());
 
-        auto [lprec, rprec] = opPrecedence(currentToken.kind);
-        if (lprec < prevPrec) {
-            break;
-        }
+        while (true) {
+            auto currentKind = peek().kind;
 
-        match(currentToken.kind);
-        auto rhs = parseExpr(rprec);
-        lhs = binaryExpr(std::move(lhs), currentToken.kind, std::move(rhs));
-    }
+            auto postfixPrecOpt = postfixPrecedence(currentKind);
+            if (postfixPrecOpt && *postfixPrecOpt >= prevPrec) {
+                lhs = at(start, parsePostfixExpr(lhs));
+                continue;
+            }
+
+            auto [lprec, rprec] = opPrecedence(currentKind);
+            if (!postfixPrecOpt && lprec >= prevPrec) {
+                match(currentKind);
+                pending.push_back({start, lhs, currentKind, prevPrec});
+                prevPrec = rprec;
+                break; // parse the right operand
+            }
 
-    return lhs;
+            // The operand is complete, hand it to the operator waiting for it
+            if (pending.empty()) {
+                return lhs;
+            }
+            auto waiting = pending.back();
+            pending.pop_back();
+            if (waiting.lhs) {
+                lhs = make<BinOpExpr>(waiting.lhs, waiting.op, lhs);
+            } else {
+                lhs = make<UnaryOpExpr>(waiting.op, lhs);
+            }
+            start = waiting.start;
+            lhs = at(start, lhs);
+            prevPrec = waiting.prevPrec;
+        }
+    }
 }
 
-std::unique_ptr<Stmt> Parser::parseStmt() {
+Stmt* Parser::parseStmt() {
     if (peek().kind == TokenKind::Local || peek().kind == TokenKind::Function) {
         return parseDecl();
     } else if (match(TokenKind::Return)) {
@@ -221,14 +296,12 @@ std::unique_ptr<Stmt> Parser::parseStmt() {
         // variable (or table member) assignment can be a statement.
     } else if (peek().kind == TokenKind::Identifier) {
         auto expr = parseExpr();
-        if (auto funCall = dynamic_cast<FunCallExpr*>(expr.get())) {
-            auto _ = expr.release();
-            return std::make_unique<FunCallStmt>(std::unique_ptr<FunCallExpr>(funCall));
+        if (auto funCall = nodeCast<FunCallExpr>(expr)) {
+            return make<FunCallStmt>(funCall);
         } else {
             if (match(TokenKind::Assign)) {
                 auto valueExpr = parseExpr();
-                ;
-                return std::make_unique<AssignStmt>(std::move(expr), std::move(valueExpr));
+                return make<AssignStmt>(expr, valueExpr);
             } else {
                 throw errorExpectedTok("function call statement or assignment");
             }
@@ -241,47 +314,108 @@ std::unique_ptr<Stmt> Parser::parseStmt() {
     throw errorExpectedTok("declaration, return statement, or if statement");
 }
 
-std::unique_ptr<ReturnStmt> Parser::parseReturnStmt() {
-    std::vector<std::unique_ptr<Expr>> returnValues;
-    auto expr = parseExpr();
-    returnValues.emplace_back(std::move(expr));
-    while (match(TokenKind::Comma)) {
-        expr = parseExpr();
-        returnValues.emplace_back(std::move(expr));
+Stmt* Parser::parseStmtOrRecover() {
+    auto start = stash();
+    auto loc = here();
+    try {
+        return at(loc, parseStmt());
+    } catch (const ParseError& e) {
+        // Every enclosing block of an unterminated one reports the end of the file again
+        if (diagnostics.empty() || diagnostics.back() != e.what()) {
+            diagnostics.emplace_back(e.what());
+        }
     }
-    return std::make_unique<ReturnStmt>(std::move(returnValues));
+    // A token that can't start a statement, like a stray `else`, would be found again
+    if (stash() == start && peek().kind != TokenKind::Eof) {
+        tokens.advance();
+    }
+    synchronize();
+    return nullptr;
 }
 
-std::unique_ptr<IfStmt> Parser::parseIfStmt() {
-    auto condition = parseExpr();
-    if (!match(TokenKind::Then)) {
-        throw errorExpectedTok("'then' after if condition");
+void Parser::synchronize() {
+    while (true) {
+        switch (peek().kind) {
+        case TokenKind::Local:
+        case TokenKind::Function:
+        case TokenKind::Return:
+        case TokenKind::If:
+        case TokenKind::End:
+        case TokenKind::Else:
+        case TokenKind::ElseIf:
+        case TokenKind::Eof:
+            return;
+        default:
+            tokens.advance();
+        }
     }
-    auto thenBlock = std::make_unique<BlockStmt>();
-    while (!match(TokenKind::Else) && !match(TokenKind::ElseIf) && !match(TokenKind::End)) {
-        thenBlock->statements.emplace_back(parseStmt());
+}
+
+void Parser::skipBlock() {
+    for (int depth = 1; depth > 0; tokens.advance()) {
+        switch (peek().kind) {
+        case TokenKind::Eof:
+            throw errorExpectedTok("'end'");
+        case TokenKind::Function:
+        case TokenKind::If:
+            ++depth;
+            break;
+        case TokenKind::End:
+            --depth;
+            break;
+        default:
+            break;
+        }
     }
+}
 
-    std::unique_ptr<Stmt> elseStmt = nullptr;
-    if (tokens[position - 1].kind == TokenKind::ElseIf) {
-        elseStmt = parseIfStmt();
-    } else if (tokens[position - 1].kind == TokenKind::Else) {
-        auto elseBlock = std::make_unique<BlockStmt>();
-        while (!match(TokenKind::End)) {
-            elseBlock->statements.emplace_back(parseStmt());
+void Parser::parseBlock(BlockStmt* block, std::initializer_list<TokenKind> terminators) {
+    while (!std::ranges::any_of(terminators, [&](TokenKind kind) { return match(kind); })) {
+        if (peek().kind == TokenKind::Eof) {
+            throw errorExpectedTok("'end'");
+        }
+        if (auto* stmt = parseStmtOrRecover()) {
+            block->statements.emplace_back(stmt);
         }
-        elseStmt = std::move(elseBlock);
     }
+}
 
-    return std::make_unique<IfStmt>(std::move(condition), std::move(thenBlock),
-                                    std::move(elseStmt));
+ReturnStmt* Parser::parseReturnStmt() {
+    std::vector<Expr*> returnValues;
+    returnValues.emplace_back(parseExpr());
+    while (match(TokenKind::Comma)) {
+        returnValues.emplace_back(parseExpr());
+    }
+    return make<ReturnStmt>(std::move(returnValues));
 }
 
-std::unique_ptr<VarDecl> Parser::parseVarDecl() {
+IfStmt* Parser::parseIfStmt() {
+    std::vector<IfStmt::Arm> arms;
+    Stmt* elseStmt = nullptr;
+    // The first arm starts after `if`, the others after `elseif`
+    do {
+        auto condition = parseExpr();
+        if (!match(TokenKind::Then)) {
+            throw errorExpectedTok("'then' after if condition");
+        }
+        auto body = make<BlockStmt>();
+        parseBlock(body, {TokenKind::Else, TokenKind::ElseIf, TokenKind::End});
+        arms.push_back({condition, body});
+    } while (previous().kind == TokenKind::ElseIf);
+
+    if (previous().kind == TokenKind::Else) {
+        auto elseBlock = make<BlockStmt>();
+        parseBlock(elseBlock, {TokenKind::End});
+        elseStmt = elseBlock;
+    }
+    return make<IfStmt>(std::move(arms), elseStmt);
+}
+
+VarDecl* Parser::parseVarDecl() {
     if (!match(TokenKind::Identifier)) {
         throw errorExpectedTok("variable name");
     }
-    std::string varName = tokens[position - 1].lexeme;
+    Symbol varName = previous().symbol;
 
     // Parse optional type annotation
     std::optional<TypeAnnotation> typeAnnotation;
@@ -290,14 +424,13 @@ std::unique_ptr<VarDecl> Parser::parseVarDecl() {
     }
 
     if (!match(TokenKind::Assign)) {
-        return std::make_unique<VarDecl>(varName, std::make_unique<NilExpr>(),
-                                         std::move(typeAnnotation));
+        return make<VarDecl>(varName, make<NilExpr>(), std::move(typeAnnotation));
     }
     auto initExpr = parseExpr();
-    return std::make_unique<VarDecl>(varName, std::move(initExpr), std::move(typeAnnotation));
+    return make<VarDecl>(varName, initExpr, std::move(typeAnnotation));
 }
 
-std::unique_ptr<Decl> Parser::parseDecl() {
+Decl* Parser::parseDecl() {
     if (match(TokenKind::Local)) {
         if (match(TokenKind::Function)) {
             return parseFunDecl(true);
@@ -309,11 +442,11 @@ std::unique_ptr<Decl> Parser::parseDecl() {
     throw errorExpectedTok("'local' or 'function' for declaration");
 }
 
-std::unique_ptr<FunDecl> Parser::parseFunDecl(bool local) {
+FunDecl* Parser::parseFunDecl(bool local) {
     if (!match(TokenKind::Identifier)) {
         throw errorExpectedTok("function name");
     }
-    std::string functionName = tokens[position - 1].lexeme;
+    Symbol functionName = previous().symbol;
 
     if (!match(TokenKind::LParen)) {
         throw errorExpectedTok("'(' after function name");
@@ -325,7 +458,7 @@ std::unique_ptr<FunDecl> Parser::parseFunDecl(bool local) {
             if (!match(TokenKind::Identifier)) {
                 throw errorExpectedTok("parameter name");
             }
-            std::string paramName = tokens[position - 1].lexeme;
+            Symbol paramName = previous().symbol;
 
             // Parse optional type annotation
             std::optional<TypeAnnotation> typeAnnotation;
@@ -333,7 +466,7 @@ std::unique_ptr<FunDecl> Parser::parseFunDecl(bool local) {
                 typeAnnotation = parseTypeAnnotation();
             }
 
-            parameters.emplace_back(std::move(paramName), std::move(typeAnnotation));
+            parameters.emplace_back(paramName, std::move(typeAnnotation));
         } while (match(TokenKind::Comma));
 
         if (!match(TokenKind::RParen)) {
@@ -347,24 +480,25 @@ std::unique_ptr<FunDecl> Parser::parseFunDecl(bool local) {
         returnTypeAnnotation = parseTypeAnnotation();
     }
 
-    auto body = std::make_unique<BlockStmt>();
-    while (!match(TokenKind::End)) {
-        body->statements.emplace_back(parseStmt());
+    auto body = make<BlockStmt>();
+    if (declarationsOnly) {
+        skipBlock();
+    } else {
+        parseBlock(body, {TokenKind::End});
     }
 
-    return std::make_unique<FunDecl>(functionName, local,
-                                     std::nullopt, // TODO
-                                     false,        // TODO
-                                     std::move(parameters), std::move(body),
-                                     std::move(returnTypeAnnotation));
+    return make<FunDecl>(functionName, local,
+                         std::nullopt, // TODO
+                         false,        // TODO
+                         std::move(parameters), body, std::move(returnTypeAnnotation));
 }
 
 std::optional<TypeAnnotation> Parser::parseTypeAnnotation() {
-    std::string typeName;
+    std::string_view typeName;
 
     // Accept either Identifier or specific keywords as type names
     if (match(TokenKind::Identifier)) {
-        typeName = tokens[position - 1].lexeme;
+        typeName = previous().lexeme;
     } else if (match(TokenKind::Nil)) {
         typeName = "nil";
     } else {
@@ -375,6 +509,8 @@ std::optional<TypeAnnotation> Parser::parseTypeAnnotation() {
     BasicTypeAnnotation::Kind kind;
     if (typeName == "number") {
         kind = BasicTypeAnnotation::Kind::Number;
+    } else if (typeName == "integer") {
+        kind = BasicTypeAnnotation::Kind::Integer;
     } else if (typeName == "string") {
         kind = BasicTypeAnnotation::Kind::String;
     } else if (typeName == "boolean") {
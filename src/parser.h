@@ -1,33 +1,65 @@
 #pragma once
 #include "ast.h"
 #include "lexer.h"
+#include "utils.h"
 #include <format>
+#include <initializer_list>
 #include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 class ParseError : public std::runtime_error {
   public:
-    ParseError(const std::string& message) : std::runtime_error(message) {}
+    ParseError(const std::string& message) : std::runtime_error(message), diagnostics{message} {}
+    /// All errors of a file, what() lists them one per line.
+    explicit ParseError(std::vector<std::string> diagnostics)
+        : std::runtime_error(join(diagnostics, "\n")), diagnostics(std::move(diagnostics)) {}
+
+    const std::vector<std::string>& getDiagnostics() const { return diagnostics; }
+
+  private:
+    std::vector<std::string> diagnostics;
 };
 
 class Parser {
   public:
-    Parser(const std::vector<Token>& tokens) : tokens(tokens), position(0) {}
+    /// Tokens are pulled from the lexer on demand, the parser never holds more than
+    /// a small lookahead window of them.
+    explicit Parser(Lexer lexer) : tokens(std::move(lexer)) {}
+    /// Parses the whole file. A syntax error doesn't stop the parser: it skips ahead to the
+    /// next statement and carries on, and the ParseError thrown at the end lists every
+    /// error found.
     Program parse();
+    /// Parses only the headers of the top-level global functions, skipping their bodies and
+    /// every other statement: what other files see of a module. Throws ParseError on the
+    /// first error.
+    Program parseDeclarations();
 
   private:
     /// If the current token matches the given kind, consumes it and returns true.
     bool match(TokenKind kind);
-    /// Consumes current and returns the next token, advancing the position.
-    Token shift();
-    Token peek() const;
+    const Token& peek() const { return tokens.peek(); }
+    /// The most recently consumed token.
+    const Token& previous() const { return tokens.previous(); }
+    /// Returns a checkpoint of the current position for `restore`.
+    size_t stash() const { return tokens.mark(); }
     /// Restore the position to the last stashed point.
-    void restore(size_t stashed) { position = stashed; }
+    /// Only works within the last `TokenStream::WINDOW_SIZE` tokens.
+    void restore(size_t stashed) { tokens.restore(stashed); }
+    SourceLoc here() const { return locationOf(peek()); }
+    static SourceLoc locationOf(const Token& token) {
+        return {static_cast<uint32_t>(token.line), static_cast<uint32_t>(token.column)};
+    }
+    /// Sets where `node` starts and returns it.
+    template <typename T> static T* at(SourceLoc loc, T* node) {
+        node->loc = loc;
+        return node;
+    }
     ParseError errorExpectedTok(const std::string& expected) const {
         return ParseError(std::format("Expected {}, but found '{}' ({}) at line {}, column {}",
-                                      expected, tokens[position].lexeme,
-                                      tokenKindToStr(tokens[position].kind), tokens[position].line,
-                                      tokens[position].column));
+                                      expected, peek().lexeme, tokenKindToStr(peek().kind),
+                                      peek().line, peek().column));
     }
 
     std::pair<int, int> opPrecedence(TokenKind kind) const;
@@ -40,20 +72,39 @@ class Parser {
 
     Program parseTopLevel();
 
-    std::unique_ptr<Expr> parseAtomExpr();
-    std::unique_ptr<Expr> parseExpr(int prevPrec = 0);
-    std::unique_ptr<Expr> parsePostfixExpr(std::unique_ptr<Expr> left, TokenKind op);
-    std::optional<std::unique_ptr<Expr>> parseMemberAccess(std::unique_ptr<Expr> object);
-    std::unique_ptr<TableExpr> parseTableExpr();
+    /// Allocates a node in the arena of the program being parsed.
+    template <typename T, typename... Args> T* make(Args&&... args) {
+        return arena.make<T>(std::forward<Args>(args)...);
+    }
+
+    Expr* parseAtomExpr();
+    Expr* parseExpr(int prevPrec = 0);
+    Expr* parsePostfixExpr(Expr* left);
+    std::optional<Expr*> parseMemberAccess(Expr* object);
+    TableExpr* parseTableExpr();
 
-    std::unique_ptr<Stmt> parseStmt();
-    std::unique_ptr<ReturnStmt> parseReturnStmt();
-    std::unique_ptr<IfStmt> parseIfStmt();
+    Stmt* parseStmt();
+    /// Parses a statement, or records its error and skips to the start of the next one
+    /// (panic mode), returning nullptr.
+    Stmt* parseStmtOrRecover();
+    /// Skips tokens until one that can start or end a statement.
+    void synchronize();
+    /// Parses statements into `block` until one of `terminators`, which is consumed.
+    void parseBlock(BlockStmt* block, std::initializer_list<TokenKind> terminators);
+    /// Skips the rest of a block up to and including its `end`.
+    void skipBlock();
+    ReturnStmt* parseReturnStmt();
+    IfStmt* parseIfStmt();
 
-    std::unique_ptr<Decl> parseDecl();
-    std::unique_ptr<FunDecl> parseFunDecl(bool local);
-    std::unique_ptr<VarDecl> parseVarDecl();
+    Decl* parseDecl();
+    FunDecl* parseFunDecl(bool local);
+    VarDecl* parseVarDecl();
     std::optional<TypeAnnotation> parseTypeAnnotation();
-    std::vector<Token> tokens;
-    size_t position;
+    TokenStream tokens;
+    // Moved into the resulting Program by parse()
+    AstArena arena;
+    // Errors recovered from so far
+    std::vector<std::string> diagnostics;
+    // Set by parseDeclarations, function bodies are left empty
+    bool declarationsOnly = false;
 };
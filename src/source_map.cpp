@@ -0,0 +1,71 @@
+#include "source_map.h"
+
+#include <algorithm>
+#include <charconv>
+#include <format>
+#include <stdexcept>
+
+void SourceMap::add(uint32_t line, uint32_t sourceLine) {
+    if (!entries.empty() &&
+        (entries.back().line == line || entries.back().sourceLine == sourceLine)) {
+        return;
+    }
+    entries.push_back({line, sourceLine});
+}
+
+uint32_t SourceMap::sourceLine(uint32_t line) const {
+    auto after = std::ranges::upper_bound(entries, line, {}, &Entry::line);
+    return after == entries.begin() ? 0 : std::prev(after)->sourceLine;
+}
+
+std::string SourceMap::encode() const {
+    std::string text;
+    for (const auto& entry : entries) {
+        if (!text.empty()) {
+            text += ',';
+        }
+        text += std::format("{}:{}", entry.line, entry.sourceLine);
+    }
+    return text;
+}
+
+SourceMap SourceMap::decode(std::string_view text) {
+    SourceMap map;
+    const char* position = text.data();
+    const char* end = text.data() + text.size();
+    auto invalid = [&] { return std::runtime_error(std::format("Invalid source map: {}", text)); };
+    auto number = [&](uint32_t& value) {
+        auto [next, ec] = std::from_chars(position, end, value);
+        if (ec != std::errc{}) {
+            throw invalid();
+        }
+        position = next;
+    };
+    while (position != end) {
+        Entry entry{};
+        number(entry.line);
+        if (position == end || *position++ != ':') {
+            throw invalid();
+        }
+        number(entry.sourceLine);
+        if (position != end && *position++ != ',') {
+            throw invalid();
+        }
+        if (!map.entries.empty() && map.entries.back().line >= entry.line) {
+            throw invalid();
+        }
+        map.entries.push_back(entry);
+    }
+    return map;
+}
+
+std::optional<SourceMap> SourceMap::fromLua(std::string_view lua) {
+    if (lua.ends_with('\n')) {
+        lua.remove_suffix(1);
+    }
+    auto lastLine = lua.substr(lua.rfind('\n') + 1);
+    if (!lastLine.starts_with(COMMENT_PREFIX)) {
+        return std::nullopt;
+    }
+    return decode(lastLine.substr(COMMENT_PREFIX.size()));
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Maps the lines of generated Lua back to the lines of the source they were compiled from,
+/// so runtime errors and profiler samples can be attributed to the `.tlua` file.
+///
+/// Only the generated lines where the source line changes are stored, each entry holds
+/// until the next one. The text form lists them as `line:sourceLine` pairs, e.g.
+/// `1:1,2:3,5:4`, and is appended to the Lua as a trailing comment:
+///   --# tlua-lines 1:1,2:3,5:4
+class SourceMap {
+  public:
+    static constexpr std::string_view COMMENT_PREFIX = "--# tlua-lines ";
+
+    /// Records that generated `line` comes from `sourceLine`. Lines must be added in
+    /// increasing order, the first source line added for a generated line is kept.
+    void add(uint32_t line, uint32_t sourceLine);
+
+    /// The source line of generated `line`, 0 before the first mapped line.
+    uint32_t sourceLine(uint32_t line) const;
+
+    bool empty() const { return entries.empty(); }
+
+    std::string encode() const;
+    /// Throws std::runtime_error if `text` is not a valid encoding.
+    static SourceMap decode(std::string_view text);
+    /// The map in the trailing comment of generated Lua, if the last line is one.
+    static std::optional<SourceMap> fromLua(std::string_view lua);
+
+    bool operator==(const SourceMap&) const = default;
+
+  private:
+    struct Entry {
+        uint32_t line;
+        uint32_t sourceLine;
+
+        bool operator==(const Entry&) const = default;
+    };
+    // Sorted by line
+    std::vector<Entry> entries;
+};
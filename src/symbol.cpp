@@ -0,0 +1,26 @@
+#include "symbol.h"
+
+SymbolTable::SymbolTable() { intern(""); }
+
+SymbolTable& SymbolTable::instance() {
+    static SymbolTable table;
+    return table;
+}
+
+Symbol SymbolTable::intern(std::string_view text) {
+    {
+        // Most names are already interned, only creating a new symbol takes the exclusive lock
+        std::shared_lock lock(mutex);
+        if (auto found = ids.find(text); found != ids.end()) {
+            return Symbol{found->second};
+        }
+    }
+    std::unique_lock lock(mutex);
+    if (auto found = ids.find(text); found != ids.end()) {
+        return Symbol{found->second};
+    }
+    auto id = static_cast<uint32_t>(names.size());
+    const auto& name = names.emplace_back(text);
+    ids.emplace(name, id);
+    return Symbol{id};
+}
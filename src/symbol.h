@@ -0,0 +1,58 @@
+#pragma once
+#include <compare>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/// An interned name (identifier, field name or string literal).
+/// Two symbols are equal iff their texts are equal, so comparing them is an integer compare.
+/// Note that the ordering is by id, not alphabetical.
+struct Symbol {
+    uint32_t id = 0; // 0 is the empty string
+
+    const std::string& str() const;
+
+    auto operator<=>(const Symbol&) const = default;
+};
+
+template <> struct std::hash<Symbol> {
+    size_t operator()(Symbol symbol) const noexcept { return std::hash<uint32_t>{}(symbol.id); }
+};
+
+/// Global table owning the text of every Symbol, shared by all compilation phases.
+/// Thread-safe: files compiled in parallel intern into the same table.
+class SymbolTable {
+  public:
+    static SymbolTable& instance();
+
+    /// Returns the symbol for `text`, adding it to the table on first use.
+    Symbol intern(std::string_view text);
+
+    const std::string& name(Symbol symbol) const {
+        std::shared_lock lock(mutex);
+        return names[symbol.id];
+    }
+
+    /// Number of distinct symbols interned so far.
+    size_t size() const {
+        std::shared_lock lock(mutex);
+        return names.size();
+    }
+
+  private:
+    SymbolTable();
+
+    // A deque never moves its elements, so the views used as keys stay valid
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, uint32_t> ids;
+    mutable std::shared_mutex mutex;
+};
+
+inline Symbol intern(std::string_view text) { return SymbolTable::instance().intern(text); }
+
+inline const std::string& Symbol::str() const { return SymbolTable::instance().name(*this); }
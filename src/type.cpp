@@ -1,101 +1,88 @@
 #include "type.h"
 
-bool isSameType(Type* a, Type* b) {
-    if (a == b) {
-        return true;
-    }
-    if (a == nullptr || b == nullptr) {
-        return false;
-    }
-
-    if (a->getKind() != b->getKind()) {
-        return false;
-    }
+#include <unordered_map>
+
+namespace {
+struct SubtypeCache {
+    // Keyed on the ids of (sub, super)
+    std::unordered_map<uint64_t, bool> results;
+    SubtypeCacheCounters counters;
+};
+
+SubtypeCache& subtypeCache() {
+    static thread_local SubtypeCache cache;
+    return cache;
+}
 
-    switch (a->getKind()) {
-    case TypeKind::Number:
-    case TypeKind::String:
-    case TypeKind::Boolean:
-    case TypeKind::Nil:
-    case TypeKind::Unknown:
-    case TypeKind::Any:
-        // Primitives are singletons, pointer equality is sufficient
-        return a == b;
+/// Whether the contents of a mutable container can be seen as either type: an {integer} used
+/// as a {number} could be given a 0.5. Unknown stays compatible with everything.
+bool isInvariant(Type* sub, Type* super) {
+    return (super->getKind() == TypeKind::Unknown || isSubtype(sub, super)) &&
+           (sub->getKind() == TypeKind::Unknown || isSubtype(super, sub));
+}
 
-    case TypeKind::Array: {
-        auto* arr1 = static_cast<ArrayType*>(a);
-        auto* arr2 = static_cast<ArrayType*>(b);
-        return isSameType(arr1->getElementType(), arr2->getElementType());
+/// Subtyping between two different composite types of the same kind.
+bool isStructuralSubtype(Type* sub, Type* super) {
+    switch (sub->getKind()) {
+    case TypeKind::Array:
+        return isInvariant(static_cast<ArrayType*>(sub)->getElementType(),
+                           static_cast<ArrayType*>(super)->getElementType());
+    case TypeKind::Record: {
+        auto* subRecord = static_cast<RecordType*>(sub);
+        auto* superRecord = static_cast<RecordType*>(super);
+        return isInvariant(subRecord->getKeyType(), superRecord->getKeyType()) &&
+               isInvariant(subRecord->getValueType(), superRecord->getValueType());
+    }
+    case TypeKind::Table: {
+        const auto& fields = static_cast<TableType*>(sub)->getFields();
+        return std::ranges::all_of(static_cast<TableType*>(super)->getFields(),
+                                   [&](auto&& field) {
+                                       auto found = fields.find(field.first);
+                                       return found != fields.end() &&
+                                              isInvariant(found->second, field.second);
+                                   });
     }
-
     case TypeKind::Function: {
-        auto* fn1 = static_cast<FunctionType*>(a);
-        auto* fn2 = static_cast<FunctionType*>(b);
-
-        if (fn1->getParamTypes().size() != fn2->getParamTypes().size()) {
+        auto* subFunction = static_cast<FunctionType*>(sub);
+        auto* superFunction = static_cast<FunctionType*>(super);
+        const auto& subParams = subFunction->getParamTypes();
+        const auto& superParams = superFunction->getParamTypes();
+        if (subParams.size() != superParams.size()) {
             return false;
         }
-
-        for (size_t i = 0; i < fn1->getParamTypes().size(); ++i) {
-            if (!isSameType(fn1->getParamTypes()[i], fn2->getParamTypes()[i])) {
+        for (size_t i = 0; i < subParams.size(); ++i) {
+            if (!isSubtype(superParams[i], subParams[i])) {
                 return false;
             }
         }
-
-        return isSameType(fn1->getReturnType(), fn2->getReturnType());
+        return isSubtype(subFunction->getReturnType(), superFunction->getReturnType());
     }
-
-    case TypeKind::Union: {
-        auto* union1 = static_cast<UnionType*>(a);
-        auto* union2 = static_cast<UnionType*>(b);
-
-        if (union1->getTypes().size() != union2->getTypes().size()) {
-            return false;
-        }
-
-        // Check if all types in union1 are in union2 (order independent)
-        for (auto* type1 : union1->getTypes()) {
-            bool found = false;
-            for (auto* type2 : union2->getTypes()) {
-                if (isSameType(type1, type2)) {
-                    found = true;
-                    break;
-                }
-            }
-            if (!found) {
-                return false;
-            }
-        }
-        return true;
+    default:
+        return false;
     }
+}
 
-    case TypeKind::Table: {
-        auto* table1 = static_cast<TableType*>(a);
-        auto* table2 = static_cast<TableType*>(b);
-
-        if (table1->getFields().size() != table2->getFields().size()) {
-            return false;
-        }
-
-        for (const auto& [key, val] : table1->getFields()) {
-            auto it = table2->getFields().find(key);
-            if (it == table2->getFields().end() || !isSameType(val, it->second)) {
-                return false;
-            }
-        }
-        return true;
+/// isSubtype for a composite or union sub, computed without the cache.
+bool isCompositeSubtype(Type* sub, Type* super, PrimitiveMask superPrimitives) {
+    // If sub is a union, all members must be subtypes of super
+    if (sub->getKind() == TypeKind::Union) {
+        auto* unionType = static_cast<UnionType*>(sub);
+        return (unionType->getPrimitives() & ~superPrimitives) == 0 &&
+               std::ranges::all_of(unionType->getComposites(),
+                                   [super](Type* member) { return isSubtype(member, super); });
     }
 
-    case TypeKind::Record: {
-        auto* rec1 = static_cast<RecordType*>(a);
-        auto* rec2 = static_cast<RecordType*>(b);
-        return isSameType(rec1->getKeyType(), rec2->getKeyType()) &&
-               isSameType(rec1->getValueType(), rec2->getValueType());
-    }
+    // Union types: sub is subtype of union if sub is subtype of any member
+    if (super->getKind() == TypeKind::Union) {
+        return std::ranges::any_of(static_cast<UnionType*>(super)->getComposites(),
+                                   [sub](Type* member) { return isSubtype(sub, member); });
     }
 
-    return false;
+    return sub->getKind() == super->getKind() && isStructuralSubtype(sub, super);
 }
+} // namespace
+
+bool isSameType(Type* a, Type* b) { return a == b; }
 
 bool isSubtype(Type* sub, Type* super) {
     if (isSameType(sub, super)) {
@@ -106,6 +93,11 @@ bool isSubtype(Type* sub, Type* super) {
         return false;
     }
 
+    // An error was already reported for the expression, don't report it again
+    if (sub->getKind() == TypeKind::Error || super->getKind() == TypeKind::Error) {
+        return true;
+    }
+
     // Any is a supertype of everything
     if (super->getKind() == TypeKind::Any) {
         return true;
@@ -116,31 +108,37 @@ bool isSubtype(Type* sub, Type* super) {
         return true;
     }
 
-    // Union types: sub is subtype of union if sub is subtype of any member
-    if (super->getKind() == TypeKind::Union) {
-        auto* unionType = static_cast<UnionType*>(super);
-        for (auto* memberType : unionType->getTypes()) {
-            if (isSubtype(sub, memberType)) {
-                return true;
-            }
-        }
-        return false;
+    // Primitive members are compared as bitmasks, integer is part of number
+    PrimitiveMask superPrimitives = primitivesOf(super);
+    if (superPrimitives & primitiveBit(TypeKind::Number)) {
+        superPrimitives |= primitiveBit(TypeKind::Integer);
     }
+    // Unknown members are subtypes of everything as well
+    superPrimitives |= primitiveBit(TypeKind::Unknown);
 
-    // If sub is a union, all members must be subtypes of super
-    if (sub->getKind() == TypeKind::Union) {
-        auto* unionType = static_cast<UnionType*>(sub);
-        for (auto* memberType : unionType->getTypes()) {
-            if (!isSubtype(memberType, super)) {
-                return false;
-            }
-        }
-        return true;
+    if (isPrimitiveKind(sub->getKind())) {
+        return (primitiveBit(sub->getKind()) & superPrimitives) != 0;
+    }
+    // A composite type is never a subtype of a primitive
+    if (sub->getKind() != TypeKind::Union && isPrimitiveKind(super->getKind())) {
+        return false;
     }
 
-    return false;
+    auto& cache = subtypeCache();
+    uint64_t key = (uint64_t{sub->getId()} << 32) | super->getId();
+    if (auto found = cache.results.find(key); found != cache.results.end()) {
+        ++cache.counters.hits;
+        return found->second;
+    }
+    ++cache.counters.misses;
+    // The computation adds the entries of the member types, the iterator can't be kept
+    bool result = isCompositeSubtype(sub, super, superPrimitives);
+    cache.results.emplace(key, result);
+    return result;
 }
 
+SubtypeCacheCounters subtypeCacheCounters() { return subtypeCache().counters; }
+
 std::string typeToString(Type* type) {
     if (type == nullptr) {
         return "<null>";
@@ -170,33 +168,120 @@ TypeFactory& TypeFactory::instance() {
     return factory;
 }
 
+template <typename T> T* TypeFactory::intern(std::unique_ptr<T> type) {
+    // Composite ids start after the primitive kinds
+    type->id = static_cast<uint32_t>(TypeKind::Any) + 1 + static_cast<uint32_t>(types.size());
+    T* result = type.get();
+    types.push_back(std::move(type));
+    return result;
+}
+
 Type* TypeFactory::createFunctionType(std::vector<Type*> paramTypes, Type* returnType) {
-    types.push_back(std::make_unique<FunctionType>(std::move(paramTypes), returnType));
-    return types.back().get();
+    std::lock_guard lock(mutex);
+    auto key = std::make_pair(paramTypes, returnType);
+    auto found = functionTypes.find(key);
+    if (found != functionTypes.end()) {
+        return found->second;
+    }
+    Type* type = intern(std::make_unique<FunctionType>(std::move(paramTypes), returnType));
+    functionTypes.emplace(std::move(key), type);
+    return type;
 }
 
 Type* TypeFactory::createArrayType(Type* elementType) {
-    types.push_back(std::make_unique<ArrayType>(elementType));
-    return types.back().get();
+    std::lock_guard lock(mutex);
+    auto found = arrayTypes.find(elementType);
+    if (found != arrayTypes.end()) {
+        return found->second;
+    }
+    Type* type = intern(std::make_unique<ArrayType>(elementType));
+    arrayTypes.emplace(elementType, type);
+    return type;
 }
 
-Type* TypeFactory::createTableType(std::map<std::string, Type*> fields) {
-    types.push_back(std::make_unique<TableType>(std::move(fields)));
-    return types.back().get();
+Type* TypeFactory::createTableType(std::map<Symbol, Type*> fields) {
+    std::lock_guard lock(mutex);
+    auto found = tableTypes.find(fields);
+    if (found != tableTypes.end()) {
+        return found->second;
+    }
+    Type* type = intern(std::make_unique<TableType>(fields));
+    tableTypes.emplace(std::move(fields), type);
+    return type;
 }
 
 Type* TypeFactory::createRecordType(Type* keyType, Type* valueType) {
-    types.push_back(std::make_unique<RecordType>(keyType, valueType));
-    return types.back().get();
+    std::lock_guard lock(mutex);
+    auto key = std::make_pair(keyType, valueType);
+    auto found = recordTypes.find(key);
+    if (found != recordTypes.end()) {
+        return found->second;
+    }
+    Type* type = intern(std::make_unique<RecordType>(keyType, valueType));
+    recordTypes.emplace(key, type);
+    return type;
 }
 
 Type* TypeFactory::createUnionType(std::vector<Type*> types_list) {
-    // If Any is in the union, the whole union is Any
-    if (std::any_of(types_list.begin(), types_list.end(),
-                    [](Type* t) { return t->getKind() == TypeKind::Any; })) {
+    // Normalize: flatten nested unions and drop duplicates, primitives go into a bitmask and
+    // composites are sorted, so large unions take O(n log n) time
+    PrimitiveMask primitives = 0;
+    std::vector<Type*> composites;
+    bool containsAny = false;
+    // Duplicates are dropped once all composites are collected
+    auto addComposite = [&](Type* type) { composites.push_back(type); };
+    for (auto* type : types_list) {
+        switch (type->getKind()) {
+        case TypeKind::Error:
+            return errorType();
+        case TypeKind::Any:
+            // If Any is in the union, the whole union is Any
+            containsAny = true;
+            break;
+        case TypeKind::Union: {
+            auto* nested = static_cast<UnionType*>(type);
+            primitives |= nested->getPrimitives();
+            std::ranges::for_each(nested->getComposites(), addComposite);
+            break;
+        }
+        default:
+            if (isPrimitiveKind(type->getKind())) {
+                primitives |= primitiveBit(type->getKind());
+            } else {
+                addComposite(type);
+            }
+        }
+    }
+    if (containsAny) {
         return anyType();
     }
+    if (primitives & primitiveBit(TypeKind::Number)) {
+        primitives &= ~primitiveBit(TypeKind::Integer);
+    }
+
+    // Members sorted by id: the primitives in kind order, then the composites
+    std::vector<Type*> members;
+    for (auto kind = TypeKind::Number; isPrimitiveKind(kind);
+         kind = static_cast<TypeKind>(static_cast<int>(kind) + 1)) {
+        if (primitives & primitiveBit(kind)) {
+            members.push_back(BasicType::ofKind(kind));
+        }
+    }
+    std::ranges::sort(composites, {}, &Type::getId);
+    auto duplicates = std::ranges::unique(composites);
+    composites.erase(duplicates.begin(), duplicates.end());
+    members.insert(members.end(), composites.begin(), composites.end());
 
-    types.push_back(std::make_unique<UnionType>(std::move(types_list)));
-    return types.back().get();
+    if (members.size() == 1) {
+        return members.front();
+    }
+
+    std::lock_guard lock(mutex);
+    auto found = unionTypes.find(members);
+    if (found != unionTypes.end()) {
+        return found->second;
+    }
+    Type* type = intern(std::make_unique<UnionType>(members));
+    unionTypes.emplace(std::move(members), type);
+    return type;
 }
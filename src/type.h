@@ -1,18 +1,25 @@
 #pragma once
+#include "symbol.h"
 #include "utils.h"
+#include <algorithm>
+#include <cstdint>
 #include <format>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <span>
 #include <string>
 #include <vector>
 enum class TypeKind {
     // Primitive Types
     Number,
+    Integer, // the integer subtype of number (Lua 5.3+)
     String,
     Boolean,
     Nil,
 
     Unknown,
+    Error, // the type of an expression that failed to check, accepted everywhere
     Any,
 
     // Composite Types
@@ -25,6 +32,17 @@ enum class TypeKind {
     Union, // string | number
 };
 
+/// Set of primitive kinds (number up to unknown), one bit per kind.
+using PrimitiveMask = uint32_t;
+
+constexpr bool isPrimitiveKind(TypeKind kind) { return kind <= TypeKind::Unknown; }
+
+constexpr PrimitiveMask primitiveBit(TypeKind kind) {
+    return PrimitiveMask{1} << static_cast<int>(kind);
+}
+
+/// Types are hash-consed by the TypeFactory: structurally equal types are the same object,
+/// so types can be compared by pointer.
 class Type {
   public:
     explicit Type(TypeKind kind) : kind(kind) {}
@@ -33,10 +51,18 @@ class Type {
 
     TypeKind getKind() const { return kind; }
 
+    /// Canonical id, primitives are numbered in TypeKind order, composite types in creation order.
+    /// Used to order union members.
+    uint32_t getId() const { return id; }
+
     virtual std::string toString() const = 0;
 
   private:
+    friend class BasicType;
+    friend class TypeFactory;
+
     TypeKind kind;
+    uint32_t id = 0;
 };
 
 class BasicType : public Type {
@@ -46,6 +72,11 @@ class BasicType : public Type {
         return &instance;
     }
 
+    static Type* integerType() {
+        static BasicType instance(TypeKind::Integer);
+        return &instance;
+    }
+
     static Type* stringType() {
         static BasicType instance(TypeKind::String);
         return &instance;
@@ -66,15 +97,44 @@ class BasicType : public Type {
         return &instance;
     }
 
+    static Type* errorType() {
+        static BasicType instance(TypeKind::Error);
+        return &instance;
+    }
+
     static Type* anyType() {
         static BasicType instance(TypeKind::Any);
         return &instance;
     }
 
+    /// The singleton of a primitive kind.
+    static Type* ofKind(TypeKind kind) {
+        switch (kind) {
+        case TypeKind::Number:
+            return numberType();
+        case TypeKind::Integer:
+            return integerType();
+        case TypeKind::String:
+            return stringType();
+        case TypeKind::Boolean:
+            return booleanType();
+        case TypeKind::Nil:
+            return nilType();
+        case TypeKind::Error:
+            return errorType();
+        case TypeKind::Any:
+            return anyType();
+        default:
+            return unknownType();
+        }
+    }
+
     std::string toString() const override {
         switch (getKind()) {
         case TypeKind::Number:
             return "number";
+        case TypeKind::Integer:
+            return "integer";
         case TypeKind::String:
             return "string";
         case TypeKind::Boolean:
@@ -83,6 +143,8 @@ class BasicType : public Type {
             return "nil";
         case TypeKind::Unknown:
             return "unknown";
+        case TypeKind::Error:
+            return "error";
         case TypeKind::Any:
             return "any";
         default:
@@ -91,7 +153,7 @@ class BasicType : public Type {
     }
 
   private:
-    explicit BasicType(TypeKind kind) : Type(kind) {}
+    explicit BasicType(TypeKind kind) : Type(kind) { id = static_cast<uint32_t>(kind); }
 };
 
 class FunctionType : public Type {
@@ -114,10 +176,25 @@ class FunctionType : public Type {
     Type* returnType;
 };
 
+/// Members are sorted by id, so the primitive members come first. They are also kept as a
+/// bitmask, which turns most subtype checks into a few bitwise operations.
 class UnionType : public Type {
   public:
-    explicit UnionType(std::vector<Type*> types) : Type(TypeKind::Union), types(std::move(types)) {}
+    explicit UnionType(std::vector<Type*> types) : Type(TypeKind::Union), types(std::move(types)) {
+        for (auto* member : this->types) {
+            if (!isPrimitiveKind(member->getKind())) {
+                break;
+            }
+            primitives |= primitiveBit(member->getKind());
+            ++firstComposite;
+        }
+    }
     const std::vector<Type*>& getTypes() const { return types; }
+    PrimitiveMask getPrimitives() const { return primitives; }
+    /// The members that aren't primitives.
+    std::span<Type* const> getComposites() const {
+        return std::span(types).subspan(firstComposite);
+    }
 
     std::string toString() const override {
         auto toStrings =
@@ -127,8 +204,18 @@ class UnionType : public Type {
 
   private:
     std::vector<Type*> types;
+    PrimitiveMask primitives = 0;
+    size_t firstComposite = 0;
 };
 
+/// The primitive kinds `type` is or has as union members.
+inline PrimitiveMask primitivesOf(Type* type) {
+    if (type->getKind() == TypeKind::Union) {
+        return static_cast<UnionType*>(type)->getPrimitives();
+    }
+    return isPrimitiveKind(type->getKind()) ? primitiveBit(type->getKind()) : 0;
+}
+
 class ArrayType : public Type {
   public:
     explicit ArrayType(Type* element_type) : Type(TypeKind::Array), elementType(element_type) {}
@@ -142,19 +229,22 @@ class ArrayType : public Type {
 
 class TableType : public Type {
   public:
-    explicit TableType(std::map<std::string, Type*> fields)
+    explicit TableType(std::map<Symbol, Type*> fields)
         : Type(TypeKind::Table), fields(std::move(fields)) {}
-    const std::map<std::string, Type*>& getFields() const { return fields; }
+    const std::map<Symbol, Type*>& getFields() const { return fields; }
 
     std::string toString() const override {
-        auto fieldStrings = std::ranges::views::transform(fields, [](auto&& field) {
-            return std::format("{}: {}", field.first, field.second->toString());
+        // Fields are keyed by symbol id, print them alphabetically
+        std::vector<std::pair<Symbol, Type*>> sorted(fields.begin(), fields.end());
+        std::ranges::sort(sorted, {}, [](auto&& field) -> auto& { return field.first.str(); });
+        auto fieldStrings = std::ranges::views::transform(sorted, [](auto&& field) {
+            return std::format("{}: {}", field.first.str(), field.second->toString());
         });
         return std::format("{{ {} }}", join(fieldStrings, ", "));
     }
 
   private:
-    std::map<std::string, Type*> fields;
+    std::map<Symbol, Type*> fields;
 };
 
 class RecordType : public Type {
@@ -174,36 +264,78 @@ class RecordType : public Type {
 };
 
 // Type utilities
+/// Types are canonical, so this is pointer equality.
 bool isSameType(Type* a, Type* b);
+/// Composite types are compared structurally: tables are mutable, so the elements of arrays
+/// and records and the fields of tables are invariant (unknown matches anything), a table is a
+/// subtype of a table with a subset of its fields, functions have contravariant parameters
+/// and a covariant return type. Results for composite types are cached per thread, types are
+/// never freed so the entries stay valid for the whole process.
 bool isSubtype(Type* sub, Type* super);
 std::string typeToString(Type* type);
 
+struct SubtypeCacheCounters {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+/// The use of the subtype cache of the calling thread so far.
+SubtypeCacheCounters subtypeCacheCounters();
+
 /// Unify multiple types into a single type.
 /// If all types are the same, returns that type.
 /// Otherwise, creates a union type.
 Type* unifyTypes(std::vector<Type*> types);
 
 // Type factory - owns all complex types
+/// Complex types are hash-consed: asking twice for the same structure returns the same pointer,
+/// so the number of types is bounded by the number of distinct types in the program.
+/// Thread-safe: one factory is shared by all files compiled in parallel.
 class TypeFactory {
   public:
     static TypeFactory& instance();
 
     // Primitive types (singletons, not owned by factory)
     static Type* numberType() { return BasicType::numberType(); }
+    static Type* integerType() { return BasicType::integerType(); }
     static Type* stringType() { return BasicType::stringType(); }
     static Type* booleanType() { return BasicType::booleanType(); }
     static Type* nilType() { return BasicType::nilType(); }
     static Type* unknownType() { return BasicType::unknownType(); }
+    static Type* errorType() { return BasicType::errorType(); }
     static Type* anyType() { return BasicType::anyType(); }
 
     // Complex type factories (owned by factory)
     Type* createFunctionType(std::vector<Type*> paramTypes, Type* returnType);
     Type* createArrayType(Type* elementType);
-    Type* createTableType(std::map<std::string, Type*> fields);
+    Type* createTableType(std::map<Symbol, Type*> fields);
     Type* createRecordType(Type* keyType, Type* valueType);
+    /// Nested unions are flattened and members are sorted by id and deduplicated, in
+    /// O(n log n) time in the number of types.
+    /// A union with a single member is that member, a union containing any is any and
+    /// one containing error is error.
+    /// Integer is dropped from unions with number, which already contains it.
     Type* createUnionType(std::vector<Type*> types);
 
+    /// Number of complex types created so far.
+    size_t size() const {
+        std::lock_guard lock(mutex);
+        return types.size();
+    }
+
   private:
     TypeFactory() = default;
+
+    // Takes ownership of a newly created type and gives it the next canonical id
+    template <typename T> T* intern(std::unique_ptr<T> type);
+
     std::vector<std::unique_ptr<Type>> types;
+
+    // Canonical instances, keyed on the structure of the type
+    std::map<Type*, Type*> arrayTypes;
+    std::map<std::pair<std::vector<Type*>, Type*>, Type*> functionTypes;
+    std::map<std::map<Symbol, Type*>, Type*> tableTypes;
+    std::map<std::pair<Type*, Type*>, Type*> recordTypes;
+    std::map<std::vector<Type*>, Type*> unionTypes;
+    mutable std::mutex mutex;
 };
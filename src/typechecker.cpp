@@ -1,20 +1,50 @@
 #include "typechecker.h"
 
+#include "ast_walk.h"
+#include "module_resolver.h"
+
 namespace {
 bool isAny(Type* type) { return type->getKind() == TypeKind::Any; }
 
-bool isNumber(Type* type) { return isAny(type) || type == TypeFactory::numberType(); }
+bool isInteger(Type* type) { return type == TypeFactory::integerType(); }
+
+bool isNumber(Type* type) {
+    return isAny(type) || isInteger(type) || type == TypeFactory::numberType();
+}
 
 bool isString(Type* type) { return isAny(type) || type == TypeFactory::stringType(); }
+
+bool isError(Type* type) { return type->getKind() == TypeKind::Error; }
 } // namespace
 
-TypeChecker::TypeChecker() {
+TypeChecker::TypeChecker(ModuleResolver* modules) : modules(modules) {
     env.pushScope(); // global scope
 }
 
+void TypeChecker::importModules(const Program& program) {
+    if (modules == nullptr) {
+        return;
+    }
+    // Running a module defines its globals, a require anywhere at the top level makes them
+    // known to the whole file
+    for (const auto& name : requiredModules(program)) {
+        try {
+            if (const auto* summary = modules->summary(name)) {
+                for (auto&& [symbol, type] : summary->exports) {
+                    env.define(symbol, type);
+                }
+            }
+        } catch (const std::exception& e) {
+            fail(std::format("Could not load module '{}': {}", name, e.what()));
+        }
+    }
+}
+
 void TypeChecker::visit(StringExpr& expr) { expr.type = TypeFactory::stringType(); }
 
-void TypeChecker::visit(NumberExpr& expr) { expr.type = TypeFactory::numberType(); }
+void TypeChecker::visit(NumberExpr& expr) {
+    expr.type = expr.integer ? TypeFactory::integerType() : TypeFactory::numberType();
+}
 
 void TypeChecker::visit(NilExpr& expr) { expr.type = TypeFactory::nilType(); }
 
@@ -26,8 +56,16 @@ void TypeChecker::visit(TableExpr& expr) {
     bool hasMapPart = !expr.mapPart.empty();
 
     if (hasArrayPart && hasMapPart) {
-        throw error("Type error: mixed table literals are not allowed. "
-                    "Use either array syntax {1, 2, 3} or record syntax {a = 1, b = 2}");
+        // The elements can have errors of their own
+        for (auto& elem : expr.arrayPart) {
+            elem->accept(*this);
+        }
+        for (auto& [key, value] : expr.mapPart) {
+            value->accept(*this);
+        }
+        expr.type = fail("Type error: mixed table literals are not allowed. "
+                         "Use either array syntax {1, 2, 3} or record syntax {a = 1, b = 2}");
+        return;
     }
 
     if (hasArrayPart) {
@@ -42,7 +80,7 @@ void TypeChecker::visit(TableExpr& expr) {
         expr.type = TypeFactory::instance().createArrayType(elementType);
     } else if (hasMapPart) {
         // Infer record/table type with named fields
-        std::map<std::string, Type*> fields;
+        std::map<Symbol, Type*> fields;
         for (auto& [key, value] : expr.mapPart) {
             value->accept(*this);
             fields[key] = value->type;
@@ -55,6 +93,10 @@ void TypeChecker::visit(TableExpr& expr) {
 }
 
 void TypeChecker::visit(VarExpr& expr) {
+    expr.binding = env.declaration(expr.name);
+    if (expr.binding) {
+        ++expr.binding->uses;
+    }
     Type* t = env.lookup(expr.name);
     if (t == nullptr) {
         expr.type = TypeFactory::anyType();
@@ -63,13 +105,34 @@ void TypeChecker::visit(VarExpr& expr) {
     }
 }
 
-void TypeChecker::visit(UnaryOpExpr& expr) {
-    expr.right->accept(*this);
+void TypeChecker::visit(UnaryOpExpr& expr) { checkOperators(expr); }
+
+void TypeChecker::visit(BinOpExpr& expr) { checkOperators(expr); }
+
+void TypeChecker::checkOperators(Expr& root) {
+    Expr* slot = &root;
+    forEachOperator(
+        slot, [this](Expr* operand) { operand->accept(*this); },
+        [this](Expr* op) {
+            if (auto* binOp = nodeCast<BinOpExpr>(op)) {
+                checkBinOp(*binOp);
+            } else {
+                checkUnaryOp(static_cast<UnaryOpExpr&>(*op));
+            }
+        });
+}
+
+void TypeChecker::checkUnaryOp(UnaryOpExpr& expr) {
+    if (isError(expr.right->type)) {
+        expr.type = expr.right->type;
+        return;
+    }
 
     switch (expr.op) {
     case TokenKind::Minus:
         if (!isNumber(expr.right->type)) {
-            throw error("Type error: unary minus requires a number type");
+            expr.type = fail("Type error: unary minus requires a number type");
+            break;
         }
         expr.type = expr.right->type;
         break;
@@ -78,30 +141,39 @@ void TypeChecker::visit(UnaryOpExpr& expr) {
         break;
     case TokenKind::Length:
         if (expr.right->type->getKind() != TypeKind::Array && !isAny(expr.right->type)) {
-            throw error(std::format("Type error: length operator requires array type, got {}",
-                                    expr.right->type->toString()));
+            expr.type = fail(std::format("Type error: length operator requires array type, got {}",
+                                         expr.right->type->toString()));
+            break;
         }
-        expr.type = TypeFactory::numberType();
+        expr.type = TypeFactory::integerType();
         break;
     default:
-        throw error("Unknown unary operator in type checker");
+        expr.type = fail("Unknown unary operator in type checker");
     }
 }
 
-void TypeChecker::visit(BinOpExpr& expr) {
-    expr.left->accept(*this);
-    expr.right->accept(*this);
+void TypeChecker::checkBinOp(BinOpExpr& expr) {
     auto* leftType = expr.left->type;
     auto* rightType = expr.right->type;
+    // The right side of a member access is the field name, it has no type of its own
+    if (isError(leftType) || (isError(rightType) && expr.op != TokenKind::MemberAccess)) {
+        expr.type = TypeFactory::errorType();
+        return;
+    }
     switch (expr.op) {
     case TokenKind::Plus:
     case TokenKind::Minus:
     case TokenKind::Star:
-    case TokenKind::Slash: {
+    case TokenKind::Slash:
+    case TokenKind::FloorDiv: {
         if (!isNumber(leftType) || !isNumber(rightType)) {
-            throw error("Type error: arithmetic operations require number types");
+            expr.type = fail("Type error: arithmetic operations require number types");
+            return;
         }
-        expr.type = TypeFactory::numberType();
+        // `/` always gives a float, the other operators keep integers integers
+        bool integer =
+            expr.op != TokenKind::Slash && isInteger(leftType) && isInteger(rightType);
+        expr.type = integer ? TypeFactory::integerType() : TypeFactory::numberType();
         return;
     }
     case TokenKind::Assign:
@@ -120,48 +192,60 @@ void TypeChecker::visit(BinOpExpr& expr) {
             expr.type = TypeFactory::booleanType();
             return;
         }
-        throw error("Type error: comparison requires number or string types");
+        expr.type = fail("Type error: comparison requires number or string types");
+        return;
     case TokenKind::And:
     case TokenKind::Or:
         // The result of logical ops can be any of the operand types => union
         expr.type = TypeFactory::instance().createUnionType({leftType, rightType});
         return;
     case TokenKind::Concat:
-        if (isString(leftType) && isString(rightType)) {
+        // Lua converts numbers to their text
+        if ((isString(leftType) || isNumber(leftType)) &&
+            (isString(rightType) || isNumber(rightType))) {
             expr.type = TypeFactory::stringType();
             return;
         }
-        throw error("Type error: concat requires string or number types");
+        expr.type = fail("Type error: concat requires string or number types");
+        return;
     case TokenKind::MemberAccess: {
         // Member access: left must be a table, right must be a VarExpr with the field name
+        // Visited as an operand, but the field name doesn't refer to a variable
+        if (auto* field = nodeCast<VarExpr>(expr.right); field && field->binding) {
+            --field->binding->uses;
+            field->binding = nullptr;
+        }
         if (leftType->getKind() == TypeKind::Any) {
             expr.type = TypeFactory::anyType();
             return;
         }
         if (leftType->getKind() != TypeKind::Table) {
-            throw error(std::format("Type error: cannot access member on non-table type {}",
-                                    leftType->toString()));
+            expr.type = fail(std::format("Type error: cannot access member on non-table type {}",
+                                         leftType->toString()));
+            return;
         }
         auto* tableType = static_cast<TableType*>(leftType);
         // The right side is parsed as a VarExpr containing the field name
-        auto* varExpr = dynamic_cast<VarExpr*>(expr.right.get());
+        auto* varExpr = nodeCast<VarExpr>(expr.right);
         if (!varExpr) {
-            throw error("Type error: member access requires an identifier");
+            expr.type = fail("Type error: member access requires an identifier");
+            return;
         }
         auto it = tableType->getFields().find(varExpr->name);
         if (it != tableType->getFields().end()) {
             expr.type = it->second;
             return;
         }
-        throw error(std::format("Type error: field '{}' does not exist on type {}", varExpr->name,
-                                leftType->toString()));
+        expr.type = fail(std::format("Type error: field '{}' does not exist on type {}",
+                                     varExpr->name.str(), leftType->toString()));
+        return;
     }
     case TokenKind::MethodAccess:
         // Method access returns any for now
         expr.type = TypeFactory::anyType();
         return;
     default:
-        throw error("Unknown binary operator in type checker");
+        expr.type = fail("Unknown binary operator in type checker");
     }
 }
 
@@ -170,6 +254,10 @@ void TypeChecker::visit(IndexExpr& expr) {
     expr.index->accept(*this);
 
     Type* objType = expr.object->type;
+    if (isError(objType) || isError(expr.index->type)) {
+        expr.type = TypeFactory::errorType();
+        return;
+    }
 
     // Any type propagates
     if (objType->getKind() == TypeKind::Any) {
@@ -180,8 +268,9 @@ void TypeChecker::visit(IndexExpr& expr) {
     // Array indexing: arr[number] -> element type
     if (objType->getKind() == TypeKind::Array) {
         if (!isNumber(expr.index->type) && !isAny(expr.index->type)) {
-            throw error(std::format("Type error: array index must be number, got {}",
-                                    expr.index->type->toString()));
+            expr.type = fail(std::format("Type error: array index must be number, got {}",
+                                         expr.index->type->toString()));
+            return;
         }
         auto* arrayType = static_cast<ArrayType*>(objType);
         expr.type = arrayType->getElementType();
@@ -198,31 +287,33 @@ void TypeChecker::visit(IndexExpr& expr) {
         return;
     }
 
-    throw error(
-        std::format("Type error: cannot index non-array/table type {}", objType->toString()));
+    expr.type =
+        fail(std::format("Type error: cannot index non-array/table type {}", objType->toString()));
 }
 
 void TypeChecker::visit(FunCallExpr& expr) {
     expr.callee->accept(*this);
+    // Also for callees that aren't checked, the arguments can have errors of their own
+    for (auto& arg : expr.args) {
+        arg->accept(*this);
+    }
     auto calleeType = expr.callee->type;
-    if (calleeType->getKind() == TypeKind::Any) {
-        expr.type = TypeFactory::anyType();
+    if (calleeType->getKind() == TypeKind::Any || isError(calleeType)) {
+        expr.type = calleeType;
         return;
     }
 
     // check that its function
     if (calleeType->getKind() != TypeKind::Function) {
-        throw error("Type error: trying to call a non-function type");
+        expr.type = fail("Type error: trying to call a non-function type");
+        return;
     }
 
     // parameter arity
     auto funType = static_cast<FunctionType*>(calleeType);
     if (funType->getParamTypes().size() != expr.args.size()) {
-        throw error("Type error: function called with incorrect number of arguments");
-    }
-
-    for (auto& arg : expr.args) {
-        arg->accept(*this);
+        expr.type = fail("Type error: function called with incorrect number of arguments");
+        return;
     }
 
     // actual parameter types
@@ -230,7 +321,8 @@ void TypeChecker::visit(FunCallExpr& expr) {
         Type* expectedType = funType->getParamTypes()[i];
         Type* actualType = expr.args[i]->type;
         if (!isSubtype(actualType, expectedType)) {
-            throw error("Type error: function argument type mismatch");
+            expr.type = fail("Type error: function argument type mismatch");
+            return;
         }
     }
 
@@ -258,7 +350,12 @@ void TypeChecker::visit(FunDecl& stmt) {
 
     Type* funcType = TypeFactory::instance().createFunctionType(paramTypes, returnType);
     stmt.type = funcType;
-    env.define(stmt.name, funcType);
+    // A global function declaration assigns the local of that name if there is one
+    Decl* binding = stmt.local ? nullptr : env.declaration(stmt.name);
+    if (binding) {
+        ++binding->uses;
+    }
+    env.define(stmt.name, funcType, binding ? binding : &stmt);
 
     env.pushScope();
     for (size_t i = 0; i < stmt.params.size(); ++i) {
@@ -283,15 +380,15 @@ void TypeChecker::visit(VarDecl& stmt) {
 
         // Check if initializer type is compatible with annotated type
         if (!isSubtype(stmt.initExpr->type, annotatedType)) {
-            throw error(std::format("Type mismatch: cannot assign {} to variable of type {}",
-                                    stmt.initExpr->type->toString(), annotatedType->toString()));
+            fail(std::format("Type mismatch: cannot assign {} to variable of type {}",
+                             stmt.initExpr->type->toString(), annotatedType->toString()));
         }
 
         stmt.type = annotatedType;
-        env.define(stmt.name, annotatedType);
+        env.define(stmt.name, annotatedType, &stmt);
     } else {
         stmt.type = stmt.initExpr->type;
-        env.define(stmt.name, stmt.initExpr->type);
+        env.define(stmt.name, stmt.initExpr->type, &stmt);
     }
 }
 
@@ -302,8 +399,10 @@ void TypeChecker::visit(VarDecls& stmt) {
 }
 
 void TypeChecker::visit(IfStmt& stmt) {
-    stmt.condition->accept(*this);
-    stmt.then_branch->accept(*this);
+    for (auto& arm : stmt.arms) {
+        arm.condition->accept(*this);
+        arm.body->accept(*this);
+    }
     if (stmt.else_branch) {
         stmt.else_branch->accept(*this);
     }
@@ -321,9 +420,8 @@ void TypeChecker::visit(ReturnStmt& stmt) {
         if (stmt.return_values.size() == 1) {
             Type* returnedType = stmt.return_values[0]->type;
             if (!isSubtype(returnedType, currentFunctionReturnType)) {
-                throw error(
-                    std::format("Type mismatch: function returns {} but declared to return {}",
-                                returnedType->toString(), currentFunctionReturnType->toString()));
+                fail(std::format("Type mismatch: function returns {} but declared to return {}",
+                                 returnedType->toString(), currentFunctionReturnType->toString()));
             }
         }
         // TODO: Handle multiple return values
@@ -351,6 +449,8 @@ Type* TypeChecker::resolveTypeAnnotation(const TypeAnnotation& annotation) {
                        switch (basic.kind) {
                        case BasicTypeAnnotation::Kind::Number:
                            return BasicType::numberType();
+                       case BasicTypeAnnotation::Kind::Integer:
+                           return BasicType::integerType();
                        case BasicTypeAnnotation::Kind::String:
                            return BasicType::stringType();
                        case BasicTypeAnnotation::Kind::Boolean:
@@ -360,21 +460,21 @@ Type* TypeChecker::resolveTypeAnnotation(const TypeAnnotation& annotation) {
                        }
                        return TypeFactory::unknownType();
                    },
-                   [](const FunctionTypeAnnotation&) -> Type* {
+                   [this](const FunctionTypeAnnotation&) -> Type* {
                        // TODO: Implement function type annotations
-                       throw TypeCheckError("Function type annotations not yet supported");
+                       return fail("Function type annotations not yet supported");
                    },
-                   [](const TableTypeAnnotation&) -> Type* {
+                   [this](const TableTypeAnnotation&) -> Type* {
                        // TODO: Implement table type annotations
-                       throw TypeCheckError("Table type annotations not yet supported");
+                       return fail("Table type annotations not yet supported");
                    },
-                   [](const ArrayTypeAnnotation&) -> Type* {
+                   [this](const ArrayTypeAnnotation&) -> Type* {
                        // TODO: Implement array type annotations
-                       throw TypeCheckError("Array type annotations not yet supported");
+                       return fail("Array type annotations not yet supported");
                    },
-                   [](const UnionTypeAnnotation&) -> Type* {
+                   [this](const UnionTypeAnnotation&) -> Type* {
                        // TODO: Implement union type annotations
-                       throw TypeCheckError("Union type annotations not yet supported");
+                       return fail("Union type annotations not yet supported");
                    }},
         annotation.getVariant());
 }
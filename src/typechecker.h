@@ -1,23 +1,46 @@
 #pragma once
 #include "ast.h"
 #include "environment.h"
+#include "utils.h"
 #include "visitor.h"
 
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 class TypeCheckError : public std::runtime_error {
   public:
-    explicit TypeCheckError(const std::string& message) : std::runtime_error(message) {}
+    explicit TypeCheckError(const std::string& message)
+        : std::runtime_error(message), diagnostics{message} {}
+    /// All errors of a program, what() lists them one per line.
+    explicit TypeCheckError(std::vector<std::string> diagnostics)
+        : std::runtime_error(join(diagnostics, "\n")), diagnostics(std::move(diagnostics)) {}
+
+    const std::vector<std::string>& getDiagnostics() const { return diagnostics; }
+
+  private:
+    std::vector<std::string> diagnostics;
 };
 
-class TypeChecker : public Visitor {
+class ModuleResolver;
+
+class TypeChecker final : public Visitor {
   public:
-    TypeChecker();
+    /// With `modules`, the global functions of the modules the program requires are known
+    /// with their types, see ModuleResolver. Other globals are any.
+    explicit TypeChecker(ModuleResolver* modules = nullptr);
 
+    /// Checks the whole program. An expression with an error gets the error type, which is
+    /// accepted everywhere, so checking carries on without reporting follow-up errors; the
+    /// TypeCheckError thrown at the end lists every error found.
     void typeCheck(Program& program) {
+        importModules(program);
         for (auto& stmt : program.statements) {
             stmt->accept(*this);
         }
+        if (!diagnostics.empty()) {
+            throw TypeCheckError(std::move(diagnostics));
+        }
     }
 
     // Expression visitors
@@ -43,11 +66,26 @@ class TypeChecker : public Visitor {
     void visit(AssignStmt& stmt) override;
 
     Environment& getEnv() { return env; }
+    /// Errors found by the visits so far.
+    const std::vector<std::string>& getDiagnostics() const { return diagnostics; }
 
   private:
-    TypeCheckError error(const std::string& message) const { return TypeCheckError(message); }
+    /// Records an error, returning the type of the expression that has it.
+    Type* fail(std::string message) {
+        diagnostics.push_back(std::move(message));
+        return TypeFactory::errorType();
+    }
     Type* resolveTypeAnnotation(const TypeAnnotation& annotation);
+    /// Checks the operator chain `root` starts without recursing along it, see forEachOperator.
+    void checkOperators(Expr& root);
+    /// Types an operator whose operands are checked.
+    void checkUnaryOp(UnaryOpExpr& expr);
+    void checkBinOp(BinOpExpr& expr);
+    /// Defines the exports of the modules required at the top level as globals.
+    void importModules(const Program& program);
+    ModuleResolver* modules;
     Environment env;
+    std::vector<std::string> diagnostics;
     // Holds current function return type for validating return statements.
     // The caller is responsible for setting and restoring this value.
     Type* currentFunctionReturnType = nullptr;
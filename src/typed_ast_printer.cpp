@@ -13,6 +13,8 @@ const char* tokenKindToSymbol(TokenKind kind) {
         return "*";
     case TokenKind::Slash:
         return "/";
+    case TokenKind::FloorDiv:
+        return "//";
     case TokenKind::Equal:
         return "==";
     case TokenKind::NotEqual:
@@ -73,25 +75,15 @@ void TypedAstPrinter::parenthesize(const std::string& name, const std::vector<Ex
     result += ")";
 }
 
-void TypedAstPrinter::parenthesize(const std::string& name,
-                                   const std::vector<std::unique_ptr<Expr>>& exprs) {
-    result += "(";
-    result += name;
-    for (auto& expr : exprs) {
-        result += " ";
-        expr->accept(*this);
-    }
-    result += ")";
-}
-
 void TypedAstPrinter::visit(StringExpr& expr) {
     assert(expr.type != nullptr && "Type not inferred for StringExpr");
-    result += std::format("'{}' <{}>", expr.val, expr.type->toString());
+    result += std::format("'{}' <{}>", expr.val.str(), expr.type->toString());
 }
 
 void TypedAstPrinter::visit(NumberExpr& expr) {
     assert(expr.type != nullptr && "Type not inferred for NumberExpr");
-    result += std::format("{} <{}>", expr.val, expr.type->toString());
+    auto value = expr.integer ? std::format("{}", *expr.integer) : std::format("{}", expr.val);
+    result += std::format("{} <{}>", value, expr.type->toString());
 }
 
 void TypedAstPrinter::visit(NilExpr& expr) {
@@ -101,7 +93,7 @@ void TypedAstPrinter::visit(NilExpr& expr) {
 
 void TypedAstPrinter::visit(VarExpr& expr) {
     assert(expr.type != nullptr && "Type not inferred for VarExpr");
-    result += std::format("(var {} <{}>)", expr.name, expr.type->toString());
+    result += std::format("(var {} <{}>)", expr.name.str(), expr.type->toString());
 }
 
 void TypedAstPrinter::visit(UnaryOpExpr& expr) {
@@ -142,10 +134,10 @@ void TypedAstPrinter::visit(FunCallExpr& expr) {
 
 void TypedAstPrinter::visit(FunDecl& stmt) {
     assert(stmt.type != nullptr && "Type not inferred for FunDecl");
-    result += std::format("(fun {} <{}>", stmt.name, stmt.type->toString());
+    result += std::format("(fun {} <{}>", stmt.name.str(), stmt.type->toString());
     result += " (params";
     for (const auto& param : stmt.params) {
-        result += " " + param.name;
+        result += " " + param.name.str();
     }
     result += ") ";
     stmt.body->accept(*this);
@@ -154,7 +146,7 @@ void TypedAstPrinter::visit(FunDecl& stmt) {
 
 void TypedAstPrinter::visit(VarDecl& stmt) {
     assert(stmt.type != nullptr && "Type not inferred for VarDecl");
-    result += std::format("(var-decl {} <{}> ", stmt.name, stmt.type->toString());
+    result += std::format("(var-decl {} <{}> ", stmt.name.str(), stmt.type->toString());
     stmt.initExpr->accept(*this);
     result += ")";
 }
@@ -171,15 +163,18 @@ void TypedAstPrinter::visit(VarDecls& stmt) {
 }
 
 void TypedAstPrinter::visit(IfStmt& stmt) {
-    result += "(if ";
-    stmt.condition->accept(*this);
-    result += " then ";
-    stmt.then_branch->accept(*this);
+    // Elseif arms print as an if in the else branch of the arm before them
+    for (size_t i = 0; i < stmt.arms.size(); ++i) {
+        result += i > 0 ? " else (if " : "(if ";
+        stmt.arms[i].condition->accept(*this);
+        result += " then ";
+        stmt.arms[i].body->accept(*this);
+    }
     if (stmt.else_branch) {
         result += " else ";
         stmt.else_branch->accept(*this);
     }
-    result += ")";
+    result.append(stmt.arms.size(), ')');
 }
 
 void TypedAstPrinter::visit(ReturnStmt& stmt) {
@@ -231,7 +226,7 @@ void TypedAstPrinter::visit(TableExpr& expr) {
     if (!expr.mapPart.empty()) {
         result += " (map";
         for (auto& [key, value] : expr.mapPart) {
-            result += std::format(" ({} ", key);
+            result += std::format(" ({} ", key.str());
             value->accept(*this);
             result += ")";
         }
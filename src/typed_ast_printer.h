@@ -5,7 +5,7 @@
 #include <string>
 #include <vector>
 
-class TypedAstPrinter : public Visitor {
+class TypedAstPrinter final : public Visitor {
   public:
     std::string print(Program& program);
     std::string print(Expr& expr);
@@ -37,5 +37,4 @@ class TypedAstPrinter : public Visitor {
     std::string result;
 
     void parenthesize(const std::string& name, const std::vector<Expr*>& exprs);
-    void parenthesize(const std::string& name, const std::vector<std::unique_ptr<Expr>>& exprs);
 };
@@ -0,0 +1,5 @@
+#pragma once
+#include <string_view>
+
+/// Compiler version, part of every build cache key: a new compiler never reuses old outputs.
+inline constexpr std::string_view TLUA_VERSION = "0.2.0";
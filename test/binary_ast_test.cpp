@@ -0,0 +1,125 @@
+#include "../src/binary_ast.h"
+#include "../src/lexer.h"
+#include "../src/lua_codegen.h"
+#include "../src/parser.h"
+#include "../src/typechecker.h"
+#include "../src/typed_ast_printer.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstring>
+#include <stdexcept>
+
+static Program checked(const std::string& code) {
+    Parser parser{Lexer{code}};
+    auto program = parser.parse();
+    TypeChecker typechecker;
+    typechecker.typeCheck(program);
+    return program;
+}
+
+static void requireRoundTrip(const std::string& code) {
+    auto program = checked(code);
+    auto bytes = writeBinaryAst(program);
+    auto loaded = BinaryAst(bytes).toProgram();
+
+    REQUIRE(LuaCodegen().generate(loaded) == LuaCodegen().generate(program));
+    REQUIRE(TypedAstPrinter().print(loaded) == TypedAstPrinter().print(program));
+}
+
+TEST_CASE("Binary AST round trips typed programs") {
+    requireRoundTrip("local a = 42");
+    requireRoundTrip("local x = 9223372036854775807 local y = 1.5e300 local z = -0.25");
+    requireRoundTrip(R"(local s = "hello" local b = true local n = nil)");
+    requireRoundTrip("local t = { 1, 2, 3 } local u = #t");
+    requireRoundTrip(R"(local p = { name = "ada", age = 36 } print(p.name, p.age))");
+    requireRoundTrip("local x = not (1 < 2) and -3 + 4 * 5 >= 6");
+    requireRoundTrip(R"(
+        function fib(n: number) -> number
+            if n == 0 then
+                return 0
+            elseif n == 1 then
+                return 1
+            else
+                return fib(n - 1) + fib(n - 2)
+            end
+        end
+        local result: number = fib(10)
+        print(result)
+    )");
+}
+
+TEST_CASE("Binary AST keeps symbols, types and source locations") {
+    auto program = checked("local count: integer = 3\nprint(count)");
+    auto bytes = writeBinaryAst(program);
+    BinaryAst ast(bytes);
+
+    auto roots = ast.roots();
+    REQUIRE(roots.count == 2);
+    auto decl = ast.node(ast.item(roots, 0));
+    REQUIRE(decl.kind == static_cast<uint8_t>(NodeKind::VarDecl));
+    REQUIRE(ast.symbolText(decl.first) == "count");
+    REQUIRE(ast.type(decl.type) == TypeFactory::integerType());
+    REQUIRE(decl.line == 1);
+
+    auto call = ast.node(ast.item(roots, 1));
+    REQUIRE(call.kind == static_cast<uint8_t>(NodeKind::FunCallStmt));
+    REQUIRE(call.line == 2);
+    REQUIRE(call.column == 1);
+
+    auto loaded = ast.toProgram();
+    REQUIRE(loaded.statements[1]->loc.line == 2);
+}
+
+TEST_CASE("Binary AST writes shared nodes and symbols once") {
+    auto program = checked("local x = 1 local y = x + x");
+    auto lone = writeBinaryAst(program);
+
+    // Passes may share subtrees, e.g. the inliner reusing an argument
+    auto* decl = static_cast<VarDecl*>(program.statements[1]);
+    auto* sum = static_cast<BinOpExpr*>(decl->initExpr);
+    sum->right = sum->left;
+    auto sharedBytes = writeBinaryAst(program);
+    BinaryAst shared(sharedBytes);
+    BinaryAst separate(lone);
+
+    REQUIRE(shared.nodeCount() == separate.nodeCount() - 1);
+    REQUIRE(separate.symbolCount() == 2);
+    auto loaded = shared.toProgram();
+    REQUIRE(LuaCodegen().generate(loaded) == "local x = 1\nlocal y = x + x");
+}
+
+TEST_CASE("Binary AST stores composite types once") {
+    auto program = checked("local a = { 1, 2 } local b = { 3 } local c = { a, b }");
+    auto bytes = writeBinaryAst(program);
+    BinaryAst ast(bytes);
+    // integer, integer[] and integer[][]
+    REQUIRE(ast.typeCount() == 3);
+
+    auto loaded = ast.toProgram();
+    auto& factory = TypeFactory::instance();
+    REQUIRE(static_cast<VarDecl*>(loaded.statements[2])->type ==
+            factory.createArrayType(factory.createArrayType(TypeFactory::integerType())));
+}
+
+TEST_CASE("Binary AST reader rejects invalid files") {
+    auto bytes = writeBinaryAst(checked("local a = 1"));
+
+    REQUIRE_THROWS_AS(BinaryAst(std::string_view(bytes).substr(0, 8)), std::runtime_error);
+    REQUIRE_THROWS_AS(BinaryAst(std::string_view(bytes).substr(0, bytes.size() - 8)),
+                      std::runtime_error);
+
+    auto wrongMagic = bytes;
+    wrongMagic[0] = 'X';
+    REQUIRE_THROWS_AS(BinaryAst(wrongMagic), std::runtime_error);
+
+    auto wrongVersion = bytes;
+    uint32_t version = binary_ast::VERSION + 1;
+    std::memcpy(wrongVersion.data() + offsetof(binary_ast::Header, version), &version,
+                sizeof(version));
+    REQUIRE_THROWS_AS(BinaryAst(wrongVersion), std::runtime_error);
+
+    BinaryAst ast(bytes);
+    REQUIRE_THROWS_AS(ast.node(static_cast<uint32_t>(ast.nodeCount())), std::runtime_error);
+    REQUIRE_THROWS_AS(ast.symbolText(static_cast<uint32_t>(ast.symbolCount())),
+                      std::runtime_error);
+    REQUIRE_THROWS_AS(ast.type(static_cast<uint32_t>(ast.typeCount()) + 1), std::runtime_error);
+}
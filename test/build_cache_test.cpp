@@ -0,0 +1,55 @@
+#include "../src/build_cache.h"
+#include "./utils.h"
+#include <catch2/catch_test_macros.hpp>
+
+TEST_CASE("BuildCache: keys depend on every source byte") {
+    REQUIRE(BuildCache::key("local a = 1") == BuildCache::key("local a = 1"));
+    REQUIRE(BuildCache::key("local a = 1") != BuildCache::key("local a = 2"));
+    REQUIRE(BuildCache::key("") != BuildCache::key(std::string_view("\0", 1)));
+    REQUIRE(BuildCache::key("local a = 1", "O1") != BuildCache::key("local a = 1", "O0"));
+}
+
+TEST_CASE("BuildCache: stored entries are found again") {
+    TempDir dir("cache_roundtrip");
+    BuildCache cache(dir.path);
+    auto key = BuildCache::key("function f(a) return a end");
+
+    REQUIRE_FALSE(cache.lookup(key).has_value());
+
+    CacheEntry entry{"function f(a)\n    return a\nend",
+                     {{"f", "(any) -> any"}, {"g", "(number, string) -> number"}}};
+    cache.store(key, entry);
+
+    // A second cache over the same directory sees the entry
+    auto found = BuildCache(dir.path).lookup(key);
+    REQUIRE(found.has_value());
+    REQUIRE(found->lua == entry.lua);
+    REQUIRE(found->exports == entry.exports);
+}
+
+TEST_CASE("BuildCache: corrupted entries are misses") {
+    TempDir dir("cache_corrupted");
+    BuildCache cache(dir.path);
+    auto key = BuildCache::key("local a = 1");
+    cache.store(key, {"local a = 1", {}});
+
+    auto entryFile = dir.path / std::format("{:016x}.entry", key);
+    REQUIRE(std::filesystem::exists(entryFile));
+    std::ofstream(entryFile) << "tlua-cache 0.0.0-old\nexports 0\nlua 11\nlocal a = 1";
+    REQUIRE_FALSE(cache.lookup(key).has_value());
+
+    std::ofstream(entryFile, std::ios::trunc) << "garbage";
+    REQUIRE_FALSE(cache.lookup(key).has_value());
+}
+
+TEST_CASE("BuildCache: remembers the last key of each source path") {
+    TempDir dir("cache_paths");
+    BuildCache cache(dir.path);
+    auto source = dir.write("a.tlua", "");
+
+    REQUIRE_FALSE(cache.lastKey(source).has_value());
+    cache.setLastKey(source, 42);
+    REQUIRE(cache.lastKey(source) == 42u);
+    cache.setLastKey(source, 0xdeadbeefcafe);
+    REQUIRE(cache.lastKey(source) == 0xdeadbeefcafeu);
+}
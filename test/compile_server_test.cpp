@@ -0,0 +1,134 @@
+#include "../src/compile_server.h"
+#include "./utils.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstring>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+TEST_CASE("CompileServer: compiles files and answers unchanged files from memory") {
+    TempDir dir("server_cache");
+    auto file = dir.write("a.tlua", "local a = 1 + 2");
+    CompileServer server;
+
+    REQUIRE(server.handleRequest("compile " + file.string()) == "ok 11\nlocal a = 3");
+    REQUIRE(server.handleRequest("check " + file.string()) == "ok 0\n");
+    REQUIRE(server.handleRequest("stats") == "ok 36\nfiles 1 requests 3 hits 1 compiles 1");
+
+    // Same size, new contents
+    std::filesystem::last_write_time(file, std::filesystem::last_write_time(file) -
+                                               std::chrono::seconds(10));
+    std::ofstream(file) << "local a = 1 + 5";
+    REQUIRE(server.handleRequest("compile " + file.string()) == "ok 11\nlocal a = 6");
+    REQUIRE(server.handleRequest("stats").ends_with("hits 1 compiles 2"));
+}
+
+TEST_CASE("CompileServer: reports errors") {
+    TempDir dir("server_errors");
+    auto file = dir.write("bad.tlua", "local a = 1 + \"x\"");
+    CompileServer server;
+
+    REQUIRE(server.handleRequest("check " + file.string()).starts_with("error "));
+    REQUIRE(server.handleRequest("compile " + (dir.path / "missing.tlua").string())
+                .starts_with("error "));
+    REQUIRE(server.handleRequest("compile") == "error 25\ncompile needs a file path");
+    REQUIRE(server.handleRequest("frobnicate x") == "error 27\nUnknown request: frobnicate");
+    REQUIRE_FALSE(server.stopped());
+    REQUIRE(server.handleRequest("shutdown") == "ok 0\n");
+    REQUIRE(server.stopped());
+}
+
+TEST_CASE("CompileServer: checks dependents again when a module signature changes") {
+    TempDir dir("server_modules");
+    dir.write("lib/geometry.tlua", "function area(w: number, h: number) -> number\n"
+                                   "    return w * h\n"
+                                   "end");
+    auto file = dir.write("main.tlua", "require(\"geometry\")\n"
+                                       "local a = area(2, 3)");
+    CompileOptions options;
+    options.modulePath = {dir.path / "lib"};
+    CompileServer server(options);
+
+    REQUIRE(server.handleRequest("check " + file.string()) == "ok 0\n");
+    // A new body with the same signature doesn't change main
+    dir.write("lib/geometry.tlua", "function area(w: number, h: number) -> number\n"
+                                   "    return h * w\n"
+                                   "end");
+    REQUIRE(server.handleRequest("check " + file.string()) == "ok 0\n");
+    REQUIRE(server.handleRequest("stats").ends_with("hits 1 compiles 1"));
+
+    dir.write("lib/geometry.tlua", "function area(w: string, h: number) -> number\n"
+                                   "    return h\n"
+                                   "end");
+    auto changed = server.handleRequest("check " + file.string());
+    REQUIRE(changed.starts_with("error "));
+    REQUIRE(changed.find("argument type mismatch") != std::string::npos);
+    REQUIRE(server.handleRequest("stats").ends_with("hits 1 compiles 2"));
+}
+
+/// A connection to the server at `socketPath`, -1 if it doesn't accept any.
+static int connectTo(const std::filesystem::path& socketPath) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, socketPath.c_str());
+    // The server binds the socket asynchronously
+    for (int attempt = 0; attempt < 500; ++attempt) {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+            return fd;
+        }
+        ::close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return -1;
+}
+
+/// Sends `requests` and reads the responses until the server closes the connection.
+static std::string sendRequests(int fd, const std::string& requests) {
+    REQUIRE(::write(fd, requests.data(), requests.size()) == ssize_t(requests.size()));
+    std::string received;
+    char chunk[256];
+    for (ssize_t count; (count = ::read(fd, chunk, sizeof(chunk))) > 0;) {
+        received.append(chunk, static_cast<size_t>(count));
+    }
+    ::close(fd);
+    return received;
+}
+
+TEST_CASE("CompileServer: serves requests over a Unix socket") {
+    TempDir dir("server_socket");
+    auto file = dir.write("a.tlua", "local a = 2");
+    auto socketPath = dir.path / "tlua.sock";
+    CompileServer server;
+    std::jthread serving([&] { server.serve(socketPath); });
+
+    int fd = connectTo(socketPath);
+    REQUIRE(fd >= 0);
+    auto received = sendRequests(fd, "compile " + file.string() + "\nshutdown\n");
+    serving.join();
+
+    REQUIRE(received == "ok 11\nlocal a = 2ok 0\n");
+    REQUIRE_FALSE(std::filesystem::exists(socketPath));
+}
+
+TEST_CASE("CompileServer: an idle connection doesn't hold up the others") {
+    TempDir dir("server_idle");
+    auto file = dir.write("a.tlua", "local a = 2");
+    auto socketPath = dir.path / "tlua.sock";
+    CompileServer server;
+    std::jthread serving([&] { server.serve(socketPath); });
+
+    // Connected first, with half a request and nothing after
+    int idle = connectTo(socketPath);
+    REQUIRE(idle >= 0);
+    REQUIRE(::write(idle, "sta", 3) == 3);
+    int fd = connectTo(socketPath);
+    REQUIRE(fd >= 0);
+    auto received = sendRequests(fd, "compile " + file.string() + "\nshutdown\n");
+    serving.join();
+    ::close(idle);
+
+    REQUIRE(received == "ok 11\nlocal a = 2ok 0\n");
+}
@@ -0,0 +1,75 @@
+#include "../src/compile_stats.h"
+#include <catch2/catch_test_macros.hpp>
+#include <memory>
+
+TEST_CASE("CompileStats: operator new counts the allocations of the thread") {
+    auto before = threadAllocations();
+    auto buffer = std::make_unique<char[]>(100);
+    auto after = threadAllocations();
+    REQUIRE(after.count == before.count + 1);
+    REQUIRE(after.bytes == before.bytes + 100);
+}
+
+TEST_CASE("CompileStats: phases record their allocations") {
+    CompileStats stats;
+    auto value = timePhase(&stats, "parse", [] { return std::make_unique<int>(42); });
+    REQUIRE(*value == 42);
+    timePhase(&stats, "codegen", [] {});
+    timePhase(nullptr, "ignored", [] {});
+
+    REQUIRE(stats.phases.size() == 2);
+    REQUIRE(stats.phases[0].name == "parse");
+    REQUIRE(stats.phases[0].allocations == 1);
+    REQUIRE(stats.phases[0].allocatedBytes == sizeof(int));
+    REQUIRE(stats.phases[1].name == "codegen");
+    REQUIRE(stats.phases[1].allocations == 0);
+}
+
+TEST_CASE("CompileStats: adding sums phases and counts") {
+    CompileStats first;
+    first.phases = {{"lex", std::chrono::milliseconds(1), 2, 20}};
+    first.tokens = 10;
+    first.files = 1;
+    first.types = 3;
+    CompileStats second;
+    second.phases = {{"lex", std::chrono::milliseconds(2), 3, 30},
+                     {"parse", std::chrono::milliseconds(4), 1, 8}};
+    second.tokens = 5;
+    second.files = 1;
+    second.types = 7;
+
+    first += second;
+    REQUIRE(first.phases.size() == 2);
+    REQUIRE(first.phases[0].time == std::chrono::milliseconds(3));
+    REQUIRE(first.phases[0].allocations == 5);
+    REQUIRE(first.phases[0].allocatedBytes == 50);
+    REQUIRE(first.tokens == 15);
+    REQUIRE(first.files == 2);
+    // Types are interned for the whole process
+    REQUIRE(first.types == 7);
+}
+
+TEST_CASE("CompileStats: text and JSON reports") {
+    CompileStats stats;
+    stats.phases = {{"lex", std::chrono::microseconds(1500), 2, 64}};
+    stats.tokens = 12;
+    stats.nodes = 9;
+    stats.types = 1;
+    stats.symbols = 4;
+    stats.files = 1;
+    stats.subtypeCacheHits = 5;
+    stats.subtypeCacheMisses = 3;
+    stats.peakRssKiB = 2048;
+
+    REQUIRE(stats.toJson() ==
+            "{\"phases\": [{\"name\": \"lex\", \"ms\": 1.500, \"allocations\": 2, \"bytes\": 64}], "
+            "\"files\": 1, \"tokens\": 12, \"nodes\": 9, \"types\": 1, \"symbols\": 4, "
+            "\"subtypeCacheHits\": 5, \"subtypeCacheMisses\": 3, \"peakRssKiB\": 2048}");
+    REQUIRE(stats.toText() == "phase          time (ms)   allocations         bytes\n"
+                              "lex                1.500             2            64\n"
+                              "total              1.500             2            64\n"
+                              "files 1, tokens 12, nodes 9, types 1, symbols 4\n"
+                              "subtype cache 5 hits, 3 misses\n"
+                              "peak rss 2048 KiB\n");
+    REQUIRE(peakRssKiB() > 0);
+}
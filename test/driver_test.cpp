@@ -0,0 +1,285 @@
+#include "../src/binary_ast.h"
+#include "../src/driver.h"
+#include "../src/parser.h"
+#include "../src/typechecker.h"
+#include "./utils.h"
+#include <catch2/catch_test_macros.hpp>
+
+namespace fs = std::filesystem;
+
+TEST_CASE("Driver: compileSource runs the whole pipeline") {
+    REQUIRE(compileSource("local a = 42") == "local a = 42");
+    REQUIRE_THROWS_AS(compileSource("local = 1"), ParseError);
+    REQUIRE_THROWS_AS(compileSource("local x: number = true"), TypeCheckError);
+}
+
+TEST_CASE("Driver: collects the stats of each phase") {
+    CompileOptions options;
+    options.collectStats = true;
+    auto unit = compileUnit("local a = 1 + 2", options);
+    REQUIRE(unit.lua == "local a = 3");
+    std::vector<std::string> phases;
+    for (const auto& phase : unit.stats.phases) {
+        phases.push_back(phase.name);
+    }
+    REQUIRE(phases == std::vector<std::string>{"lex", "parse", "typecheck", "optimize", "codegen"});
+    // local, a, =, 1, +, 2 and the end of the file
+    REQUIRE(unit.stats.tokens == 7);
+    REQUIRE(unit.stats.nodes >= 4);
+    REQUIRE(unit.stats.files == 1);
+
+    StringSink sink;
+    REQUIRE(compileSource("local a = 1", sink, {}).phases.empty());
+}
+
+TEST_CASE("Driver: appends the source map as a trailing comment") {
+    CompileOptions options;
+    options.sourceMap = true;
+    REQUIRE(compileSource("local a = 1\n\nlocal b = a", options) ==
+            "local a = 1\nlocal b = a\n--# tlua-lines 1:1,2:3");
+    REQUIRE(compileUnit("local a = 1", options).lua == "local a = 1\n--# tlua-lines 1:1");
+    REQUIRE(compileSource("", options).empty());
+}
+
+TEST_CASE("Driver: --checked guards untyped values in the Lua") {
+    CompileOptions options;
+    options.checked = true;
+    auto lua = compileSource("local a = scale * 2", options);
+    REQUIRE(lua.starts_with("local function __guard(value, expected)\n"));
+    REQUIRE(lua.ends_with("\nlocal a = __guard(scale, \"number\") * 2"));
+    REQUIRE(compileSource("local a = 2 * 3", options) == "local a = 6");
+}
+
+TEST_CASE("Driver: --eliminate removes unused locals after optimizing") {
+    CompileOptions options;
+    options.eliminate = true;
+    // The folded condition leaves `debug` unused
+    REQUIRE(compileSource("local debug = \"on\"\n"
+                          "if false then print(debug) end\n"
+                          "local a = 1\n"
+                          "print(a)",
+                          options) == "local a = 1\nprint(a)");
+}
+
+TEST_CASE("Driver: collects files, directories and manifests") {
+    TempDir dir("collect");
+    auto single = dir.write("single.tlua", "local a = 1");
+    dir.write("tree/b.tlua", "local b = 2");
+    dir.write("tree/nested/a.tlua", "local a = 1");
+    dir.write("tree/notes.txt", "not a source file");
+    dir.write("list.txt", "# comment\n\nsingle.tlua\n  tree/b.tlua  \n");
+
+    auto inputs = collectInputs({single.string(), (dir.path / "tree").string()});
+    REQUIRE(inputs.size() == 3);
+    REQUIRE(inputs[0].relative == "single.tlua");
+    REQUIRE(inputs[1].relative == "b.tlua");
+    REQUIRE(inputs[2].relative == fs::path("nested") / "a.tlua");
+
+    auto fromManifest = collectInputs({"@" + (dir.path / "list.txt").string()});
+    REQUIRE(fromManifest.size() == 2);
+    REQUIRE(fromManifest[0].source == dir.path / "single.tlua");
+    REQUIRE(fromManifest[1].source == dir.path / "tree" / "b.tlua");
+
+    REQUIRE_THROWS_AS(collectInputs({(dir.path / "missing.tlua").string()}), std::runtime_error);
+}
+
+TEST_CASE("Driver: output paths") {
+    CompileInput input{"src/mod/a.tlua", "mod/a.tlua"};
+    REQUIRE(outputPath(input, {}) == "src/mod/a.lua");
+
+    CompileOptions options;
+    options.outDir = "out";
+    REQUIRE(outputPath(input, options) == fs::path("out") / "mod" / "a.lua");
+
+    // Compiling a .lua file in place would overwrite it
+    REQUIRE_THROWS_AS(outputPath({"a.lua", "a.lua"}, {}), std::runtime_error);
+}
+
+TEST_CASE("Driver: compiles many files in parallel") {
+    TempDir dir("parallel");
+    constexpr int FILES = 64;
+    for (int i = 0; i < FILES; ++i) {
+        dir.write(std::format("src/m{}.tlua", i),
+                  std::format("local function f{0}(x: number) -> number\n"
+                              "    return x + {0}\n"
+                              "end\n"
+                              "local r = f{0}({0})",
+                              i));
+    }
+    dir.write("src/broken.tlua", "local s: string = 1");
+
+    CompileOptions options;
+    options.jobs = 8;
+    options.outDir = dir.path / "out";
+    auto inputs = collectInputs({(dir.path / "src").string()});
+    auto results = compileFiles(inputs, options);
+
+    REQUIRE(results.size() == FILES + 1);
+    REQUIRE(results[0].input == dir.path / "src" / "broken.tlua");
+    REQUIRE_FALSE(results[0].ok());
+    REQUIRE_FALSE(fs::exists(dir.path / "out" / "broken.lua"));
+
+    for (size_t i = 1; i < results.size(); ++i) {
+        REQUIRE(results[i].ok());
+        REQUIRE(results[i].input == inputs[i].source);
+    }
+    REQUIRE(readFile(dir.path / "out" / "m7.lua") == "local function f7(x)\n"
+                                                     "    return x + 7\n"
+                                                     "end\n"
+                                                     "local r = f7(7)\n");
+}
+
+TEST_CASE("Driver: writes the binary AST next to the output") {
+    TempDir dir("emit_ast");
+    auto source = dir.write("a.tlua", "local function f(x: number) -> number\n"
+                                      "    return x\n"
+                                      "end\n"
+                                      "local r = f(1)");
+    CompileOptions options;
+    options.emitAst = true;
+    options.cacheDir = dir.path / "cache";
+    auto results = compileFiles(collectInputs({source.string()}), options);
+    REQUIRE(results[0].ok());
+    // The build cache doesn't hold ASTs, the file is compiled
+    REQUIRE_FALSE(results[0].cached);
+    REQUIRE(astPath(results[0].output) == dir.path / "a.tast");
+
+    auto bytes = readFile(dir.path / "a.tast");
+    BinaryAst ast(bytes);
+    REQUIRE(ast.roots().count == 2);
+    auto decl = ast.node(ast.item(ast.roots(), 0));
+    REQUIRE(ast.symbolText(decl.first) == "f");
+    REQUIRE(ast.type(decl.type)->toString() == "(number) -> number");
+}
+
+TEST_CASE("Driver: every pass handles operator chains of any length") {
+    // Long enough to overflow the stack if a pass recursed for each operator
+    constexpr int LENGTH = 30000;
+    std::string code = "local function inc(n)\n"
+                       "    return n + 1\n"
+                       "end\n"
+                       "local s = inc(x)";
+    for (int i = 1; i < LENGTH; ++i) {
+        code += " + math.pi + inc(x)";
+    }
+    TempDir dir("long_chains");
+    auto source = dir.write("a.tlua", code);
+    CompileOptions options;
+    options.inlineFunctions = true;
+    options.localize = true;
+    options.eliminate = true;
+    options.emitAst = true;
+    auto results = compileFiles(collectInputs({source.string()}), options);
+    REQUIRE(results[0].ok());
+
+    auto lua = readFile(results[0].output);
+    REQUIRE(lua.starts_with("local __math_pi = math.pi\nlocal s = x + 1 + __math_pi + (x + 1)"));
+    REQUIRE(lua.find("inc(") == std::string::npos);
+    auto bytes = readFile(dir.path / "a.tast");
+    REQUIRE(BinaryAst(bytes).roots().count == 2);
+}
+
+TEST_CASE("Driver: --bytecode writes precompiled chunks named after their source") {
+    TempDir dir("bytecode");
+    auto source = dir.write("a.tlua", "local a = 1\nprint(a + 2)");
+    CompileOptions options;
+    options.bytecode = true;
+    options.cacheDir = dir.path / "cache";
+    for (int build = 0; build < 2; ++build) {
+        auto results = compileFiles(collectInputs({source.string()}), options);
+        REQUIRE(results[0].ok());
+        REQUIRE(results[0].cached == (build == 1));
+        REQUIRE(results[0].output == dir.path / "a.luac");
+
+        // Binary, without the newline the Lua gets
+        auto chunk = readFile(dir.path / "a.luac");
+        REQUIRE(chunk.starts_with("\x1bLua\x54"));
+        REQUIRE(chunk.find("@" + source.string()) != std::string::npos);
+        REQUIRE(chunk.back() != '\n');
+    }
+    REQUIRE_FALSE(fs::exists(dir.path / "a.lua"));
+}
+
+TEST_CASE("Driver: unchanged files are taken from the build cache") {
+    TempDir dir("cached");
+    auto source = dir.write("a.tlua", "function f(x: number) -> number\n"
+                                      "    return x\n"
+                                      "end");
+    CompileOptions options;
+    options.cacheDir = dir.path / "cache";
+    auto inputs = collectInputs({source.string()});
+
+    auto first = compileFiles(inputs, options);
+    REQUIRE(first[0].ok());
+    REQUIRE_FALSE(first[0].cached);
+    REQUIRE(first[0].exportsChanged);
+
+    auto second = compileFiles(inputs, options);
+    REQUIRE(second[0].ok());
+    REQUIRE(second[0].cached);
+    REQUIRE_FALSE(second[0].exportsChanged);
+    REQUIRE(readFile(dir.path / "a.lua") == "function f(x)\n    return x\nend\n");
+
+    // A new body with the same signature does not affect dependents
+    dir.write("a.tlua", "function f(x: number) -> number\n"
+                        "    return x + 1\n"
+                        "end");
+    auto third = compileFiles(inputs, options);
+    REQUIRE(third[0].ok());
+    REQUIRE_FALSE(third[0].cached);
+    REQUIRE_FALSE(third[0].exportsChanged);
+    REQUIRE(readFile(dir.path / "a.lua") == "function f(x)\n    return x + 1\nend\n");
+
+    // A new signature does
+    dir.write("a.tlua", "function f(x: string) -> string\n"
+                        "    return x\n"
+                        "end");
+    auto fourth = compileFiles(inputs, options);
+    REQUIRE(fourth[0].ok());
+    REQUIRE(fourth[0].exportsChanged);
+
+    // Going back to an earlier version is a cache hit
+    dir.write("a.tlua", "function f(x: number) -> number\n"
+                        "    return x\n"
+                        "end");
+    auto fifth = compileFiles(inputs, options);
+    REQUIRE(fifth[0].cached);
+    REQUIRE(fifth[0].exportsChanged);
+}
+
+TEST_CASE("Driver: required modules are typed and part of the cache key") {
+    TempDir dir("modules");
+    dir.write("lib/geometry.tlua", "function area(w: number, h: number) -> number\n"
+                                   "    return w * h\n"
+                                   "end");
+    auto source = dir.write("main.tlua", "require(\"geometry\")\n"
+                                         "local a = area(2, 3)");
+    CompileOptions options;
+    options.modulePath = {dir.path / "lib"};
+    options.cacheDir = dir.path / "cache";
+    auto inputs = collectInputs({source.string()});
+
+    REQUIRE(compileFiles(inputs, options)[0].ok());
+    REQUIRE(compileFiles(inputs, options)[0].cached);
+
+    // The signature used by main changed, main has to be checked again
+    dir.write("lib/geometry.tlua", "function area(w: string, h: number) -> number\n"
+                                   "    return h\n"
+                                   "end");
+    auto changed = compileFiles(inputs, options);
+    REQUIRE_FALSE(changed[0].cached);
+    REQUIRE_FALSE(changed[0].ok());
+    REQUIRE(changed[0].error.find("argument type mismatch") != std::string::npos);
+
+    REQUIRE_THROWS_AS(compileUnit(readFile(source), options), TypeCheckError);
+    REQUIRE_NOTHROW(compileUnit(readFile(source)));
+}
+
+TEST_CASE("Driver: exports are the global functions") {
+    auto unit = compileUnit("function f(a: number) -> number\n"
+                            "    return a\n"
+                            "end\n"
+                            "local function g() return 1 end\n"
+                            "local h = 1");
+    REQUIRE(unit.exports == std::vector<ExportedSymbol>{{"f", "(number) -> number"}});
+}
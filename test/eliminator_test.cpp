@@ -0,0 +1,127 @@
+#include "../src/eliminator.h"
+#include "../src/inliner.h"
+#include "../src/lexer.h"
+#include "../src/lua_codegen.h"
+#include "../src/parser.h"
+#include "../src/typechecker.h"
+#include "./utils.h"
+#include <catch2/catch_test_macros.hpp>
+
+static std::string eliminate_lua(const std::string& code, bool inlineFirst = false) {
+    Parser parser{Lexer{code}};
+    auto prog = parser.parse();
+    TypeChecker typechecker;
+    typechecker.typeCheck(prog);
+    if (inlineFirst) {
+        Inliner inliner;
+        inliner.inlineCalls(prog);
+    }
+    Eliminator eliminator;
+    eliminator.eliminate(prog);
+    LuaCodegen codegen;
+    return codegen.generate(prog);
+}
+
+TEST_CASE("Eliminator counts the uses of each declaration") {
+    Parser parser{Lexer{"local a = 1\n"
+                        "local b = a + a\n"
+                        "local t = {a = b}\n"
+                        "print(t.a)"}};
+    auto prog = parser.parse();
+    TypeChecker typechecker;
+    typechecker.typeCheck(prog);
+    std::vector<uint32_t> uses;
+    for (auto* stmt : prog.statements) {
+        if (auto* decl = nodeCast<Decl>(stmt)) {
+            uses.push_back(decl->uses);
+        }
+    }
+    // Field names and table keys are not references
+    REQUIRE(uses == std::vector<uint32_t>{2, 1, 1});
+}
+
+TEST_CASE("Eliminator removes unused locals without effects") {
+    REQUIRE(eliminate_lua("local a = 1\n"
+                          "local b = {1, 2, 3}\n"
+                          "local c = \"x\" .. 1\n"
+                          "local d = 2\n"
+                          "print(d)") == "local d = 2\n"
+                                         "print(d)");
+    // Locals only used by removed code go as well
+    REQUIRE(eliminate_lua("local a = 1\n"
+                          "local b = {a}\n"
+                          "local function f() return b end\n"
+                          "print(2)") == "print(2)");
+    // A redeclaration leaves the first declaration unused
+    REQUIRE(eliminate_lua("local a = 1\n"
+                          "local a = 2\n"
+                          "print(a)") == "local a = 2\n"
+                                         "print(a)");
+}
+
+TEST_CASE("Eliminator removes recursive local functions only they call") {
+    REQUIRE(eliminate_lua("local base = 1\n"
+                          "local function fact(n)\n"
+                          "    if n == 0 then return base end\n"
+                          "    return n * fact(n - 1)\n"
+                          "end\n"
+                          "print(2)") == "print(2)");
+    std::string used = "local function count(n)\n"
+                       "    return count(n)\n"
+                       "end\n"
+                       "print(count(1))";
+    REQUIRE(eliminate_lua(used) == used);
+}
+
+TEST_CASE("Eliminator keeps effects, globals and assigned locals") {
+    REQUIRE(eliminate_lua("local a = f()\n"
+                          "local b = x + 1\n"
+                          "local c = {f()}") == "f()\n"
+                                                "local b = x + 1\n"
+                                                "local c = {f()}");
+    REQUIRE(eliminate_lua("x = 1\n"
+                          "function g() return 1 end\n"
+                          "local a = 1\n"
+                          "a = 2\n"
+                          "local h = 1\n"
+                          "function h() return 2 end") == "x = 1\n"
+                                                          "function g()\n"
+                                                          "    return 1\n"
+                                                          "end\n"
+                                                          "local a = 1\n"
+                                                          "a = 2\n"
+                                                          "local h = 1\n"
+                                                          "function h()\n"
+                                                          "    return 2\n"
+                                                          "end");
+}
+
+TEST_CASE("Eliminator removes code after a return and inside functions") {
+    REQUIRE(eliminate_lua("function f()\n"
+                          "    local unused = 1\n"
+                          "    return 1\n"
+                          "    print(2)\n"
+                          "end") == "function f()\n"
+                                    "    return 1\n"
+                                    "end");
+    // `y` is only read by the unreachable statement
+    REQUIRE(eliminate_lua("function f(x)\n"
+                          "    local y = 2\n"
+                          "    if x then\n"
+                          "        return x\n"
+                          "        print(y)\n"
+                          "    end\n"
+                          "end") == "function f(x)\n"
+                                    "    if x then\n"
+                                    "        return x\n"
+                                    "    end\n"
+                                    "end");
+}
+
+TEST_CASE("Eliminator sees the references the inliner copies") {
+    REQUIRE(eliminate_lua("local k = 2\n"
+                          "local function scale(x: number) -> number return x * k end\n"
+                          "print(scale(3))",
+                          true) == "local k = 2\n"
+                                   "print(3 * k)");
+}
@@ -6,8 +6,8 @@ TEST_CASE("Environment: basic define and lookup") {
     Environment env;
     env.pushScope();
 
-    env.define("x", BasicType::numberType());
-    Type* found = env.lookup("x");
+    env.define(intern("x"), BasicType::numberType());
+    Type* found = env.lookup(intern("x"));
 
     REQUIRE(found != nullptr);
     REQUIRE(isSameType(found, BasicType::numberType()));
@@ -17,7 +17,7 @@ TEST_CASE("Environment: lookup returns nullptr for undefined variable") {
     Environment env;
     env.pushScope();
 
-    Type* found = env.lookup("undefined");
+    Type* found = env.lookup(intern("undefined"));
 
     REQUIRE(found == nullptr);
 }
@@ -26,62 +26,97 @@ TEST_CASE("Environment: multiple variables in same scope") {
     Environment env;
     env.pushScope();
 
-    env.define("x", BasicType::numberType());
-    env.define("y", BasicType::stringType());
-    env.define("z", BasicType::booleanType());
+    env.define(intern("x"), BasicType::numberType());
+    env.define(intern("y"), BasicType::stringType());
+    env.define(intern("z"), BasicType::booleanType());
 
-    REQUIRE(isSameType(env.lookup("x"), BasicType::numberType()));
-    REQUIRE(isSameType(env.lookup("y"), BasicType::stringType()));
-    REQUIRE(isSameType(env.lookup("z"), BasicType::booleanType()));
+    REQUIRE(isSameType(env.lookup(intern("x")), BasicType::numberType()));
+    REQUIRE(isSameType(env.lookup(intern("y")), BasicType::stringType()));
+    REQUIRE(isSameType(env.lookup(intern("z")), BasicType::booleanType()));
 }
 
 TEST_CASE("Environment: lookup across scopes (inner to outer)") {
     Environment env;
 
     env.pushScope(); // outer scope
-    env.define("x", BasicType::numberType());
+    env.define(intern("x"), BasicType::numberType());
 
     env.pushScope(); // inner scope
-    env.define("y", BasicType::stringType());
+    env.define(intern("y"), BasicType::stringType());
 
     // Can see both
-    REQUIRE(isSameType(env.lookup("x"), BasicType::numberType()));
-    REQUIRE(isSameType(env.lookup("y"), BasicType::stringType()));
+    REQUIRE(isSameType(env.lookup(intern("x")), BasicType::numberType()));
+    REQUIRE(isSameType(env.lookup(intern("y")), BasicType::stringType()));
 
     env.popScope();
 
     // Outer scope can only see x
-    REQUIRE(isSameType(env.lookup("x"), BasicType::numberType()));
-    REQUIRE(env.lookup("y") == nullptr);
+    REQUIRE(isSameType(env.lookup(intern("x")), BasicType::numberType()));
+    REQUIRE(env.lookup(intern("y")) == nullptr);
 }
 
 TEST_CASE("Environment: shadowing in nested scopes") {
     Environment env;
 
     env.pushScope(); // outer scope
-    env.define("x", BasicType::numberType());
+    env.define(intern("x"), BasicType::numberType());
 
-    env.pushScope();                          // inner scope
-    env.define("x", BasicType::stringType()); // shadow with different type
+    env.pushScope();                                  // inner scope
+    env.define(intern("x"), BasicType::stringType()); // shadow with different type
 
     // Inner scope sees shadowed version
-    REQUIRE(isSameType(env.lookup("x"), BasicType::stringType()));
+    REQUIRE(isSameType(env.lookup(intern("x")), BasicType::stringType()));
 
     env.popScope();
 
     // Outer scope still has original
-    REQUIRE(isSameType(env.lookup("x"), BasicType::numberType()));
+    REQUIRE(isSameType(env.lookup(intern("x")), BasicType::numberType()));
 }
 
 TEST_CASE("Environment: pop scope removes variables") {
     Environment env;
 
     env.pushScope();
-    env.define("x", BasicType::numberType());
+    env.define(intern("x"), BasicType::numberType());
 
-    REQUIRE(env.lookup("x") != nullptr);
+    REQUIRE(env.lookup(intern("x")) != nullptr);
 
     env.popScope();
 
-    REQUIRE(env.lookup("x") == nullptr);
-}
\ No newline at end of file
+    REQUIRE(env.lookup(intern("x")) == nullptr);
+}
+TEST_CASE("Environment: redefinition in the same scope replaces the binding") {
+    Environment env;
+    env.pushScope();
+    env.define(intern("x"), BasicType::numberType());
+
+    env.pushScope();
+    env.define(intern("x"), BasicType::stringType());
+    env.define(intern("x"), BasicType::booleanType());
+    REQUIRE(isSameType(env.lookup(intern("x")), BasicType::booleanType()));
+
+    // One pop restores the outer binding
+    env.popScope();
+    REQUIRE(isSameType(env.lookup(intern("x")), BasicType::numberType()));
+}
+
+TEST_CASE("Environment: deep nesting") {
+    Environment env;
+    env.pushScope();
+    env.define(intern("x"), BasicType::nilType());
+
+    constexpr int DEPTH = 10000;
+    for (int i = 0; i < DEPTH; ++i) {
+        env.pushScope();
+        env.define(intern("x"), i % 2 == 0 ? BasicType::numberType() : BasicType::stringType());
+        env.define(intern(std::format("v{}", i)), BasicType::booleanType());
+    }
+    REQUIRE(isSameType(env.lookup(intern("x")), BasicType::stringType()));
+    REQUIRE(env.lookup(intern("v0")) != nullptr);
+
+    for (int i = DEPTH - 1; i >= 0; --i) {
+        env.popScope();
+        REQUIRE(env.lookup(intern(std::format("v{}", i))) == nullptr);
+    }
+    REQUIRE(isSameType(env.lookup(intern("x")), BasicType::nilType()));
+}
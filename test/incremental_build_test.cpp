@@ -0,0 +1,95 @@
+#include "../src/incremental_build.h"
+#include "../src/file_watcher.h"
+#include "./utils.h"
+#include <catch2/catch_test_macros.hpp>
+
+namespace fs = std::filesystem;
+
+namespace {
+std::vector<std::string> inputsOf(const std::vector<CompileResult>& results) {
+    std::vector<std::string> inputs;
+    for (const auto& result : results) {
+        REQUIRE(result.ok());
+        inputs.push_back(result.input.filename().string());
+    }
+    return inputs;
+}
+} // namespace
+
+TEST_CASE("IncrementalBuild: only changed files are compiled again") {
+    TempDir dir("incremental_changed");
+    auto a = dir.write("src/a.tlua", "local a = 1");
+    dir.write("src/b.tlua", "local b = 2");
+    CompileOptions options;
+    options.outDir = dir.path / "out";
+    IncrementalBuild build({(dir.path / "src").string()}, options);
+
+    REQUIRE(inputsOf(build.buildAll()) == std::vector<std::string>{"a.tlua", "b.tlua"});
+    REQUIRE(readFile(dir.path / "out/a.lua") == "local a = 1\n");
+
+    // Saved without a change
+    REQUIRE(build.rebuild({a}).empty());
+    dir.write("src/a.tlua", "local a = 3");
+    REQUIRE(inputsOf(build.rebuild({a})) == std::vector<std::string>{"a.tlua"});
+    REQUIRE(readFile(dir.path / "out/a.lua") == "local a = 3\n");
+}
+
+TEST_CASE("IncrementalBuild: picks up new files and forgets removed ones") {
+    TempDir dir("incremental_new");
+    auto a = dir.write("src/a.tlua", "local a = 1");
+    CompileOptions options;
+    options.outDir = dir.path / "out";
+    IncrementalBuild build({(dir.path / "src").string()}, options);
+    build.buildAll();
+
+    auto b = dir.write("src/nested/b.tlua", "local b = 2");
+    REQUIRE(inputsOf(build.rebuild({b})) == std::vector<std::string>{"b.tlua"});
+    REQUIRE(readFile(dir.path / "out/nested/b.lua") == "local b = 2\n");
+
+    fs::remove(a);
+    REQUIRE(build.rebuild({a}).empty());
+    REQUIRE(inputsOf(build.buildAll()) == std::vector<std::string>{"b.tlua"});
+}
+
+TEST_CASE("IncrementalBuild: rebuilds the files requiring a module whose signatures changed") {
+    TempDir dir("incremental_modules");
+    auto module = dir.write("lib/geometry.tlua", "function area(w: number, h: number) -> number\n"
+                                                 "    return w * h\n"
+                                                 "end");
+    dir.write("src/main.tlua", "require(\"geometry\")\n"
+                               "local a = area(2, 3)");
+    dir.write("src/other.tlua", "local b = 1");
+    CompileOptions options;
+    options.outDir = dir.path / "out";
+    options.modulePath = {dir.path / "lib"};
+    IncrementalBuild build({(dir.path / "src").string()}, options);
+    REQUIRE(inputsOf(build.buildAll()) == std::vector<std::string>{"main.tlua", "other.tlua"});
+
+    // A body doesn't appear in the summary
+    dir.write("lib/geometry.tlua", "function area(w: number, h: number) -> number\n"
+                                   "    return h * w\n"
+                                   "end");
+    REQUIRE(build.rebuild({module}).empty());
+
+    dir.write("lib/geometry.tlua", "function area(w: string, h: number) -> number\n"
+                                   "    return h\n"
+                                   "end");
+    auto results = build.rebuild({module});
+    REQUIRE(results.size() == 1);
+    REQUIRE(results[0].input.filename() == "main.tlua");
+    REQUIRE(results[0].error.find("argument type mismatch") != std::string::npos);
+}
+
+TEST_CASE("FileWatcher: reports the sources written") {
+    TempDir dir("file_watcher");
+    dir.write("src/a.tlua", "local a = 1");
+    FileWatcher watcher({dir.path});
+    using std::chrono::milliseconds;
+    REQUIRE(watcher.waitForChanges(milliseconds(0), milliseconds(0)).empty());
+
+    auto a = dir.write("src/a.tlua", "local a = 2");
+    dir.write("src/a.lua", "local a = 2");
+    auto b = dir.write("src/new/b.tlua", "local b = 1");
+    REQUIRE(watcher.waitForChanges(milliseconds(1000), milliseconds(10)) ==
+            std::vector<fs::path>{a, b});
+}
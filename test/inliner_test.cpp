@@ -0,0 +1,233 @@
+#include "../src/inliner.h"
+#include "../src/lexer.h"
+#include "../src/lua_codegen.h"
+#include "../src/optimizer.h"
+#include "../src/parser.h"
+#include "../src/typechecker.h"
+#include "./utils.h"
+#include <catch2/catch_test_macros.hpp>
+
+static std::string inline_lua(const std::string& code, bool optimize = false) {
+    Parser parser{Lexer{code}};
+    auto prog = parser.parse();
+    TypeChecker typechecker;
+    typechecker.typeCheck(prog);
+    Inliner inliner;
+    inliner.inlineCalls(prog);
+    if (optimize) {
+        Optimizer optimizer;
+        optimizer.optimize(prog);
+    }
+    LuaCodegen codegen;
+    return codegen.generate(prog);
+}
+
+TEST_CASE("Inliner replaces calls by the returned expression") {
+    std::string code = R"(
+local function add(a: number, b: number) -> number
+    return a + b
+end
+local x = add(1, 2)
+local y = add(x, 3) * 2)";
+    std::string expected = "local x = 1 + 2\n"
+                           "local y = (x + 3) * 2";
+    REQUIRE(inline_lua(code) == expected);
+    REQUIRE(inline_lua(code, true) == "local x = 3\nlocal y = (x + 3) * 2");
+}
+
+TEST_CASE("Inliner evaluates arguments with effects once, in order") {
+    std::string code = R"(
+local function twice(n)
+    return n + n
+end
+local function first(a, b)
+    return a
+end
+local x = twice(read())
+local y = first(x, read()))";
+    std::string expected = "local __inl_1 = read()\n"
+                           "local x = __inl_1 + __inl_1\n"
+                           "local __inl_2 = x\n"
+                           "local __inl_3 = read()\n"
+                           "local y = __inl_2";
+    REQUIRE(inline_lua(code) == expected);
+}
+
+TEST_CASE("Inliner computes pure arguments used twice once") {
+    std::string code = R"(
+local function square(n)
+    return n * n
+end
+local a = square(x + 1)
+local b = square(x))";
+    std::string expected = "local __inl_1 = x + 1\n"
+                           "local a = __inl_1 * __inl_1\n"
+                           "local b = x * x";
+    REQUIRE(inline_lua(code) == expected);
+}
+
+TEST_CASE("Inliner keeps calls it can't inline without reordering effects") {
+    std::string code = R"(
+local function inc(n)
+    return n + 1
+end
+local x = before() + inc(read())
+if c then
+    f(1)
+elseif inc(read()) then
+    f(2)
+end)";
+    std::string expected = "local function inc(n)\n"
+                           "    return n + 1\n"
+                           "end\n"
+                           "local x = before() + inc(read())\n"
+                           "if c then\n"
+                           "    f(1)\n"
+                           "elseif inc(read()) then\n"
+                           "    f(2)\n"
+                           "end";
+    REQUIRE(inline_lua(code) == expected);
+}
+
+TEST_CASE("Inliner doesn't hoist effects before reads they could change") {
+    std::string code = R"(
+local function sq(n)
+    return n * n
+end
+local k = 1
+local total = 0
+total = 2
+local r = a + sq(bump())
+local s = k + sq(bump())
+local t = total + sq(bump())
+local u = p.x + sq(bump())
+local v = sq(bump()) + a)";
+    std::string expected = "local function sq(n)\n"
+                           "    return n * n\n"
+                           "end\n"
+                           "local k = 1\n"
+                           "local total = 0\n"
+                           "total = 2\n"
+                           "local r = a + sq(bump())\n"
+                           "local __inl_1 = bump()\n"
+                           "local s = k + __inl_1 * __inl_1\n"
+                           "local t = total + sq(bump())\n"
+                           "local u = p.x + sq(bump())\n"
+                           "local __inl_2 = bump()\n"
+                           "local v = __inl_2 * __inl_2 + a";
+    REQUIRE(inline_lua(code) == expected);
+}
+
+TEST_CASE("Inliner stops declaring temporaries at the local limit") {
+    std::string code = "local function sq(n)\n"
+                       "    return n * n\n"
+                       "end\n";
+    for (int i = 0; i < 250; ++i) {
+        code += "x = sq(read())\n";
+    }
+    auto lua = inline_lua(code);
+    auto count = [&](std::string_view text) {
+        size_t found = 0;
+        for (auto at = lua.find(text); at != std::string::npos; at = lua.find(text, at + 1)) {
+            ++found;
+        }
+        return found;
+    };
+    // `sq` itself is one of the locals
+    REQUIRE(count("local __inl_") == Inliner::MAX_LOCALS - 1);
+    REQUIRE(count("x = sq(read())") == 250 - (Inliner::MAX_LOCALS - 1));
+}
+
+TEST_CASE("Inliner doesn't hoist arguments out of the right operand of and/or") {
+    std::string code = R"(
+local function inc(n)
+    return n + 1
+end
+local y = c and inc(g(1))
+if c or inc(g(2)) then
+    f(1)
+end
+local z = inc(g(3)) or c)";
+    std::string expected = "local function inc(n)\n"
+                           "    return n + 1\n"
+                           "end\n"
+                           "local y = c and inc(g(1))\n"
+                           "if c or inc(g(2)) then\n"
+                           "    f(1)\n"
+                           "end\n"
+                           "local __inl_1 = g(3)\n"
+                           "local z = __inl_1 + 1 or c";
+    REQUIRE(inline_lua(code) == expected);
+}
+
+TEST_CASE("Inliner skips recursive, assigned, large and multi-statement functions") {
+    std::string recursive = R"(
+local function loop(n)
+    return loop(n)
+end
+local a = loop(1))";
+    REQUIRE(inline_lua(recursive).ends_with("local a = loop(1)"));
+
+    std::string assigned = R"(
+local function id(n)
+    return n
+end
+id = other
+local a = id(1))";
+    REQUIRE(inline_lua(assigned).ends_with("local a = id(1)"));
+
+    std::string large = R"(
+local function big(n)
+    return n + n + n + n + n + n + n + n + n
+end
+local a = big(1))";
+    REQUIRE(inline_lua(large).ends_with("local a = big(1)"));
+
+    std::string statements = R"(
+local function two(n)
+    local m = n
+    return m
+end
+local a = two(1))";
+    REQUIRE(inline_lua(statements).ends_with("local a = two(1)"));
+}
+
+TEST_CASE("Inliner keeps functions used as values and respects shadowing") {
+    std::string code = R"(
+local k = 1
+local function addK(n)
+    return n + k
+end
+local a = addK(2)
+function g()
+    local k = 5
+    return addK(3)
+end
+local b = map(addK))";
+    std::string expected = "local k = 1\n"
+                           "local function addK(n)\n"
+                           "    return n + k\n"
+                           "end\n"
+                           "local a = 2 + k\n"
+                           "function g()\n"
+                           "    local k = 5\n"
+                           "    return addK(3)\n"
+                           "end\n"
+                           "local b = map(addK)";
+    REQUIRE(inline_lua(code) == expected);
+}
+
+TEST_CASE("Inliner keeps the call of a call statement") {
+    std::string code = R"(
+local function id(n)
+    return n
+end
+id(1)
+print(id(2)))";
+    std::string expected = "local function id(n)\n"
+                           "    return n\n"
+                           "end\n"
+                           "id(1)\n"
+                           "print(2)";
+    REQUIRE(inline_lua(code) == expected);
+}
@@ -1,5 +1,9 @@
 #include "../src/lexer.h"
+#include "../src/mapped_file.h"
 #include <catch2/catch_test_macros.hpp>
+#include <filesystem>
+#include <fstream>
+#include <vector>
 
 TEST_CASE("should be able to tokenize simple source") {
     std::string source = "local x = 10";
@@ -25,6 +29,32 @@ TEST_CASE("should tokenize length operator") {
     REQUIRE(tokens[2].kind == TokenKind::Eof);
 }
 
+TEST_CASE("should tokenize concat and not-equal operators") {
+    std::string source = "a .. b ~= c.d";
+    auto tokens = Lexer::tokenize(source);
+    REQUIRE(tokens.size() == 8);
+    REQUIRE(tokens[1].kind == TokenKind::Concat);
+    REQUIRE(tokens[1].lexeme == "..");
+    REQUIRE(tokens[3].kind == TokenKind::NotEqual);
+    REQUIRE(tokens[3].lexeme == "~=");
+    REQUIRE(tokens[5].kind == TokenKind::MemberAccess);
+    REQUIRE(tokens[7].kind == TokenKind::Eof);
+}
+
+TEST_CASE("should tokenize decimal numerals") {
+    std::string source = "1.5 .5 3e-2 2E8 1. 7 // 2 1..x";
+    auto tokens = Lexer::tokenize(source);
+    std::vector<std::string_view> lexemes;
+    for (size_t i = 0; i < 10 && i < tokens.size(); ++i) {
+        lexemes.push_back(tokens[i].lexeme);
+    }
+    REQUIRE(lexemes ==
+            std::vector<std::string_view>{"1.5", ".5", "3e-2", "2E8", "1.", "7", "//", "2", "1",
+                                          ".."});
+    REQUIRE(tokens[6].kind == TokenKind::FloorDiv);
+    REQUIRE(tokens[9].kind == TokenKind::Concat);
+}
+
 TEST_CASE("should tokenize bracket indexing") {
     std::string source = "arr[1]";
     auto tokens = Lexer::tokenize(source);
@@ -39,3 +69,127 @@ TEST_CASE("should tokenize bracket indexing") {
     REQUIRE(tokens[3].lexeme == "]");
     REQUIRE(tokens[4].kind == TokenKind::Eof);
 }
+
+TEST_CASE("lexemes point into the source buffer") {
+    std::string source = "local name = \"hello\"";
+    auto tokens = Lexer::tokenize(source);
+    REQUIRE(tokens.size() == 5);
+    for (const auto& token : tokens) {
+        REQUIRE(token.lexeme.data() >= source.data());
+        REQUIRE(token.lexeme.data() + token.lexeme.size() <= source.data() + source.size());
+    }
+    // string literal lexemes exclude the quotes, but columns point at the opening quote
+    REQUIRE(tokens[3].lexeme == "hello");
+    REQUIRE(tokens[3].column == 14);
+}
+
+TEST_CASE("should tokenize a memory-mapped file") {
+    auto path = std::filesystem::temp_directory_path() / "tlua_lexer_test.lua";
+    {
+        std::ofstream out(path);
+        out << "function foo() return 1 end\n";
+    }
+    MappedFile file(path.string());
+    auto tokens = Lexer::tokenize(file.view());
+    REQUIRE(tokens.size() == 8); // function, foo, (, ), return, 1, end, eof
+    REQUIRE(tokens[1].kind == TokenKind::Identifier);
+    REQUIRE(tokens[1].lexeme == "foo");
+    REQUIRE(tokens[0].line == 1);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("should tokenize an empty memory-mapped file") {
+    auto path = std::filesystem::temp_directory_path() / "tlua_lexer_empty_test.lua";
+    std::ofstream(path).close();
+    MappedFile file(path.string());
+    auto tokens = Lexer::tokenize(file.view());
+    REQUIRE(tokens.size() == 1);
+    REQUIRE(tokens[0].kind == TokenKind::Eof);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("token stream pulls tokens lazily with peek and previous") {
+    std::string source = "local x = 10";
+    TokenStream stream{Lexer{source}};
+    REQUIRE(stream.peek().kind == TokenKind::Local);
+    stream.advance();
+    REQUIRE(stream.previous().kind == TokenKind::Local);
+    REQUIRE(stream.peek().kind == TokenKind::Identifier);
+    REQUIRE(stream.peek().lexeme == "x");
+    stream.advance();
+    stream.advance();
+    stream.advance();
+    REQUIRE(stream.peek().kind == TokenKind::Eof);
+    // advancing past the end keeps yielding Eof
+    stream.advance();
+    REQUIRE(stream.peek().kind == TokenKind::Eof);
+}
+
+TEST_CASE("token stream restores checkpoints inside the window") {
+    std::string source;
+    for (size_t i = 0; i < 4 * TokenStream::WINDOW_SIZE; ++i) {
+        source += std::format("a{} ", i);
+    }
+    TokenStream stream{Lexer{source}};
+    stream.advance();
+    auto checkpoint = stream.mark();
+    for (size_t i = 0; i < TokenStream::WINDOW_SIZE - 2; ++i) {
+        stream.advance();
+    }
+    stream.restore(checkpoint);
+    REQUIRE(stream.peek().lexeme == "a1");
+
+    for (size_t i = 0; i < 2 * TokenStream::WINDOW_SIZE; ++i) {
+        stream.advance();
+    }
+    REQUIRE_THROWS_AS(stream.restore(checkpoint), std::out_of_range);
+}
+
+TEST_CASE("should recognize every keyword and nothing else") {
+    std::string source = "local function end return if then else elseif true false nil not and or";
+    std::vector<TokenKind> expected = {
+        TokenKind::Local, TokenKind::Function, TokenKind::End,   TokenKind::Return,
+        TokenKind::If,    TokenKind::Then,     TokenKind::Else,  TokenKind::ElseIf,
+        TokenKind::True,  TokenKind::False,    TokenKind::Nil,   TokenKind::Not,
+        TokenKind::And,   TokenKind::Or,       TokenKind::Eof,
+    };
+    auto tokens = Lexer::tokenize(source);
+    REQUIRE(tokens.size() == expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        REQUIRE(tokens[i].kind == expected[i]);
+    }
+
+    for (auto&& word : {"iff", "en", "ends", "nil_", "_not", "noT", "functions", "Local", "elsei"}) {
+        auto identifier = Lexer::tokenize(word);
+        REQUIRE(identifier[0].kind == TokenKind::Identifier);
+        REQUIRE(identifier[0].lexeme == word);
+    }
+}
+
+TEST_CASE("should tokenize identifiers longer than a vector chunk") {
+    std::string name = "a_very_long_identifier_with_Digits_0123456789_and_CAPS";
+    std::string source = name + "+" + name + "[1]";
+    auto tokens = Lexer::tokenize(source);
+    REQUIRE(tokens.size() == 7);
+    REQUIRE(tokens[0].lexeme == name);
+    REQUIRE(tokens[1].kind == TokenKind::Plus);
+    REQUIRE(tokens[1].column == static_cast<int>(name.size()) + 1);
+    REQUIRE(tokens[2].lexeme == name);
+    REQUIRE(tokens[3].kind == TokenKind::LBracket);
+}
+
+TEST_CASE("should skip deep indentation and track lines and columns") {
+    std::string indent(100000, ' ');
+    std::string source = indent + "x\n\t\t  \t" + indent + "y\r\n  z";
+    auto tokens = Lexer::tokenize(source);
+    REQUIRE(tokens.size() == 4);
+    REQUIRE(tokens[0].lexeme == "x");
+    REQUIRE(tokens[0].line == 1);
+    REQUIRE(tokens[0].column == 100001);
+    REQUIRE(tokens[1].lexeme == "y");
+    REQUIRE(tokens[1].line == 2);
+    REQUIRE(tokens[1].column == 100006);
+    REQUIRE(tokens[2].lexeme == "z");
+    REQUIRE(tokens[2].line == 3);
+    REQUIRE(tokens[2].column == 3);
+}
@@ -0,0 +1,96 @@
+#include "../src/lexer.h"
+#include "../src/localizer.h"
+#include "../src/lua_codegen.h"
+#include "../src/parser.h"
+#include "../src/typechecker.h"
+#include "./utils.h"
+#include <catch2/catch_test_macros.hpp>
+
+static std::string localize_lua(const std::string& code) {
+    Parser parser{Lexer{code}};
+    auto prog = parser.parse();
+    TypeChecker typechecker;
+    typechecker.typeCheck(prog);
+    Localizer localizer;
+    localizer.localize(prog);
+    LuaCodegen codegen;
+    return codegen.generate(prog);
+}
+
+TEST_CASE("Localizer caches library globals read more than once") {
+    std::string code = R"(
+print(1)
+function f()
+    print(2)
+end
+type(x))";
+    std::string expected = "local print = print\n"
+                           "print(1)\n"
+                           "function f()\n"
+                           "    print(2)\n"
+                           "end\n"
+                           "type(x)";
+    REQUIRE(localize_lua(code) == expected);
+}
+
+TEST_CASE("Localizer caches library fields read more than once") {
+    std::string code = R"(
+local a = string.format("%d", 1)
+local b = string.format("%d", 2)
+local c = math.floor(a))";
+    std::string expected = "local __string_format = string.format\n"
+                           "local a = __string_format(\"%d\", 1)\n"
+                           "local b = __string_format(\"%d\", 2)\n"
+                           "local c = math.floor(a)";
+    REQUIRE(localize_lua(code) == expected);
+}
+
+TEST_CASE("Localizer leaves assigned and shadowed globals alone") {
+    std::string assigned = R"(
+print(1)
+print(2)
+print = other)";
+    REQUIRE(localize_lua(assigned) == "print(1)\nprint(2)\nprint = other");
+
+    std::string fieldAssigned = R"(
+string.format = other
+print(string.format)
+print(string.format))";
+    REQUIRE(localize_lua(fieldAssigned).starts_with("local print = print\nstring.format"));
+
+    std::string shadowed = R"(
+local function f(print)
+    print(1)
+    print(2)
+end)";
+    REQUIRE(localize_lua(shadowed).starts_with("local function f(print)"));
+}
+
+TEST_CASE("Localizer reads repeated member access chains once") {
+    std::string code = R"(
+local p = {pos = {x = 1}}
+local a = p.pos.x + 1
+local b = p.pos.x * 2)";
+    std::string expected = "local p = {pos = {x = 1}}\n"
+                           "local __p_pos_x = p.pos.x\n"
+                           "local a = __p_pos_x + 1\n"
+                           "local b = __p_pos_x * 2";
+    REQUIRE(localize_lua(code) == expected);
+}
+
+TEST_CASE("Localizer doesn't hoist chains across calls and assignments") {
+    std::string code = R"(
+local p = {x = 1}
+local a = p.x
+f()
+local b = p.x
+p.x = 2
+local c = p.x)";
+    std::string expected = "local p = {x = 1}\n"
+                           "local a = p.x\n"
+                           "f()\n"
+                           "local b = p.x\n"
+                           "p.x = 2\n"
+                           "local c = p.x";
+    REQUIRE(localize_lua(code) == expected);
+}
@@ -0,0 +1,215 @@
+#include "../src/lexer.h"
+#include "../src/lua_bytecode.h"
+#include "../src/parser.h"
+#include "../src/typechecker.h"
+#include "./utils.h"
+#include <catch2/catch_test_macros.hpp>
+
+using namespace lua_bytecode;
+
+static std::unique_ptr<Function> compile(const std::string& code) {
+    Parser parser{Lexer{code}};
+    auto prog = parser.parse();
+    TypeChecker typechecker;
+    typechecker.typeCheck(prog);
+    LuaBytecode bytecode;
+    return bytecode.compile(prog);
+}
+
+static std::string listing(const std::string& code) { return compile(code)->listing(); }
+
+TEST_CASE("Bytecode instruction encoding") {
+    auto add = iABC(OpCode::Add, 1, 2, 3, true);
+    REQUIRE(opcode(add) == OpCode::Add);
+    REQUIRE(argA(add) == 1);
+    REQUIRE(argB(add) == 2);
+    REQUIRE(argC(add) == 3);
+    REQUIRE(argK(add));
+    REQUIRE(argSBx(iAsBx(OpCode::LoadI, 0, -5)) == -5);
+    REQUIRE(argSJ(isJ(OpCode::Jmp, -3)) == -3);
+    REQUIRE(argAx(iAx(OpCode::ExtraArg, MAXARG_AX)) == MAXARG_AX);
+    // The numbers of the Lua 5.4 VM
+    REQUIRE(static_cast<int>(OpCode::AddI) == 21);
+    REQUIRE(static_cast<int>(OpCode::Jmp) == 56);
+    REQUIRE(static_cast<int>(OpCode::Call) == 68);
+    REQUIRE(static_cast<int>(OpCode::ExtraArg) == 82);
+}
+
+TEST_CASE("Bytecode locals in registers and immediate arithmetic") {
+    REQUIRE(listing("local x = 1 local y = x + 2") == "VARARGPREP 0 0 0\n"
+                                                      "LOADI 0 1\n"
+                                                      "ADDI 1 0 2\n"
+                                                      "MMBINI 0 2 6\n"
+                                                      "RETURN 2 1 1\n");
+    // Number constants use the K forms, other operands a register
+    REQUIRE(listing("local a = 2 local b = a * 2.5 - 3.5 local c = a / b") ==
+            "VARARGPREP 0 0 0\n"
+            "LOADI 0 2\n"
+            "MULK 1 0 1\n"
+            "MMBINK 0 1 8\n"
+            "SUBK 1 1 0\n"
+            "MMBINK 1 0 7\n"
+            "DIV 2 0 1\n"
+            "MMBIN 0 1 11\n"
+            "RETURN 3 1 1\n");
+}
+
+TEST_CASE("Bytecode globals are fields of _ENV") {
+    auto main = compile(R"(print("hi"))");
+    REQUIRE(main->listing() == "VARARGPREP 0 0 0\n"
+                               "GETTABUP 0 0 0\n"
+                               "LOADK 1 1\n"
+                               "CALL 0 2 1\n"
+                               "RETURN 0 1 1\n");
+    REQUIRE(main->constants == std::vector<Constant>{std::string("print"), std::string("hi")});
+    REQUIRE(main->upvalues.size() == 1);
+    REQUIRE(main->upvalues[0].name.str() == "_ENV");
+}
+
+TEST_CASE("Bytecode if and elseif chains jump over the other arms") {
+    REQUIRE(listing("local x = 1\n"
+                    "if x == 1 then\n"
+                    "    print(\"a\")\n"
+                    "elseif x < 2 then\n"
+                    "    print(\"b\")\n"
+                    "else\n"
+                    "    print(\"c\")\n"
+                    "end") == "VARARGPREP 0 0 0\n"
+                              "LOADI 0 1\n"
+                              "EQI 0 1 0\n"
+                              "JMP 4\n"
+                              "GETTABUP 1 0 0\n"
+                              "LOADK 2 1\n"
+                              "CALL 1 2 1\n"
+                              "JMP 9\n"
+                              "LTI 0 2 0\n"
+                              "JMP 4\n"
+                              "GETTABUP 1 0 0\n"
+                              "LOADK 2 2\n"
+                              "CALL 1 2 1\n"
+                              "JMP 3\n"
+                              "GETTABUP 1 0 0\n"
+                              "LOADK 2 3\n"
+                              "CALL 1 2 1\n"
+                              "RETURN 1 1 1\n");
+}
+
+TEST_CASE("Bytecode and, or and comparisons as values") {
+    REQUIRE(listing("local a = 1 local b = a > 3 and a or -a") == "VARARGPREP 0 0 0\n"
+                                                                 "LOADI 0 1\n"
+                                                                 "GTI 0 3 0 k\n"
+                                                                 "JMP 1\n"
+                                                                 "LFALSESKIP 1 0 0\n"
+                                                                 "LOADTRUE 1 0 0\n"
+                                                                 "TEST 1 0 0\n"
+                                                                 "JMP 1\n"
+                                                                 "MOVE 1 0 0\n"
+                                                                 "TEST 1 0 0 k\n"
+                                                                 "JMP 1\n"
+                                                                 "UNM 1 0 0\n"
+                                                                 "RETURN 2 1 1\n");
+}
+
+TEST_CASE("Bytecode closures capture locals as upvalues") {
+    auto main = compile("local c = 1\n"
+                        "if c then\n"
+                        "    local n = 0\n"
+                        "    function inc()\n"
+                        "        n = n + 1\n"
+                        "        return n\n"
+                        "    end\n"
+                        "end");
+    // The block closes the upvalue of n, returns close the ones still open
+    REQUIRE(main->listing() == "VARARGPREP 0 0 0\n"
+                               "LOADI 0 1\n"
+                               "TEST 0 0 0\n"
+                               "JMP 4\n"
+                               "LOADI 1 0\n"
+                               "CLOSURE 2 0\n"
+                               "SETTABUP 0 0 2\n"
+                               "CLOSE 1 0 0\n"
+                               "RETURN 1 1 1 k\n"
+                               "function 0\n"
+                               "    GETUPVAL 0 0 0\n"
+                               "    ADDI 0 0 1\n"
+                               "    MMBINI 0 1 6\n"
+                               "    SETUPVAL 0 0 0\n"
+                               "    GETUPVAL 0 0 0\n"
+                               "    RETURN 0 2 0\n"
+                               "    RETURN 0 1 0\n");
+    auto& inc = *main->functions[0];
+    REQUIRE(inc.upvalues.size() == 1);
+    REQUIRE(inc.upvalues[0].name.str() == "n");
+    REQUIRE(inc.upvalues[0].inStack);
+    REQUIRE(inc.upvalues[0].index == 1);
+    REQUIRE(inc.lineDefined == 4);
+    REQUIRE(inc.lastLineDefined == 6);
+    REQUIRE(inc.lines == std::vector<uint32_t>{5, 5, 5, 5, 6, 6, 6});
+}
+
+TEST_CASE("Bytecode tables are sized up front") {
+    std::string code = R"(local s = "x" local t = {name = s .. "y", other = 2} local u = {1, 2, 3})";
+    REQUIRE(listing(code) ==
+            "VARARGPREP 0 0 0\n"
+            "LOADK 0 0\n"
+            "NEWTABLE 1 2 0\n"
+            "EXTRAARG 0\n"
+            "MOVE 2 0 0\n"
+            "LOADK 3 1\n"
+            "CONCAT 2 2 0\n"
+            "SETFIELD 1 2 2\n"
+            "LOADI 2 2\n"
+            "SETFIELD 1 3 2\n"
+            "NEWTABLE 2 0 3\n"
+            "EXTRAARG 0\n"
+            "LOADI 3 1\n"
+            "LOADI 4 2\n"
+            "LOADI 5 3\n"
+            "SETLIST 2 3 0\n"
+            "RETURN 3 1 1\n");
+}
+
+TEST_CASE("Bytecode long chains compile without recursion") {
+    std::string sum = "local x = 0 local y = x";
+    std::string chain = "local v = 1\nif v == 0 then\n    v = 0\n";
+    for (int i = 0; i < 10000; ++i) {
+        sum += " + x";
+        chain += "elseif v == 1 then\n    v = 2\n";
+    }
+    chain += "end";
+    // One ADD and MMBIN per operator, all into the register of y
+    REQUIRE(compile(sum)->code.size() == 2 + 2 * 10000 + 1);
+    REQUIRE(compile(chain)->code.size() == 2 + 10001 * 4 - 1 + 1);
+}
+
+TEST_CASE("Bytecode throws when an expression needs too many registers") {
+    // Concatenation keeps every operand of a right nested chain in a register
+    std::string code = R"(local s = "a")";
+    code += " local t = s";
+    for (int i = 0; i < 300; ++i) {
+        code += " .. s";
+    }
+    REQUIRE_THROWS_AS(compile(code), std::runtime_error);
+}
+
+TEST_CASE("Bytecode chunk header and function layout") {
+    Function main;
+    main.vararg = true;
+    main.upvalues.push_back({intern("_ENV"), true, 0});
+    main.code = {iABC(OpCode::VarArgPrep, 0, 0, 0), iABC(OpCode::Return, 0, 1, 1)};
+    main.lines = {1, 1};
+    auto chunk = dump(main, "@a.tlua");
+    std::string expected("\x1bLua\x54\x00\x19\x93\r\n\x1a\n\x04\x08\x08", 15);
+    expected += std::string("\x78\x56\0\0\0\0\0\0", 8);
+    expected += std::string("\0\0\0\0\0\x28\x77\x40", 8);
+    // One upvalue, the source name (size + 1) and both lines defined
+    expected += std::string("\x01\x88@a.tlua\x80\x80\x00\x01\x02", 14);
+    REQUIRE(chunk.starts_with(expected));
+    // Two instructions, no constants, the _ENV upvalue, no functions, then the debug info:
+    // relative lines, no absolute ones, no local names and the upvalue name
+    auto code = chunk.substr(expected.size());
+    REQUIRE(code.substr(0, 1) == "\x82");
+    REQUIRE(code.substr(9) == std::string("\x80\x81\x01\x00\x00\x80"
+                                          "\x82\x01\x00\x80\x80\x81\x85_ENV",
+                                          17));
+}
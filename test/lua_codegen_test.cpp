@@ -6,8 +6,7 @@
 #include <catch2/catch_test_macros.hpp>
 
 static std::string generate_lua(const std::string& code) {
-    auto tokens = Lexer::tokenize(code);
-    Parser parser(tokens);
+    Parser parser{Lexer{code}};
     auto prog = parser.parse();
     TypeChecker typechecker;
     typechecker.typeCheck(prog);
@@ -33,6 +32,34 @@ TEST_CASE("Codegen arithmetic expression") {
     REQUIRE(generate_lua(code) == expected);
 }
 
+TEST_CASE("Codegen keeps parentheses precedence requires") {
+    REQUIRE(generate_lua("local x = a * (b + c)") == "local x = a * (b + c)");
+    REQUIRE(generate_lua("local x = a - (b - c)") == "local x = a - (b - c)");
+    REQUIRE(generate_lua("local x = (a - b) - c") == "local x = a - b - c");
+    REQUIRE(generate_lua("local x = (a or b) and c") == "local x = (a or b) and c");
+    REQUIRE(generate_lua("local x = (s .. t) .. u") == "local x = (s .. t) .. u");
+    REQUIRE(generate_lua("local x = -(a + b)") == "local x = -(a + b)");
+    REQUIRE(generate_lua("local x = -(-a)") == "local x = -(-a)");
+    REQUIRE(generate_lua("local x = not (a == b)") == "local x = not (a == b)");
+}
+
+TEST_CASE("Codegen keeps integer and float literals apart") {
+    REQUIRE(generate_lua("local x = 3000000000") == "local x = 3000000000");
+    REQUIRE(generate_lua("local x = 9223372036854775807") == "local x = 9223372036854775807");
+    REQUIRE(generate_lua("local x = 2.0") == "local x = 2.0");
+    REQUIRE(generate_lua("local x = 1.5e300") == "local x = 1.5e+300");
+    REQUIRE(generate_lua("local x = 0.1") == "local x = 0.1");
+    // Too large for an integer, so a float like in Lua
+    REQUIRE(generate_lua("local x = 9223372036854775808") == "local x = 9.223372036854776e+18");
+    REQUIRE(generate_lua("local x = 1e999") == "local x = 1e999");
+    REQUIRE(generate_lua("local x = a // 2") == "local x = a // 2");
+}
+
+TEST_CASE("Codegen member access") {
+    std::string code = "local p = {name = \"a\"}\nlocal n = p.name";
+    REQUIRE(generate_lua(code) == "local p = {name = \"a\"}\nlocal n = p.name");
+}
+
 TEST_CASE("Codegen function declaration") {
     std::string code = R"(
 function add(a, b)
@@ -108,6 +135,24 @@ end)";
     REQUIRE(generate_lua(code) == expected);
 }
 
+TEST_CASE("Codegen elseif statement") {
+    std::string code = "local x = 1\n"
+                       "if x == 1 then\n"
+                       "    f(1)\n"
+                       "elseif x == 2 then\n"
+                       "    f(2)\n"
+                       "else\n"
+                       "    f(3)\n"
+                       "end";
+    Parser parser{Lexer{code}};
+    auto prog = parser.parse();
+    TypeChecker typechecker;
+    typechecker.typeCheck(prog);
+    LuaCodegen codegen;
+    REQUIRE(codegen.generate(prog) == code);
+    REQUIRE(codegen.getSourceMap().encode() == "1:1,2:2,3:3,4:4,5:5,7:7");
+}
+
 TEST_CASE("Codegen boolean literals") {
     std::string code = "local t = true";
     REQUIRE(generate_lua(code) == "local t = true");
@@ -169,3 +214,136 @@ TEST_CASE("Codegen table string indexing") {
     std::string expected = "local val = tbl[\"key\"]";
     REQUIRE(generate_lua(code) == expected);
 }
+
+TEST_CASE("Codegen streams into a sink") {
+    std::string code;
+    for (int i = 0; i < 5000; ++i) {
+        code += std::format("local v{} = f({}, {{{}, \"s\"}})\n", i, i, i);
+    }
+    Parser parser{Lexer{code}};
+    auto prog = parser.parse();
+    LuaCodegen codegen;
+
+    std::ostringstream stream;
+    {
+        OstreamSink sink(stream);
+        codegen.generate(prog, sink);
+    }
+    REQUIRE(stream.str() == codegen.generate(prog));
+    REQUIRE(stream.str().starts_with("local v0 = f(0, {0, \"s\"})\nlocal v1 = f(1, {1, \"s\"})"));
+}
+
+TEST_CASE("Codegen maps generated lines back to the source") {
+    std::string code = R"(local a = 1
+
+function f(x)
+    local y = x
+    return y
+end
+f(a))";
+    Parser parser{Lexer{code}};
+    auto prog = parser.parse();
+    TypeChecker typechecker;
+    typechecker.typeCheck(prog);
+    LuaCodegen codegen;
+    REQUIRE(codegen.generate(prog) ==
+            "local a = 1\nfunction f(x)\n    local y = x\n    return y\nend\nf(a)");
+    // `end` belongs to the return before it
+    REQUIRE(codegen.getSourceMap().encode() == "1:1,2:3,3:4,4:5,6:7");
+}
+
+TEST_CASE("Codegen handles operator and elseif chains of any length") {
+    // Long enough to overflow the stack if a pass recursed for each link
+    constexpr int LENGTH = 10000;
+    std::string concat = "local s = a";
+    std::string negations = "local b = x";
+    std::string arms = "local x = 1\nif x == 0 then\n    f(0)\n";
+    for (int i = 1; i < LENGTH; ++i) {
+        concat += " .. a";
+        negations.insert(10, "not ");
+        arms += "elseif x == " + std::to_string(i) + " then\n    f(" + std::to_string(i) + ")\n";
+    }
+    arms += "end";
+    REQUIRE(generate_lua(concat) == concat);
+    REQUIRE(generate_lua(negations) == negations);
+    REQUIRE(generate_lua(arms) == arms);
+}
+
+static std::string generate_checked(const std::string& code) {
+    Parser parser{Lexer{code}};
+    auto prog = parser.parse();
+    TypeChecker typechecker;
+    typechecker.typeCheck(prog);
+    LuaCodegen codegen(true);
+    return codegen.generate(prog);
+}
+
+static const std::string GUARD_FUNCTION = "local function __guard(value, expected)\n"
+                                          "    if type(value) ~= expected then\n"
+                                          "        error(expected .. \" expected, got \" .. "
+                                          "type(value), 2)\n"
+                                          "    end\n"
+                                          "    return value\n"
+                                          "end\n";
+
+TEST_CASE("Checked codegen guards untyped operands Lua would accept with the wrong type") {
+    // Indexing a table, a global and an untyped parameter
+    REQUIRE(generate_checked("local t = {a = 1}\nlocal n = t[\"a\"] + 1") ==
+            GUARD_FUNCTION + "local t = {a = 1}\nlocal n = __guard(t[\"a\"], \"number\") + 1");
+    REQUIRE(generate_checked("local x = -cfg.scale") ==
+            GUARD_FUNCTION + "local x = -__guard(__guard(cfg, \"table\").scale, \"number\")");
+    REQUIRE(generate_checked("local function f(v)\n    return #v\nend") ==
+            GUARD_FUNCTION + "local function f(v)\n    return #__guard(v, \"table\")\nend");
+    REQUIRE(generate_checked("local a = {1, 2}\nlocal e = a[k]") ==
+            GUARD_FUNCTION + "local a = {1, 2}\nlocal e = a[__guard(k, \"number\")]");
+}
+
+TEST_CASE("Checked codegen elides guards the types make redundant") {
+    // Typed operands, and operations Lua checks itself
+    std::string code = "local t = {a = 1}\n"
+                       "local n = t.a * 2\n"
+                       "local s = name .. n\n"
+                       "local b = limit < n\n"
+                       "print(s, b)";
+    REQUIRE(generate_checked(code) == code);
+    // Typed parameters of local functions are only called with checked arguments
+    std::string local = "local function f(x: number) -> number\n"
+                        "    return x + 1\n"
+                        "end\n"
+                        "local y = f(2)";
+    REQUIRE(generate_checked(local) == "local function f(x)\n"
+                                       "    return x + 1\n"
+                                       "end\n"
+                                       "local y = f(2)");
+}
+
+TEST_CASE("Checked codegen checks the parameters of functions untyped code can call") {
+    std::string code = "function f(x: number, n: integer)\n"
+                       "    return x\n"
+                       "end\n"
+                       "local function g(s: string)\n"
+                       "    return s\n"
+                       "end\n"
+                       "register(g)";
+    Parser parser{Lexer{code}};
+    auto prog = parser.parse();
+    TypeChecker typechecker;
+    typechecker.typeCheck(prog);
+    LuaCodegen codegen(true);
+    REQUIRE(codegen.generate(prog) ==
+            "function f(x, n)\n"
+            "    if type(x) ~= \"number\" then error(\"bad argument #1 to 'f' (number expected, "
+            "got \" .. type(x) .. \")\", 2) end\n"
+            "    if math.type(n) ~= \"integer\" then error(\"bad argument #2 to 'f' (integer "
+            "expected, got \" .. type(n) .. \")\", 2) end\n"
+            "    return x\n"
+            "end\n"
+            "local function g(s)\n"
+            "    if type(s) ~= \"string\" then error(\"bad argument #1 to 'g' (string expected, "
+            "got \" .. type(s) .. \")\", 2) end\n"
+            "    return s\n"
+            "end\n"
+            "register(g)");
+    // The checks belong to the line of their function, runs of one source line are one entry
+    REQUIRE(codegen.getSourceMap().encode() == "1:1,4:2,6:4,8:5,10:7");
+}
@@ -0,0 +1,107 @@
+#include "../src/module_resolver.h"
+#include "../src/lexer.h"
+#include "../src/parser.h"
+#include "../src/typechecker.h"
+#include "./utils.h"
+#include <catch2/catch_test_macros.hpp>
+
+static Program parse(const std::string& code) {
+    Parser parser{Lexer{code}};
+    return parser.parse();
+}
+
+static void typeCheck(const std::string& code, ModuleResolver& modules) {
+    auto program = parse(code);
+    TypeChecker typechecker(&modules);
+    typechecker.typeCheck(program);
+}
+
+TEST_CASE("Modules are found along the search path") {
+    TempDir dir("modules_locate");
+    dir.write("first/util.tlua", "");
+    dir.write("second/util.tlua", "");
+    dir.write("second/net/http.tlua", "");
+    ModuleResolver modules({dir.path / "first", dir.path / "second"});
+
+    REQUIRE(modules.locate("util") == dir.path / "first" / "util.tlua");
+    REQUIRE(modules.locate("net.http") == dir.path / "second" / "net" / "http.tlua");
+    REQUIRE_FALSE(modules.locate("socket").has_value());
+    REQUIRE(modules.summary("socket") == nullptr);
+}
+
+TEST_CASE("Module summaries hold the signatures of the global functions") {
+    TempDir dir("modules_summary");
+    dir.write("geometry.tlua", "function area(w: number, h: number) -> number\n"
+                               "    local s: string = 1\n"
+                               "    if w > 0 then return w * h end\n"
+                               "end\n"
+                               "local function helper() return 1 end\n"
+                               "if debug then\n"
+                               "    function trace(x) end\n"
+                               "end\n"
+                               "function name() -> string return \"geometry\" end");
+    ModuleResolver modules({dir.path});
+
+    // Bodies aren't checked for the summary, the error in `area` doesn't matter
+    const auto* summary = modules.summary("geometry");
+    REQUIRE(summary != nullptr);
+    REQUIRE(summary->path == dir.path / "geometry.tlua");
+    REQUIRE(summary->toString() == "area: (number, number) -> number, name: () -> string");
+
+    // Loaded once: later changes to the file aren't seen
+    dir.write("geometry.tlua", "function area() end");
+    REQUIRE(modules.summary("geometry") == summary);
+}
+
+TEST_CASE("Invalidated module summaries are read again") {
+    TempDir dir("modules_invalidate");
+    dir.write("util.tlua", "function f(x: number) -> number\n    return x\nend");
+    ModuleResolver modules({dir.path});
+    REQUIRE(modules.loaded("util") == nullptr);
+    REQUIRE(modules.summary("util")->toString() == "f: (number) -> number");
+    REQUIRE(modules.loaded("util") != nullptr);
+
+    dir.write("util.tlua", "function f(x: string) -> string\n    return x\nend");
+    REQUIRE(modules.summary("util")->toString() == "f: (number) -> number");
+    modules.invalidate("util");
+    REQUIRE(modules.loaded("util") == nullptr);
+    REQUIRE(modules.summary("util")->toString() == "f: (string) -> string");
+}
+
+TEST_CASE("Module declarations that don't parse are errors") {
+    TempDir dir("modules_invalid");
+    dir.write("broken.tlua", "function f(x: number -> number end");
+    ModuleResolver modules({dir.path});
+    REQUIRE_THROWS_AS(modules.summary("broken"), ParseError);
+    REQUIRE_THROWS_AS(typeCheck(R"(require("broken"))", modules), TypeCheckError);
+}
+
+TEST_CASE("Required modules are found at the top level and by scanning tokens") {
+    auto program = parse(R"(
+        require("a")
+        local b = require("b.c")
+        require("a")
+        function f() require("nested") end
+    )");
+    REQUIRE(requiredModules(program) == std::vector<std::string>{"a", "b.c"});
+    REQUIRE(scanRequires(R"(require("a") local b = require("b.c")
+                            function f() require("nested") end)") ==
+            std::vector<std::string>{"a", "b.c", "nested"});
+}
+
+TEST_CASE("The type checker knows the functions of required modules") {
+    TempDir dir("modules_typecheck");
+    dir.write("geometry.tlua", "function area(w: number, h: number) -> number\n"
+                               "    return w * h\n"
+                               "end");
+    ModuleResolver modules({dir.path});
+
+    REQUIRE_NOTHROW(typeCheck(R"(require("geometry") local a: number = area(2, 3))", modules));
+    REQUIRE_THROWS_AS(typeCheck(R"(require("geometry") local a = area("2", 3))", modules),
+                      TypeCheckError);
+    REQUIRE_THROWS_AS(typeCheck(R"(require("geometry") local s: string = area(2, 3))", modules),
+                      TypeCheckError);
+    // Without the require, the function is an unknown global
+    REQUIRE_NOTHROW(typeCheck(R"(local a = area("2", 3))", modules));
+    REQUIRE_NOTHROW(typeCheck(R"(require("socket") local a = connect("2", 3))", modules));
+}
@@ -0,0 +1,193 @@
+#include "../src/lexer.h"
+#include "../src/lua_codegen.h"
+#include "../src/optimizer.h"
+#include "../src/parser.h"
+#include "../src/typechecker.h"
+#include "./utils.h"
+#include <catch2/catch_test_macros.hpp>
+
+static std::string optimize_lua(const std::string& code) {
+    Parser parser{Lexer{code}};
+    auto prog = parser.parse();
+    TypeChecker typechecker;
+    typechecker.typeCheck(prog);
+    Optimizer optimizer;
+    optimizer.optimize(prog);
+    LuaCodegen codegen;
+    return codegen.generate(prog);
+}
+
+TEST_CASE("Optimizer folds number arithmetic") {
+    REQUIRE(optimize_lua("local x = 1 + 2 * 3") == "local x = 7");
+    REQUIRE(optimize_lua("local x = -(4 - 6)") == "local x = 2");
+    REQUIRE(optimize_lua("local x = 7 / 2") == "local x = 3.5");
+    REQUIRE(optimize_lua("local x = 1 / 4 * 2 + 1") == "local x = 1.5");
+    REQUIRE(optimize_lua("local x = a + 2 * 3") == "local x = a + 6");
+}
+
+TEST_CASE("Optimizer keeps the Lua number subtype of folded values") {
+    // `/` always gives a float
+    REQUIRE(optimize_lua("local x = 4 / 2") == "local x = 2.0");
+    REQUIRE(optimize_lua("local x = 7 / 2 + 7 / 2") == "local x = 7.0");
+    REQUIRE(optimize_lua("local x = 1.5 + 1") == "local x = 2.5");
+    REQUIRE(optimize_lua("local x = 1 / 0") == "local x = 1 / 0");
+    // Integers are 64 bits and wrap around
+    REQUIRE(optimize_lua("local x = 2000000000 + 2000000000") == "local x = 4000000000");
+    REQUIRE(optimize_lua("local x = 9223372036854775807 + 1") ==
+            "local x = (-9223372036854775807 - 1)");
+}
+
+TEST_CASE("Optimizer folds floor division") {
+    REQUIRE(optimize_lua("local x = 7 // 2") == "local x = 3");
+    REQUIRE(optimize_lua("local x = -7 // 2") == "local x = -4");
+    REQUIRE(optimize_lua("local x = 7 // 2.0") == "local x = 3.0");
+    // Integer division by zero is an error at run time
+    REQUIRE(optimize_lua("local x = 7 // 0") == "local x = 7 // 0");
+}
+
+TEST_CASE("Optimizer compares integers and floats by value") {
+    REQUIRE(optimize_lua("local x = 1 == 1.0") == "local x = true");
+    REQUIRE(optimize_lua("local x = 2 < 2.5") == "local x = true");
+    // 2^53 + 1 has no exact double
+    REQUIRE(optimize_lua("local x = 9007199254740993 == 9007199254740992.0") ==
+            "local x = 9007199254740993 == 9007199254740992.0");
+}
+
+TEST_CASE("Optimizer moves field assignments into the table constructor") {
+    std::string code = R"(
+local t = {x = 0, y = 0}
+t.y = 2
+t.x = 1
+t.y = 3
+local u = t.x)";
+    REQUIRE(optimize_lua(code) == "local t = {x = 1, y = 3}\nlocal u = t.x");
+
+    std::string array = R"(
+local a = {1}
+a[2] = x
+a[3] = 3
+a[5] = 5)";
+    REQUIRE(optimize_lua(array) == "local a = {1, x, 3}\na[5] = 5");
+}
+
+TEST_CASE("Optimizer keeps table assignments that read the table or call") {
+    std::string code = R"(
+local t = {x = 0, y = 0, z = 0}
+t.x = 1
+t.y = t.x
+t.z = 2)";
+    REQUIRE(optimize_lua(code) == "local t = {x = 1, y = 0, z = 0}\nt.y = t.x\nt.z = 2");
+
+    std::string calls = R"(
+local t = {x = f(), y = 0}
+t.y = g()
+t.x = 1)";
+    REQUIRE(optimize_lua(calls) == "local t = {x = f(), y = 0}\nt.y = g()\nt.x = 1");
+}
+
+TEST_CASE("Optimizer folds string concatenation") {
+    REQUIRE(optimize_lua(R"(local s = "a" .. "b" .. "c")") == R"(local s = "abc")");
+    REQUIRE(optimize_lua(R"(local s = "n" .. 1 + 2)") == R"(local s = "n3")");
+    REQUIRE(optimize_lua(R"(local s = "x" .. 1 / 4)") == R"(local s = "x" .. 0.25)");
+}
+
+TEST_CASE("Optimizer folds comparisons and logical operators") {
+    REQUIRE(optimize_lua("local b = 1 < 2") == "local b = true");
+    REQUIRE(optimize_lua("local b = 3 >= 4") == "local b = false");
+    REQUIRE(optimize_lua(R"(local b = "a" == "a")") == "local b = true");
+    REQUIRE(optimize_lua(R"(local b = 1 == "1")") == "local b = false");
+    REQUIRE(optimize_lua("local b = nil ~= false") == "local b = true");
+    REQUIRE(optimize_lua("local b = not true") == "local b = false");
+    REQUIRE(optimize_lua("local b = not nil") == "local b = true");
+    REQUIRE(optimize_lua("local b = true and 1") == "local b = 1");
+    REQUIRE(optimize_lua("local b = nil and f()") == "local b = nil");
+    REQUIRE(optimize_lua("local b = false or g()") == "local b = g()");
+    REQUIRE(optimize_lua("local b = 0 or g()") == "local b = 0");
+    REQUIRE(optimize_lua("local b = x and true") == "local b = x and true");
+}
+
+TEST_CASE("Optimizer removes branches with constant conditions") {
+    std::string code = R"(
+if 1 > 2 then
+    f(1)
+elseif true then
+    f(2)
+else
+    f(3)
+end
+if false then
+    f(4)
+end
+if x then
+    f(5)
+elseif nil then
+    f(6)
+end)";
+    std::string expected = "f(2)\n"
+                           "if x then\n"
+                           "    f(5)\n"
+                           "end";
+    REQUIRE(optimize_lua(code) == expected);
+}
+
+TEST_CASE("Optimizer removes constant arms from the middle of an elseif chain") {
+    std::string code = R"(
+if x then
+    f(1)
+elseif false then
+    f(2)
+elseif y then
+    f(3)
+elseif 1 then
+    f(4)
+elseif z then
+    f(5)
+end)";
+    std::string expected = "if x then\n"
+                           "    f(1)\n"
+                           "elseif y then\n"
+                           "    f(3)\n"
+                           "else\n"
+                           "    f(4)\n"
+                           "end";
+    REQUIRE(optimize_lua(code) == expected);
+}
+
+TEST_CASE("Optimizer folds long operator chains") {
+    std::string code = "local n = 1";
+    for (int i = 1; i < 10000; ++i) {
+        code += " + 1";
+    }
+    REQUIRE(optimize_lua(code) == "local n = 10000");
+}
+
+TEST_CASE("Optimizer keeps the scope of a constant branch declaring locals") {
+    std::string code = R"(
+local a = 1
+if true then
+    local a = 2
+    f(a)
+end
+f(a))";
+    std::string expected = "local a = 1\n"
+                           "if true then\n"
+                           "    local a = 2\n"
+                           "    f(a)\n"
+                           "end\n"
+                           "f(a)";
+    REQUIRE(optimize_lua(code) == expected);
+}
+
+TEST_CASE("Optimizer drops statements after a spliced return") {
+    std::string code = R"(
+function f(x)
+    if 2 > 1 then
+        return x + 1 * 2
+    end
+    return 0
+end)";
+    std::string expected = "function f(x)\n"
+                           "    return x + 2\n"
+                           "end";
+    REQUIRE(optimize_lua(code) == expected);
+}
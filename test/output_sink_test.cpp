@@ -0,0 +1,76 @@
+#include "../src/output_sink.h"
+#include "./utils.h"
+#include <catch2/catch_test_macros.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+/// Records the size of every block handed to the destination.
+class RecordingSink : public OutputSink {
+  public:
+    ~RecordingSink() override { flush(); }
+
+    std::string content;
+    std::vector<size_t> blocks;
+
+  protected:
+    void flushBuffer(std::string_view data) override {
+        content += data;
+        blocks.push_back(data.size());
+    }
+};
+} // namespace
+
+TEST_CASE("OutputSink: collects pieces into a string") {
+    StringSink sink;
+    sink.write("local ");
+    sink.write('x');
+    sink.format(" = {} + {}", 1, 2.5);
+    sink.write('\n');
+    sink.fill(' ', 4);
+    sink.write("end");
+    REQUIRE(sink.str() == "local x = 1 + 2.5\n    end");
+}
+
+TEST_CASE("OutputSink: flushes in large blocks") {
+    RecordingSink sink;
+    std::string expected;
+    for (int i = 0; i < 100000; ++i) {
+        sink.write("abc, ");
+        expected += "abc, ";
+    }
+    std::string large(3 * OutputSink::BUFFER_SIZE, 'x');
+    sink.write(large);
+    expected += large;
+    sink.flush();
+
+    REQUIRE(sink.content == expected);
+    REQUIRE(std::ranges::all_of(sink.blocks, [](auto&& size) { return size > 0; }));
+    // Small pieces are never passed on one by one
+    REQUIRE(sink.blocks.size() < 2 * expected.size() / OutputSink::BUFFER_SIZE + 2);
+}
+
+TEST_CASE("OutputSink: writes to a file descriptor") {
+    TempDir dir("fd_sink");
+    auto path = dir.path / "out.lua";
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    REQUIRE(fd >= 0);
+    {
+        FdSink sink(fd);
+        sink.write("return ");
+        sink.format("{}", 42);
+    } // flushed by the destructor
+    ::close(fd);
+    REQUIRE(readFile(path) == "return 42");
+}
+
+TEST_CASE("OutputSink: writes to an ostream") {
+    std::ostringstream stream;
+    {
+        OstreamSink sink(stream);
+        sink.write("a");
+        sink.write(std::string(OutputSink::BUFFER_SIZE + 1, 'b'));
+    }
+    REQUIRE(stream.str() == "a" + std::string(OutputSink::BUFFER_SIZE + 1, 'b'));
+}
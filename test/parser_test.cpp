@@ -4,8 +4,7 @@
 #include <catch2/catch_test_macros.hpp>
 
 const Program parse(const std::string& source) {
-    auto tokens = Lexer::tokenize(source);
-    Parser parser(tokens);
+    Parser parser{Lexer{source}};
     return parser.parse();
 }
 
@@ -60,12 +59,57 @@ TEST_CASE("parse if-elseif-else statements") {
     REQUIRE(normalize(prog.statements.at(0)->toSExpr()) == normalize(expected));
 }
 
+TEST_CASE("parse elseif chains into the arms of one if statement") {
+    std::string code = "if x == 0 then return 0\n";
+    for (int i = 1; i < 10000; ++i) {
+        code += "elseif x == " + std::to_string(i) + " then return " + std::to_string(i) + "\n";
+    }
+    code += "else return -1 end";
+    auto prog = parse(code);
+    auto* ifStmt = dynamic_cast<IfStmt*>(prog.statements.at(0));
+    REQUIRE(ifStmt->arms.size() == 10000);
+    REQUIRE(ifStmt->arms.back().condition->toSExpr() == "(Equal (var x) (number 9999))");
+    REQUIRE(ifStmt->else_branch != nullptr);
+}
+
 TEST_CASE("throw error on invalid syntax") {
     REQUIRE_THROWS_AS(parse("local = 10\n"), ParseError);
     REQUIRE_THROWS_AS(parse("function add(a b) return a end\n"), ParseError);
     REQUIRE_THROWS_AS(parse("if x then return 1\n"), ParseError);
 }
 
+static std::vector<std::string> parseErrors(const std::string& source) {
+    try {
+        parse(source);
+    } catch (const ParseError& e) {
+        return e.getDiagnostics();
+    }
+    return {};
+}
+
+TEST_CASE("report every syntax error of a file") {
+    auto errors = parseErrors(R"(local = 10
+function f()
+    local x = 1 +
+end
+local y = )
+local ok = 2
+)");
+    REQUIRE(errors.size() == 3);
+    REQUIRE(errors[0] == "Expected variable name, but found '=' (Assign) at line 1, column 7");
+    REQUIRE(errors[1].starts_with("Expected atomic expression, but found 'End'"));
+    REQUIRE(errors[2].starts_with("Expected atomic expression, but found 'RParen'"));
+
+    // A token that can't start a statement is skipped
+    REQUIRE(parseErrors("end\nlocal a = 1\nelse\n").size() == 2);
+}
+
+TEST_CASE("report an unterminated block once") {
+    auto errors = parseErrors("function f()\n    if x then\n        local a = 1\n");
+    REQUIRE(errors.size() == 1);
+    REQUIRE(errors[0].starts_with("Expected 'end', but found"));
+}
+
 TEST_CASE("parse return statements with multiple values") {
     REQUIRE_NOTHROW(parse("function foo()\n"
                           "  return 1, 2, 3\n"
@@ -79,6 +123,18 @@ TEST_CASE("binary expressions parsing") {
     REQUIRE_NOTHROW(parse("local result = a == b"));
 }
 
+TEST_CASE("binary operators follow Lua precedence") {
+    auto program = parse("local a = x or y and z\n"
+                         "local b = s .. t .. u\n"
+                         "local c = s .. 1 + 2 == v\n");
+    REQUIRE(program.statements[0]->toSExpr() ==
+            "(var-decl a (Or (var x) (And (var y) (var z))))");
+    REQUIRE(program.statements[1]->toSExpr() ==
+            "(var-decl b (Concat (var s) (Concat (var t) (var u))))");
+    REQUIRE(program.statements[2]->toSExpr() ==
+            "(var-decl c (Equal (Concat (var s) (Plus (number 1) (number 2))) (var v)))");
+}
+
 TEST_CASE("unary expressions parsing") {
     REQUIRE_NOTHROW(parse("local result = -x"));
     REQUIRE_NOTHROW(parse("local result = not flag"));
@@ -107,6 +163,14 @@ TEST_CASE("parse member access expressions") {
     REQUIRE_NOTHROW(parse("local value = foo().bar + 1"));
 }
 
+TEST_CASE("parse calls of member access expressions") {
+    auto prog = parse("local value = obj.nested.method(1)");
+    auto expected = R"(
+(var-decl value (call (MemberAccess (MemberAccess (var obj) (var nested)) (var method)) (number 1)))
+)";
+    REQUIRE(normalize(prog.statements.at(0)->toSExpr()) == normalize(expected));
+}
+
 TEST_CASE("parse bracket indexing") {
     REQUIRE_NOTHROW(parse("local value = arr[1]"));
     REQUIRE_NOTHROW(parse("local value = arr[i]"));
@@ -188,12 +252,12 @@ TEST_CASE("parse type annotations - variables") {
     REQUIRE(normalize(progSExpr) == normalize(expected));
 
     // Also verify the type annotations structure
-    auto* xDecl = dynamic_cast<VarDecl*>(prog.statements[0].get());
+    auto* xDecl = dynamic_cast<VarDecl*>(prog.statements[0]);
     REQUIRE(xDecl != nullptr);
     REQUIRE(xDecl->typeAnnotation.has_value());
     REQUIRE(xDecl->typeAnnotation->toString() == "number");
 
-    auto* sDecl = dynamic_cast<VarDecl*>(prog.statements[1].get());
+    auto* sDecl = dynamic_cast<VarDecl*>(prog.statements[1]);
     REQUIRE(sDecl != nullptr);
     REQUIRE(sDecl->typeAnnotation.has_value());
     REQUIRE(sDecl->typeAnnotation->toString() == "string");
@@ -212,7 +276,7 @@ TEST_CASE("parse type annotations - function with parameters and return type") {
     REQUIRE(normalize(prog.statements.at(0)->toSExpr()) == normalize(expected));
 
     // Also verify the type annotations are parsed
-    auto* funDecl = dynamic_cast<FunDecl*>(prog.statements[0].get());
+    auto* funDecl = dynamic_cast<FunDecl*>(prog.statements[0]);
     REQUIRE(funDecl != nullptr);
     REQUIRE(funDecl->params.size() == 2);
     REQUIRE(funDecl->params[0].typeAnnotation.has_value());
@@ -222,3 +286,112 @@ TEST_CASE("parse type annotations - function with parameters and return type") {
     REQUIRE(funDecl->returnTypeAnnotation.has_value());
     REQUIRE(funDecl->returnTypeAnnotation->toString() == "number");
 }
+
+TEST_CASE("parse program much longer than the token window") {
+    std::string source;
+    for (int i = 0; i < 1000; ++i) {
+        source += std::format("local x{} = f(a, b + {}, {{1, 2}})\n", i, i);
+    }
+    auto prog = parse(source);
+    REQUIRE(prog.statements.size() == 1000);
+    REQUIRE(normalize(prog.statements.back()->toSExpr()) ==
+            "(var-decl x999 (call (var f) (var a) (Plus (var b) (number 999)) (table (array "
+            "(number 1) (number 2) ) (map ))))");
+}
+
+TEST_CASE("parse table with repeated keys keeps last value") {
+    auto prog = parse("local t = {b = 1, a = 2, b = 3}\n");
+    REQUIRE(normalize(prog.statements.at(0)->toSExpr()) ==
+            "(var-decl t (table (array ) (map (a (number 2)) (b (number 3)) )))");
+}
+
+TEST_CASE("AST nodes are owned by the program arena") {
+    std::string source = "local x = 1 + 2";
+    Parser parser{Lexer{source}};
+    auto prog = parser.parse();
+    // var-decl, binop and two numbers
+    REQUIRE(prog.arena.size() == 4);
+
+    // The arena moves with the program, the node pointers stay valid
+    Program moved = std::move(prog);
+    REQUIRE(normalize(moved.statements.at(0)->toSExpr()) ==
+            "(var-decl x (Plus (number 1) (number 2)))");
+}
+
+TEST_CASE("arena allocates nodes larger than a chunk") {
+    AstArena arena;
+    struct Large {
+        std::array<std::byte, 100 * 1024> payload;
+    };
+    auto* small = arena.make<NumberExpr>(1);
+    auto* large = arena.make<Large>();
+    auto* after = arena.make<NumberExpr>(2);
+    REQUIRE(small->val == 1);
+    REQUIRE(after->val == 2);
+    REQUIRE(reinterpret_cast<std::uintptr_t>(large) % alignof(Large) == 0);
+    REQUIRE(arena.size() == 3);
+}
+
+TEST_CASE("AST nodes know where they start") {
+    auto program = parse("local a = 1\nif a then\n    f(a,\n      b + c)\nend\n");
+    REQUIRE(program.statements.at(0)->loc.line == 1);
+    auto* ifStmt = dynamic_cast<IfStmt*>(program.statements.at(1));
+    REQUIRE(ifStmt->loc.line == 2);
+    REQUIRE(ifStmt->arms.at(0).condition->loc.line == 2);
+    REQUIRE(ifStmt->arms.at(0).condition->loc.column == 4);
+
+    auto* call = dynamic_cast<FunCallStmt*>(
+        dynamic_cast<BlockStmt*>(ifStmt->arms.at(0).body)->statements.at(0));
+    REQUIRE(call->loc.line == 3);
+    REQUIRE(call->loc.column == 5);
+    REQUIRE(call->call->args.at(1)->loc.line == 4);
+    REQUIRE(call->call->args.at(1)->loc.column == 7);
+}
+
+TEST_CASE("parse only the declarations of a module") {
+    Parser parser{Lexer{"local x = 1\n"
+                        "function f(a: number, b) -> string\n"
+                        "    if a then return \"a\" end\n"
+                        "    this is never parsed\n"
+                        "end\n"
+                        "local function g() return 1 end\n"
+                        "if x then function h() end end\n"
+                        "function k() end"}};
+    auto program = parser.parseDeclarations();
+    REQUIRE(program.statements.size() == 2);
+    REQUIRE(program.statements[0]->toSExpr() == "(fun global f -> string (a:number b) (block))");
+    REQUIRE(program.statements[0]->loc.line == 2);
+    REQUIRE(program.statements[1]->toSExpr() == "(fun global k () (block))");
+
+    Parser unterminated{Lexer{"function f() if x then end"}};
+    REQUIRE_THROWS_AS(unterminated.parseDeclarations(), ParseError);
+}
+
+TEST_CASE("nodes are cast and dispatched on their kind") {
+    auto program = parse("local function f(a: number) return a + 1 end\n"
+                         "f(2)");
+    auto* fun = nodeCast<FunDecl>(program.statements[0]);
+    REQUIRE(fun);
+    REQUIRE(nodeCast<Decl>(program.statements[0]) == fun);
+    REQUIRE_FALSE(nodeCast<VarDecl>(program.statements[0]));
+    REQUIRE_FALSE(nodeCast<Decl>(program.statements[1]));
+    REQUIRE_FALSE(nodeCast<BlockStmt>(static_cast<Stmt*>(nullptr)));
+
+    const Stmt* call = program.statements[1];
+    const FunCallStmt* constCall = nodeCast<FunCallStmt>(call);
+    REQUIRE(constCall);
+
+    auto kindName = [](auto& node) -> std::string_view {
+        using Node = std::remove_cvref_t<decltype(node)>;
+        if constexpr (std::is_same_v<Node, FunDecl>) {
+            return "fun";
+        } else if constexpr (std::is_same_v<Node, FunCallStmt>) {
+            return "call";
+        } else {
+            return "other";
+        }
+    };
+    REQUIRE(dispatch(*program.statements[0], kindName) == "fun");
+    REQUIRE(dispatch(*program.statements[1], kindName) == "call");
+    REQUIRE(dispatch(*constCall->call->args[0], kindName) == "other");
+}
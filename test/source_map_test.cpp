@@ -0,0 +1,37 @@
+#include "../src/source_map.h"
+#include <catch2/catch_test_macros.hpp>
+#include <stdexcept>
+
+TEST_CASE("SourceMap: generated lines map to the source line of their run") {
+    SourceMap map;
+    map.add(1, 1);
+    map.add(2, 3);
+    map.add(2, 4); // the first statement of a line wins
+    map.add(3, 3); // same source line, nothing new
+    map.add(5, 7);
+
+    REQUIRE(map.encode() == "1:1,2:3,5:7");
+    REQUIRE(map.sourceLine(0) == 0);
+    REQUIRE(map.sourceLine(1) == 1);
+    REQUIRE(map.sourceLine(4) == 3);
+    REQUIRE(map.sourceLine(5) == 7);
+    REQUIRE(map.sourceLine(100) == 7);
+}
+
+TEST_CASE("SourceMap: decodes its encoding and the trailing comment of generated Lua") {
+    auto map = SourceMap::decode("1:2,4:10");
+    REQUIRE(map.encode() == "1:2,4:10");
+    REQUIRE(SourceMap::decode("").empty());
+
+    auto fromLua = SourceMap::fromLua("local a = 1\nlocal b = 2\n--# tlua-lines 1:2,4:10\n");
+    REQUIRE(fromLua == map);
+    REQUIRE_FALSE(SourceMap::fromLua("local a = 1").has_value());
+    REQUIRE_FALSE(SourceMap::fromLua("").has_value());
+}
+
+TEST_CASE("SourceMap: rejects malformed maps") {
+    REQUIRE_THROWS_AS(SourceMap::decode("1"), std::runtime_error);
+    REQUIRE_THROWS_AS(SourceMap::decode("1:"), std::runtime_error);
+    REQUIRE_THROWS_AS(SourceMap::decode("1:2;3:4"), std::runtime_error);
+    REQUIRE_THROWS_AS(SourceMap::decode("3:1,2:2"), std::runtime_error);
+}
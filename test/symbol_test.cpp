@@ -0,0 +1,43 @@
+#include "../src/lexer.h"
+#include "../src/symbol.h"
+#include <catch2/catch_test_macros.hpp>
+
+TEST_CASE("Symbol: interning the same text gives the same symbol") {
+    auto a = intern("symbol_test_a");
+    auto b = intern(std::string("symbol_test_") + "a");
+    auto c = intern("symbol_test_c");
+
+    REQUIRE(a == b);
+    REQUIRE(a != c);
+    REQUIRE(a.str() == "symbol_test_a");
+    REQUIRE(c.str() == "symbol_test_c");
+}
+
+TEST_CASE("Symbol: default symbol is the empty string") {
+    REQUIRE(Symbol{}.str().empty());
+    REQUIRE(intern("") == Symbol{});
+}
+
+TEST_CASE("Symbol: names stay valid while the table grows") {
+    auto first = intern("symbol_test_first");
+    const std::string& name = first.str();
+    for (int i = 0; i < 10000; ++i) {
+        intern(std::format("symbol_test_{}", i));
+    }
+    REQUIRE(name == "symbol_test_first");
+    REQUIRE(intern("symbol_test_first") == first);
+}
+
+TEST_CASE("Symbol: lexer interns identifiers and string literals") {
+    std::string source = R"(local foo = bar(foo, "foo"))";
+    auto tokens = Lexer::tokenize(source);
+
+    REQUIRE(tokens[0].kind == TokenKind::Local);
+    REQUIRE(tokens[0].symbol == Symbol{});
+    REQUIRE(tokens[1].kind == TokenKind::Identifier);
+    REQUIRE(tokens[1].symbol == intern("foo"));
+    REQUIRE(tokens[3].symbol == intern("bar"));
+    REQUIRE(tokens[5].symbol == tokens[1].symbol);
+    REQUIRE(tokens[7].kind == TokenKind::String);
+    REQUIRE(tokens[7].symbol == intern("foo"));
+}
@@ -0,0 +1,177 @@
+#include "../src/type.h"
+#include <catch2/catch_test_macros.hpp>
+
+TEST_CASE("Types: structurally equal types are the same pointer") {
+    auto& factory = TypeFactory::instance();
+    auto* number = TypeFactory::numberType();
+    auto* string = TypeFactory::stringType();
+
+    REQUIRE(factory.createArrayType(number) == factory.createArrayType(number));
+    REQUIRE(factory.createArrayType(number) != factory.createArrayType(string));
+    REQUIRE(factory.createArrayType(factory.createArrayType(number)) ==
+            factory.createArrayType(factory.createArrayType(number)));
+
+    REQUIRE(factory.createFunctionType({number, string}, number) ==
+            factory.createFunctionType({number, string}, number));
+    REQUIRE(factory.createFunctionType({number, string}, number) !=
+            factory.createFunctionType({string, number}, number));
+
+    auto* point = factory.createTableType({{intern("x"), number}, {intern("y"), number}});
+    REQUIRE(point == factory.createTableType({{intern("y"), number}, {intern("x"), number}}));
+    REQUIRE(point != factory.createTableType({{intern("x"), number}}));
+    REQUIRE(factory.createTableType({}) == factory.createTableType({}));
+
+    REQUIRE(factory.createRecordType(string, number) == factory.createRecordType(string, number));
+}
+
+TEST_CASE("Types: unions are normalized") {
+    auto& factory = TypeFactory::instance();
+    auto* number = TypeFactory::numberType();
+    auto* string = TypeFactory::stringType();
+    auto* boolean = TypeFactory::booleanType();
+
+    auto* numberOrString = factory.createUnionType({number, string});
+    REQUIRE(numberOrString == factory.createUnionType({string, number}));
+    REQUIRE(numberOrString == factory.createUnionType({string, number, string}));
+    REQUIRE(numberOrString->toString() == "number | string");
+
+    // Nested unions are flattened
+    REQUIRE(factory.createUnionType({boolean, numberOrString}) ==
+            factory.createUnionType({number, string, boolean}));
+
+    // Degenerate unions
+    REQUIRE(factory.createUnionType({number, number}) == number);
+    REQUIRE(factory.createUnionType({number, TypeFactory::anyType()}) == TypeFactory::anyType());
+}
+
+TEST_CASE("Types: integer is a subtype of number") {
+    auto& factory = TypeFactory::instance();
+    auto* number = TypeFactory::numberType();
+    auto* integer = TypeFactory::integerType();
+    auto* string = TypeFactory::stringType();
+
+    REQUIRE(isSubtype(integer, number));
+    REQUIRE_FALSE(isSubtype(number, integer));
+    REQUIRE(isSubtype(integer, factory.createUnionType({number, string})));
+    REQUIRE(factory.createUnionType({integer, number}) == number);
+    REQUIRE(factory.createUnionType({integer, string, number}) ==
+            factory.createUnionType({number, string}));
+}
+
+TEST_CASE("Types: unions keep their primitive members as a bitmask") {
+    auto& factory = TypeFactory::instance();
+    auto* number = TypeFactory::numberType();
+    auto* string = TypeFactory::stringType();
+    auto* nil = TypeFactory::nilType();
+    auto* boolean = TypeFactory::booleanType();
+    auto* array = factory.createArrayType(string);
+
+    auto* mixed = static_cast<UnionType*>(factory.createUnionType({array, nil, number}));
+    REQUIRE(mixed->getPrimitives() ==
+            (primitiveBit(TypeKind::Number) | primitiveBit(TypeKind::Nil)));
+    REQUIRE(mixed->getComposites().size() == 1);
+    REQUIRE(mixed->getComposites()[0] == array);
+    REQUIRE(mixed->toString() == "number | nil | string[]");
+
+    auto* primitives = factory.createUnionType({number, string, nil, boolean});
+    REQUIRE(isSubtype(factory.createUnionType({nil, string}), primitives));
+    REQUIRE(isSubtype(TypeFactory::integerType(), primitives));
+    REQUIRE_FALSE(isSubtype(factory.createUnionType({nil, array}), primitives));
+    REQUIRE(isSubtype(factory.createUnionType({nil, array}), mixed));
+    REQUIRE(isSubtype(array, mixed));
+    REQUIRE_FALSE(isSubtype(mixed, primitives));
+    REQUIRE(isSubtype(factory.createUnionType({TypeFactory::unknownType(), nil}), mixed));
+}
+
+TEST_CASE("Types: unifying large heterogeneous lists") {
+    auto& factory = TypeFactory::instance();
+    auto* array = factory.createArrayType(TypeFactory::numberType());
+    std::vector<Type*> elements;
+    for (int i = 0; i < 200000; ++i) {
+        elements.push_back(i % 3 == 0   ? TypeFactory::integerType()
+                           : i % 3 == 1 ? TypeFactory::stringType()
+                                        : array);
+    }
+    auto* expected =
+        factory.createUnionType({array, TypeFactory::stringType(), TypeFactory::integerType()});
+    REQUIRE(unifyTypes(elements) == expected);
+    REQUIRE(unifyTypes(elements)->toString() == "integer | string | number[]");
+}
+
+TEST_CASE("Types: composite types are compared structurally") {
+    auto& factory = TypeFactory::instance();
+    auto* number = TypeFactory::numberType();
+    auto* integer = TypeFactory::integerType();
+    auto* string = TypeFactory::stringType();
+    auto x = intern("x");
+    auto y = intern("y");
+
+    // Tables are mutable, their contents are invariant
+    auto* numberOrString = factory.createUnionType({number, string});
+    REQUIRE_FALSE(
+        isSubtype(factory.createArrayType(number), factory.createArrayType(numberOrString)));
+    REQUIRE_FALSE(isSubtype(factory.createArrayType(integer), factory.createArrayType(number)));
+    REQUIRE_FALSE(isSubtype(factory.createArrayType(number), factory.createArrayType(integer)));
+    REQUIRE(isSubtype(factory.createArrayType(TypeFactory::unknownType()),
+                      factory.createArrayType(number)));
+    REQUIRE(isSubtype(factory.createArrayType(number),
+                      factory.createArrayType(TypeFactory::unknownType())));
+
+    auto* point = factory.createTableType({{x, integer}, {y, integer}});
+    REQUIRE(isSubtype(point, factory.createTableType({{x, integer}})));
+    REQUIRE_FALSE(isSubtype(point, factory.createTableType({{x, number}})));
+    REQUIRE_FALSE(isSubtype(factory.createTableType({{x, integer}}), point));
+    REQUIRE_FALSE(isSubtype(point, factory.createTableType({{x, string}})));
+
+    REQUIRE_FALSE(isSubtype(factory.createRecordType(string, integer),
+                            factory.createRecordType(string, number)));
+
+    // Parameters are contravariant, return types covariant
+    auto* takesNumber = factory.createFunctionType({number}, integer);
+    auto* takesInteger = factory.createFunctionType({integer}, number);
+    REQUIRE(isSubtype(takesNumber, takesInteger));
+    REQUIRE_FALSE(isSubtype(takesInteger, takesNumber));
+    REQUIRE_FALSE(isSubtype(takesNumber, factory.createFunctionType({number, number}, number)));
+    REQUIRE_FALSE(isSubtype(point, factory.createArrayType(number)));
+    REQUIRE_FALSE(isSubtype(point, number));
+}
+
+TEST_CASE("Types: structural comparisons are cached") {
+    auto& factory = TypeFactory::instance();
+    auto* wide = factory.createTableType({{intern("cached_a"), TypeFactory::integerType()},
+                                          {intern("cached_b"), TypeFactory::stringType()}});
+    auto* narrow = factory.createTableType({{intern("cached_a"), TypeFactory::integerType()}});
+
+    auto before = subtypeCacheCounters();
+    REQUIRE(isSubtype(wide, narrow));
+    auto afterFirst = subtypeCacheCounters();
+    REQUIRE(afterFirst.misses == before.misses + 1);
+    REQUIRE(afterFirst.hits == before.hits);
+    for (int i = 0; i < 1000; ++i) {
+        REQUIRE(isSubtype(wide, narrow));
+    }
+    REQUIRE(subtypeCacheCounters().hits == afterFirst.hits + 1000);
+    REQUIRE(subtypeCacheCounters().misses == afterFirst.misses);
+}
+
+TEST_CASE("Types: the error type is accepted everywhere") {
+    auto& factory = TypeFactory::instance();
+    auto* error = TypeFactory::errorType();
+    auto* string = TypeFactory::stringType();
+
+    REQUIRE(error->toString() == "error");
+    REQUIRE(isSubtype(error, string));
+    REQUIRE(isSubtype(string, error));
+    REQUIRE(factory.createUnionType({string, error, TypeFactory::anyType()}) == error);
+}
+
+TEST_CASE("Types: the factory does not grow for repeated types") {
+    auto& factory = TypeFactory::instance();
+    auto* number = TypeFactory::numberType();
+    factory.createArrayType(factory.createUnionType({number, TypeFactory::nilType()}));
+    auto size = factory.size();
+    for (int i = 0; i < 100; ++i) {
+        factory.createArrayType(factory.createUnionType({TypeFactory::nilType(), number}));
+    }
+    REQUIRE(factory.size() == size);
+}
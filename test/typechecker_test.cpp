@@ -6,8 +6,7 @@
 #include <catch2/catch_test_macros.hpp>
 
 static std::string typecheck_and_print(const std::string& code) {
-    auto tokens = Lexer::tokenize(code);
-    Parser parser(tokens);
+    Parser parser{Lexer{code}};
     auto prog = parser.parse();
     TypeChecker typechecker;
     typechecker.typeCheck(prog);
@@ -17,19 +16,39 @@ static std::string typecheck_and_print(const std::string& code) {
 
 TEST_CASE("Arithmetic") {
     std::string code = "local a = 1 + 2";
-    std::string expected = "(var-decl a <number> (+ <number> 1 <number> 2 <number>))\n";
+    std::string expected = "(var-decl a <integer> (+ <integer> 1 <integer> 2 <integer>))\n";
     REQUIRE(typecheck_and_print(code) == expected);
 }
 
+TEST_CASE("Arithmetic keeps integers on the integer subtype") {
+    REQUIRE(typecheck_and_print("local a = 1 * 2 - 3") ==
+            "(var-decl a <integer> (- <integer> (* <integer> 1 <integer> 2 <integer>) 3 "
+            "<integer>))\n");
+    REQUIRE(typecheck_and_print("local a = 7 // 2") ==
+            "(var-decl a <integer> (// <integer> 7 <integer> 2 <integer>))\n");
+    REQUIRE(typecheck_and_print("local a = 4 / 2") ==
+            "(var-decl a <number> (/ <number> 4 <integer> 2 <integer>))\n");
+    REQUIRE(typecheck_and_print("local a = 1 + 1.5") ==
+            "(var-decl a <number> (+ <number> 1 <integer> 1.5 <number>))\n");
+    REQUIRE(typecheck_and_print("local a = {1, 2.5}") ==
+            "(var-decl a <number[]> (table (array 1 <integer> 2.5 <number>) <number[]>))\n");
+}
+
+TEST_CASE("Integers are numbers, but not the other way around") {
+    REQUIRE_NOTHROW(typecheck_and_print("local n: number = 1"));
+    REQUIRE_NOTHROW(typecheck_and_print("local i: integer = 1 + 2"));
+    REQUIRE_THROWS_AS(typecheck_and_print("local i: integer = 1 / 2"), TypeCheckError);
+}
+
 TEST_CASE("ArithmeticWithAny") {
     std::string code = "local a = x + 2";
-    std::string expected = "(var-decl a <number> (+ <number> (var x <any>) 2 <number>))\n";
+    std::string expected = "(var-decl a <number> (+ <number> (var x <any>) 2 <integer>))\n";
     REQUIRE(typecheck_and_print(code) == expected);
 }
 
 TEST_CASE("Comparison") {
     std::string code = "local a = 1 > 2";
-    std::string expected = "(var-decl a <boolean> (> <boolean> 1 <number> 2 <number>))\n";
+    std::string expected = "(var-decl a <boolean> (> <boolean> 1 <integer> 2 <integer>))\n";
     REQUIRE(typecheck_and_print(code) == expected);
 }
 
@@ -46,7 +65,7 @@ TEST_CASE("Logical") {
 
     std::string code2 = "local b = true or 1";
     std::string expected2 =
-        "(var-decl b <boolean | number> (or <boolean | number> true <boolean> 1 <number>))\n";
+        "(var-decl b <integer | boolean> (or <integer | boolean> true <boolean> 1 <integer>))\n";
     REQUIRE(typecheck_and_print(code2) == expected2);
 }
 
@@ -65,7 +84,7 @@ local result = add(2, 3)
 )";
     std::string expected = R"(
 (fun add <(any, any) -> any> (params a b) (block (return (+ <number> (var a <any>) (var b <any>)))))
-(var-decl result <any> (call <any> (var add <(any, any) -> any>) 2 <number> 3 <number>))
+(var-decl result <any> (call <any> (var add <(any, any) -> any>) 2 <integer> 3 <integer>))
 )";
     REQUIRE(normalize(typecheck_and_print(code)) == normalize(expected));
 }
@@ -79,41 +98,41 @@ TEST_CASE("Empty table is empty record") {
 
 TEST_CASE("Homogeneous array literal") {
     std::string code = "local arr = {1, 2, 3}";
-    std::string expected =
-        "(var-decl arr <number[]> (table (array 1 <number> 2 <number> 3 <number>) <number[]>))\n";
+    std::string expected = "(var-decl arr <integer[]> (table (array 1 <integer> 2 <integer> 3 "
+                           "<integer>) <integer[]>))\n";
     REQUIRE(typecheck_and_print(code) == expected);
 }
 
 TEST_CASE("Heterogeneous array literal creates union") {
     std::string code = "local arr = {1, \"hello\", true}";
-    std::string expected = "(var-decl arr <number | string | boolean[]> (table (array 1 <number> "
-                           "'hello' <string> true "
-                           "<boolean>) <number | string | boolean[]>))\n";
+    std::string expected = "(var-decl arr <integer | string | boolean[]> (table (array 1 "
+                           "<integer> 'hello' <string> true "
+                           "<boolean>) <integer | string | boolean[]>))\n";
     REQUIRE(typecheck_and_print(code) == expected);
 }
 
 TEST_CASE("Record table literal") {
     std::string code = "local obj = {x = 1, y = 2}";
     // Note: map keys are sorted alphabetically in std::map
-    std::string expected = "(var-decl obj <{ x: number, y: number }> (table (map (x 1 <number>) (y "
-                           "2 <number>)) <{ x: number, y: number }>))\n";
+    std::string expected = "(var-decl obj <{ x: integer, y: integer }> (table (map (x 1 "
+                           "<integer>) (y 2 <integer>)) <{ x: integer, y: integer }>))\n";
     REQUIRE(typecheck_and_print(code) == expected);
 }
 
 TEST_CASE("Record table with mixed value types") {
     std::string code = "local obj = {name = \"alice\", age = 30}";
     // Note: map keys are sorted alphabetically in std::map
-    std::string expected = "(var-decl obj <{ age: number, name: string }> (table (map (age 30 "
-                           "<number>) (name 'alice' <string>)) "
-                           "<{ age: number, name: string }>))\n";
+    std::string expected = "(var-decl obj <{ age: integer, name: string }> (table (map (age 30 "
+                           "<integer>) (name 'alice' <string>)) "
+                           "<{ age: integer, name: string }>))\n";
     REQUIRE(typecheck_and_print(code) == expected);
 }
 
 TEST_CASE("Nested table literal") {
     std::string code = "local obj = {inner = {1, 2, 3}}";
-    std::string expected = "(var-decl obj <{ inner: number[] }> (table (map (inner (table (array 1 "
-                           "<number> 2 <number> 3 "
-                           "<number>) <number[]>))) <{ inner: number[] }>))\n";
+    std::string expected = "(var-decl obj <{ inner: integer[] }> (table (map (inner (table "
+                           "(array 1 <integer> 2 <integer> 3 <integer>) <integer[]>))) "
+                           "<{ inner: integer[] }>))\n";
     REQUIRE(typecheck_and_print(code) == expected);
 }
 
@@ -125,12 +144,26 @@ TEST_CASE("Mixed table literal is forbidden") {
 TEST_CASE("Member access on record") {
     std::string code = "local obj = {x = 10}\nlocal a = obj.x";
     std::string expected = R"(
-(var-decl obj <{ x: number }> (table (map (x 10 <number>)) <{ x: number }>))
-(var-decl a <number> (MemberAccess <number> (var obj <{ x: number }>) (var x <any>)))
+(var-decl obj <{ x: integer }> (table (map (x 10 <integer>)) <{ x: integer }>))
+(var-decl a <integer> (MemberAccess <integer> (var obj <{ x: integer }>) (var x <any>)))
 )";
     REQUIRE(normalize(typecheck_and_print(code)) == normalize(expected));
 }
 
+TEST_CASE("Assigning a field a table doesn't have throws") {
+    // Wherever the assignment is, the field isn't part of the table's type
+    REQUIRE_THROWS_AS(typecheck_and_print("local t = {}\n"
+                                          "t.x = 1"),
+                      TypeCheckError);
+    REQUIRE_THROWS_AS(typecheck_and_print("local t = {}\n"
+                                          "print(1)\n"
+                                          "t.x = 1"),
+                      TypeCheckError);
+    REQUIRE_THROWS_AS(typecheck_and_print("local u = {}\n"
+                                          "if true then u.y = 2 end"),
+                      TypeCheckError);
+}
+
 TEST_CASE("Member access on unknown field throws") {
     std::string code = R"(
 local obj = {x = 10}
@@ -142,8 +175,8 @@ local a = obj.z
 TEST_CASE("Length operator on array") {
     std::string code = "local arr = {1, 2, 3}\nlocal len = #arr";
     std::string expected = R"(
-(var-decl arr <number[]> (table (array 1 <number> 2 <number> 3 <number>) <number[]>))
-(var-decl len <number> (# <number> (var arr <number[]>)))
+(var-decl arr <integer[]> (table (array 1 <integer> 2 <integer> 3 <integer>) <integer[]>))
+(var-decl len <integer> (# <integer> (var arr <integer[]>)))
 )";
     REQUIRE(normalize(typecheck_and_print(code)) == normalize(expected));
 }
@@ -151,7 +184,7 @@ TEST_CASE("Length operator on array") {
 TEST_CASE("Length operator on nested expression") {
     std::string code = "local len = #{1, 2, 3}";
     std::string expected = R"(
-(var-decl len <number> (# <number> (table (array 1 <number> 2 <number> 3 <number>) <number[]>)))
+(var-decl len <integer> (# <integer> (table (array 1 <integer> 2 <integer> 3 <integer>) <integer[]>)))
 )";
     REQUIRE(normalize(typecheck_and_print(code)) == normalize(expected));
 }
@@ -169,8 +202,8 @@ TEST_CASE("Length operator on record throws") {
 TEST_CASE("Array indexing returns element type") {
     std::string code = "local arr = {1, 2, 3}\nlocal val = arr[1]";
     std::string expected = R"(
-(var-decl arr <number[]> (table (array 1 <number> 2 <number> 3 <number>) <number[]>))
-(var-decl val <number> ([] <number> (var arr <number[]>) 1 <number>))
+(var-decl arr <integer[]> (table (array 1 <integer> 2 <integer> 3 <integer>) <integer[]>))
+(var-decl val <integer> ([] <integer> (var arr <integer[]>) 1 <integer>))
 )";
     REQUIRE(normalize(typecheck_and_print(code)) == normalize(expected));
 }
@@ -178,9 +211,9 @@ TEST_CASE("Array indexing returns element type") {
 TEST_CASE("Array indexing with variable index") {
     std::string code = "local arr = {1, 2, 3}\nlocal i = 1\nlocal val = arr[i]";
     std::string expected = R"(
-(var-decl arr <number[]> (table (array 1 <number> 2 <number> 3 <number>) <number[]>))
-(var-decl i <number> 1 <number>)
-(var-decl val <number> ([] <number> (var arr <number[]>) (var i <number>)))
+(var-decl arr <integer[]> (table (array 1 <integer> 2 <integer> 3 <integer>) <integer[]>))
+(var-decl i <integer> 1 <integer>)
+(var-decl val <integer> ([] <integer> (var arr <integer[]>) (var i <integer>)))
 )";
     REQUIRE(normalize(typecheck_and_print(code)) == normalize(expected));
 }
@@ -188,8 +221,8 @@ TEST_CASE("Array indexing with variable index") {
 TEST_CASE("Nested array indexing") {
     std::string code = "local arr = {{1, 2}}\nlocal val = arr[1][2]";
     std::string expected = R"(
-(var-decl arr <number[][]> (table (array (table (array 1 <number> 2 <number>) <number[]>)) <number[][]>))
-(var-decl val <number> ([] <number> ([] <number[]> (var arr <number[][]>) 1 <number>) 2 <number>))
+(var-decl arr <integer[][]> (table (array (table (array 1 <integer> 2 <integer>) <integer[]>)) <integer[][]>))
+(var-decl val <integer> ([] <integer> ([] <integer[]> (var arr <integer[][]>) 1 <integer>) 2 <integer>))
 )";
     REQUIRE(normalize(typecheck_and_print(code)) == normalize(expected));
 }
@@ -207,8 +240,8 @@ TEST_CASE("Indexing non-array throws") {
 TEST_CASE("Table indexing returns any") {
     std::string code = "local tbl = {x = 10}\nlocal val = tbl[\"x\"]";
     std::string expected = R"(
-(var-decl tbl <{ x: number }> (table (map (x 10 <number>)) <{ x: number }>))
-(var-decl val <any> ([] <any> (var tbl <{ x: number }>) 'x' <string>))
+(var-decl tbl <{ x: integer }> (table (map (x 10 <integer>)) <{ x: integer }>))
+(var-decl val <any> ([] <any> (var tbl <{ x: integer }>) 'x' <string>))
 )";
     REQUIRE(normalize(typecheck_and_print(code)) == normalize(expected));
 }
@@ -221,7 +254,7 @@ local b: boolean = true
 local x: nil = nil
 )";
     std::string expected = R"(
-(var-decl n <number> 42 <number>)
+(var-decl n <number> 42 <integer>)
 (var-decl s <string> 'hello' <string>)
 (var-decl b <boolean> true <boolean>)
 (var-decl x <nil> nil <nil>)
@@ -239,7 +272,7 @@ local result = add(2, 3)
 )";
     std::string expected = R"(
 (fun add <(number, number) -> number> (params x y) (block (return (+ <number> (var x <number>) (var y <number>)))))
-(var-decl result <number> (call <number> (var add <(number, number) -> number>) 2 <number> 3 <number>))
+(var-decl result <number> (call <number> (var add <(number, number) -> number>) 2 <integer> 3 <integer>))
 )";
     REQUIRE(normalize(typecheck_and_print(code)) == normalize(expected));
 }
@@ -290,3 +323,35 @@ end
 )";
     REQUIRE_THROWS_AS(typecheck_and_print(code2), TypeCheckError);
 }
+
+TEST_CASE("Every type error is reported in one pass") {
+    std::string code = R"(
+local a = 1 + "x"
+local b = a * 2
+local c: string = 5
+print(-"s")
+)";
+    std::vector<std::string> errors;
+    try {
+        typecheck_and_print(code);
+    } catch (const TypeCheckError& e) {
+        errors = e.getDiagnostics();
+    }
+    // `a` has the error type, using it reports nothing more
+    REQUIRE(errors == std::vector<std::string>{
+                          "Type error: arithmetic operations require number types",
+                          "Type mismatch: cannot assign integer to variable of type string",
+                          "Type error: unary minus requires a number type"});
+}
+
+TEST_CASE("Expressions with errors get the error type") {
+    Parser parser{Lexer{"local t = {x = 1}\nlocal v = t.y + 1\nlocal w = -t.y\n"}};
+    auto prog = parser.parse();
+    TypeChecker typechecker;
+    for (auto& stmt : prog.statements) {
+        stmt->accept(typechecker);
+    }
+    REQUIRE(typechecker.getDiagnostics().size() == 2);
+    REQUIRE(typechecker.getEnv().lookup(intern("v")) == TypeFactory::errorType());
+    REQUIRE(typechecker.getEnv().lookup(intern("w")) == TypeFactory::errorType());
+}
@@ -1,3 +1,6 @@
+#include <filesystem>
+#include <format>
+#include <fstream>
 #include <sstream>
 #include <string>
 
@@ -18,3 +21,30 @@ inline std::string normalize(const std::string& str) {
     return result;
 }
 
+
+/// Fresh directory below the system temp directory, removed at the end of the test.
+struct TempDir {
+    std::filesystem::path path;
+
+    explicit TempDir(const std::string& name)
+        : path(std::filesystem::temp_directory_path() / std::format("tlua_test_{}", name)) {
+        std::filesystem::remove_all(path);
+        std::filesystem::create_directories(path);
+    }
+    ~TempDir() { std::filesystem::remove_all(path); }
+
+    std::filesystem::path write(const std::filesystem::path& relative,
+                                const std::string& content) const {
+        auto file = path / relative;
+        std::filesystem::create_directories(file.parent_path());
+        std::ofstream(file) << content;
+        return file;
+    }
+};
+
+inline std::string readFile(const std::filesystem::path& path) {
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}